@@ -9,6 +9,7 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <arch/x86/acpi/acpi.h>
+#include <arch/x86/x86-arch.h>
 #include <infos/util/string.h>
 
 using namespace infos::arch::x86::acpi;
@@ -150,6 +151,12 @@ static bool is_structure_valid(const void *structure_base, size_t structure_size
 static bool parse_madt_lapic(const MADTRecordLAPIC *lapic)
 {
 	acpi_log.messagef(infos::kernel::LogLevel::DEBUG, "madt: lapic: id=%u, procid=%u, flags=%x", lapic->apic_id, lapic->acpi_processor_id, lapic->flags);
+
+	// Only processors that are enabled can be started.
+	if (lapic->flags & 1) {
+		infos::arch::x86::x86arch.add_cpu(lapic->apic_id);
+	}
+
 	return true;
 }
 
@@ -17,22 +17,49 @@ using namespace infos::kernel;
 using namespace infos::arch;
 using namespace infos::arch::x86;
 
+static_assert(offsetof(X86PerCPU, self) == 0, "trap.S depends on the per-CPU block layout");
+static_assert(offsetof(X86PerCPU, current_thread) == 8, "trap.S depends on the per-CPU block layout");
+static_assert(offsetof(X86PerCPU, switch_release) == 16, "trap.S depends on the per-CPU block layout");
+static_assert(offsetof(X86PerCPU, cpu) == 24, "trap.S depends on the per-CPU block layout");
+static_assert(offsetof(X86PerCPU, kernel_stack) == 32, "syscall-trap.S depends on the per-CPU block layout");
+static_assert(offsetof(X86PerCPU, user_stack) == 40, "syscall-trap.S depends on the per-CPU block layout");
+
 /**
  * Initialises the CPU.
  * @return Returns TRUE if the CPU was successfully initialised, or FALSE otherwise.
  */
 bool infos::arch::x86::cpu_init()
 {
-	// This doesn't do anything, because we currently only support
-	// a uniprocessor machine.  In the future, this would involve getting the CPU
-	// online and configured.
+	// The CPUs have been discovered (from the ACPI tables) by now, but only the boot
+	// CPU is running.  The remainder are started once the scheduler is up.
+	x86_log.messagef(LogLevel::INFO, "%u CPU(s) present", x86arch.nr_cpus());
 	return true;
 }
 
 /**
  * Constructs a new X86CPU object.
+ * @param index The logical index of the CPU.
+ * @param lapic_id The ID of the CPU's local APIC.
+ * @param gdt The GDT to be used by the CPU.
+ * @param tss The TSS to be used by the CPU.
  */
-X86CPU::X86CPU()
+X86CPU::X86CPU(unsigned int index, uint32_t lapic_id, GDT& gdt, TSS& tss)
+	: CPU(index), _lapic_id(lapic_id), _online(false), _gdt(gdt), _tss(tss)
 {
+	_per_cpu.self = &_per_cpu;
+	_per_cpu.current_thread = NULL;
+	_per_cpu.switch_release = NULL;
+	_per_cpu.cpu = this;
+	_per_cpu.kernel_stack = 0;
+	_per_cpu.user_stack = 0;
+}
 
+/**
+ * Makes this CPU object the current one, on the calling CPU, by pointing the GS segment
+ * base at its per-CPU data block.
+ */
+void X86CPU::activate()
+{
+	__wrmsr(MSR_GS_BASE, (uint64_t)&_per_cpu);
+	__wrmsr(MSR_KERNEL_GS_BASE, 0);
 }
@@ -23,6 +23,7 @@
 #include <infos/drivers/input/keyboard.h>
 #include <infos/drivers/timer/lapic-timer.h>
 #include <infos/drivers/timer/pit.h>
+#include <infos/drivers/timer/tsc.h>
 #include <infos/drivers/pci/pci-bus.h>
 #include <infos/drivers/irq/lapic.h>
 #include <infos/drivers/irq/ioapic.h>
@@ -42,6 +43,15 @@ RegisterCmdLineArgument(SysLogDestination, "syslog") {
 	}
 }
 
+// Define a command-line argument that selects the clocksource.  Setting it
+// to anything other than 'tsc' causes the kernel to keep time by counting
+// timer interrupts.
+static bool use_tsc_clocksource = true;
+
+RegisterCmdLineArgument(ClockSource, "clocksource") {
+	use_tsc_clocksource = (infos::util::strncmp(value, "tsc", 3) == 0);
+}
+
 using namespace infos::arch::x86;
 using namespace infos::drivers;
 using namespace infos::drivers::console;
@@ -99,6 +109,18 @@ bool infos::arch::x86::timer_init()
 	if (!sys.device_manager().register_device(*pit))
 		return false;
 
+	// Create and register the TSC, which is calibrated against the PIT, and
+	// use it as the kernel's clocksource.  If it is not usable, then the kernel
+	// falls back to keeping time with the system timer.
+	if (use_tsc_clocksource) {
+		TSC *tsc = new TSC();
+		if (sys.device_manager().register_device(*tsc)) {
+			sys.set_clocksource(*tsc);
+		} else {
+			syslog.message(LogLevel::WARNING, "TSC unavailable, falling back to timer-based timekeeping");
+		}
+	}
+
 	// Finally, create a register the LAPIC timer.  The LAPIC timer will
 	// calibrate itself as part of its initialisation, and so the PIT
 	// must be registered beforehand.
@@ -111,6 +133,10 @@ bool infos::arch::x86::timer_init()
 	lapic_timer->init_periodic((lapic_timer->frequency() >> 4) / 100);
 	lapic_timer->start();
 
+	// The LAPIC timer is also the event source for the scheduler, should it
+	// be running in tickless mode.
+	sys.scheduler().set_event_timer(*lapic_timer);
+
 	return true;
 }
 
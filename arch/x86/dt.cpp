@@ -24,6 +24,17 @@ __aligned(16) TSS infos::arch::x86::tss;
  * @return Returns true if initialisation was successful, false otherwise.
  */
 bool GDT::init()
+{
+	return init(tss);
+}
+
+/**
+ * Initialises the Global Descriptor Table, with a descriptor for the given Task State Segment.
+ * Each CPU has its own GDT and TSS.
+ * @param task_state The TSS to describe in the GDT.
+ * @return Returns true if initialisation was successful, false otherwise.
+ */
+bool GDT::init(TSS& task_state)
 {
 	// Clear the GDT.
 	erase();
@@ -35,12 +46,13 @@ bool GDT::init()
 	if (!add_code_segment(0)) return false;			// 8
 	if (!add_data_segment(0)) return false;			// 10
 
-	// User code and data segments.
-	if (!add_code_segment(3)) return false;			// 18
-	if (!add_data_segment(3)) return false;			// 20
+	// User data and code segments.  SYSRET requires the data segment to come
+	// first.
+	if (!add_data_segment(3)) return false;			// 18
+	if (!add_code_segment(3)) return false;			// 20
 	
 	// TSS
-	if (!add_tss((void *)tss.__tss, sizeof(tss.__tss))) return false;	// 28
+	if (!add_tss((void *)task_state.__tss, sizeof(task_state.__tss))) return false;	// 28
 	
 	return reload();
 }
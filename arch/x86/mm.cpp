@@ -13,6 +13,7 @@
 #include <arch/x86/cpuid.h>
 #include <arch/x86/irq.h>
 #include <arch/x86/context.h>
+#include <arch/x86/cpu.h>
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/thread.h>
 #include <infos/kernel/process.h>
@@ -28,7 +29,6 @@ using namespace infos::kernel;
 using namespace infos::mm;
 using namespace infos::util;
 
-extern "C" infos::kernel::Thread *current_thread;
 
 /**
  * Page fault handler
@@ -41,6 +41,7 @@ static void handle_page_fault(const IRQ *irq, void *priv)
 	uint64_t fault_address;
 	asm volatile("mov %%cr2, %0" : "=r"(fault_address));
 
+	Thread *current_thread = X86CPU::current_thread();
 	if (current_thread == NULL) {
 		// If there is no current_thread, then this page fault happened REALLY
 		// early.  We must abort.
@@ -49,7 +50,13 @@ static void handle_page_fault(const IRQ *irq, void *priv)
 		arch_abort();
 	}
 
-	// If there is a current thread, abort it.
+	// Reserved user memory is backed on demand, so a fault on a page that has not been touched
+	// yet is resolved by mapping in a zeroed page.
+	if (current_thread->owner().vma().handle_fault(fault_address)) {
+		return;
+	}
+
+	// Otherwise, this is a genuine fault, so abort the thread.
 	syslog.messagef(LogLevel::WARNING, "*** PAGE FAULT @ vaddr=%p rip=%p proc=%s", fault_address, current_thread->context().native_context->rip, current_thread->owner().name().c_str());
 
 	// TODO: support passing page-faults into threads.
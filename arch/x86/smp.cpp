@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * arch/x86/smp.cpp
+ *
+ * Application processor (AP) start-up.  The boot CPU starts each AP discovered in the MADT in
+ * turn, with the INIT-SIPI-SIPI sequence.  Once an AP has been initialised, it joins the
+ * scheduler, and its start-up control-flow becomes its idle thread.
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <arch/x86/init.h>
+#include <arch/x86/x86-arch.h>
+#include <arch/x86/cpu.h>
+#include <arch/x86/irq.h>
+#include <infos/drivers/irq/lapic.h>
+#include <infos/drivers/timer/lapic-timer.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/log.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/util/string.h>
+#include <infos/util/time.h>
+
+using namespace infos::arch::x86;
+using namespace infos::drivers::irq;
+using namespace infos::drivers::timer;
+using namespace infos::kernel;
+using namespace infos::mm;
+using namespace infos::util;
+
+// Must match AP_TRAMPOLINE_BASE in smp-trampoline.S
+#define AP_TRAMPOLINE_BASE	0x8000
+
+// The order of the initial (and idle) stack of an AP.
+#define AP_STACK_ORDER		2
+
+/**
+ * The parameters passed to an AP through the trampoline.
+ */
+struct APTrampolineData {
+	uint64_t entry;
+	uint64_t cr3;
+	uint64_t stack;
+	uint64_t cpu;
+} __packed;
+
+extern "C" char __ap_trampoline_start, __ap_trampoline_data, __ap_trampoline_end;
+extern "C" void __ap_start64(void);
+
+static LAPIC *smp_lapic;
+
+/**
+ * Handles a reschedule IPI, which is sent by another CPU when an entity becomes runnable, and
+ * this CPU is idle.
+ */
+static void reschedule_interrupt(const IRQ *irq, void *priv)
+{
+	smp_lapic->eoi();
+	sys.scheduler().schedule();
+}
+
+/**
+ * Asks a CPU to invoke the scheduler.
+ * @param cpu The index of the CPU.
+ */
+void X86Arch::send_reschedule(unsigned int cpu)
+{
+	if (!smp_lapic || cpu >= _nr_cpus) return;
+
+	X86CPU& target = get_cpu(cpu);
+	if (!target.online()) return;
+
+	smp_lapic->send_ipi(target.lapic_id(), IRQ_RESCHEDULE);
+}
+
+/**
+ * Starts a single AP, and waits for it to come online.
+ * @param cpu The CPU to start.
+ * @return Returns TRUE if the CPU came online, or FALSE otherwise.
+ */
+static bool start_ap(X86CPU& cpu)
+{
+	auto stack = sys.mm().pgalloc().alloc_pages(AP_STACK_ORDER);
+	if (!stack) {
+		x86_log.messagef(LogLevel::ERROR, "Unable to allocate stack for cpu%u", cpu.index());
+		return false;
+	}
+
+	// The idle entity must exist before the AP can join the scheduler.
+	if (!sys.scheduler().add_cpu(cpu)) {
+		return false;
+	}
+
+	uint64_t cr3;
+	asm volatile("mov %%cr3, %0" : "=r"(cr3));
+
+	APTrampolineData *data = (APTrampolineData *)pa_to_vpa(AP_TRAMPOLINE_BASE + (&__ap_trampoline_data - &__ap_trampoline_start));
+	data->entry = (uint64_t)__ap_start64;
+	data->cr3 = cr3;
+	data->stack = sys.mm().pgalloc().pgd_to_vpa(stack) + ((1 << AP_STACK_ORDER) << __page_bits);
+	data->cpu = (uint64_t)&cpu;
+	__sync_synchronize();
+
+	// INIT-SIPI-SIPI.  The second STARTUP IPI is only sent if the first one was missed.
+	smp_lapic->send_init(cpu.lapic_id());
+	sys.spin_delay(Milliseconds(10));
+
+	for (int attempt = 0; attempt < 2 && !cpu.online(); attempt++) {
+		smp_lapic->send_startup(cpu.lapic_id(), AP_TRAMPOLINE_BASE >> __page_bits);
+		sys.spin_delay(Microseconds(200));
+	}
+
+	for (int i = 0; i < 100 && !cpu.online(); i++) {
+		sys.spin_delay(Milliseconds(1));
+	}
+
+	return cpu.online();
+}
+
+/**
+ * Starts the application processors.
+ * @return Returns TRUE if the APs were started, or FALSE otherwise.
+ */
+bool infos::arch::x86::smp_init()
+{
+	if (x86arch.nr_cpus() == 1) {
+		return true;
+	}
+
+	if (!sys.device_manager().try_get_device_by_class(LAPIC::LAPICDeviceClass, smp_lapic)) {
+		x86_log.message(LogLevel::ERROR, "SMP requires the LAPIC");
+		return false;
+	}
+
+	if (!x86arch.irq_manager().install_software_handler(IRQ_RESCHEDULE, reschedule_interrupt, NULL)) {
+		return false;
+	}
+
+	// Copy the trampoline into its page, in low memory.
+	memcpy((void *)pa_to_vpa(AP_TRAMPOLINE_BASE), &__ap_trampoline_start, &__ap_trampoline_end - &__ap_trampoline_start);
+
+	// The APs start up on the initial page tables, which need the lower identity mapping back
+	// while they do so.
+	uint64_t *boot_pml4 = (uint64_t *)pa_to_kva(0x1000);
+	boot_pml4[0] = 0x2003;
+
+	for (unsigned int i = 1; i < x86arch.nr_cpus(); i++) {
+		X86CPU& cpu = x86arch.get_cpu(i);
+
+		x86_log.messagef(LogLevel::DEBUG, "Starting cpu%u (lapic=%u)", i, cpu.lapic_id());
+		if (!start_ap(cpu)) {
+			x86_log.messagef(LogLevel::WARNING, "cpu%u did not come online", i);
+			break;
+		}
+	}
+
+	boot_pml4[0] = 0;
+	return true;
+}
+
+/**
+ * The C++ entry point for an AP, called from the trampoline on the AP's initial stack.
+ * @param cpu The CPU object for this AP.
+ */
+extern "C" void __noreturn x86_ap_init(X86CPU *cpu)
+{
+	if (!x86arch.init_cpu(*cpu)) {
+		arch_abort();
+	}
+
+	// This control-flow becomes the idle entity, and must be a thread before it can e.g. log.
+	sys.scheduler().init_cpu();
+
+	smp_lapic->init_local();
+
+	// Each CPU drives its own scheduling events.
+	LAPICTimer *lapic_timer = new LAPICTimer();
+	if (!sys.device_manager().register_device(*lapic_timer)) {
+		arch_abort();
+	}
+
+	lapic_timer->init_periodic((lapic_timer->frequency() >> 4) / 100);
+	lapic_timer->start();
+
+	sys.scheduler().set_event_timer(*lapic_timer);
+
+	cpu->online(true);
+	x86_log.messagef(LogLevel::INFO, "cpu%u online", cpu->index());
+
+	sys.scheduler().run();
+}
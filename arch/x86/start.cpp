@@ -10,6 +10,7 @@
  */
 #include <arch/x86/init.h>
 #include <arch/x86/x86-arch.h>
+#include <arch/x86/cpu.h>
 #include <arch/x86/multiboot.h>
 #include <arch/x86/early-screen.h>
 #include <arch/x86/qemu-stream.h>
@@ -86,6 +87,12 @@ static void eliminate_lower_mapping()
  */
 static bool x86_init_bottom()
 {
+	x86_log.message(LogLevel::DEBUG, "Starting application processors");
+	if (!smp_init()) {
+		syslog.message(LogLevel::ERROR, "Unable to start application processors");
+		goto init_error;
+	}
+
 	x86_log.message(LogLevel::DEBUG, "Initialising and activating console");
 	if (!console_init()) {
 		syslog.message(LogLevel::ERROR, "Unable to initialise console");
@@ -126,6 +133,10 @@ extern "C" void __noreturn x86_init_top()
 
 	run_static_constructors();
 
+	// The boot CPU's per-CPU block must be in place before anything asks for the current CPU
+	// or thread -- which even taking a mutex (e.g. in the syslog) does.
+	x86arch.get_cpu(0).activate();
+
 	syslog.set_stream(qemu_stream);
 	//syslog.set_stream(early_screen);
 	syslog.colour(true);
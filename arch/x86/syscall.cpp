@@ -40,6 +40,15 @@ void user_syscall_handler(const IRQ *irq, void *priv)
 	sys.arch().disable_interrupts();
 }
 
+/**
+ * Dispatch a system call that came from user-space via the SYSCALL instruction.  This is
+ * called from __syscall_trap, on the kernel stack of the current thread.
+ */
+extern "C" unsigned long x86_syscall_dispatch(unsigned long nr, unsigned long arg0, unsigned long arg1, unsigned long arg2, unsigned long arg3, unsigned long arg4, unsigned long arg5)
+{
+	return sys.syscalls().InvokeSyscall(nr, arg0, arg1, arg2, arg3, arg4, arg5);
+}
+
 /**
  * Handle a system call that came from the kernel.
  */
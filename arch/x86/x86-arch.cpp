@@ -21,10 +21,6 @@
 #include <infos/kernel/process.h>
 #include <infos/util/string.h>
 
-extern "C" {
-	infos::kernel::Thread *current_thread;
-}
-
 using namespace infos::arch;
 using namespace infos::arch::x86;
 using namespace infos::kernel;
@@ -32,7 +28,7 @@ using namespace infos::util;
 
 X86Arch infos::arch::x86::x86arch;
 Arch& infos::arch::sys_arch = x86arch;
-X86CPU bsp;
+X86CPU bsp(0, 0, gdt, tss);
 
 extern "C" void __syscall_trap(void);
 extern void kernel_syscall_handler(const IRQ *irq, void *priv);
@@ -52,22 +48,22 @@ static void trap_interrupt(const IRQ *irq, void *priv)
 	arch_abort();
 }
 
-X86Arch::X86Arch()
+X86Arch::X86Arch() : _nr_cpus(1)
 {
 	_cpus[0] = &bsp;
 }
 
 bool X86Arch::init()
 {
-	if (!gdt.init()) {
-		return false;
-	}
+	// The boot CPU is always the first CPU.
+	bsp.lapic_id(__cpuid(CPUID_GET_FEATURES).rbx >> 24);
+	bsp.online(true);
 
 	if (!idt.init()) {
 		return false;
 	}
 
-	if (!tss.init(0x28)) {
+	if (!init_cpu(bsp)) {
 		return false;
 	}
 
@@ -76,10 +72,6 @@ bool X86Arch::init()
 
 	x86_log.messagef(LogLevel::DEBUG, "GDTR = %p, IDTR = %p, TR = %p, RSP = %p", gdt.get_ptr(), idt.get_ptr(), tss.get_sel(), rsp);
 
-	__wrmsr(MSR_STAR, 0x18000800000000ULL);				// CS Bases for User-Mode/Kernel-Mode
-	__wrmsr(MSR_LSTAR, (uint64_t)__syscall_trap);		// RIP for syscall entry
-	__wrmsr(MSR_SFMASK, (1 << 9));
-
 //	auto feat = cpuid_get_features();
 //	if (!(feat.rcx & (uint64_t)CPUIDFeatures::OSXSAVE)) {
 //		syslog.message(LogLevel::WARNING, "XSAVE not supported");
@@ -90,6 +82,62 @@ bool X86Arch::init()
 	return true;
 }
 
+/**
+ * Performs the architecture initialisation that is local to a CPU, on the CPU itself.
+ * @param cpu The CPU that is being initialised, which must be the calling CPU.
+ * @return Returns TRUE if the CPU was successfully initialised, or FALSE otherwise.
+ */
+bool X86Arch::init_cpu(X86CPU& cpu)
+{
+	cpu.activate();
+
+	if (!cpu.gdt().init(cpu.tss())) {
+		return false;
+	}
+
+	if (!idt.reload()) {
+		return false;
+	}
+
+	if (!cpu.tss().init(0x28)) {
+		return false;
+	}
+
+	__wrmsr(MSR_STAR, 0x10000800000000ULL);				// CS Bases for User-Mode/Kernel-Mode
+	__wrmsr(MSR_LSTAR, (uint64_t)__syscall_trap);		// RIP for syscall entry
+	__wrmsr(MSR_SFMASK, (1 << 9));
+
+	return true;
+}
+
+/**
+ * Adds a CPU that has been discovered by the platform.  The CPU is not started.
+ * @param lapic_id The local APIC ID of the CPU.
+ * @return Returns TRUE if the CPU was added, or FALSE otherwise.
+ */
+bool X86Arch::add_cpu(uint32_t lapic_id)
+{
+	// The boot CPU is already known about.
+	if (lapic_id == bsp.lapic_id()) {
+		return true;
+	}
+
+	if (_nr_cpus >= MAX_CPUS) {
+		x86_log.messagef(LogLevel::WARNING, "Ignoring CPU with LAPIC ID %u: too many CPUs", lapic_id);
+		return false;
+	}
+
+	_cpus[_nr_cpus] = new X86CPU(_nr_cpus, lapic_id, *new GDT(), *new TSS());
+	_nr_cpus++;
+
+	return true;
+}
+
+CPU& X86Arch::get_current_cpu()
+{
+	return X86CPU::current();
+}
+
 bool X86Arch::init_irq()
 {
 	if (!_irq_manager.init()) {
@@ -163,15 +211,28 @@ void X86Arch::invoke_kernel_syscall(int nr)
 
 infos::kernel::Thread& X86Arch::get_current_thread() const
 {
-	return *current_thread;
+	return *X86CPU::current_thread();
 }
 
 void X86Arch::set_current_thread(kernel::Thread& thread)
 {
+	X86CPU& cpu = X86CPU::current();
+
 	asm volatile("mov %0, %%cr3" :: "r"(thread.owner().vma().pgt_base()) : "memory");
 
-	tss.set_kernel_stack(thread.context().kernel_stack);
-	current_thread = &thread;
+	cpu.tss().set_kernel_stack(thread.context().kernel_stack);
+	cpu.per_cpu().kernel_stack = thread.context().kernel_stack;
+	cpu.per_cpu().current_thread = &thread;
+}
+
+/**
+ * Arranges for a flag to be cleared once the calling CPU has finished switching to the
+ * current thread, i.e. when it is no longer using the stack of the previous thread.
+ * @param flag The flag to clear.
+ */
+void X86Arch::clear_after_switch(volatile bool& flag)
+{
+	X86CPU::current().per_cpu().switch_release = &flag;
 }
 
 IRQ *X86Arch::request_irq()
@@ -183,6 +244,7 @@ IRQ *X86Arch::request_irq()
 extern "C" {
 	void *get_current_thread_context()
 	{
+		Thread *current_thread = X86CPU::current_thread();
 		if (!current_thread) return NULL;
 		//assert(current_thread);
 		return &current_thread->context();
@@ -190,12 +252,14 @@ extern "C" {
 
 	void __debug_save_context()
 	{
+		Thread *current_thread = X86CPU::current_thread();
 		assert(current_thread);
 		syslog.messagef(LogLevel::DEBUG, "Save Context %p %p", current_thread, current_thread->context());
 	}
 
 	void __debug_restore_context()
 	{
+		Thread *current_thread = X86CPU::current_thread();
 		assert(current_thread);
 		syslog.messagef(LogLevel::DEBUG, "Restore Context %p %p", current_thread, current_thread->context());
 	}
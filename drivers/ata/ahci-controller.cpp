@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/ata/ahci-controller.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/drivers/ata/ahci-controller.h>
+#include <infos/drivers/ata/ahci-device.h>
+#include <infos/drivers/ata/ata-controller.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/irq.h>
+
+using namespace infos::drivers;
+using namespace infos::drivers::ata;
+using namespace infos::kernel;
+
+const DeviceClass AHCIController::AHCIControllerDeviceClass(Device::RootDeviceClass, "ahcictl");
+
+AHCIController::AHCIController(const AHCIControllerConfiguration& cfg)
+	: _regs((volatile uint32_t *)cfg.abar), _irq(cfg.irq), _caps(0)
+{
+	for (int port = 0; port < AHCI_MAX_PORTS; port++) {
+		_ports[port] = NULL;
+	}
+}
+
+bool AHCIController::init(kernel::DeviceManager& dm)
+{
+	// The controller must be switched into AHCI mode before any of the port registers can be
+	// used, and its interrupt is kept off until the ports have been set up.
+	write(AHCI_REG_GHC, (read(AHCI_REG_GHC) | AHCI_GHC_AE) & ~AHCI_GHC_IE);
+
+	_caps = read(AHCI_REG_CAP);
+	uint32_t implemented = read(AHCI_REG_PI);
+
+	ata_log.messagef(LogLevel::INFO, "Initialising AHCI controller: version=%x, slots=%u, ncq=%u, ports=%x",
+			read(AHCI_REG_VS), AHCI_CAP_NCS(_caps), !!(_caps & AHCI_CAP_SNCQ), implemented);
+
+	if (_irq) {
+		_irq->attach(ahci_irq_handler, this);
+	} else {
+		ata_log.message(LogLevel::WARNING, "No interrupt for the AHCI controller, polling instead");
+	}
+
+	write(AHCI_REG_IS, 0xffffffff);
+	if (_irq) {
+		write(AHCI_REG_GHC, read(AHCI_REG_GHC) | AHCI_GHC_IE);
+	}
+
+	for (int port = 0; port < AHCI_MAX_PORTS; port++) {
+		if (implemented & (1u << port)) {
+			probe_port(dm, port);
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Creates a device for the drive attached to a port, if there is one.
+ */
+bool AHCIController::probe_port(kernel::DeviceManager& dm, int port)
+{
+	uint32_t ssts = port_read(port, AHCI_PxSSTS);
+	if (AHCI_PxSSTS_DET(ssts) != AHCI_PxSSTS_DET_PRESENT) return true;
+
+	// Only ATA drives are supported -- ATAPI devices and port multipliers are ignored.
+	uint32_t sig = port_read(port, AHCI_PxSIG);
+	if (sig != AHCI_SIG_ATA) {
+		ata_log.messagef(LogLevel::DEBUG, "Ignoring AHCI port %d with signature %x", port, sig);
+		return true;
+	}
+
+	ata_log.messagef(LogLevel::INFO, "Found SATA drive on port %d", port);
+
+	AHCIDevice *dev = new AHCIDevice(*this, port);
+	_ports[port] = dev;
+
+	if (!dm.register_device(*dev)) {
+		_ports[port] = NULL;
+		delete dev;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * The interrupt handler for the controller, which passes the interrupt on to each port that
+ * is signalling one.
+ */
+void AHCIController::ahci_irq_handler(const IRQ *irq, void *priv)
+{
+	AHCIController *ctrl = (AHCIController *)priv;
+
+	uint32_t pending = ctrl->read(AHCI_REG_IS);
+
+	for (int port = 0; port < AHCI_MAX_PORTS; port++) {
+		if ((pending & (1u << port)) && ctrl->_ports[port]) {
+			ctrl->_ports[port]->handle_interrupt();
+		}
+	}
+
+	// The port interrupt status has been cleared by now, so clearing the controller's status
+	// will not cause the interrupt to be lost.
+	ctrl->write(AHCI_REG_IS, pending);
+}
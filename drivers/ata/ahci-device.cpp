@@ -0,0 +1,674 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/ata/ahci-device.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/drivers/ata/ahci-device.h>
+#include <infos/drivers/ata/ahci-controller.h>
+#include <infos/drivers/ata/ata-controller.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/process.h>
+#include <infos/kernel/thread.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/util/string.h>
+#include <arch/arch.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::ata;
+using namespace infos::drivers::block;
+using namespace infos::mm;
+using namespace infos::util;
+
+const DeviceClass AHCIDevice::AHCIDeviceClass(BlockDevice::BlockDeviceClass, "sata");
+
+// Commands that are not in the legacy ATA driver's set.
+#define ATA_CMD_READ_FPDMA_QUEUED	0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED	0x61
+
+#define FIS_TYPE_REG_H2D	0x27
+
+// The largest amount of memory a single physical region descriptor can describe.
+#define PRD_MAX_BYTES		0x400000
+
+AHCIDevice::AHCIDevice(AHCIController& controller, int port)
+	: _ctrl(controller),
+	_port(port),
+	_size(0),
+	_lba48(false),
+	_ncq(false),
+	_cmd_list(NULL),
+	_cmd_list_pa(0),
+	_cmd_tables(NULL),
+	_cmd_tables_pa(0),
+	_nr_slots(1),
+	_free_slots(0),
+	_issued(0),
+	_slot_available(false),
+	_port_ready(true),
+	_port_dead(false),
+	_recovery_pending(false)
+{
+
+}
+
+uint32_t AHCIDevice::port_read(uint32_t reg) const
+{
+	return _ctrl.port_read(_port, reg);
+}
+
+void AHCIDevice::port_write(uint32_t reg, uint32_t value)
+{
+	_ctrl.port_write(_port, reg, value);
+}
+
+bool AHCIDevice::init(kernel::DeviceManager& dm)
+{
+	if (!init_memory()) {
+		ata_log.messagef(LogLevel::ERROR, "Unable to allocate command memory for AHCI port %d", _port);
+		return false;
+	}
+
+	stop_port();
+	if (!start_port()) {
+		ata_log.messagef(LogLevel::ERROR, "Unable to start AHCI port %d", _port);
+		return false;
+	}
+
+	Thread& recovery = sys.kernel_process().create_thread(ThreadPrivilege::Kernel, recovery_thread_proc, "ahci-recovery", SchedulingEntityPriority::DAEMON);
+	recovery.add_entry_argument(this);
+	recovery.start();
+
+	// Until the drive has been identified, commands are issued one at a time from slot zero.
+	_free_slots = 1;
+
+	uint16_t ident[256];
+	if (!identify(ident)) {
+		ata_log.messagef(LogLevel::ERROR, "Unable to identify drive on AHCI port %d", _port);
+		return false;
+	}
+
+	if ((ident[49] & (1 << 9)) == 0) {
+		ata_log.messagef(LogLevel::ERROR, "drive does not support lba addressing mode");
+		return false;
+	}
+
+	_lba48 = (ident[83] & (1 << 10)) != 0;
+	if (_lba48) {
+		_size = (uint64_t)ident[100] | ((uint64_t)ident[101] << 16) | ((uint64_t)ident[102] << 32) | ((uint64_t)ident[103] << 48);
+	} else {
+		_size = (uint64_t)ident[60] | ((uint64_t)ident[61] << 16);
+	}
+
+	// Queued commands are tagged with the number of their slot, so with NCQ only as many slots
+	// as the drive has tags can be used.  Otherwise, the controller executes the commands in
+	// its slots one after another.
+	unsigned int nr_slots = AHCI_CAP_NCS(_ctrl._caps);
+
+	_ncq = _lba48 && (_ctrl._caps & AHCI_CAP_SNCQ) && (ident[76] & (1 << 8));
+	if (_ncq) {
+		nr_slots = __min(nr_slots, (unsigned int)(ident[75] & 0x1f) + 1);
+	}
+
+	_nr_slots = nr_slots;
+	_free_slots = (nr_slots == 32) ? 0xffffffff : ((1u << nr_slots) - 1);
+
+	char model[41];
+	for (int i = 0; i < 20; i++) {
+		model[i * 2] = ident[27 + i] >> 8;
+		model[i * 2 + 1] = ident[27 + i] & 0xff;
+	}
+
+	for (int i = 40; i > 0; i--) {
+		model[i] = 0;
+		if (model[i - 1] != ' ') break;
+	}
+
+	ata_log.messagef(LogLevel::DEBUG, "model=%s, size=%lu, lba48=%u, ncq=%u, depth=%u", model, _size, _lba48, _ncq, _nr_slots);
+
+	return BlockDevicePartition::scan_partitions(*this, _partitions);
+}
+
+/**
+ * Allocates the command list, the received FIS area, and the command tables of the port.  The
+ * command list and FIS area share a page, and the command tables (one per slot) are 256 bytes
+ * apart, which keeps them suitably aligned.
+ */
+bool AHCIDevice::init_memory()
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	PageDescriptor *list_pgd = pgalloc.alloc_pages(0);
+	if (!list_pgd) return false;
+
+	PageDescriptor *tables_pgd = pgalloc.alloc_pages(1);
+	if (!tables_pgd) {
+		pgalloc.free_pages(list_pgd, 0);
+		return false;
+	}
+
+	_cmd_list = (CommandHeader *)pgalloc.pgd_to_vpa(list_pgd);
+	_cmd_list_pa = pgalloc.pgd_to_pa(list_pgd);
+	_cmd_tables = (CommandTable *)pgalloc.pgd_to_vpa(tables_pgd);
+	_cmd_tables_pa = pgalloc.pgd_to_pa(tables_pgd);
+
+	if (!(_ctrl._caps & AHCI_CAP_S64A) && ((_cmd_list_pa >> 32) || (_cmd_tables_pa >> 32))) {
+		pgalloc.free_pages(list_pgd, 0);
+		pgalloc.free_pages(tables_pgd, 1);
+		return false;
+	}
+
+	bzero(_cmd_list, __page_size);
+	bzero(_cmd_tables, __page_size << 1);
+
+	for (int slot = 0; slot < 32; slot++) {
+		phys_addr_t table_pa = _cmd_tables_pa + (slot * sizeof(CommandTable));
+
+		_cmd_list[slot].ctba = (uint32_t)table_pa;
+		_cmd_list[slot].ctbau = (uint32_t)(table_pa >> 32);
+	}
+
+	return true;
+}
+
+/**
+ * Stops the command engine and FIS receive engine of the port.
+ */
+void AHCIDevice::stop_port()
+{
+	port_write(AHCI_PxCMD, port_read(AHCI_PxCMD) & ~AHCI_PxCMD_ST);
+	for (int i = 0; i < 500 && (port_read(AHCI_PxCMD) & AHCI_PxCMD_CR); i++) {
+		sys.spin_delay(Milliseconds(1));
+	}
+
+	port_write(AHCI_PxCMD, port_read(AHCI_PxCMD) & ~AHCI_PxCMD_FRE);
+	for (int i = 0; i < 500 && (port_read(AHCI_PxCMD) & AHCI_PxCMD_FR); i++) {
+		sys.spin_delay(Milliseconds(1));
+	}
+}
+
+/**
+ * Points the port at its command list and FIS area, and starts it processing commands.
+ * @return Returns true if the port was started, or false if the drive did not become ready.
+ */
+bool AHCIDevice::start_port()
+{
+	if (port_read(AHCI_PxCMD) & (AHCI_PxCMD_CR | AHCI_PxCMD_FR)) return false;
+
+	port_write(AHCI_PxCLB, (uint32_t)_cmd_list_pa);
+	port_write(AHCI_PxCLBU, (uint32_t)(_cmd_list_pa >> 32));
+	port_write(AHCI_PxFB, (uint32_t)(_cmd_list_pa + 1024));
+	port_write(AHCI_PxFBU, (uint32_t)((_cmd_list_pa + 1024) >> 32));
+
+	port_write(AHCI_PxCMD, port_read(AHCI_PxCMD) | AHCI_PxCMD_FRE | AHCI_PxCMD_SUD | AHCI_PxCMD_POD);
+
+	port_write(AHCI_PxSERR, 0xffffffff);
+	port_write(AHCI_PxIS, 0xffffffff);
+	port_write(AHCI_PxIE, _ctrl.irq_enabled() ? (AHCI_PxIS_COMPLETION | AHCI_PxIS_ERROR) : 0);
+
+	// The command engine may only be started once the drive is no longer busy.
+	int timeout = 1000;
+	while (port_read(AHCI_PxTFD) & (ATA_SR_BSY | ATA_SR_DRQ)) {
+		if (--timeout == 0) return false;
+		sys.spin_delay(Milliseconds(1));
+	}
+
+	port_write(AHCI_PxCMD, port_read(AHCI_PxCMD) | AHCI_PxCMD_ST);
+	return true;
+}
+
+/**
+ * Claims a free command slot, sleeping until one becomes available if they are all in use.
+ * @return Returns the number of the slot.
+ */
+int AHCIDevice::alloc_slot()
+{
+	for (;;) {
+		{
+			UniqueIRQLock irq;
+			UniqueLock<SpinLock> l(_slot_lock);
+
+			if (_free_slots) {
+				int slot = __builtin_ctz(_free_slots);
+				_free_slots &= ~(1u << slot);
+				return slot;
+			}
+
+			// This is cleared under the lock, so a slot freed from now on will be noticed.
+			_slot_available = false;
+		}
+
+		_slot_waiters.sleep_unless(Thread::current(), _slot_available);
+	}
+}
+
+void AHCIDevice::free_slot(int slot)
+{
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_slot_lock);
+
+		_free_slots |= (1u << slot);
+		_slot_available = true;
+	}
+
+	_slot_waiters.wake();
+}
+
+/**
+ * Fills in the command FIS and header of a slot.  Queued (FPDMA) commands carry their block
+ * count in the features field, and their tag -- which is the slot number -- in the count field.
+ */
+void AHCIDevice::build_command(int slot, uint8_t command, uint64_t lba, size_t nr_blocks, bool write)
+{
+	CommandHeader& header = _cmd_list[slot];
+	uint8_t *fis = _cmd_tables[slot].cfis;
+
+	bzero(fis, 20);
+
+	fis[0] = FIS_TYPE_REG_H2D;
+	fis[1] = 0x80;
+	fis[2] = command;
+	fis[7] = command == ATA_CMD_IDENTIFY ? 0 : 0x40;
+
+	fis[4] = lba & 0xff;
+	fis[5] = (lba >> 8) & 0xff;
+	fis[6] = (lba >> 16) & 0xff;
+	fis[8] = (lba >> 24) & 0xff;
+	fis[9] = (lba >> 32) & 0xff;
+	fis[10] = (lba >> 40) & 0xff;
+
+	if (command == ATA_CMD_READ_FPDMA_QUEUED || command == ATA_CMD_WRITE_FPDMA_QUEUED) {
+		fis[3] = nr_blocks & 0xff;
+		fis[11] = (nr_blocks >> 8) & 0xff;
+		fis[12] = slot << 3;
+	} else {
+		fis[12] = nr_blocks & 0xff;
+		fis[13] = (nr_blocks >> 8) & 0xff;
+	}
+
+	// Without LBA48, the top four bits of the address live in the device register.
+	if (command == ATA_CMD_READ_DMA || command == ATA_CMD_WRITE_DMA) {
+		fis[7] |= (lba >> 24) & 0x0f;
+	}
+
+	header.flags = (20 / 4) | (write ? (1 << 6) : 0);
+	header.prdtl = 0;
+	header.prdbc = 0;
+}
+
+/**
+ * Describes a physically contiguous buffer in the PRD table of a slot, after the PRDs that
+ * have already been filled in.
+ */
+bool AHCIDevice::map_buffer(int slot, phys_addr_t pa, size_t size, unsigned int& nr_prds)
+{
+	CommandTable& table = _cmd_tables[slot];
+
+	while (size > 0) {
+		if (nr_prds == AHCI_PRDS_PER_COMMAND) return false;
+
+		size_t chunk = __min(size, (size_t)PRD_MAX_BYTES);
+
+		table.prdt[nr_prds].dba = (uint32_t)pa;
+		table.prdt[nr_prds].dbau = (uint32_t)(pa >> 32);
+		table.prdt[nr_prds].reserved = 0;
+		table.prdt[nr_prds].dbc = chunk - 1;
+
+		pa += chunk;
+		size -= chunk;
+		nr_prds++;
+	}
+
+	_cmd_list[slot].prdtl = nr_prds;
+	return true;
+}
+
+/**
+ * Issues the command that has been built in a slot, and waits for it to complete.  Other
+ * threads can issue commands in other slots in the meantime.
+ * @return Returns true if the command completed successfully, or false otherwise.
+ */
+bool AHCIDevice::execute(int slot)
+{
+	Slot& s = _slots[slot];
+	uint8_t command = _cmd_tables[slot].cfis[2];
+	bool queued = command == ATA_CMD_READ_FPDMA_QUEUED || command == ATA_CMD_WRITE_FPDMA_QUEUED;
+
+	s.done = false;
+	s.error = false;
+
+	for (;;) {
+		{
+			UniqueIRQLock irq;
+			UniqueLock<SpinLock> l(_slot_lock);
+
+			if (_port_dead) return false;
+
+			if (_port_ready) {
+				_issued |= (1u << slot);
+
+				if (queued) {
+					port_write(AHCI_PxSACT, 1u << slot);
+				}
+
+				port_write(AHCI_PxCI, 1u << slot);
+				break;
+			}
+		}
+
+		_port_waiters.sleep_unless(Thread::current(), _port_ready);
+	}
+
+	if (_ctrl.irq_enabled()) {
+		while (!s.done) {
+			s.waiters.sleep_unless(Thread::current(), s.done);
+		}
+	} else {
+		for (;;) {
+			handle_interrupt();
+			if (s.done) break;
+
+			sys.arch().invoke_kernel_syscall(1);
+		}
+	}
+
+	return !s.error;
+}
+
+/**
+ * Completes the commands that the port has finished, and wakes up the threads waiting on them.
+ * This is called from the interrupt handler, or by the waiters themselves when polling.
+ */
+void AHCIDevice::handle_interrupt()
+{
+	uint32_t completed;
+	bool error;
+
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_slot_lock);
+
+		uint32_t status = port_read(AHCI_PxIS);
+		port_write(AHCI_PxIS, status);
+
+		error = (status & AHCI_PxIS_ERROR) != 0;
+
+		if (error) {
+			// The drive aborts every outstanding queued command when one of them fails, so they
+			// all fail here.  The port must be restarted before it will accept more commands,
+			// which can take too long to do here, so that is left to the recovery thread.
+			ata_log.messagef(LogLevel::ERROR, "AHCI port %d error: is=%x, tfd=%x, serr=%x", _port,
+					status, port_read(AHCI_PxTFD), port_read(AHCI_PxSERR));
+
+			completed = _issued;
+
+			_port_ready = false;
+			_recovery_pending = true;
+		} else {
+			completed = _issued & ~(port_read(AHCI_PxCI) | port_read(AHCI_PxSACT));
+		}
+
+		_issued &= ~completed;
+
+		for (uint32_t pending = completed; pending; pending &= pending - 1) {
+			Slot& s = _slots[__builtin_ctz(pending)];
+			s.error = error;
+			s.done = true;
+		}
+	}
+
+	for (uint32_t pending = completed; pending; pending &= pending - 1) {
+		_slots[__builtin_ctz(pending)].waiters.wake();
+	}
+
+	if (error) {
+		_recovery_work.wake();
+	}
+}
+
+void AHCIDevice::recovery_thread_proc(void *arg)
+{
+	AHCIDevice *dev = (AHCIDevice *)arg;
+
+	for (;;) {
+		if (!__sync_bool_compare_and_swap(&dev->_recovery_pending, true, false)) {
+			dev->_recovery_work.sleep_unless(Thread::current(), dev->_recovery_pending);
+			continue;
+		}
+
+		dev->recover();
+	}
+}
+
+/**
+ * Restarts the port after an error, and lets the commands that were held back in the meantime
+ * be issued.  If the port cannot be restarted, it is given up on, and every command fails.
+ */
+void AHCIDevice::recover()
+{
+	stop_port();
+	bool started = start_port();
+
+	if (!started) {
+		ata_log.messagef(LogLevel::ERROR, "Unable to restart AHCI port %d", _port);
+	}
+
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_slot_lock);
+
+		_port_dead = !started;
+		_port_ready = true;
+	}
+
+	_port_waiters.wake();
+}
+
+bool AHCIDevice::identify(uint16_t *ident)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	PageDescriptor *pgd = pgalloc.alloc_pages(0);
+	if (!pgd) return false;
+
+	int slot = alloc_slot();
+
+	build_command(slot, ATA_CMD_IDENTIFY, 0, 0, false);
+	unsigned int nr_prds = 0;
+	map_buffer(slot, pgalloc.pgd_to_pa(pgd), 512, nr_prds);
+
+	bool result = execute(slot);
+	free_slot(slot);
+
+	if (result) {
+		memcpy(ident, (const void *)pgalloc.pgd_to_vpa(pgd), 512);
+	}
+
+	pgalloc.free_pages(pgd, 0);
+	return result;
+}
+
+/**
+ * Works out the address the controller must use to access a buffer, if it can access it
+ * directly.  A buffer in a linear mapping is physically contiguous.
+ */
+static bool dma_address(const void *buffer, size_t size, bool s64a, phys_addr_t& pa)
+{
+	// Data buffers must be word aligned.
+	if ((uintptr_t)buffer & 1) return false;
+
+	if (!linear_va_to_pa((virt_addr_t)buffer, pa)) return false;
+	if (pa + size > PMEM_VA_SIZE) return false;
+
+	return s64a || ((pa + size) >> 32) == 0;
+}
+
+bool AHCIDevice::read_blocks_direct(void* buffer, size_t offset, size_t count)
+{
+	return transfer(false, offset, buffer, count);
+}
+
+bool AHCIDevice::write_blocks_direct(const void* buffer, size_t offset, size_t count)
+{
+	return transfer(true, offset, (void *)buffer, count);
+}
+
+bool AHCIDevice::transfer(bool write, uint64_t lba, void *buffer, size_t nr_blocks)
+{
+	phys_addr_t pa;
+	bool direct = dma_address(buffer, nr_blocks * 512, _ctrl._caps & AHCI_CAP_S64A, pa);
+
+	size_t max_blocks = direct ? AHCI_MAX_COMMAND_BLOCKS : ((__page_size << AHCI_BOUNCE_ORDER) / 512);
+	if (!_lba48) max_blocks = __min(max_blocks, (size_t)256);
+
+	uint8_t *data = (uint8_t *)buffer;
+	while (nr_blocks > 0) {
+		size_t n = __min(nr_blocks, max_blocks);
+
+		if (!transfer_one(write, lba, data, n)) {
+			return false;
+		}
+
+		lba += n;
+		data += n * 512;
+		nr_blocks -= n;
+	}
+
+	return true;
+}
+
+uint8_t AHCIDevice::transfer_command(bool write) const
+{
+	if (_ncq) {
+		return write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+	} else if (_lba48) {
+		return write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+	} else {
+		return write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+	}
+}
+
+/**
+ * Transfers a run of blocks to or from several buffers with a single command, by giving each
+ * buffer its own PRDs.  This is only possible when the controller can address every buffer,
+ * and the whole transfer fits in one command.
+ */
+bool AHCIDevice::transfer_vector_direct(bool write, size_t offset, const BlockSegment *segments, unsigned int nr_segments)
+{
+	if (nr_segments > AHCI_PRDS_PER_COMMAND) {
+		return BlockDevice::transfer_vector_direct(write, offset, segments, nr_segments);
+	}
+
+	phys_addr_t pa[AHCI_PRDS_PER_COMMAND];
+	size_t nr_blocks = 0;
+
+	for (unsigned int i = 0; i < nr_segments; i++) {
+		if (!dma_address(segments[i].buffer, segments[i].count * 512, _ctrl._caps & AHCI_CAP_S64A, pa[i])) {
+			return BlockDevice::transfer_vector_direct(write, offset, segments, nr_segments);
+		}
+
+		nr_blocks += segments[i].count;
+	}
+
+	if (nr_blocks > (_lba48 ? (size_t)AHCI_MAX_COMMAND_BLOCKS : (size_t)256)) {
+		return BlockDevice::transfer_vector_direct(write, offset, segments, nr_segments);
+	}
+
+	int slot = alloc_slot();
+	unsigned int nr_prds = 0;
+
+	build_command(slot, transfer_command(write), offset, nr_blocks, write);
+
+	bool mapped = true;
+	for (unsigned int i = 0; mapped && i < nr_segments; i++) {
+		mapped = map_buffer(slot, pa[i], segments[i].count * 512, nr_prds);
+	}
+
+	// Large segments can need more PRDs than a command has, in which case they are transferred
+	// separately after all.
+	if (!mapped) {
+		free_slot(slot);
+		return BlockDevice::transfer_vector_direct(write, offset, segments, nr_segments);
+	}
+
+	bool result = execute(slot);
+	free_slot(slot);
+
+	return result;
+}
+
+/**
+ * Transfers a run of blocks with a single command.  The controller transfers straight to or
+ * from the buffer when it can address it, and through a bounce buffer otherwise.
+ */
+bool AHCIDevice::transfer_one(bool write, uint64_t lba, void *buffer, size_t nr_blocks)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	size_t size = nr_blocks * 512;
+	phys_addr_t pa;
+
+	PageDescriptor *bounce = NULL;
+	int bounce_order = 0;
+
+	if (!dma_address(buffer, size, _ctrl._caps & AHCI_CAP_S64A, pa)) {
+		while (((size_t)__page_size << bounce_order) < size) bounce_order++;
+
+		bounce = pgalloc.alloc_pages(bounce_order);
+		if (!bounce) return false;
+
+		pa = pgalloc.pgd_to_pa(bounce);
+		if (write) {
+			memcpy((void *)pgalloc.pgd_to_vpa(bounce), buffer, size);
+		}
+	}
+
+	int slot = alloc_slot();
+	unsigned int nr_prds = 0;
+
+	build_command(slot, transfer_command(write), lba, nr_blocks, write);
+	bool result = map_buffer(slot, pa, size, nr_prds) && execute(slot);
+
+	free_slot(slot);
+
+	if (bounce) {
+		if (result && !write) {
+			memcpy(buffer, (const void *)pgalloc.pgd_to_vpa(bounce), size);
+		}
+
+		pgalloc.free_pages(bounce, bounce_order);
+	}
+
+	return result;
+}
+
+/**
+ * Asks the drive to write its own cache out to the disk.  A cache flush cannot be queued, so it
+ * can only be issued when nothing else is outstanding -- which is arranged by claiming every
+ * slot first.
+ */
+bool AHCIDevice::flush_direct()
+{
+	UniqueLock<Mutex> l(_flush_mtx);
+
+	int slots[32];
+	for (unsigned int i = 0; i < _nr_slots; i++) {
+		slots[i] = alloc_slot();
+	}
+
+	build_command(slots[0], _lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH, 0, 0, false);
+	bool result = execute(slots[0]);
+
+	for (unsigned int i = 0; i < _nr_slots; i++) {
+		free_slot(slots[i]);
+	}
+
+	return result;
+}
@@ -12,21 +12,43 @@
 #include <infos/drivers/ata/ata-device.h>
 #include <infos/util/lock.h>
 #include <infos/kernel/kernel.h>
+#include <infos/kernel/thread.h>
+#include <infos/drivers/irq/lapic.h>
+#include <infos/drivers/irq/ioapic.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
 #include <arch/x86/pio.h>
 
 using namespace infos::drivers;
 using namespace infos::drivers::ata;
+using namespace infos::drivers::irq;
 using namespace infos::kernel;
 using namespace infos::arch::x86;
+using namespace infos::mm;
 using namespace infos::util;
 
 ComponentLog infos::drivers::ata::ata_log(syslog, "ata");
 
 DeviceClass ATAController::ATAControllerDeviceClass(Device::RootDeviceClass, "atactl");
 
+static bool use_dma = true;
+static bool use_irq = true;
+
+RegisterCmdLineArgument(ATADMA, "ata.dma")
+{
+	use_dma = strncmp(value, "1", 1) == 0;
+}
+
+RegisterCmdLineArgument(ATAIRQ, "ata.irq")
+{
+	use_irq = strncmp(value, "1", 1) == 0;
+}
+
 #define PORT_OR_BASE_ADDRESS(__v, __p) ((__v == 0) ? (__p) : (__v & ~3))
 
-ATAController::ATAController(IRQ& irq, const ATAControllerConfiguration& cfg) : _irq(irq)
+ATAController::ATAController(const ATAControllerConfiguration& cfg)
 {
 	channels[ATA_PRIMARY].base = PORT_OR_BASE_ADDRESS(cfg.BAR[0], 0x1F0);
 	channels[ATA_PRIMARY].ctrl = PORT_OR_BASE_ADDRESS(cfg.BAR[1], 0x3F6);
@@ -38,26 +60,164 @@ ATAController::ATAController(IRQ& irq, const ATAControllerConfiguration& cfg) :
 
 	channels[ATA_PRIMARY].nIEN = 2;
 	channels[ATA_SECONDARY].nIEN = 2;
+
+	dma[ATA_PRIMARY].enabled = false;
+	dma[ATA_SECONDARY].enabled = false;
+
+	for (int channel = 0; channel < 2; channel++) {
+		irqs[channel].controller = this;
+		irqs[channel].channel = channel;
+		irqs[channel].irq = NULL;
+		irqs[channel].raised = false;
+	}
 }
 
 bool ATAController::init(kernel::DeviceManager& dm)
 {
 	ata_log.messagef(LogLevel::INFO, "Initialising ATA storage device Status=%u", ata_read(0, ATA_REG_STATUS));
 
-	// Disable interrupts
-	ata_write(ATA_PRIMARY, ATA_REG_CONTROL, 2);
-	ata_write(ATA_SECONDARY, ATA_REG_CONTROL, 2);
+	// Use interrupts to signal command completion if they can be routed, or fall back to
+	// polling otherwise.
+	if (init_irq(dm)) {
+		channels[ATA_PRIMARY].nIEN = 0;
+		channels[ATA_SECONDARY].nIEN = 0;
+	} else {
+		ata_log.message(LogLevel::WARNING, "Unable to route ATA interrupts, polling instead");
+	}
 
-	//UniqueLock<IRQLock> l(IRQLock::Instance);
+	ata_write(ATA_PRIMARY, ATA_REG_CONTROL, channels[ATA_PRIMARY].nIEN);
+	ata_write(ATA_SECONDARY, ATA_REG_CONTROL, channels[ATA_SECONDARY].nIEN);
 
 	bool success = true;
 	for (int channel = 0; channel < 2; channel++) {
+		if (init_dma(channel)) {
+			ata_log.messagef(LogLevel::INFO, "Using bus-master DMA on channel %d", channel);
+		}
+
 		success &= probe_channel(dm, channel);
 	}
 
 	return success;
 }
 
+/**
+ * Routes the interrupts of the two channels (which, in compatibility mode, are always ISA IRQs 14
+ * and 15) through the IOAPIC.
+ * @return Returns true if the interrupts were routed, or false otherwise.
+ */
+bool ATAController::init_irq(kernel::DeviceManager& dm)
+{
+	if (!use_irq) return false;
+
+	LAPIC *lapic;
+	if (!dm.try_get_device_by_class(LAPIC::LAPICDeviceClass, lapic)) {
+		return false;
+	}
+
+	IOAPIC *ioapic;
+	if (!dm.try_get_device_by_class(IOAPIC::IOAPICDeviceClass, ioapic)) {
+		return false;
+	}
+
+	for (int channel = 0; channel < 2; channel++) {
+		irqs[channel].irq = ioapic->request_physical_irq(lapic, 14 + channel);
+		if (!irqs[channel].irq) return false;
+
+		irqs[channel].irq->attach(ata_irq_handler, &irqs[channel]);
+	}
+
+	return true;
+}
+
+/**
+ * The interrupt handler for a channel.
+ * @param irq The IRQ object that was signalled.
+ * @param priv The ChannelIRQ of the channel.
+ */
+void ATAController::ata_irq_handler(const IRQ *irq, void *priv)
+{
+	ChannelIRQ *ci = (ChannelIRQ *)priv;
+	ATAController *ctrl = ci->controller;
+
+	// Reading the status register acknowledges the interrupt at the drive.  The interrupt bit in
+	// the bus-master status register must be cleared separately -- without touching the error
+	// bit, which the waiter still needs to see.
+	ctrl->ata_read(ci->channel, ATA_REG_STATUS);
+
+	if (ctrl->dma[ci->channel].enabled) {
+		uint8_t bm_status = ctrl->ata_read(ci->channel, ATA_REG_BMSTATUS);
+		ctrl->ata_write(ci->channel, ATA_REG_BMSTATUS, (bm_status & ~ATA_BM_SR_ERR) | ATA_BM_SR_IRQ);
+	}
+
+	ci->raised = true;
+	ci->waiters.wake();
+}
+
+/**
+ * Puts the current thread to sleep until the channel raises its interrupt.  The interrupt must
+ * have been armed (with arm_irq) before the command that will raise it was issued.
+ */
+void ATAController::wait_for_irq(int channel)
+{
+	ChannelIRQ& ci = irqs[channel];
+
+	while (!ci.raised) {
+		ci.waiters.sleep_unless(Thread::current(), ci.raised);
+	}
+
+	ci.raised = false;
+}
+
+/**
+ * Sets up the memory used for bus-master DMA on a channel.
+ * @return Returns true if the channel can use DMA, or false if it must fall back to PIO.
+ */
+bool ATAController::init_dma(int channel)
+{
+	if (!use_dma || channels[channel].bmide == 0) return false;
+
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	ChannelDMA& cd = dma[channel];
+
+	// Bus-master addresses are 32 bits wide, so each page must be in the first 4G.  The PRD
+	// table lives in its own page, which (being page aligned) never crosses a 64K boundary.
+	PageDescriptor *prdt_pgd = pgalloc.alloc_pages(0);
+	if (!prdt_pgd) return false;
+
+	if (pgalloc.pgd_to_pa(prdt_pgd) >> 32) {
+		pgalloc.free_pages(prdt_pgd, 0);
+		return false;
+	}
+
+	cd.prdt = (PRDEntry *)pgalloc.pgd_to_vpa(prdt_pgd);
+	cd.prdt_pa = pgalloc.pgd_to_pa(prdt_pgd);
+
+	for (int i = 0; i < ATA_DMA_PAGES; i++) {
+		PageDescriptor *pgd = pgalloc.alloc_pages(0);
+
+		if (!pgd || (pgalloc.pgd_to_pa(pgd) >> 32)) {
+			if (pgd) pgalloc.free_pages(pgd, 0);
+
+			while (i-- > 0) {
+				pgalloc.free_pages(pgalloc.vpa_to_pgd((virt_addr_t)cd.pages[i]), 0);
+			}
+
+			pgalloc.free_pages(prdt_pgd, 0);
+			return false;
+		}
+
+		cd.pages[i] = (uint8_t *)pgalloc.pgd_to_vpa(pgd);
+		cd.pages_pa[i] = pgalloc.pgd_to_pa(pgd);
+	}
+
+	// Make sure the bus-master is stopped, and its status is clear.
+	ata_write(channel, ATA_REG_BMCOMMAND, 0);
+	ata_write(channel, ATA_REG_BMSTATUS, ata_read(channel, ATA_REG_BMSTATUS) | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+
+	cd.enabled = true;
+	return true;
+}
+
 bool ATAController::probe_channel(kernel::DeviceManager& dm, int channel)
 {
 	bool success = true;
@@ -27,7 +27,8 @@ const DeviceClass ATADevice::ATADeviceClass(BlockDevice::BlockDeviceClass, "ata"
 ATADevice::ATADevice(ATAController& controller, int channel, int drive)
 : _ctrl(controller),
 _channel(channel & 1),
-_drive(drive & 1)
+_drive(drive & 1),
+_use_dma(false)
 {
 
 }
@@ -70,61 +71,9 @@ bool ATADevice::init(kernel::DeviceManager& dm)
 		return false;
 	}
 	
-	return check_for_partitions();
-}
-
-bool ATADevice::check_for_partitions()
-{
-	uint8_t *buffer = new uint8_t[512];
-	if (!buffer)
-		return false;
+	_use_dma = _ctrl.dma[_channel].enabled && (_caps & 0x100);
 	
-	if (!read_blocks(buffer, 0, 1)) {
-		sys.mm().objalloc().free(buffer);
-		return false;
-	}
-	
-	bool result = true;
-	if (buffer[0x1fe] == 0x55 && buffer[0x1ff] == 0xaa) {
-		ata_log.messagef(LogLevel::INFO, "disk has partitions!");
-		result = create_partitions(buffer);
-	}
-	
-	sys.mm().objalloc().free(buffer);
-	return result;
-}
-
-bool ATADevice::create_partitions(const uint8_t* partition_table)
-{
-	struct partition_table_entry {
-		uint8_t status;
-		uint8_t first_absolute_sector[3];
-		uint8_t type;
-		uint8_t last_absolute_sector[3];
-		uint32_t first_absolute_sector_lba;
-		uint32_t nr_sectors;
-	} __packed;
-		
-	for (int partition_table_index = 0; partition_table_index < 4; partition_table_index++) {
-		const struct partition_table_entry *pte = (const partition_table_entry *)&partition_table[0x1be + (16 * partition_table_index)];
-		
-		if (pte->type == 0) {
-			ata_log.messagef(LogLevel::INFO, "partition %u inactive", partition_table_index);
-			continue;
-		}
-		
-		ata_log.messagef(LogLevel::INFO, "partition %u active @ off=%x, sz=%x", partition_table_index, pte->first_absolute_sector, pte->nr_sectors);
-		
-		auto partition_device = new infos::drivers::block::BlockDevicePartition(*this, pte->first_absolute_sector_lba, pte->nr_sectors);
-		_partitions.append(partition_device);
-
-		sys.device_manager().register_device(*partition_device);
-
-		String partition_name = name() + "p" + ToString(partition_table_index);
-		sys.device_manager().add_device_alias(partition_name, *partition_device);
-	}
-	
-	return true;
+	return BlockDevicePartition::scan_partitions(*this, _partitions);
 }
 
 size_t ATADevice::block_count() const
@@ -137,16 +86,36 @@ size_t ATADevice::block_size() const
 	return 512;
 }
 
-bool ATADevice::read_blocks(void* buffer, size_t offset, size_t count)
+bool ATADevice::read_blocks_direct(void* buffer, size_t offset, size_t count)
 {
 	return transfer(0, offset, buffer, count);
 }
 
-bool ATADevice::write_blocks(const void* buffer, size_t offset, size_t count)
+bool ATADevice::write_blocks_direct(const void* buffer, size_t offset, size_t count)
 {
 	return transfer(1, offset, (void *) buffer, count);
 }
 
+/**
+ * Asks the drive to write its own cache out to the disk.
+ */
+bool ATADevice::flush_direct()
+{
+	UniqueLock<Mutex> l(_ctrl._mtx[_channel]);
+
+	while (ata_read(ATA_REG_STATUS) & ATA_SR_BSY) asm volatile("pause");
+
+	ata_write(ATA_REG_HDDEVSEL, 0xE0 | (_drive << 4));
+
+	_ctrl.arm_irq(_channel);
+	ata_write(ATA_REG_COMMAND, (_cmdsets & (1 << 26)) ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+
+	wait_for_drive();
+	ata_poll(false);
+
+	return !(ata_read(ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF));
+}
+
 uint8_t ATADevice::ata_read(int reg)
 {
 	return _ctrl.ata_read(_channel, reg);
@@ -167,31 +136,111 @@ int ATADevice::ata_poll(bool error_check)
 	return _ctrl.ata_poll(_channel, error_check);
 }
 
-bool ATADevice::transfer(int direction, uint64_t lba, void* buffer, size_t nr_blocks)
+/**
+ * Selects the drive, and programs the LBA48 address and sector count registers for a command.
+ */
+void ATADevice::select_lba48(uint64_t lba, size_t nr_blocks)
 {
-	UniqueLock<Mutex> l(_ctrl._mtx[_channel]);
-
 	while (ata_read(ATA_REG_STATUS) & ATA_SR_BSY) asm volatile("pause");
 
 	ata_write(ATA_REG_HDDEVSEL, 0xE0 | (_drive << 4));
 
-	ata_write(ATA_REG_SECCOUNT1, 0);
+	ata_write(ATA_REG_SECCOUNT1, (nr_blocks >> 8) & 0xff);
 	ata_write(ATA_REG_LBA3, (lba >> 24) & 0xff);
 	ata_write(ATA_REG_LBA4, (lba >> 32) & 0xff);
 	ata_write(ATA_REG_LBA5, (lba >> 40) & 0xff);
 
-	ata_write(ATA_REG_SECCOUNT0, nr_blocks);
+	ata_write(ATA_REG_SECCOUNT0, nr_blocks & 0xff);
 	ata_write(ATA_REG_LBA0, (lba >> 0) & 0xff);
 	ata_write(ATA_REG_LBA1, (lba >> 8) & 0xff);
 	ata_write(ATA_REG_LBA2, (lba >> 16) & 0xff);
+}
+
+/**
+ * Waits for the drive to signal that it is ready, if interrupts are in use.  Otherwise, the
+ * caller's polling does the waiting.
+ */
+void ATADevice::wait_for_drive()
+{
+	if (_ctrl.irq_enabled(_channel)) {
+		_ctrl.wait_for_irq(_channel);
+	}
+}
+
+/**
+ * Transfers blocks to or from the device, splitting the transfer into commands that fit in the
+ * DMA memory of the channel.
+ */
+bool ATADevice::transfer(int direction, uint64_t lba, void* buffer, size_t nr_blocks)
+{
+	const size_t max_blocks_per_command = (ATA_DMA_PAGES * __page_size) / 512;
+
+	UniqueLock<Mutex> l(_ctrl._mtx[_channel]);
+
+	uint8_t *p = (uint8_t *)buffer;
+	while (nr_blocks > 0) {
+		size_t count = __min(nr_blocks, max_blocks_per_command);
+
+		bool ok = false;
+		if (_use_dma) {
+			ok = dma_transfer(direction, lba, p, count);
+			if (!ok) {
+				ata_log.messagef(LogLevel::WARNING, "DMA transfer failed, falling back to PIO");
+				_use_dma = false;
+			}
+		}
+
+		if (!ok && !pio_transfer(direction, lba, p, count)) {
+			return false;
+		}
+
+		p += count * 512;
+		lba += count;
+		nr_blocks -= count;
+	}
+
+	return true;
+}
+
+bool ATADevice::pio_transfer(int direction, uint64_t lba, void* buffer, size_t nr_blocks)
+{
+	select_lba48(lba, nr_blocks);
+
+	_ctrl.arm_irq(_channel);
 
 	if (direction) {
 		ata_write(ATA_REG_COMMAND, ATA_CMD_WRITE_PIO_EXT);
+
+		const uint8_t *p = (const uint8_t *) buffer;
+		for (size_t cur_block = 0; cur_block < nr_blocks; cur_block++) {
+			// The drive asks for the first sector straight away, and then interrupts as it
+			// becomes ready for each of the others.
+			if (cur_block > 0) wait_for_drive();
+
+			if (ata_poll(true)) {
+				return false;
+			}
+
+			__outsw(_ctrl.channels[_channel].base, (uintptr_t)p, (512 / 2));
+
+			p += 512;
+		}
+
+		// There is one more interrupt once the last sector has been written.
+		wait_for_drive();
+		ata_poll(false);
+
+		if (ata_read(ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF)) {
+			return false;
+		}
 	} else {
 		ata_write(ATA_REG_COMMAND, ATA_CMD_READ_PIO_EXT);
 
 		uint8_t *p = (uint8_t *) buffer;
 		for (size_t cur_block = 0; cur_block < nr_blocks; cur_block++) {
+			// The drive interrupts as each sector becomes ready.
+			wait_for_drive();
+			
 			if (ata_poll(true)) {
 				return false;
 			}
@@ -204,3 +253,74 @@ bool ATADevice::transfer(int direction, uint64_t lba, void* buffer, size_t nr_bl
 
 	return true;
 }
+
+/**
+ * Performs a transfer with bus-master DMA.  The data moves through the channel's DMA pages,
+ * which are described to the controller by the PRD table.
+ */
+bool ATADevice::dma_transfer(int direction, uint64_t lba, void* buffer, size_t nr_blocks)
+{
+	ATAController::ChannelDMA& cd = _ctrl.dma[_channel];
+	size_t size = nr_blocks * 512;
+
+	// Build the PRD table, with one entry per page.
+	unsigned int nr_prds = (size + __page_size - 1) / __page_size;
+	for (unsigned int i = 0; i < nr_prds; i++) {
+		size_t chunk = __min(size - (i * __page_size), __page_size);
+
+		cd.prdt[i].base = (uint32_t)cd.pages_pa[i];
+		cd.prdt[i].size = (uint16_t)chunk;
+		cd.prdt[i].flags = (i == nr_prds - 1) ? ATA_PRD_EOT : 0;
+
+		if (direction) {
+			memcpy(cd.pages[i], (const uint8_t *)buffer + (i * __page_size), chunk);
+		}
+	}
+
+	uint8_t bm_command = direction ? 0 : ATA_BM_CMD_READ;
+	uint16_t bmide = _ctrl.channels[_channel].bmide;
+
+	ata_write(ATA_REG_BMCOMMAND, 0);
+	__outl(bmide + (ATA_REG_BMPRDT - ATA_REG_BMCOMMAND), (uint32_t)cd.prdt_pa);
+	ata_write(ATA_REG_BMSTATUS, ata_read(ATA_REG_BMSTATUS) | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+	ata_write(ATA_REG_BMCOMMAND, bm_command);
+
+	select_lba48(lba, nr_blocks);
+
+	_ctrl.arm_irq(_channel);
+	ata_write(ATA_REG_COMMAND, direction ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+
+	ata_write(ATA_REG_BMCOMMAND, bm_command | ATA_BM_CMD_START);
+
+	// The drive interrupts once the whole transfer is complete, so other threads can run in
+	// the meantime.
+	wait_for_drive();
+
+	// Make sure the bus-master has finished with the PRD table, and that the drive has
+	// finished the command.
+	uint8_t bm_status;
+	do {
+		bm_status = ata_read(ATA_REG_BMSTATUS);
+	} while ((bm_status & ATA_BM_SR_ACTIVE) && !(bm_status & ATA_BM_SR_ERR));
+
+	ata_write(ATA_REG_BMCOMMAND, 0);
+
+	uint8_t status;
+	do {
+		status = ata_read(ATA_REG_STATUS);
+	} while (status & ATA_SR_BSY);
+
+	ata_write(ATA_REG_BMSTATUS, bm_status | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+
+	if ((bm_status & ATA_BM_SR_ERR) || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+		return false;
+	}
+
+	if (!direction) {
+		for (unsigned int i = 0; i < nr_prds; i++) {
+			memcpy((uint8_t *)buffer + (i * __page_size), cd.pages[i], __min(size - (i * __page_size), __page_size));
+		}
+	}
+
+	return true;
+}
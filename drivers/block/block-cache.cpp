@@ -0,0 +1,734 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/block/block-cache.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/drivers/block/block-cache.h>
+#include <infos/drivers/block/block-device.h>
+#include <infos/drivers/block/block-request.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/process.h>
+#include <infos/kernel/thread.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::drivers;
+using namespace infos::drivers::block;
+using namespace infos::kernel;
+using namespace infos::util;
+
+// The number of blocks cached for each block device.  Zero disables the cache.
+static unsigned long bcache_size = 2048;
+
+// The interval (in milliseconds) at which the writer thread writes dirty blocks back.  Zero
+// makes the cache write-through.
+static unsigned long bcache_writeback_interval = 5000;
+
+// The largest number of blocks written back in a single transfer.
+#define MAX_WRITEBACK_RUN	128
+
+// The most transfers the cache has queued on its device at once.
+#define MAX_TRANSFERS_IN_FLIGHT	16
+
+RegisterCmdLineArgument(BlockCacheSize, "bcache.size")
+{
+	bcache_size = strtoul(value, NULL, 0);
+}
+
+RegisterCmdLineArgument(BlockCacheWritebackInterval, "bcache.writeback-interval")
+{
+	bcache_writeback_interval = strtoul(value, NULL, 0);
+}
+
+BlockCache *BlockCache::_all_caches;
+SpinLock BlockCache::_all_caches_lock;
+
+/**
+ * Creates a cache for a block device, of the size given on the command-line.
+ * @return Returns the new cache, or NULL if block caching is disabled.
+ */
+BlockCache *BlockCache::create(BlockDevice& bdev)
+{
+	if (bcache_size == 0) return NULL;
+
+	BlockCache *cache = new BlockCache(bdev, bcache_size);
+	if (!cache) return NULL;
+
+	bool first;
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_all_caches_lock);
+
+		first = _all_caches == NULL;
+
+		cache->_next_cache = _all_caches;
+		_all_caches = cache;
+	}
+
+	// The writer thread is started along with the first cache.
+	if (first && cache->_write_back) {
+		Thread& writer = sys.kernel_process().create_thread(ThreadPrivilege::Kernel, writer_thread_proc, "bcache-writer", SchedulingEntityPriority::DAEMON);
+		writer.start();
+	}
+
+	return cache;
+}
+
+/**
+ * The writer thread, which periodically flushes every cache.
+ */
+void BlockCache::writer_thread_proc(void *arg)
+{
+	for (;;) {
+		sys.timer_queue().sleep(DurationCast<Nanoseconds>(Milliseconds(bcache_writeback_interval)));
+
+		BlockCache *cache;
+		{
+			UniqueIRQLock irq;
+			UniqueLock<SpinLock> l(_all_caches_lock);
+			cache = _all_caches;
+		}
+
+		// Caches live as long as their block devices, which are never removed, so the list can
+		// be walked without the lock.
+		for (; cache; cache = cache->_next_cache) {
+			if (!cache->flush()) {
+				syslog.messagef(LogLevel::WARNING, "bcache: unable to write back %s", cache->_bdev.name().c_str());
+			}
+		}
+	}
+}
+
+BlockCache::BlockCache(BlockDevice& bdev, unsigned int capacity)
+	: _bdev(bdev),
+	_capacity(capacity),
+	_nr_buffers(0),
+	_nr_dirty(0),
+	_write_back(bcache_writeback_interval != 0),
+	_needs_flush(false),
+	_lru_head(NULL),
+	_lru_tail(NULL),
+	_nr_hits(0),
+	_nr_misses(0),
+	_nr_prefetched(0),
+	_next_cache(NULL)
+{
+	for (unsigned int i = 0; i < NR_BUCKETS; i++) {
+		_buckets[i] = NULL;
+	}
+}
+
+BlockCache::~BlockCache()
+{
+	// Only unreferenced buffers can be released.
+	while (_lru_head) {
+		Buffer *buffer = _lru_head;
+		lru_remove(buffer);
+
+		delete[] buffer->data;
+		delete buffer;
+	}
+}
+
+BlockCache::Buffer *BlockCache::lookup(size_t block) const
+{
+	for (Buffer *buffer = _buckets[bucket_of(block)]; buffer; buffer = buffer->hash_next) {
+		if (buffer->block == block) return buffer;
+	}
+
+	return NULL;
+}
+
+void BlockCache::hash_insert(Buffer *buffer)
+{
+	Buffer *& bucket = _buckets[bucket_of(buffer->block)];
+
+	buffer->hash_prev = NULL;
+	buffer->hash_next = bucket;
+
+	if (bucket) bucket->hash_prev = buffer;
+	bucket = buffer;
+
+	buffer->hashed = true;
+}
+
+void BlockCache::hash_remove(Buffer *buffer)
+{
+	if (buffer->hash_prev) {
+		buffer->hash_prev->hash_next = buffer->hash_next;
+	} else {
+		_buckets[bucket_of(buffer->block)] = buffer->hash_next;
+	}
+
+	if (buffer->hash_next) buffer->hash_next->hash_prev = buffer->hash_prev;
+
+	buffer->hashed = false;
+}
+
+/**
+ * Puts an unreferenced buffer on the LRU list -- at the most recently used end, or at the least
+ * recently used end if it holds nothing worth keeping.
+ */
+void BlockCache::lru_insert(Buffer *buffer, bool most_recent)
+{
+	if (most_recent) {
+		buffer->lru_prev = NULL;
+		buffer->lru_next = _lru_head;
+
+		if (_lru_head) _lru_head->lru_prev = buffer;
+		else _lru_tail = buffer;
+
+		_lru_head = buffer;
+	} else {
+		buffer->lru_next = NULL;
+		buffer->lru_prev = _lru_tail;
+
+		if (_lru_tail) _lru_tail->lru_next = buffer;
+		else _lru_head = buffer;
+
+		_lru_tail = buffer;
+	}
+}
+
+void BlockCache::lru_remove(Buffer *buffer)
+{
+	if (buffer->lru_prev) buffer->lru_prev->lru_next = buffer->lru_next;
+	else _lru_head = buffer->lru_next;
+
+	if (buffer->lru_next) buffer->lru_next->lru_prev = buffer->lru_prev;
+	else _lru_tail = buffer->lru_prev;
+}
+
+/**
+ * Obtains a buffer for a block that is not in the cache, either by creating a new one, or by
+ * recycling the least recently used buffer.  The cache lock must be held.
+ * @return Returns a referenced, hashed (but not yet valid) buffer, or NULL if every buffer is
+ * in use.
+ */
+BlockCache::Buffer *BlockCache::acquire(size_t block)
+{
+	Buffer *buffer;
+
+	if (_nr_buffers < _capacity) {
+		buffer = new Buffer();
+		if (!buffer) return NULL;
+
+		buffer->data = new uint8_t[_bdev.block_size()];
+		if (!buffer->data) {
+			delete buffer;
+			return NULL;
+		}
+
+		_nr_buffers++;
+	} else {
+		// Dirty buffers cannot be recycled until they have been written back.
+		buffer = _lru_tail;
+		while (buffer && buffer->dirty) {
+			buffer = buffer->lru_prev;
+		}
+
+		if (!buffer) return NULL;
+
+		lru_remove(buffer);
+		if (buffer->hashed) hash_remove(buffer);
+	}
+
+	buffer->block = block;
+	buffer->valid = false;
+	buffer->dirty = false;
+	buffer->refcount = 1;
+	hash_insert(buffer);
+
+	return buffer;
+}
+
+/**
+ * Reads a block from the device into its buffer, if the buffer does not already hold it.  The
+ * buffer lock must be held.
+ */
+bool BlockCache::fill(Buffer *buffer)
+{
+	if (buffer->valid) return true;
+
+	buffer->valid = _bdev.read_blocks_direct(buffer->data, buffer->block, 1);
+	return buffer->valid;
+}
+
+/**
+ * Returns a referenced buffer holding the contents of a block, reading it from the device if
+ * it is not already cached.  The buffer must be released with put().
+ * @param block The block to retrieve.
+ * @return Returns the buffer, or NULL if the block could not be read, or every buffer is in use.
+ */
+BlockCache::Buffer *BlockCache::get(size_t block)
+{
+	Buffer *buffer;
+
+	{
+		UniqueLock<Mutex> l(_mtx);
+
+		buffer = lookup(block);
+		if (buffer) {
+			if (buffer->refcount++ == 0) lru_remove(buffer);
+			_nr_hits++;
+		} else {
+			buffer = acquire(block);
+			if (!buffer) return NULL;
+
+			_nr_misses++;
+		}
+	}
+
+	buffer->lock.lock();
+	bool ok = fill(buffer);
+	buffer->lock.unlock();
+
+	if (!ok) {
+		put(buffer);
+		return NULL;
+	}
+
+	return buffer;
+}
+
+/**
+ * Releases a reference to a buffer.
+ */
+void BlockCache::put(Buffer *buffer)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	assert(buffer->refcount > 0);
+	if (--buffer->refcount > 0) return;
+
+	// A buffer that could not be filled is dropped from the hash table, and is the first to be
+	// recycled.
+	if (!buffer->valid && buffer->hashed) {
+		hash_remove(buffer);
+	}
+
+	lru_insert(buffer, buffer->valid);
+}
+
+/**
+ * Marks a buffer as needing to be written back.  The cache lock must be held.
+ */
+void BlockCache::mark_dirty(Buffer *buffer)
+{
+	if (!buffer->dirty) {
+		buffer->dirty = true;
+		_nr_dirty++;
+	}
+}
+
+/**
+ * Copies the contents of a block into the cache.
+ * @param overwrite If false, a block that is already cached is left alone, as the cached copy
+ * may be newer than the data given.
+ * @param dirty Whether or not the block must be written back to the device.
+ * @return Returns true if the block is now in the cache, or false if there was no buffer for it.
+ */
+bool BlockCache::store(size_t block, const void *data, bool overwrite, bool dirty)
+{
+	Buffer *buffer;
+
+	{
+		UniqueLock<Mutex> l(_mtx);
+
+		buffer = lookup(block);
+		if (buffer) {
+			if (!overwrite) return true;
+			if (buffer->refcount++ == 0) lru_remove(buffer);
+		} else {
+			buffer = acquire(block);
+			if (!buffer) return false;
+		}
+	}
+
+	buffer->lock.lock();
+	memcpy(buffer->data, data, _bdev.block_size());
+	buffer->valid = true;
+	buffer->lock.unlock();
+
+	if (dirty) {
+		UniqueLock<Mutex> l(_mtx);
+		mark_dirty(buffer);
+	}
+
+	put(buffer);
+	return true;
+}
+
+/**
+ * Reads blocks through the cache.  Cached blocks are copied out of their buffers, and each run
+ * of blocks that are not cached is read from the device in a single transfer, and then added to
+ * the cache.
+ */
+bool BlockCache::read(void *buffer, size_t offset, size_t count)
+{
+	uint8_t *dst = (uint8_t *)buffer;
+	size_t block_size = _bdev.block_size();
+
+	while (count > 0) {
+		Buffer *cached;
+		size_t run = 0;
+
+		{
+			UniqueLock<Mutex> l(_mtx);
+
+			cached = lookup(offset);
+			if (cached) {
+				if (cached->refcount++ == 0) lru_remove(cached);
+				_nr_hits++;
+			} else {
+				run = 1;
+				while (run < count && !lookup(offset + run)) run++;
+
+				_nr_misses += run;
+			}
+		}
+
+		if (cached) {
+			// The buffer may still be being filled by someone else, in which case this waits
+			// for them to finish.
+			cached->lock.lock();
+			bool ok = fill(cached);
+			if (ok) memcpy(dst, cached->data, block_size);
+			cached->lock.unlock();
+
+			put(cached);
+			if (!ok) return false;
+
+			run = 1;
+		} else {
+			if (!_bdev.read_blocks_direct(dst, offset, run)) return false;
+
+			for (size_t i = 0; i < run; i++) {
+				store(offset + i, dst + (i * block_size), false, false);
+			}
+		}
+
+		dst += run * block_size;
+		offset += run;
+		count -= run;
+	}
+
+	return true;
+}
+
+/**
+ * Writes blocks through the cache.  In write-back mode, the blocks are only written to the
+ * device when the cache is flushed -- unless there is no room for them in the cache.  Otherwise,
+ * they are written straight through to the device, and the cached copies updated.
+ */
+bool BlockCache::write(const void *buffer, size_t offset, size_t count)
+{
+	const uint8_t *src = (const uint8_t *)buffer;
+	size_t block_size = _bdev.block_size();
+
+	if (!_write_back) {
+		if (!_bdev.write_blocks_direct(buffer, offset, count)) return false;
+		_needs_flush = true;
+
+		for (size_t i = 0; i < count; i++) {
+			store(offset + i, src + (i * block_size), true, false);
+		}
+
+		return true;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		const uint8_t *data = src + (i * block_size);
+
+		if (!store(offset + i, data, true, true)) {
+			if (!_bdev.write_blocks_direct(data, offset + i, 1)) return false;
+			_needs_flush = true;
+		}
+	}
+
+	// Writers are made to write back once too much of the cache is dirty, so that there are
+	// always clean buffers left to recycle.
+	if (_nr_dirty > _capacity / 2) {
+		return writeback();
+	}
+
+	return true;
+}
+
+/**
+ * Sorts buffers into block order.
+ */
+static void sort_buffers(BlockCache::Buffer **buffers, size_t count)
+{
+	for (size_t gap = count / 2; gap > 0; gap /= 2) {
+		for (size_t i = gap; i < count; i++) {
+			BlockCache::Buffer *buffer = buffers[i];
+
+			size_t j = i;
+			for (; j >= gap && buffers[j - gap]->block > buffer->block; j -= gap) {
+				buffers[j] = buffers[j - gap];
+			}
+
+			buffers[j] = buffer;
+		}
+	}
+}
+
+/**
+ * A run of blocks being transferred between the cache and its device, through a request on
+ * the device's queue.
+ */
+struct CacheTransfer
+{
+	size_t first;
+	size_t count;
+	uint8_t *data;
+	BlockRequest *req;
+	BlockRequestGroup *group;
+	bool ok;
+};
+
+static void cache_transfer_complete(BlockRequest *req, bool success)
+{
+	CacheTransfer *transfer = (CacheTransfer *)req->priv;
+
+	transfer->ok = success;
+	transfer->group->end(success);
+}
+
+/**
+ * Allocates the buffer and the request for a transfer, which is not yet submitted.
+ */
+static bool prepare_transfer(BlockDevice& bdev, CacheTransfer& transfer, BlockRequest::Operation op, size_t block, size_t count)
+{
+	transfer.count = count;
+	transfer.ok = false;
+	transfer.req = NULL;
+
+	transfer.data = new uint8_t[count * bdev.block_size()];
+	if (!transfer.data) return false;
+
+	transfer.req = new BlockRequest(op, block, count, transfer.data, cache_transfer_complete, &transfer);
+	return transfer.req != NULL;
+}
+
+static void submit_transfer(BlockDevice& bdev, CacheTransfer& transfer, BlockRequestGroup& group)
+{
+	transfer.group = &group;
+
+	group.begin();
+	if (!bdev.submit(transfer.req)) {
+		group.end(false);
+	}
+}
+
+static void release_transfer(CacheTransfer& transfer)
+{
+	if (transfer.req) delete transfer.req;
+	delete[] transfer.data;
+}
+
+/**
+ * Writes every dirty block back to the device, waiting for any write-back already in progress
+ * to finish first.
+ */
+bool BlockCache::writeback()
+{
+	UniqueLock<Mutex> wl(_writeback_mtx);
+	return write_dirty();
+}
+
+/**
+ * Writes every dirty block back to the device.  Dirty blocks are written in block order, and
+ * each run of adjacent blocks is coalesced into a single request.  Several runs are queued on
+ * the device at once, so that its scheduler can order them, and a device that can have several
+ * transfers outstanding can carry them out together.  The write-back lock must be held.
+ */
+bool BlockCache::write_dirty()
+{
+	Buffer **dirty;
+	size_t nr_dirty = 0;
+
+	{
+		UniqueLock<Mutex> l(_mtx);
+		if (_nr_dirty == 0) return true;
+
+		dirty = new Buffer *[_nr_dirty];
+		if (!dirty) return false;
+
+		// The buffers are marked clean as they are collected, so that a block written again
+		// while the write-back is in progress is marked dirty again.
+		for (unsigned int i = 0; i < NR_BUCKETS; i++) {
+			for (Buffer *buffer = _buckets[i]; buffer; buffer = buffer->hash_next) {
+				if (!buffer->dirty) continue;
+
+				buffer->dirty = false;
+				if (buffer->refcount++ == 0) lru_remove(buffer);
+
+				dirty[nr_dirty++] = buffer;
+			}
+		}
+
+		_nr_dirty = 0;
+	}
+
+	sort_buffers(dirty, nr_dirty);
+
+	size_t block_size = _bdev.block_size();
+	bool ok = true;
+	size_t i = 0;
+
+	while (i < nr_dirty) {
+		BlockRequestGroup group;
+		CacheTransfer transfers[MAX_TRANSFERS_IN_FLIGHT];
+		unsigned int nr_transfers = 0;
+
+		while (i < nr_dirty && nr_transfers < MAX_TRANSFERS_IN_FLIGHT) {
+			size_t run = 1;
+			while (i + run < nr_dirty && run < MAX_WRITEBACK_RUN && dirty[i + run]->block == dirty[i]->block + run) {
+				run++;
+			}
+
+			CacheTransfer& transfer = transfers[nr_transfers++];
+			transfer.first = i;
+
+			if (prepare_transfer(_bdev, transfer, BlockRequest::WRITE, dirty[i]->block, run)) {
+				for (size_t j = 0; j < run; j++) {
+					dirty[i + j]->lock.lock();
+					memcpy(transfer.data + (j * block_size), dirty[i + j]->data, block_size);
+					dirty[i + j]->lock.unlock();
+				}
+
+				submit_transfer(_bdev, transfer, group);
+			}
+
+			i += run;
+		}
+
+		group.wait();
+
+		for (unsigned int t = 0; t < nr_transfers; t++) {
+			CacheTransfer& transfer = transfers[t];
+
+			if (transfer.ok) {
+				_needs_flush = true;
+			} else {
+				UniqueLock<Mutex> l(_mtx);
+				for (size_t j = 0; j < transfer.count; j++) {
+					mark_dirty(dirty[transfer.first + j]);
+				}
+
+				ok = false;
+			}
+
+			release_transfer(transfer);
+		}
+	}
+
+	for (i = 0; i < nr_dirty; i++) {
+		put(dirty[i]);
+	}
+
+	delete[] dirty;
+
+	return ok;
+}
+
+/**
+ * Writes back every dirty block, and then has the device commit what has been written to
+ * stable storage.
+ */
+bool BlockCache::flush()
+{
+	// Blocks being written back by someone else are only known to have reached the device
+	// once their write-back has finished, so the lock is held until the device is flushed.
+	UniqueLock<Mutex> wl(_writeback_mtx);
+
+	if (!write_dirty()) return false;
+	if (!_needs_flush) return true;
+
+	_needs_flush = false;
+	if (!_bdev.flush_direct()) {
+		_needs_flush = true;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Reads blocks into the cache, ahead of them being needed.  Blocks that are already cached are
+ * skipped, and each run of blocks that are not is read from the device with a single request.
+ * The requests for several runs are queued at once, and the blocks stored once they have all
+ * completed.
+ */
+bool BlockCache::prefetch(size_t offset, size_t count)
+{
+	size_t block_size = _bdev.block_size();
+
+	// Never fetch so much that the start of the range would be evicted by the end of it.
+	count = __min(count, _capacity / 2);
+
+	bool ok = true;
+
+	while (count > 0 && ok) {
+		BlockRequestGroup group;
+		CacheTransfer transfers[MAX_TRANSFERS_IN_FLIGHT];
+		unsigned int nr_transfers = 0;
+
+		while (count > 0 && nr_transfers < MAX_TRANSFERS_IN_FLIGHT) {
+			size_t run = 0;
+
+			{
+				UniqueLock<Mutex> l(_mtx);
+
+				while (count > 0 && lookup(offset)) {
+					offset++;
+					count--;
+				}
+
+				while (run < count && !lookup(offset + run)) run++;
+			}
+
+			if (run == 0) break;
+
+			CacheTransfer& transfer = transfers[nr_transfers++];
+			transfer.first = offset;
+
+			if (!prepare_transfer(_bdev, transfer, BlockRequest::READ, offset, run)) {
+				ok = false;
+				break;
+			}
+
+			submit_transfer(_bdev, transfer, group);
+
+			offset += run;
+			count -= run;
+		}
+
+		group.wait();
+
+		for (unsigned int t = 0; t < nr_transfers; t++) {
+			CacheTransfer& transfer = transfers[t];
+
+			if (transfer.ok) {
+				for (size_t i = 0; i < transfer.count; i++) {
+					store(transfer.first + i, transfer.data + (i * block_size), false, false);
+				}
+
+				_nr_prefetched += transfer.count;
+			} else {
+				ok = false;
+			}
+
+			release_transfer(transfer);
+		}
+	}
+
+	return ok;
+}
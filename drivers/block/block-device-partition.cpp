@@ -9,13 +9,20 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/drivers/block/block-device-partition.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/log.h>
+#include <infos/util/string.h>
 
 using namespace infos::drivers;
 using namespace infos::drivers::block;
+using namespace infos::kernel;
+using namespace infos::util;
 
 const DeviceClass BlockDevicePartition::BlockDevicePartitionClass(BlockDevice::BlockDeviceClass, "block-partition");
 
-BlockDevicePartition::BlockDevicePartition(BlockDevice& underlying_block_device, size_t block_offset, size_t block_count) : _underlying_block_device(underlying_block_device), _block_offset(block_offset), _block_count(block_count)
+// A partition does not have a cache of its own, as it is accessed through the underlying
+// device -- and so shares its cache.
+BlockDevicePartition::BlockDevicePartition(BlockDevice& underlying_block_device, size_t block_offset, size_t block_count) : BlockDevice(false), _underlying_block_device(underlying_block_device), _block_offset(block_offset), _block_count(block_count)
 {
 
 }
@@ -25,12 +32,91 @@ BlockDevicePartition::~BlockDevicePartition()
 
 }
 
-bool BlockDevicePartition::read_blocks(void* buffer, size_t offset, size_t count)
+bool BlockDevicePartition::read_blocks_direct(void* buffer, size_t offset, size_t count)
 {
 	return _underlying_block_device.read_blocks(buffer, _block_offset + offset, count);
 }
 
-bool BlockDevicePartition::write_blocks(const void* buffer, size_t offset, size_t count)
+bool BlockDevicePartition::write_blocks_direct(const void* buffer, size_t offset, size_t count)
 {
 	return _underlying_block_device.write_blocks(buffer, _block_offset + offset, count);
 }
+
+bool BlockDevicePartition::flush_direct()
+{
+	return _underlying_block_device.flush();
+}
+
+/**
+ * Requests for a partition are queued on the underlying device, so that they are scheduled
+ * (and merged) along with everything else going to it.  The request is moved to the device's
+ * block numbering on the way.
+ */
+void BlockDevicePartition::submit_direct(BlockRequest *req)
+{
+	req->block += _block_offset;
+	_underlying_block_device.submit_direct(req);
+}
+
+bool BlockDevicePartition::prefetch_blocks(size_t offset, size_t count)
+{
+	if (offset >= _block_count) return false;
+	return _underlying_block_device.prefetch_blocks(_block_offset + offset, __min(count, _block_count - offset));
+}
+
+/**
+ * Reads the MBR partition table of a disk, and creates (and registers) a device for each of the
+ * active partitions.  Partition n of a disk is aliased as <disk>p<n>.
+ * @param bdev The disk to scan.
+ * @param partitions Receives the partition devices that were created.
+ * @return Returns false if the partition table could not be read, or true otherwise.
+ */
+bool BlockDevicePartition::scan_partitions(BlockDevice& bdev, List<BlockDevicePartition *>& partitions)
+{
+	struct partition_table_entry {
+		uint8_t status;
+		uint8_t first_absolute_sector[3];
+		uint8_t type;
+		uint8_t last_absolute_sector[3];
+		uint32_t first_absolute_sector_lba;
+		uint32_t nr_sectors;
+	} __packed;
+
+	uint8_t *buffer = new uint8_t[bdev.block_size()];
+	if (!buffer)
+		return false;
+	
+	if (!bdev.read_blocks(buffer, 0, 1)) {
+		delete[] buffer;
+		return false;
+	}
+	
+	if (buffer[0x1fe] != 0x55 || buffer[0x1ff] != 0xaa) {
+		delete[] buffer;
+		return true;
+	}
+
+	syslog.messagef(LogLevel::INFO, "%s: disk has partitions!", bdev.name().c_str());
+	
+	for (int partition_table_index = 0; partition_table_index < 4; partition_table_index++) {
+		const struct partition_table_entry *pte = (const partition_table_entry *)&buffer[0x1be + (16 * partition_table_index)];
+		
+		if (pte->type == 0) {
+			syslog.messagef(LogLevel::INFO, "partition %u inactive", partition_table_index);
+			continue;
+		}
+		
+		syslog.messagef(LogLevel::INFO, "partition %u active @ off=%x, sz=%x", partition_table_index, pte->first_absolute_sector_lba, pte->nr_sectors);
+		
+		auto partition_device = new BlockDevicePartition(bdev, pte->first_absolute_sector_lba, pte->nr_sectors);
+		partitions.append(partition_device);
+
+		sys.device_manager().register_device(*partition_device);
+
+		String partition_name = bdev.name() + "p" + ToString(partition_table_index);
+		sys.device_manager().add_device_alias(partition_name, *partition_device);
+	}
+	
+	delete[] buffer;
+	return true;
+}
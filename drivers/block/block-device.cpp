@@ -9,8 +9,158 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/drivers/block/block-device.h>
+#include <infos/drivers/block/block-cache.h>
+#include <infos/drivers/block/request-queue.h>
+#include <infos/util/string.h>
 
 using namespace infos::drivers;
 using namespace infos::drivers::block;
+using namespace infos::util;
 
 const DeviceClass BlockDevice::BlockDeviceClass(Device::RootDeviceClass, "block");
+
+BlockDevice::BlockDevice(bool cached) : _cache(cached ? BlockCache::create(*this) : NULL), _queue(NULL)
+{
+
+}
+
+BlockDevice::~BlockDevice()
+{
+	delete _cache;
+	delete _queue;
+}
+
+bool BlockDevice::read_blocks(void* buffer, size_t offset, size_t count)
+{
+	if (offset + count > block_count()) return false;
+	
+	if (_cache) {
+		return _cache->read(buffer, offset, count);
+	} else {
+		return read_blocks_direct(buffer, offset, count);
+	}
+}
+
+bool BlockDevice::write_blocks(const void* buffer, size_t offset, size_t count)
+{
+	if (offset + count > block_count()) return false;
+	
+	if (_cache) {
+		return _cache->write(buffer, offset, count);
+	} else {
+		return write_blocks_direct(buffer, offset, count);
+	}
+}
+
+/**
+ * Writes any dirty blocks held in the block cache back to the device, and then has the device
+ * commit them to stable storage.
+ */
+bool BlockDevice::flush()
+{
+	if (_cache) {
+		return _cache->flush();
+	} else {
+		return flush_direct();
+	}
+}
+
+/**
+ * Brings blocks into the block cache, so that they can be read without waiting for the device.
+ */
+bool BlockDevice::prefetch_blocks(size_t offset, size_t count)
+{
+	if (offset >= block_count()) return false;
+	
+	count = __min(count, block_count() - offset);
+	
+	if (_cache) {
+		return _cache->prefetch(offset, count);
+	} else {
+		return true;
+	}
+}
+
+/**
+ * Returns the request queue of the device, creating it on first use.
+ */
+RequestQueue& BlockDevice::queue()
+{
+	if (!_queue) {
+		RequestQueue *queue = new RequestQueue(*this);
+
+		// Someone else may have got there first.
+		if (!__sync_bool_compare_and_swap(&_queue, NULL, queue)) {
+			delete queue;
+		}
+	}
+
+	return *_queue;
+}
+
+/**
+ * Submits an asynchronous request, which goes straight to the device -- beneath the block
+ * cache.  The request's completion function is called once it has been carried out.
+ * @return Returns false (without calling the completion function) if the request is outside
+ * the device, or true otherwise.
+ */
+bool BlockDevice::submit(BlockRequest *req)
+{
+	if (req->op != BlockRequest::FLUSH && req->block + req->count > block_count()) return false;
+
+	submit_direct(req);
+	return true;
+}
+
+void BlockDevice::submit_direct(BlockRequest *req)
+{
+	queue().submit(req);
+}
+
+/**
+ * Transfers a run of blocks to or from several buffers.  This is done in one transfer through a
+ * bounce buffer, or one transfer per segment if a bounce buffer cannot be allocated.
+ */
+bool BlockDevice::transfer_vector_direct(bool write, size_t offset, const BlockSegment *segments, unsigned int nr_segments)
+{
+	size_t total = 0;
+	for (unsigned int i = 0; i < nr_segments; i++) {
+		total += segments[i].count;
+	}
+
+	uint8_t *bounce = nr_segments > 1 ? new uint8_t[total * block_size()] : NULL;
+
+	if (!bounce) {
+		for (unsigned int i = 0; i < nr_segments; i++) {
+			bool ok = write ? write_blocks_direct(segments[i].buffer, offset, segments[i].count)
+					: read_blocks_direct(segments[i].buffer, offset, segments[i].count);
+			if (!ok) return false;
+
+			offset += segments[i].count;
+		}
+
+		return true;
+	}
+
+	bool ok;
+	if (write) {
+		uint8_t *p = bounce;
+		for (unsigned int i = 0; i < nr_segments; i++) {
+			memcpy(p, segments[i].buffer, segments[i].count * block_size());
+			p += segments[i].count * block_size();
+		}
+
+		ok = write_blocks_direct(bounce, offset, total);
+	} else {
+		ok = read_blocks_direct(bounce, offset, total);
+
+		uint8_t *p = bounce;
+		for (unsigned int i = 0; ok && i < nr_segments; i++) {
+			memcpy(segments[i].buffer, p, segments[i].count * block_size());
+			p += segments[i].count * block_size();
+		}
+	}
+
+	delete[] bounce;
+	return ok;
+}
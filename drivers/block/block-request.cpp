@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/block/block-request.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/drivers/block/block-request.h>
+#include <infos/kernel/thread.h>
+
+using namespace infos::drivers::block;
+using namespace infos::kernel;
+using namespace infos::util;
+
+void BlockRequestGroup::begin()
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	_pending++;
+	_done = false;
+}
+
+/**
+ * Counts a request out of the group.  The waiter is woken with the group lock held, as the
+ * group usually lives on the waiter's stack, and must not go away until this is finished.
+ */
+void BlockRequestGroup::end(bool success)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	if (!success) _ok = false;
+
+	if (--_pending == 0) {
+		_done = true;
+		_waiters.wake();
+	}
+}
+
+/**
+ * Waits for every request in the group to complete.
+ * @return Returns true if they all succeeded, or false otherwise.
+ */
+bool BlockRequestGroup::wait()
+{
+	while (!_done) {
+		_waiters.sleep_unless(Thread::current(), _done);
+	}
+
+	// Whoever completed the group may still be inside end().
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	return _ok;
+}
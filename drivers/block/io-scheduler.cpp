@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/block/io-scheduler.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/drivers/block/io-scheduler.h>
+#include <infos/kernel/log.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::drivers::block;
+using namespace infos::kernel;
+using namespace infos::util;
+
+extern IOSchedulerRegistration _IOSCHED_REG_START[], _IOSCHED_REG_END[];
+
+// The name of the I/O scheduler given to each block device.
+static char iosched_name[16] = "deadline";
+
+RegisterCmdLineArgument(IOSchedulerName, "blk.scheduler")
+{
+	strncpy(iosched_name, value, sizeof(iosched_name) - 1);
+}
+
+/**
+ * Creates an instance of the I/O scheduler chosen on the command-line, or of the first one
+ * registered if there is no scheduler by that name.
+ */
+IOScheduler *infos::drivers::block::create_io_scheduler()
+{
+	IOSchedulerRegistration *first = _IOSCHED_REG_START;
+	IOSchedulerRegistration *last = _IOSCHED_REG_END;
+
+	if (first == last) return NULL;
+
+	for (IOSchedulerRegistration *reg = first; reg < last; reg++) {
+		if (strncmp(reg->name, iosched_name, sizeof(iosched_name)) == 0) {
+			return reg->creation_fn();
+		}
+	}
+
+	syslog.messagef(LogLevel::WARNING, "blk: unknown i/o scheduler '%s', using '%s'", iosched_name, first->name);
+	return first->creation_fn();
+}
+
+/**
+ * Inserts a request into the sorted list, after any requests for the same block.
+ */
+void IOScheduler::sorted_insert(BlockRequest *req)
+{
+	BlockRequest *prev = NULL, *next = _sorted;
+	while (next && next->block <= req->block) {
+		prev = next;
+		next = next->sort_next;
+	}
+
+	req->sort_prev = prev;
+	req->sort_next = next;
+
+	if (prev) prev->sort_next = req;
+	else _sorted = req;
+
+	if (next) next->sort_prev = req;
+
+	_nr_queued++;
+}
+
+void IOScheduler::sorted_remove(BlockRequest *req)
+{
+	if (req->sort_prev) req->sort_prev->sort_next = req->sort_next;
+	else _sorted = req->sort_next;
+
+	if (req->sort_next) req->sort_next->sort_prev = req->sort_prev;
+
+	req->sort_next = req->sort_prev = NULL;
+	_nr_queued--;
+}
+
+/**
+ * Returns the first queued request that starts at or after the given block.
+ */
+BlockRequest *IOScheduler::sorted_from(size_t block) const
+{
+	BlockRequest *req = _sorted;
+	while (req && req->block < block) {
+		req = req->sort_next;
+	}
+
+	return req;
+}
+
+/**
+ * Removes a request that can be merged onto the end of another -- one of the same kind, which
+ * starts at the given block, and is no longer than the given count.
+ * @return Returns the request, or NULL if there is none.
+ */
+BlockRequest *IOScheduler::take_adjacent(BlockRequest::Operation op, size_t block, size_t max_count)
+{
+	for (BlockRequest *req = sorted_from(block); req && req->block == block; req = req->sort_next) {
+		if (req->op != op || req->count > max_count) continue;
+
+		sorted_remove(req);
+		removed(req);
+
+		return req;
+	}
+
+	return NULL;
+}
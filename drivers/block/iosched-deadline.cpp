@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/block/iosched-deadline.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/drivers/block/io-scheduler.h>
+#include <infos/kernel/kernel.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::drivers::block;
+using namespace infos::kernel;
+using namespace infos::util;
+
+// How long (in milliseconds) a read or a write may be queued before it is dispatched ahead of
+// everything else.
+static unsigned long deadline_read_expire = 500;
+static unsigned long deadline_write_expire = 5000;
+
+RegisterCmdLineArgument(DeadlineReadExpire, "deadline.read-expire")
+{
+	deadline_read_expire = strtoul(value, NULL, 0);
+}
+
+RegisterCmdLineArgument(DeadlineWriteExpire, "deadline.write-expire")
+{
+	deadline_write_expire = strtoul(value, NULL, 0);
+}
+
+/**
+ * Dispatches requests in a sweep across the device, like the elevator, but also keeps reads and
+ * writes in the order they arrived.  Once the oldest request of either kind has been waiting
+ * longer than its expiry time, it is dispatched next, and the sweep carries on from there.
+ * Reads expire sooner than writes, as a thread is usually waiting for them.
+ */
+class DeadlineIOScheduler : public IOScheduler
+{
+public:
+	DeadlineIOScheduler() : _head(0)
+	{
+		for (int i = 0; i < 2; i++) {
+			_fifo_head[i] = _fifo_tail[i] = NULL;
+		}
+	}
+
+	const char *name() const override { return "deadline"; }
+
+	void add(BlockRequest *req) override
+	{
+		unsigned long expire = req->op == BlockRequest::READ ? deadline_read_expire : deadline_write_expire;
+		req->deadline = now() + (expire * 1000000);
+
+		sorted_insert(req);
+		fifo_append(req);
+	}
+
+	BlockRequest *next() override
+	{
+		BlockRequest *req = NULL;
+		uint64_t time = now();
+
+		// Expired reads are looked at first.
+		for (int i = 0; i < 2 && !req; i++) {
+			if (_fifo_head[i] && _fifo_head[i]->deadline <= time) {
+				req = _fifo_head[i];
+			}
+		}
+
+		if (!req) {
+			req = sorted_from(_head);
+			if (!req) req = sorted_first();
+			if (!req) return NULL;
+		}
+
+		sorted_remove(req);
+		fifo_remove(req);
+
+		_head = req->block + req->count;
+		return req;
+	}
+
+protected:
+	void removed(BlockRequest *req) override
+	{
+		fifo_remove(req);
+	}
+
+private:
+	size_t _head;
+
+	// The FIFO of reads, and the FIFO of everything else.
+	BlockRequest *_fifo_head[2], *_fifo_tail[2];
+
+	static uint64_t now() { return sys.runtime().time_since_epoch().count(); }
+	static int fifo_of(const BlockRequest *req) { return req->op == BlockRequest::READ ? 0 : 1; }
+
+	void fifo_append(BlockRequest *req)
+	{
+		int fifo = fifo_of(req);
+
+		req->fifo_next = NULL;
+		req->fifo_prev = _fifo_tail[fifo];
+
+		if (_fifo_tail[fifo]) _fifo_tail[fifo]->fifo_next = req;
+		else _fifo_head[fifo] = req;
+
+		_fifo_tail[fifo] = req;
+	}
+
+	void fifo_remove(BlockRequest *req)
+	{
+		int fifo = fifo_of(req);
+
+		if (req->fifo_prev) req->fifo_prev->fifo_next = req->fifo_next;
+		else _fifo_head[fifo] = req->fifo_next;
+
+		if (req->fifo_next) req->fifo_next->fifo_prev = req->fifo_prev;
+		else _fifo_tail[fifo] = req->fifo_prev;
+
+		req->fifo_next = req->fifo_prev = NULL;
+	}
+};
+
+static IOScheduler *deadline_create()
+{
+	return new DeadlineIOScheduler();
+}
+
+RegisterIOScheduler(deadline, deadline_create);
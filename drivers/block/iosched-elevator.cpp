@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/block/iosched-elevator.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/drivers/block/io-scheduler.h>
+
+using namespace infos::drivers::block;
+
+/**
+ * A one-way elevator (C-LOOK).  Requests are dispatched in increasing block order from where
+ * the last one finished, and once there are none beyond that point, the sweep starts again
+ * from the lowest queued block.
+ */
+class ElevatorIOScheduler : public IOScheduler
+{
+public:
+	ElevatorIOScheduler() : _head(0) { }
+
+	const char *name() const override { return "elevator"; }
+
+	void add(BlockRequest *req) override
+	{
+		sorted_insert(req);
+	}
+
+	BlockRequest *next() override
+	{
+		BlockRequest *req = sorted_from(_head);
+		if (!req) req = sorted_first();
+		if (!req) return NULL;
+
+		sorted_remove(req);
+		_head = req->block + req->count;
+
+		return req;
+	}
+
+private:
+	size_t _head;
+};
+
+static IOScheduler *elevator_create()
+{
+	return new ElevatorIOScheduler();
+}
+
+RegisterIOScheduler(elevator, elevator_create);
@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/block/request-queue.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/drivers/block/request-queue.h>
+#include <infos/drivers/block/io-scheduler.h>
+#include <infos/drivers/block/block-device.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/process.h>
+#include <infos/kernel/thread.h>
+#include <infos/util/string.h>
+
+using namespace infos::drivers::block;
+using namespace infos::kernel;
+using namespace infos::util;
+
+RequestQueue::RequestQueue(BlockDevice& bdev)
+	: _bdev(bdev),
+	_sched(create_io_scheduler()),
+	_has_work(false),
+	_started(false),
+	_nr_submitted(0),
+	_nr_dispatched(0),
+	_nr_merged(0)
+{
+	assert(_sched);
+}
+
+const char *RequestQueue::scheduler_name() const
+{
+	return _sched->name();
+}
+
+/**
+ * Queues a request to be carried out by one of the dispatcher threads.
+ */
+void RequestQueue::submit(BlockRequest *req)
+{
+	req->merged = NULL;
+
+	if (!_started) start();
+
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_lock);
+
+		_sched->add(req);
+		_nr_submitted++;
+
+		_has_work = true;
+	}
+
+	_work.wake();
+}
+
+/**
+ * Starts the dispatcher threads -- one for each transfer the device can have outstanding, up
+ * to a limit.
+ */
+void RequestQueue::start()
+{
+	if (!__sync_bool_compare_and_swap(&_started, false, true)) return;
+
+	unsigned int nr_dispatchers = __min(__max(_bdev.queue_depth(), 1u), (unsigned int)REQUEST_QUEUE_MAX_DISPATCHERS);
+
+	for (unsigned int i = 0; i < nr_dispatchers; i++) {
+		Thread& dispatcher = sys.kernel_process().create_thread(ThreadPrivilege::Kernel, dispatcher_proc, "blkq-" + _bdev.name(), SchedulingEntityPriority::DAEMON);
+		dispatcher.add_entry_argument(this);
+		dispatcher.start();
+	}
+}
+
+void RequestQueue::dispatcher_proc(void *arg)
+{
+	RequestQueue *queue = (RequestQueue *)arg;
+
+	for (;;) {
+		BlockRequest *req = queue->take_batch();
+		if (!req) {
+			queue->_work.sleep_unless(Thread::current(), queue->_has_work);
+			continue;
+		}
+
+		queue->dispatch(req);
+	}
+}
+
+/**
+ * Takes the next request from the scheduler, along with any requests that continue on from
+ * it, which are chained onto it through their merged pointers.
+ * @return Returns the request, or NULL if the queue is empty.
+ */
+BlockRequest *RequestQueue::take_batch()
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	BlockRequest *req = _sched->next();
+	if (!req) {
+		_has_work = false;
+		return NULL;
+	}
+
+	BlockRequest *tail = req;
+	size_t nr_blocks = req->count;
+	unsigned int nr_segments = 1;
+
+	while (nr_segments < REQUEST_QUEUE_MAX_MERGE_SEGMENTS) {
+		// Flushes are not transfers, so any number of them can be merged.
+		size_t max_count = req->op == BlockRequest::FLUSH ? 0 : REQUEST_QUEUE_MAX_MERGE_BLOCKS - nr_blocks;
+		if (req->op != BlockRequest::FLUSH && max_count == 0) break;
+
+		BlockRequest *next = _sched->take_adjacent(req->op, tail->block + tail->count, max_count);
+		if (!next) break;
+
+		next->merged = NULL;
+		tail->merged = next;
+		tail = next;
+
+		nr_blocks += next->count;
+		nr_segments++;
+	}
+
+	_nr_dispatched++;
+	_nr_merged += nr_segments - 1;
+
+	return req;
+}
+
+/**
+ * Carries out a request and any requests merged onto it, and then completes them all.
+ */
+void RequestQueue::dispatch(BlockRequest *req)
+{
+	bool ok;
+
+	if (req->op == BlockRequest::FLUSH) {
+		ok = _bdev.flush_direct();
+	} else if (!req->merged) {
+		if (req->op == BlockRequest::WRITE) {
+			ok = _bdev.write_blocks_direct(req->buffer, req->block, req->count);
+		} else {
+			ok = _bdev.read_blocks_direct(req->buffer, req->block, req->count);
+		}
+	} else {
+		BlockSegment segments[REQUEST_QUEUE_MAX_MERGE_SEGMENTS];
+		unsigned int nr_segments = 0;
+
+		for (BlockRequest *r = req; r; r = r->merged) {
+			segments[nr_segments].buffer = r->buffer;
+			segments[nr_segments].count = r->count;
+			nr_segments++;
+		}
+
+		ok = _bdev.transfer_vector_direct(req->op == BlockRequest::WRITE, req->block, segments, nr_segments);
+	}
+
+	// A completion function may free its request, so the chain is followed before calling it.
+	while (req) {
+		BlockRequest *next = req->merged;
+		req->merged = NULL;
+
+		if (req->completion) req->completion(req, ok);
+		req = next;
+	}
+}
@@ -10,6 +10,7 @@
  */
 #include <infos/drivers/irq/lapic.h>
 #include <arch/x86/x86-arch.h>
+#include <infos/util/lock.h>
 
 #define MASKED     0x00010000   // Interrupt masked
 
@@ -29,6 +30,7 @@
 using namespace infos::drivers;
 using namespace infos::drivers::irq;
 using namespace infos::arch::x86;
+using namespace infos::util;
 
 const DeviceClass infos::drivers::irq::LAPIC::LAPICDeviceClass(RootDeviceClass, "lapic");
 
@@ -38,6 +40,24 @@ LAPIC::LAPIC(virt_addr_t base_address) : _apic_base((volatile uint32_t *)base_ad
 }
 
 bool LAPIC::init(kernel::DeviceManager& dm)
+{
+	init_local();
+
+	// Set-up the interrupt control register
+	write(LAPICRegisters::ICRHI, 0);
+	write(LAPICRegisters::ICRLO, BCAST | INIT | LEVEL);
+
+	// Wait for pending deliveries to complete
+	while (read(LAPICRegisters::ICRLO) & DELIVS);
+
+	return true;
+}
+
+/**
+ * Initialises the local APIC of the calling CPU.  As each CPU sees its own local APIC at the
+ * same address, this must be called on every CPU.
+ */
+void LAPIC::init_local()
 {
 	// Specify the spurious interrupt vector, and enable the device.
 	write(LAPICRegisters::SVR, 0x1ff);
@@ -60,23 +80,86 @@ bool LAPIC::init(kernel::DeviceManager& dm)
 	// Acknowledge any pending interrupts
 	write(LAPICRegisters::EOI, 0);
 
-	// Set-up the interrupt control register
-	write(LAPICRegisters::ICRHI, 0);
-	write(LAPICRegisters::ICRLO, BCAST | INIT | LEVEL);
-
-	// Wait for pending deliveries to complete
-	while (read(LAPICRegisters::ICRLO) & DELIVS);
-	
 	write(LAPICRegisters::TPR, 0);
-	
-	// Initialise the timer IRQ
-	_timer_irq = new LAPICIRQ(*this, Timer);
-	if (!x86arch.irq_manager().attach_irq(_timer_irq)) {
-		return false;
+}
+
+/**
+ * Allocates an IRQ for the timer of the calling CPU's local APIC, and routes the timer to it.
+ * @return Returns the timer IRQ, or NULL if one could not be allocated.
+ */
+infos::kernel::IRQ *LAPIC::allocate_timer_irq()
+{
+	LAPICIRQ *irq = new LAPICIRQ(*this, Timer);
+	if (!x86arch.irq_manager().attach_irq(irq)) {
+		return NULL;
 	}
-	
-	set_timer_irq(_timer_irq->nr());
-	return true;
+
+	set_timer_irq(irq->nr());
+	return irq;
+}
+
+/**
+ * Allocates an IRQ for a message-signalled interrupt, and returns the message a device must
+ * write to raise it.  Like the IOAPIC routes, messages are delivered to the boot CPU.
+ * @param msg_address Receives the address the device must write to.
+ * @param msg_data Receives the value the device must write.
+ * @return Returns the IRQ, or NULL if one could not be allocated.
+ */
+infos::kernel::IRQ *LAPIC::allocate_msi_irq(uint64_t& msg_address, uint32_t& msg_data)
+{
+	MSIIRQ *irq = new MSIIRQ(*this);
+	if (!x86arch.irq_manager().attach_irq(irq)) {
+		return NULL;
+	}
+
+	// Fixed delivery, edge triggered, physical destination APIC 0.
+	msg_address = 0xfee00000;
+	msg_data = irq->nr();
+
+	return irq;
+}
+
+/**
+ * Writes a command into the interrupt command register, and waits for it to be delivered.
+ */
+void LAPIC::send_command(uint32_t apic_id, uint32_t command)
+{
+	UniqueIRQLock l;
+
+	write(LAPICRegisters::ICRHI, apic_id << 24);
+	write(LAPICRegisters::ICRLO, command);
+
+	while (read(LAPICRegisters::ICRLO) & DELIVS);
+}
+
+/**
+ * Sends an inter-processor interrupt to another CPU.
+ * @param apic_id The local APIC ID of the destination CPU.
+ * @param vector The interrupt vector to raise on the destination CPU.
+ */
+void LAPIC::send_ipi(uint32_t apic_id, uint8_t vector)
+{
+	send_command(apic_id, FIXED | ASSERT | vector);
+}
+
+/**
+ * Sends an INIT IPI to another CPU, which resets it into the wait-for-SIPI state.
+ * @param apic_id The local APIC ID of the destination CPU.
+ */
+void LAPIC::send_init(uint32_t apic_id)
+{
+	send_command(apic_id, INIT | ASSERT | LEVEL);
+}
+
+/**
+ * Sends a STARTUP IPI to another CPU, which begins executing in real-mode at the start
+ * of the given page.
+ * @param apic_id The local APIC ID of the destination CPU.
+ * @param page The physical page number (below 1MB) at which to start.
+ */
+void LAPIC::send_startup(uint32_t apic_id, uint8_t page)
+{
+	send_command(apic_id, STARTUP | page);
 }
 
 void LAPIC::eoi()
@@ -169,6 +252,12 @@ void LAPIC::LAPICIRQ::disable()
 	_lapic.mask_interrupts(_lvt);
 }
 
+void LAPIC::MSIIRQ::handle() const
+{
+	invoke();
+	_lapic.eoi();
+}
+
 void LAPIC::LAPICIRQ::handle() const
 {
 	if (!invoke()) {
@@ -9,6 +9,8 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/drivers/pci/pci-device.h>
+#include <infos/drivers/irq/lapic.h>
+#include <infos/kernel/irq.h>
 #include <infos/drivers/pci/pci-bus.h>
 #include <infos/drivers/pci/bridge.h>
 #include <infos/kernel/device-manager.h>
@@ -19,6 +21,7 @@
 
 using namespace infos::drivers;
 using namespace infos::drivers::pci;
+using namespace infos::drivers::irq;
 using namespace infos::kernel;
 using namespace infos::arch::x86;
 
@@ -50,3 +53,141 @@ void PCIDevice::write_config(uint8_t reg, uint32_t value) const
 {
 	bus().write_config(_slot, _func, reg, value);
 }
+
+/**
+ * Searches the capability list of the device for a capability.
+ * @param id The ID of the capability to look for.
+ * @param start The capability to continue the search after, or zero to search from the start.
+ * @return Returns the configuration space offset of the capability, or zero if it was not found.
+ */
+uint8_t PCIDevice::find_capability(uint8_t id, uint8_t start) const
+{
+	if (!(read_config(PCI_REG_COMMAND) & PCI_STATUS_CAPABILITIES)) return 0;
+
+	uint8_t cap;
+	if (start) {
+		cap = (read_config(start) >> 8) & 0xfc;
+	} else {
+		cap = read_config(PCI_REG_CAPABILITIES) & 0xfc;
+	}
+
+	// The list is bounded, in case a broken device has made it circular.
+	for (int i = 0; i < 48 && cap; i++) {
+		uint32_t header = read_config(cap);
+		if ((header & 0xff) == id) return cap;
+
+		cap = (header >> 8) & 0xfc;
+	}
+
+	return 0;
+}
+
+/**
+ * Configures the device to signal its interrupt with a message (MSI), rather than with its
+ * interrupt pin.
+ * @param lapic The local APIC that will receive the message.
+ * @return Returns the IRQ, or NULL if the device does not support MSI.
+ */
+IRQ *PCIDevice::request_msi_irq(LAPIC *lapic)
+{
+	if (!lapic) return NULL;
+
+	uint8_t cap = find_capability(PCI_CAP_ID_MSI);
+	if (!cap) return NULL;
+
+	uint64_t msg_address;
+	uint32_t msg_data;
+
+	IRQ *irq = lapic->allocate_msi_irq(msg_address, msg_data);
+	if (!irq) return NULL;
+
+	// Only a single message is used, so the multiple message enable field is left at zero.
+	uint32_t control = read_config(cap) >> 16;
+
+	write_config(cap + 4, (uint32_t)msg_address);
+	if (control & PCI_MSI_CTRL_64BIT) {
+		write_config(cap + 8, (uint32_t)(msg_address >> 32));
+		write_config(cap + 12, msg_data);
+	} else {
+		write_config(cap + 8, msg_data);
+	}
+
+	control = (control & ~(7 << 4)) | PCI_MSI_CTRL_ENABLE;
+	write_config(cap, (read_config(cap) & 0xffff) | (control << 16));
+
+	// The pin is no longer needed, so stop the device from asserting it too.
+	write_config(PCI_REG_COMMAND, (read_config(PCI_REG_COMMAND) & 0xffff) | PCI_COMMAND_INTX_DISABLE);
+
+	return irq;
+}
+
+/**
+ * Works out the physical address of a memory BAR.
+ * @param bar The index of the BAR.
+ * @param pa Receives the address the BAR is mapped at.
+ * @return Returns true if the BAR is a memory BAR, or false otherwise.
+ */
+bool PCIDevice::bar_address(int bar, phys_addr_t& pa) const
+{
+	if (bar < 0 || bar > 5) return false;
+
+	uint32_t value = read_config(PCI_REG_BAR0 + (bar * 4));
+	if (value & 1) return false;
+
+	pa = value & ~0xf;
+
+	// A 64-bit BAR takes the next BAR for the upper half of its address.
+	if (((value >> 1) & 3) == 2) {
+		if (bar == 5) return false;
+		pa |= (phys_addr_t)read_config(PCI_REG_BAR0 + ((bar + 1) * 4)) << 32;
+	}
+
+	return pa != 0;
+}
+
+/**
+ * Configures the device to signal its interrupts with MSI-X messages, and routes one entry of
+ * its MSI-X table to a new IRQ.  All other entries are left masked.
+ * @param lapic The local APIC that will receive the message.
+ * @param entry The MSI-X table entry to use.
+ * @return Returns the IRQ, or NULL if the device does not support MSI-X.
+ */
+IRQ *PCIDevice::request_msix_irq(LAPIC *lapic, unsigned int entry)
+{
+	if (!lapic) return NULL;
+
+	uint8_t cap = find_capability(PCI_CAP_ID_MSIX);
+	if (!cap) return NULL;
+
+	uint32_t control = read_config(cap) >> 16;
+	if (entry >= PCI_MSIX_CTRL_TABLE_SIZE(control)) return NULL;
+
+	// The table lives in one of the memory BARs, which must be within the physical memory
+	// window to be accessible.
+	uint32_t table_info = read_config(cap + 4);
+
+	phys_addr_t table_pa;
+	if (!bar_address(table_info & 7, table_pa)) return NULL;
+
+	table_pa += table_info & ~7;
+	if (table_pa + (PCI_MSIX_CTRL_TABLE_SIZE(control) * 16) > PMEM_VA_SIZE) return NULL;
+
+	uint64_t msg_address;
+	uint32_t msg_data;
+
+	IRQ *irq = lapic->allocate_msi_irq(msg_address, msg_data);
+	if (!irq) return NULL;
+
+	write_config(PCI_REG_COMMAND, (read_config(PCI_REG_COMMAND) & 0xffff) | PCI_COMMAND_MEMORY | PCI_COMMAND_INTX_DISABLE);
+
+	volatile uint32_t *table_entry = (volatile uint32_t *)pa_to_vpa(table_pa + (entry * 16));
+	table_entry[0] = (uint32_t)msg_address;
+	table_entry[1] = (uint32_t)(msg_address >> 32);
+	table_entry[2] = msg_data;
+	table_entry[3] = 0;
+
+	control = (control & ~PCI_MSIX_CTRL_FUNCTION_MASK) | PCI_MSIX_CTRL_ENABLE;
+	write_config(cap, (read_config(cap) & 0xffff) | (control << 16));
+
+	return irq;
+}
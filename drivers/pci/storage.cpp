@@ -10,6 +10,9 @@
  */
 #include <infos/drivers/pci/storage.h>
 #include <infos/drivers/ata/ata-controller.h>
+#include <infos/drivers/ata/ahci-controller.h>
+#include <infos/drivers/irq/lapic.h>
+#include <infos/drivers/virtio/virtio-block.h>
 #include <infos/kernel/device-manager.h>
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/log.h>
@@ -20,6 +23,7 @@ using namespace infos::drivers;
 using namespace infos::drivers::block;
 using namespace infos::drivers::pci;
 using namespace infos::drivers::ata;
+using namespace infos::drivers::virtio;
 
 const DeviceClass Storage::StorageDeviceClass(PCIDevice::PCIDeviceClass, "storage");
 
@@ -36,6 +40,13 @@ Storage::~Storage()
 
 bool Storage::init(kernel::DeviceManager& dm)
 {
+	// Paravirtualised disks present themselves as SCSI controllers, so they are picked out by
+	// their IDs instead.
+	uint32_t ids = read_config(PCI_REG_VENDOR);
+	if (PCI_CONFIG_VENDOR(ids) == VIRTIO_PCI_VENDOR && PCI_CONFIG_DEVICE(ids) == VIRTIO_PCI_DEVICE_BLOCK) {
+		return init_virtio_block(dm);
+	}
+
 	switch(subclass()) {
 	case StorageSubclass::IDE_CONTROLLER:
 		return init_ide_controller(dm);
@@ -57,17 +68,13 @@ StorageSubclass::StorageSubclass Storage::subclass() const
 
 bool Storage::init_ide_controller(DeviceManager& dm)
 {
-	IRQ *irq = NULL;
-	
+	// The controller is used in compatibility mode, where its interrupts are the legacy ISA
+	// IRQs 14 and 15 -- which the ATA driver routes itself.
 	uint32_t old_config = read_config(PCI_REG_IRQ);
 	uint32_t new_config = (old_config & ~0xFF) | 0xFE;
 	write_config(PCI_REG_IRQ, new_config);
 	if ((read_config(PCI_REG_IRQ) & 0xFF) == 0xFE) {
-		//irq = dm.owner().arch().request_irq();
-		//if (!irq) return false;
-
-		//pci_log.messagef(LogLevel::INFO, "Configuring IDE storage device with IRQ %u", irq->nr());
-		new_config = (old_config & ~0xFF) | 0; //(uint8_t)irq->nr();
+		new_config = (old_config & ~0xFF) | 0;
 		write_config(PCI_REG_IRQ, new_config);
 	} else {
 		pci_log.messagef(LogLevel::ERROR, "Unsupported PCI IDE storage configuration");
@@ -81,7 +88,15 @@ bool Storage::init_ide_controller(DeviceManager& dm)
 	cfg.BAR[3] = read_config(PCI_REG_BAR3);
 	cfg.BAR[4] = read_config(PCI_REG_BAR4);
 	
-	ATAController *dev = new ATAController(*irq, cfg);
+	// BAR4 holds the bus-master IDE registers, which are only usable if the controller is
+	// allowed to master the bus.
+	if (cfg.BAR[4] & 1) {
+		write_config(PCI_REG_COMMAND, (read_config(PCI_REG_COMMAND) & 0xffff) | PCI_COMMAND_BUS_MASTER);
+	} else {
+		cfg.BAR[4] = 0;
+	}
+	
+	ATAController *dev = new ATAController(cfg);
 	if (!dm.register_device(*dev)) {
 		delete dev;
 		return false;
@@ -92,6 +107,61 @@ bool Storage::init_ide_controller(DeviceManager& dm)
 
 bool Storage::init_sata_controller(kernel::DeviceManager& dm)
 {
-	pci_log.messagef(LogLevel::WARNING, "SATA controller not (yet!) supported");
+	// The AHCI registers are memory mapped, through BAR5.
+	uint32_t abar = read_config(PCI_REG_BAR5);
+	if ((abar & 1) || (abar & ~0xf) == 0) {
+		pci_log.messagef(LogLevel::ERROR, "Unsupported PCI SATA storage configuration");
+		return false;
+	}
+
+	write_config(PCI_REG_COMMAND, (read_config(PCI_REG_COMMAND) & 0xffff) | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+
+	AHCIControllerConfiguration cfg;
+	cfg.abar = pa_to_vpa(abar & ~0xf);
+	cfg.irq = NULL;
+
+	// The controller's interrupt is message signalled, which avoids sharing an interrupt pin
+	// (and the IOAPIC) with other devices.
+	irq::LAPIC *lapic;
+	if (dm.try_get_device_by_class(irq::LAPIC::LAPICDeviceClass, lapic)) {
+		cfg.irq = request_msi_irq(lapic);
+	}
+
+	AHCIController *dev = new AHCIController(cfg);
+	if (!dm.register_device(*dev)) {
+		delete dev;
+		return false;
+	}
+
+	return true;
+}
+
+bool Storage::init_virtio_block(kernel::DeviceManager& dm)
+{
+	// The legacy interface is used, whose registers are in the I/O space of BAR0.
+	uint32_t bar0 = read_config(PCI_REG_BAR0);
+	if (!(bar0 & 1)) {
+		pci_log.messagef(LogLevel::ERROR, "Unsupported virtio block device configuration");
+		return false;
+	}
+
+	write_config(PCI_REG_COMMAND, (read_config(PCI_REG_COMMAND) & 0xffff) | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+	VirtIOBlockDeviceConfiguration cfg;
+	cfg.io_base = bar0 & ~3;
+	cfg.irq = NULL;
+
+	// Virtio devices only support message-signalled interrupts through MSI-X.
+	irq::LAPIC *lapic;
+	if (dm.try_get_device_by_class(irq::LAPIC::LAPICDeviceClass, lapic)) {
+		cfg.irq = request_msix_irq(lapic, 0);
+	}
+
+	VirtIOBlockDevice *dev = new VirtIOBlockDevice(cfg);
+	if (!dm.register_device(*dev)) {
+		delete dev;
+		return false;
+	}
+
 	return true;
 }
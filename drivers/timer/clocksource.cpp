@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/timer/clocksource.cpp
+ * 
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ * 
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/drivers/timer/clocksource.h>
+
+using namespace infos::drivers;
+using namespace infos::drivers::timer;
+
+const DeviceClass ClockSource::ClockSourceDeviceClass(Device::RootDeviceClass, "clocksource");
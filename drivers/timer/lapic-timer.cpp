@@ -14,7 +14,9 @@
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/irq.h>
 #include <infos/kernel/log.h>
+#include <infos/kernel/cpu.h>
 #include <infos/util/time.h>
+#include <infos/util/lock.h>
 #include <arch/x86/context.h>
 #include <arch/x86/irq.h>
 
@@ -33,7 +35,7 @@ ComponentLog lapic_timer_log(syslog, "lapic-timer");
  * @param irq The IRQ associated with the LAPIC timer
  * @param apic_base The base address of the APIC
  */
-LAPICTimer::LAPICTimer() : _frequency(0)
+LAPICTimer::LAPICTimer() : _frequency(0), _oneshot(false), _period(0), _charged(0), _timekeeper(false)
 {
 }
 
@@ -120,7 +122,14 @@ bool LAPICTimer::init(kernel::DeviceManager& dm)
 	if (!dm.try_get_device_by_class(LAPIC::LAPICDeviceClass, _lapic))
 		return false;
 
-	_irq = &_lapic->timer_irq();
+	// Each CPU has its own LAPIC timer, but only the one on the boot CPU drives the kernel's
+	// notion of time.
+	_timekeeper = CPU::current().index() == 0;
+
+	_irq = _lapic->allocate_timer_irq();
+	if (!_irq)
+		return false;
+
 	_irq->attach(lapic_timer_irq_handler, this);
 
 	// Initialise the timer controls
@@ -164,6 +173,10 @@ void LAPICTimer::init_oneshot(uint64_t period)
 {
 	reset();
 
+	_oneshot = true;
+	_period = period;
+	_charged = 0;
+
 	_lapic->set_timer_one_shot();
 	_lapic->set_timer_initial_count(period);
 }
@@ -176,6 +189,10 @@ void LAPICTimer::init_periodic(uint64_t period)
 {
 	reset();
 
+	_oneshot = false;
+	_period = period;
+	_charged = 0;
+
 	_lapic->set_timer_periodic();
 	_lapic->set_timer_initial_count(period);
 }
@@ -199,32 +216,93 @@ bool LAPICTimer::expired() const
 	return false;
 }
 
-static uint64_t last_tsc = 0;
+/**
+ * Converts a number of (divided) LAPIC timer ticks into nanoseconds.
+ */
+Nanoseconds LAPICTimer::ticks_to_ns(uint64_t ticks) const
+{
+	return Nanoseconds((ticks * 1000000000ull) / (_frequency >> 4));
+}
 
 /**
- * The IRQ handler for the LAPIC timer.
- * @param nr The IRQ number that occurred.
- * @param priv IRQ specific data.  In this case, a pointer to the LAPIC timer device object.
+ * Converts nanoseconds into a number of (divided) LAPIC timer ticks.  A delay of only a few
+ * minutes is too long for the conversion to fit in 64 bits, so such delays saturate instead --
+ * they are far beyond the longest one-shot period anyway.
  */
-void LAPICTimer::lapic_timer_irq_handler(const IRQ *irq, void* priv)
+uint64_t LAPICTimer::ns_to_ticks(Nanoseconds ns) const
+{
+	uint64_t rate = _frequency >> 4;
+	uint64_t count = ns.count();
+
+	if (rate && count > ~0ull / rate) return ~0ull;
+	return (count * rate) / 1000000000ull;
+}
+
+/**
+ * Arms the LAPIC timer in one-shot mode, so that it interrupts after the given delay.  If
+ * the delay is zero, then the timer is programmed with its longest possible period, so that
+ * the counter keeps running (and elapsed time can still be accounted), but interrupts
+ * only occur when it wraps.
+ * @param delay The delay after which the timer should fire.
+ * @return Returns TRUE, as the LAPIC timer can always be used as an event source.
+ */
+bool LAPICTimer::arm(Nanoseconds delay)
 {
-	/*uint32_t tscl, tsch;
-	asm volatile("rdtsc" : "=a"(tscl), "=d"(tsch));
+	UniqueIRQLock l;
 
-	uint64_t tsc = tscl | (uint64_t)tsch << 32;
-	uint64_t delta_tsc = tsc - last_tsc;
-	last_tsc = tsc;
+	// If the timer is mid-period, then the time that has passed since the period began
+	// has not been accounted for yet.  Do that before the counter is reprogrammed.
+	charge_elapsed();
 
-	uint64_t khz = 3600000;
-	uint64_t shift = 32;
-	uint64_t scale = (1000000 * shift) / khz;
+	uint64_t ticks = delay.count() ? ns_to_ticks(delay) : 0xffffffffu;
+	if (ticks == 0) ticks = 1;
+	if (ticks > 0xffffffffu) ticks = 0xffffffffu;
 
-	uint64_t ns = (delta_tsc * scale) / shift;*/
+	init_oneshot(ticks);
+	start();
 
-//	syslog.messagef(LogLevel::DEBUG, "ns = %lu", ns);
+	return true;
+}
+
+/**
+ * Accounts for the time that has passed in the current period, and has not been accounted for
+ * already.  So, each tick of a period is counted exactly once -- even if the timer is re-armed
+ * after it has expired, and its interrupt is then taken during the new period.
+ */
+void LAPICTimer::charge_elapsed()
+{
+	uint32_t remaining = count();
+	if (remaining > _period) return;
+
+	uint32_t elapsed = _period - remaining;
+	if (elapsed <= _charged) return;
+
+	if (_timekeeper) {
+		sys.update_runtime(ticks_to_ns(elapsed - _charged));
+	}
+
+	_charged = elapsed;
+}
+
+/**
+ * The IRQ handler for the LAPIC timer.
+ * @param nr The IRQ number that occurred.
+ * @param priv IRQ specific data.  In this case, a pointer to the LAPIC timer device object.
+ */
+void LAPICTimer::lapic_timer_irq_handler(const IRQ *irq, void* priv)
+{
+	LAPICTimer *timer = (LAPICTimer *)priv;
+
+	// Tell the kernel to update its internal runtime with the length of the period that has just
+	// expired.  A one-shot period may already have been partly (or wholly) accounted for, by
+	// arm(), so only the remainder is counted.
+	if (timer->_oneshot) {
+		timer->charge_elapsed();
+	} else if (timer->_timekeeper) {
+		sys.update_runtime(timer->ticks_to_ns(timer->_period));
+	}
 
-	// HACK HACK HACK -- this shouldn't be hard-coded in
-	sys.update_runtime(DurationCast<Nanoseconds>(Milliseconds(10)));		// Tell the kernel to update its internal runtime with +10mS
+	sys.timer_queue().run_expired();			// Wake up any sleepers whose time has come
 	sys.scheduler().update_accounting();		// Tell the scheduler to update process accounting
 	sys.scheduler().schedule();					// Cause a scheduling event to occur
 }
@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/timer/tsc.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/drivers/timer/tsc.h>
+#include <infos/kernel/log.h>
+#include <infos/util/time.h>
+#include <infos/util/lock.h>
+#include <arch/x86/cpuid.h>
+#include <arch/x86/pio.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::timer;
+using namespace infos::arch::x86;
+using namespace infos::util;
+
+const DeviceClass TSC::TSCDeviceClass(ClockSource::ClockSourceDeviceClass, "tsc");
+
+ComponentLog tsc_log(syslog, "tsc");
+
+#define CPUID_GET_POWER_MANAGEMENT	0x80000007
+#define INVARIANT_TSC				(1 << 8)
+
+// The reference timer is channel 2 of the PIT, which counts at a known frequency.
+#define PIT_FREQUENCY			1193180
+#define CALIBRATION_TICKS		0x2e9b		// ~10ms
+#define CALIBRATION_ROUNDS		3
+
+TSC::TSC() : _frequency(0), _mult(0)
+{
+}
+
+/**
+ * Runs channel 2 of the PIT for one calibration period, and counts the number of TSC cycles
+ * that elapse in that time.
+ * @return Returns the number of TSC cycles in the calibration period.
+ */
+static uint64_t measure_calibration_period()
+{
+	// Disable the speaker, and gate channel 2 off.
+	uint8_t gate = __inb(0x61);
+	gate &= 0x0c;
+	__outb(0x61, gate);
+
+	// Channel 2, lo/hi byte access, mode 0 (interrupt on terminal count)
+	__outb(0x43, 0xb0);
+	__outb(0x42, CALIBRATION_TICKS & 0xff);
+	__outb(0x42, CALIBRATION_TICKS >> 8);
+
+	// Gate channel 2 on, to start counting, and wait for the output to go high.
+	uint64_t start = TSC::rdtsc();
+	__outb(0x61, gate | 1);
+	while (!(__inb(0x61) & 0x20));
+	uint64_t end = TSC::rdtsc();
+
+	__outb(0x61, gate);
+
+	return end - start;
+}
+
+/**
+ * Calibrates the TSC against the PIT, and derives the cycle-to-nanosecond conversion factor.
+ * @return Returns TRUE if the calibration succeeded, or FALSE otherwise.
+ */
+bool TSC::calibrate()
+{
+	uint64_t cycles = 0;
+
+	// Take the shortest of a few measurements, as any interference (e.g. an SMI or, under
+	// virtualisation, a preempted vCPU) can only ever make a measurement longer.
+	{
+		UniqueIRQLock l;
+		for (int i = 0; i < CALIBRATION_ROUNDS; i++) {
+			uint64_t measurement = measure_calibration_period();
+			if (cycles == 0 || measurement < cycles) {
+				cycles = measurement;
+			}
+		}
+	}
+
+	tsc_log.messagef(LogLevel::DEBUG, "cycles-per-period=%lu", cycles);
+
+	_frequency = (cycles * PIT_FREQUENCY) / CALIBRATION_TICKS;
+	if (_frequency == 0) {
+		return false;
+	}
+
+	const uint64_t ns_per_second = DurationCast<Nanoseconds>(Seconds(1)).count();
+
+	_mult = (ns_per_second << Shift) / _frequency;
+
+	tsc_log.messagef(LogLevel::INFO, "frequency=%lu kHz, mult=%lu, shift=%u", _frequency / 1000, _mult, Shift);
+	return true;
+}
+
+/**
+ * Initialises the TSC device
+ * @param dm The device manager that manages this device.
+ * @return Returns TRUE if the TSC is usable as a clocksource, FALSE otherwise.
+ */
+bool TSC::init(kernel::DeviceManager& dm)
+{
+	if (!(cpuid_get_features().rdx & CPUIDFeatures::TSC)) {
+		tsc_log.message(LogLevel::ERROR, "TSC not present");
+		return false;
+	}
+
+	// Without an invariant TSC, the rate may change with the processor frequency -- but there
+	// is nothing better to use, so carry on regardless.
+	if (!(__cpuid(CPUID_GET_POWER_MANAGEMENT).rdx & INVARIANT_TSC)) {
+		tsc_log.message(LogLevel::WARNING, "TSC is not invariant");
+	}
+
+	return calibrate();
+}
@@ -0,0 +1,470 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/virtio/virtio-block.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/drivers/virtio/virtio-block.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/irq.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/util/string.h>
+#include <arch/arch.h>
+#include <arch/x86/pio.h>
+
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::drivers::virtio;
+using namespace infos::drivers::block;
+using namespace infos::mm;
+using namespace infos::util;
+using namespace infos::arch::x86;
+
+ComponentLog infos::drivers::virtio::virtio_log(syslog, "virtio");
+
+const DeviceClass VirtIOBlockDevice::VirtIOBlockDeviceClass(BlockDevice::BlockDeviceClass, "vd");
+
+VirtIOBlockDevice::VirtIOBlockDevice(const VirtIOBlockDeviceConfiguration& cfg)
+	: _io_base(cfg.io_base),
+	_irq(cfg.irq),
+	_features(0),
+	_capacity(0),
+	_max_segment_size(0),
+	_max_segments(0),
+	_requests(NULL),
+	_requests_pa(0),
+	_nr_slots(0),
+	_free_slots(0),
+	_slot_available(false)
+{
+
+}
+
+bool VirtIOBlockDevice::init(kernel::DeviceManager& dm)
+{
+	// Reset the device, and tell it that it has been found and is being driven.
+	__outb(_io_base + VIRTIO_PCI_STATUS, 0);
+	__outb(_io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+	uint32_t host_features = __inl(_io_base + VIRTIO_PCI_HOST_FEATURES);
+	_features = host_features & (VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH);
+	__outl(_io_base + VIRTIO_PCI_GUEST_FEATURES, _features);
+
+	uint16_t config = _io_base + VIRTIO_PCI_CONFIG(_irq != NULL);
+
+	_capacity = (uint64_t)__inl(config + 0) | ((uint64_t)__inl(config + 4) << 32);
+
+	_max_segment_size = (size_t)__page_size << 10;
+	if (_features & VIRTIO_BLK_F_SIZE_MAX) {
+		uint32_t size_max = __inl(config + 8);
+		if (size_max >= 512) _max_segment_size = size_max & ~511;
+	}
+
+	_max_segments = VIRTIO_BLK_MAX_SEGMENTS;
+	if (_features & VIRTIO_BLK_F_SEG_MAX) {
+		uint32_t seg_max = __inl(config + 12);
+		if (seg_max > 0) _max_segments = __min(_max_segments, (unsigned int)seg_max);
+	}
+
+	if (!init_queue()) {
+		__outb(_io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+		return false;
+	}
+
+	__outb(_io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+	virtio_log.messagef(LogLevel::INFO, "%s: capacity=%lu, queue=%u, requests=%u, indirect=%u, flush=%u, ro=%u, irq=%u",
+			name().c_str(), _capacity, _vq.size(), _nr_slots, indirect(), !!(_features & VIRTIO_BLK_F_FLUSH),
+			!!(_features & VIRTIO_BLK_F_RO), _irq != NULL);
+
+	return BlockDevicePartition::scan_partitions(*this, _partitions);
+}
+
+/**
+ * Sets up the request queue (queue zero), and the memory for the requests that go through it.
+ */
+bool VirtIOBlockDevice::init_queue()
+{
+	__outw(_io_base + VIRTIO_PCI_QUEUE_SEL, 0);
+
+	// With MSI-X, the queue's interrupt is routed to the first table entry.  Configuration
+	// changes are not interesting.
+	if (_irq) {
+		__outw(_io_base + VIRTIO_MSI_CONFIG_VECTOR, VIRTIO_MSI_NO_VECTOR);
+		__outw(_io_base + VIRTIO_MSI_QUEUE_VECTOR, 0);
+
+		if (__inw(_io_base + VIRTIO_MSI_QUEUE_VECTOR) != 0) {
+			virtio_log.message(LogLevel::WARNING, "Unable to route the request queue interrupt, polling instead");
+			_irq = NULL;
+		}
+	}
+
+	unsigned int queue_size = __inw(_io_base + VIRTIO_PCI_QUEUE_NUM);
+	if (queue_size == 0 || __inl(_io_base + VIRTIO_PCI_QUEUE_PFN) != 0) return false;
+
+	if (!_vq.init(queue_size)) return false;
+
+	// A request takes one ring descriptor with indirect descriptors, and a fixed run of them
+	// otherwise.
+	if (indirect()) {
+		_nr_slots = __min(queue_size, (unsigned int)VIRTIO_BLK_MAX_REQUESTS);
+	} else {
+		_nr_slots = __min(queue_size / DESCRIPTORS_PER_SLOT, (unsigned int)VIRTIO_BLK_MAX_REQUESTS);
+	}
+
+	if (_nr_slots == 0) return false;
+
+	size_t requests_size = _nr_slots * sizeof(Request);
+
+	int order = 0;
+	while (((size_t)__page_size << order) < requests_size) order++;
+
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	PageDescriptor *pgd = pgalloc.alloc_pages(order);
+	if (!pgd) return false;
+
+	_requests = (Request *)pgalloc.pgd_to_vpa(pgd);
+	_requests_pa = pgalloc.pgd_to_pa(pgd);
+	bzero(_requests, (size_t)__page_size << order);
+
+	_free_slots = (_nr_slots == 64) ? ~0ull : ((1ull << _nr_slots) - 1);
+
+	if (_irq) {
+		_irq->attach(virtio_irq_handler, this);
+	}
+
+	__outl(_io_base + VIRTIO_PCI_QUEUE_PFN, _vq.ring_pa() >> 12);
+	return true;
+}
+
+/**
+ * Claims a free request slot, sleeping until one becomes available if they are all in use.
+ * @return Returns the number of the slot.
+ */
+int VirtIOBlockDevice::alloc_slot()
+{
+	for (;;) {
+		{
+			UniqueIRQLock irq;
+			UniqueLock<SpinLock> l(_queue_lock);
+
+			if (_free_slots) {
+				int slot = __builtin_ctzll(_free_slots);
+				_free_slots &= ~(1ull << slot);
+				return slot;
+			}
+
+			_slot_available = false;
+		}
+
+		_slot_waiters.sleep_unless(Thread::current(), _slot_available);
+	}
+}
+
+void VirtIOBlockDevice::free_slot(int slot)
+{
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_queue_lock);
+
+		_free_slots |= (1ull << slot);
+		_slot_available = true;
+	}
+
+	_slot_waiters.wake();
+}
+
+/**
+ * Builds a request in a slot, hands it to the device, and waits for it to complete.  Requests
+ * in other slots can be submitted (and complete) in the meantime.
+ * @return Returns true if the device completed the request successfully, or false otherwise.
+ */
+bool VirtIOBlockDevice::execute(int slot, uint32_t type, uint64_t sector, const Segment *segments, unsigned int nr_segments, bool write)
+{
+	Request& request = _requests[slot];
+	phys_addr_t request_pa = _requests_pa + (slot * sizeof(Request));
+
+	request.header.type = type;
+	request.header.reserved = 0;
+	request.header.sector = sector;
+	request.status = 0xff;
+
+	// The chain is built in the request's own descriptor table when indirect descriptors are
+	// in use, in which case the links are indices into that table.
+	VirtQueue::Descriptor *chain;
+	uint16_t base;
+
+	if (indirect()) {
+		chain = request.table;
+		base = 0;
+	} else {
+		base = slot * DESCRIPTORS_PER_SLOT;
+		chain = &_vq.descriptors()[base];
+	}
+
+	unsigned int n = 0;
+
+	chain[n].addr = request_pa + offsetof(Request, header);
+	chain[n].len = sizeof(RequestHeader);
+	chain[n].flags = VRING_DESC_F_NEXT;
+	chain[n].next = base + n + 1;
+	n++;
+
+	for (unsigned int i = 0; i < nr_segments; i++, n++) {
+		chain[n].addr = segments[i].pa;
+		chain[n].len = segments[i].size;
+		chain[n].flags = VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE);
+		chain[n].next = base + n + 1;
+	}
+
+	chain[n].addr = request_pa + offsetof(Request, status);
+	chain[n].len = 1;
+	chain[n].flags = VRING_DESC_F_WRITE;
+	chain[n].next = 0;
+	n++;
+
+	uint16_t head;
+	if (indirect()) {
+		VirtQueue::Descriptor& desc = _vq.descriptors()[slot];
+
+		desc.addr = request_pa + offsetof(Request, table);
+		desc.len = n * sizeof(VirtQueue::Descriptor);
+		desc.flags = VRING_DESC_F_INDIRECT;
+		desc.next = 0;
+
+		head = slot;
+	} else {
+		head = base;
+	}
+
+	Slot& s = _slots[slot];
+	s.done = false;
+	s.error = false;
+
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_queue_lock);
+
+		_vq.publish(head);
+		__outw(_io_base + VIRTIO_PCI_QUEUE_NOTIFY, 0);
+	}
+
+	if (_irq) {
+		while (!s.done) {
+			s.waiters.sleep_unless(Thread::current(), s.done);
+		}
+	} else {
+		for (;;) {
+			complete_requests();
+			if (s.done) break;
+
+			sys.arch().invoke_kernel_syscall(1);
+		}
+	}
+
+	return !s.error;
+}
+
+/**
+ * Completes the requests the device has returned on the used ring, and wakes up the threads
+ * waiting on them.
+ */
+void VirtIOBlockDevice::complete_requests()
+{
+	uint64_t completed = 0;
+
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_queue_lock);
+
+		uint32_t id, len;
+		while (_vq.next_used(id, len)) {
+			unsigned int slot = indirect() ? id : (id / DESCRIPTORS_PER_SLOT);
+			if (slot >= _nr_slots) continue;
+
+			Slot& s = _slots[slot];
+			s.error = _requests[slot].status != VIRTIO_BLK_S_OK;
+			s.done = true;
+
+			completed |= (1ull << slot);
+		}
+	}
+
+	for (; completed; completed &= completed - 1) {
+		_slots[__builtin_ctzll(completed)].waiters.wake();
+	}
+}
+
+void VirtIOBlockDevice::virtio_irq_handler(const IRQ *irq, void *priv)
+{
+	VirtIOBlockDevice *dev = (VirtIOBlockDevice *)priv;
+	dev->complete_requests();
+}
+
+bool VirtIOBlockDevice::read_blocks_direct(void* buffer, size_t offset, size_t count)
+{
+	return transfer(false, offset, buffer, count);
+}
+
+bool VirtIOBlockDevice::write_blocks_direct(const void* buffer, size_t offset, size_t count)
+{
+	if (_features & VIRTIO_BLK_F_RO) return false;
+	return transfer(true, offset, (void *)buffer, count);
+}
+
+/**
+ * Works out the physical address of a buffer, if the device can be given it directly.  A buffer
+ * that lies entirely in a linear mapping is physically contiguous.
+ */
+static bool dma_address(const void *buffer, size_t size, phys_addr_t& pa)
+{
+	if (!linear_va_to_pa((virt_addr_t)buffer, pa)) return false;
+	return pa + size <= PMEM_VA_SIZE;
+}
+
+bool VirtIOBlockDevice::transfer(bool write, uint64_t sector, void *buffer, size_t nr_blocks)
+{
+	// A buffer in a linear mapping is given to the device directly, and is split only where
+	// segments would be too large.  Anything else is bounced through individual pages -- though
+	// parts of it may still be direct, so each part must suit either way of transferring it.
+	phys_addr_t pa;
+	size_t max_blocks;
+
+	if (dma_address(buffer, nr_blocks * 512, pa)) {
+		max_blocks = __min((size_t)VIRTIO_BLK_MAX_REQUEST_BLOCKS, (_max_segments * _max_segment_size) / 512);
+	} else {
+		max_blocks = (_max_segments * __min(_max_segment_size, (size_t)__page_size)) / 512;
+	}
+
+	uint8_t *data = (uint8_t *)buffer;
+	while (nr_blocks > 0) {
+		size_t n = __min(nr_blocks, max_blocks);
+
+		if (!transfer_one(write, sector, data, n)) {
+			return false;
+		}
+
+		sector += n;
+		data += n * 512;
+		nr_blocks -= n;
+	}
+
+	return true;
+}
+
+bool VirtIOBlockDevice::transfer_one(bool write, uint64_t sector, void *buffer, size_t nr_blocks)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	Segment segments[VIRTIO_BLK_MAX_SEGMENTS];
+	PageDescriptor *bounce[VIRTIO_BLK_MAX_SEGMENTS];
+	unsigned int nr_segments = 0, nr_bounce = 0;
+
+	size_t size = nr_blocks * 512;
+	phys_addr_t pa;
+
+	if (dma_address(buffer, size, pa)) {
+		for (size_t done = 0; done < size; nr_segments++) {
+			segments[nr_segments].pa = pa + done;
+			segments[nr_segments].size = __min(size - done, _max_segment_size);
+
+			done += segments[nr_segments].size;
+		}
+	} else {
+		for (size_t done = 0; done < size; done += __page_size) {
+			PageDescriptor *pgd = pgalloc.alloc_pages(0);
+			if (!pgd) {
+				while (nr_bounce > 0) pgalloc.free_pages(bounce[--nr_bounce], 0);
+				return false;
+			}
+
+			size_t chunk = __min(size - done, (size_t)__page_size);
+			if (write) {
+				memcpy((void *)pgalloc.pgd_to_vpa(pgd), (const uint8_t *)buffer + done, chunk);
+			}
+
+			bounce[nr_bounce++] = pgd;
+			segments[nr_segments].pa = pgalloc.pgd_to_pa(pgd);
+			segments[nr_segments].size = chunk;
+			nr_segments++;
+		}
+	}
+
+	int slot = alloc_slot();
+	bool result = execute(slot, write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN, sector, segments, nr_segments, write);
+	free_slot(slot);
+
+	for (unsigned int i = 0; i < nr_bounce; i++) {
+		if (result && !write) {
+			memcpy((uint8_t *)buffer + (i * __page_size), (const void *)pgalloc.pgd_to_vpa(bounce[i]), segments[i].size);
+		}
+
+		pgalloc.free_pages(bounce[i], 0);
+	}
+
+	return result;
+}
+
+/**
+ * Transfers a run of blocks to or from several buffers with a single request, when they are
+ * all in a linear mapping and fit in one.
+ */
+bool VirtIOBlockDevice::transfer_vector_direct(bool write, size_t offset, const BlockSegment *segments, unsigned int nr_segments)
+{
+	Segment request_segments[VIRTIO_BLK_MAX_SEGMENTS];
+	unsigned int nr_request_segments = 0;
+	size_t nr_blocks = 0;
+
+	for (unsigned int i = 0; i < nr_segments; i++) {
+		size_t size = segments[i].count * 512;
+		phys_addr_t pa;
+
+		if (!dma_address(segments[i].buffer, size, pa)) {
+			return BlockDevice::transfer_vector_direct(write, offset, segments, nr_segments);
+		}
+
+		for (size_t done = 0; done < size; nr_request_segments++) {
+			if (nr_request_segments == _max_segments) {
+				return BlockDevice::transfer_vector_direct(write, offset, segments, nr_segments);
+			}
+
+			request_segments[nr_request_segments].pa = pa + done;
+			request_segments[nr_request_segments].size = __min(size - done, _max_segment_size);
+
+			done += request_segments[nr_request_segments].size;
+		}
+
+		nr_blocks += segments[i].count;
+	}
+
+	if (nr_blocks > VIRTIO_BLK_MAX_REQUEST_BLOCKS) {
+		return BlockDevice::transfer_vector_direct(write, offset, segments, nr_segments);
+	}
+
+	int slot = alloc_slot();
+	bool result = execute(slot, write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN, offset, request_segments, nr_request_segments, write);
+	free_slot(slot);
+
+	return result;
+}
+
+/**
+ * Asks the device to make completed writes durable, if it has a write cache to flush.
+ */
+bool VirtIOBlockDevice::flush_direct()
+{
+	if (!(_features & VIRTIO_BLK_F_FLUSH)) return true;
+
+	int slot = alloc_slot();
+	bool result = execute(slot, VIRTIO_BLK_T_FLUSH, 0, NULL, 0, true);
+	free_slot(slot);
+
+	return result;
+}
@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * drivers/virtio/virtqueue.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/drivers/virtio/virtqueue.h>
+#include <infos/kernel/kernel.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/util/string.h>
+
+using namespace infos::drivers::virtio;
+using namespace infos::kernel;
+using namespace infos::mm;
+using namespace infos::util;
+
+VirtQueue::VirtQueue()
+	: _size(0),
+	_ring_pgd(NULL),
+	_ring_pa(0),
+	_desc(NULL),
+	_avail_flags(NULL),
+	_avail_idx(NULL),
+	_avail_ring(NULL),
+	_used_flags(NULL),
+	_used_idx(NULL),
+	_used_ring(NULL),
+	_next_avail(0),
+	_last_used(0)
+{
+
+}
+
+/**
+ * Allocates the memory for the queue, laid out as the legacy interface expects: the descriptor
+ * table, then the available ring, then -- on the next page boundary -- the used ring.
+ * @param size The number of entries in the queue, as given by the device.
+ */
+bool VirtQueue::init(unsigned int size)
+{
+	size_t avail_end = (16 * size) + 6 + (2 * size);
+	size_t used_offset = __align_up(avail_end, VIRTIO_PCI_VRING_ALIGN);
+	size_t total = used_offset + 6 + (8 * size);
+
+	int order = 0;
+	while (((size_t)__page_size << order) < total) order++;
+
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	_ring_pgd = pgalloc.alloc_pages(order);
+	if (!_ring_pgd) return false;
+
+	uint8_t *ring = (uint8_t *)pgalloc.pgd_to_vpa(_ring_pgd);
+	_ring_pa = pgalloc.pgd_to_pa(_ring_pgd);
+
+	bzero(ring, (size_t)__page_size << order);
+
+	_size = size;
+
+	_desc = (Descriptor *)ring;
+
+	_avail_flags = (volatile uint16_t *)(ring + (16 * size));
+	_avail_idx = _avail_flags + 1;
+	_avail_ring = _avail_flags + 2;
+
+	_used_flags = (volatile uint16_t *)(ring + used_offset);
+	_used_idx = _used_flags + 1;
+	_used_ring = (volatile UsedElement *)(ring + used_offset + 4);
+
+	return true;
+}
+
+/**
+ * Makes a descriptor chain available to the device.  The device must still be notified.
+ * @param head The index of the first descriptor in the chain.
+ */
+void VirtQueue::publish(uint16_t head)
+{
+	_avail_ring[_next_avail % _size] = head;
+	_next_avail++;
+
+	// The ring entry must be visible before the index that covers it.
+	__sync_synchronize();
+	*_avail_idx = _next_avail;
+	__sync_synchronize();
+}
+
+/**
+ * Takes the next chain that the device has finished with from the used ring.
+ * @param id Receives the index of the head of the chain.
+ * @param len Receives the number of bytes the device wrote into the chain.
+ * @return Returns true if a chain was taken, or false if the used ring is empty.
+ */
+bool VirtQueue::next_used(uint32_t& id, uint32_t& len)
+{
+	if (_last_used == *_used_idx) return false;
+
+	// The entry must not be read before the index that covers it.
+	__sync_synchronize();
+
+	volatile UsedElement& elem = _used_ring[_last_used % _size];
+	id = elem.id;
+	len = elem.len;
+
+	_last_used++;
+	return true;
+}
@@ -9,6 +9,8 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/fs/block-based-filesystem.h>
+#include <infos/fs/readahead.h>
+#include <infos/drivers/block/block-device.h>
 
 using namespace infos::fs;
 
@@ -16,3 +18,21 @@ BlockBasedFilesystem::BlockBasedFilesystem(drivers::block::BlockDevice& bdev) :
 {
 
 }
+
+/**
+ * Reads ahead in a file whose blocks are stored contiguously on the block device.  This should
+ * be called before the blocks being read are fetched, so that they (and the blocks ahead of
+ * them) are brought in with as few transfers as possible.
+ * @param ra The readahead state of the open file.
+ * @param base_block The block on the device at which the file starts.
+ * @param index The first block of the file being read.
+ * @param count The number of blocks being read.
+ * @param nr_blocks The number of blocks in the file.
+ */
+void BlockBasedFilesystem::readahead(Readahead& ra, size_t base_block, size_t index, size_t count, size_t nr_blocks)
+{
+	size_t ra_index, ra_count;
+	if (ra.access(index, count, nr_blocks, ra_index, ra_count)) {
+		_bdev.prefetch_blocks(base_block + ra_index, ra_count);
+	}
+}
@@ -0,0 +1,266 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * fs/dentry-cache.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/fs/dentry-cache.h>
+#include <infos/fs/vfs-node.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::fs;
+using namespace infos::util;
+
+// The number of negative and path entries kept, beyond which the oldest are dropped.
+static unsigned long dcache_size = 1024;
+
+RegisterCmdLineArgument(DentryCacheSize, "dcache.size")
+{
+	dcache_size = strtoul(value, NULL, 0);
+}
+
+DentryCache::DentryCache() : _lru_head(NULL), _lru_tail(NULL), _nr_lru(0), _generation(0), _nr_hits(0), _nr_misses(0)
+{
+	for (unsigned int i = 0; i < NR_BUCKETS; i++) {
+		_buckets[i] = NULL;
+	}
+}
+
+unsigned int DentryCache::bucket_of(const VFSNode *parent, hash_type hash)
+{
+	uint64_t key = hash ^ ((uint64_t)parent * 0x9e3779b97f4a7c15ULL);
+	return (key ^ (key >> 32)) & (NR_BUCKETS - 1);
+}
+
+/**
+ * Finds the entry for a name in a parent, comparing the names themselves so that two names
+ * with the same hash are never confused.  The cache lock must be held.
+ */
+DentryCache::Dentry *DentryCache::find(const VFSNode *parent, const char *name, size_t length, hash_type hash) const
+{
+	for (Dentry *dentry = _buckets[bucket_of(parent, hash)]; dentry; dentry = dentry->hash_next) {
+		if (dentry->parent != parent || dentry->hash != hash) continue;
+		if (dentry->name.length() != length) continue;
+		if (length > 0 && strncmp(dentry->name.c_str(), name, length) != 0) continue;
+
+		return dentry;
+	}
+
+	return NULL;
+}
+
+void DentryCache::hash_insert(Dentry *dentry)
+{
+	Dentry *& bucket = _buckets[bucket_of(dentry->parent, dentry->hash)];
+
+	dentry->hash_prev = NULL;
+	dentry->hash_next = bucket;
+
+	if (bucket) bucket->hash_prev = dentry;
+	bucket = dentry;
+}
+
+void DentryCache::hash_remove(Dentry *dentry)
+{
+	if (dentry->hash_prev) {
+		dentry->hash_prev->hash_next = dentry->hash_next;
+	} else {
+		_buckets[bucket_of(dentry->parent, dentry->hash)] = dentry->hash_next;
+	}
+
+	if (dentry->hash_next) dentry->hash_next->hash_prev = dentry->hash_prev;
+}
+
+void DentryCache::lru_insert(Dentry *dentry)
+{
+	dentry->lru_prev = NULL;
+	dentry->lru_next = _lru_head;
+
+	if (_lru_head) _lru_head->lru_prev = dentry;
+	else _lru_tail = dentry;
+
+	_lru_head = dentry;
+
+	dentry->on_lru = true;
+	_nr_lru++;
+}
+
+void DentryCache::lru_remove(Dentry *dentry)
+{
+	if (dentry->lru_prev) dentry->lru_prev->lru_next = dentry->lru_next;
+	else _lru_head = dentry->lru_next;
+
+	if (dentry->lru_next) dentry->lru_next->lru_prev = dentry->lru_prev;
+	else _lru_tail = dentry->lru_prev;
+
+	dentry->on_lru = false;
+	_nr_lru--;
+}
+
+/**
+ * Adds an entry to the cache, making room for it if it is one that can be dropped.  The cache
+ * lock must be held.
+ */
+void DentryCache::add(Dentry *dentry)
+{
+	hash_insert(dentry);
+
+	if (dentry->parent && dentry->node) return;
+
+	lru_insert(dentry);
+	while (_nr_lru > dcache_size && _lru_tail) {
+		remove(_lru_tail);
+	}
+}
+
+void DentryCache::remove(Dentry *dentry)
+{
+	hash_remove(dentry);
+	if (dentry->on_lru) lru_remove(dentry);
+
+	delete dentry;
+}
+
+/**
+ * Looks up a name in a parent node.
+ * @param node Receives the child node, or NULL if the name is known not to exist.
+ * @return Returns true if the name was in the cache, or false if the parent must be asked.
+ */
+bool DentryCache::lookup(const VFSNode *parent, const char *name, size_t length, hash_type hash, VFSNode *& node)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	Dentry *dentry = find(parent, name, length, hash);
+	if (!dentry) {
+		_nr_misses++;
+		return false;
+	}
+
+	if (dentry->on_lru) {
+		lru_remove(dentry);
+		lru_insert(dentry);
+	}
+
+	_nr_hits++;
+
+	node = dentry->node;
+	return true;
+}
+
+/**
+ * Records the result of asking a parent node for a name.  A negative result is not recorded if
+ * the namespace has changed since the parent was asked, as the name may have been created since.
+ * @param generation The generation of the cache before the parent was asked.
+ * @return Returns the node now cached for the name -- which is a node found by someone else, if
+ * they got there first.
+ */
+VFSNode *DentryCache::insert(const VFSNode *parent, const String& name, VFSNode *node, uint64_t generation)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	Dentry *dentry = find(parent, name.c_str(), name.length(), name.get_hash());
+	if (dentry) {
+		if (!dentry->node && node) {
+			// The name has been created since the negative entry was added.
+			lru_remove(dentry);
+			dentry->node = node;
+		}
+
+		return dentry->node;
+	}
+
+	if (!node && generation != _generation) return NULL;
+
+	dentry = new Dentry(parent, name, node);
+	if (dentry) add(dentry);
+
+	return node;
+}
+
+/**
+ * Looks up a whole absolute path.
+ * @return Returns true if the path was in the cache, or false if it must be walked.
+ */
+bool DentryCache::lookup_path(const String& path, VFSNode *& node)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	Dentry *dentry = find(NULL, path.c_str(), path.length(), path.get_hash());
+	if (!dentry) {
+		_nr_misses++;
+		return false;
+	}
+
+	if (dentry->generation != _generation) {
+		remove(dentry);
+
+		_nr_misses++;
+		return false;
+	}
+
+	lru_remove(dentry);
+	lru_insert(dentry);
+
+	_nr_hits++;
+
+	node = dentry->node;
+	return true;
+}
+
+/**
+ * Records the result of walking a whole path, unless the namespace has changed since the walk
+ * began.
+ */
+void DentryCache::insert_path(const String& path, VFSNode *node, uint64_t generation)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	if (generation != _generation) return;
+
+	Dentry *dentry = find(NULL, path.c_str(), path.length(), path.get_hash());
+	if (dentry) remove(dentry);
+
+	dentry = new Dentry(NULL, path, node);
+	if (!dentry) return;
+
+	dentry->generation = generation;
+	add(dentry);
+}
+
+/**
+ * Forgets what is known about a name in a parent, once it has been created or removed.
+ */
+void DentryCache::invalidate(const VFSNode *parent, const String& name)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	Dentry *dentry = find(parent, name.c_str(), name.length(), name.get_hash());
+	if (dentry) remove(dentry);
+
+	_generation++;
+}
+
+/**
+ * Forgets every name in a parent, when something is mounted over it.
+ */
+void DentryCache::invalidate_children(const VFSNode *parent)
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	for (unsigned int i = 0; i < NR_BUCKETS; i++) {
+		Dentry *dentry = _buckets[i];
+		while (dentry) {
+			Dentry *next = dentry->hash_next;
+			if (dentry->parent == parent) remove(dentry);
+
+			dentry = next;
+		}
+	}
+
+	_generation++;
+}
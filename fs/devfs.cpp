@@ -82,15 +82,47 @@ Directory* DeviceFSNode::opendir()
 	return NULL;
 }
 
-DeviceFSDirectory::DeviceFSDirectory(DeviceFSRootNode& node)
-{
-	for (const auto& device : kernel::sys.device_manager().devices()) {
-		DirectoryEntry de;
-		de.name = device.value->name();
-		de.size = 0;
-		
-		add_entry(de);
+DeviceFSDirectory::DeviceFSDirectory(DeviceFSRootNode& node) : _nr_devices(0), _cursor(0)
+{
+	const auto& devices = kernel::sys.device_manager().devices();
+
+	_devices = new drivers::Device *[devices.count()];
+	if (!_devices) return;
+
+	for (const auto& device : devices) {
+		_devices[_nr_devices++] = device.value;
+	}
+}
+
+DeviceFSDirectory::~DeviceFSDirectory()
+{
+	delete[] _devices;
+}
+
+bool DeviceFSDirectory::read_entry(DirectoryEntry& entry)
+{
+	if (_cursor >= _nr_devices) return false;
+
+	entry.name = _devices[_cursor]->name();
+	entry.size = 0;
+
+	_cursor++;
+	return true;
+}
+
+unsigned int DeviceFSDirectory::read_entries(DirectoryEntrySink& sink)
+{
+	unsigned int nr_entries = 0;
+
+	while (_cursor < _nr_devices) {
+		const util::String& name = _devices[_cursor]->name();
+		if (!sink.add(name.c_str(), name.length(), 0)) break;
+
+		_cursor++;
+		nr_entries++;
 	}
+
+	return nr_entries;
 }
 
 
@@ -14,24 +14,81 @@
 using namespace infos::fs;
 using namespace infos::kernel;
 
+/**
+ * Reads entries one at a time until the sink is full.  Directories that can hand over their
+ * entries without building a DirectoryEntry for each override this.
+ * @return Returns the number of entries the sink took.
+ */
+unsigned int Directory::read_entries(DirectoryEntrySink& sink)
+{
+	unsigned int nr_entries = 0;
+
+	for (;;) {
+		if (!_has_pending) {
+			if (!read_entry(_pending)) break;
+			_has_pending = true;
+		}
+
+		if (!sink.add(_pending.name.c_str(), _pending.name.length(), _pending.size)) break;
+
+		_has_pending = false;
+		nr_entries++;
+	}
+
+	return nr_entries;
+}
+
+SimpleDirectory::~SimpleDirectory()
+{
+	close();
+}
+
 bool SimpleDirectory::read_entry(DirectoryEntry& entry)
 {
-	if (_current_entry < _entries.count()) {
-		entry = _entries.at(_current_entry);
-		_current_entry++;
-		
-		return true;
+	if (!_cursor) return false;
+
+	entry = _cursor->de;
+	_cursor = _cursor->next;
+
+	return true;
+}
+
+unsigned int SimpleDirectory::read_entries(DirectoryEntrySink& sink)
+{
+	unsigned int nr_entries = 0;
+
+	while (_cursor && sink.add(_cursor->de.name.c_str(), _cursor->de.name.length(), _cursor->de.size)) {
+		_cursor = _cursor->next;
+		nr_entries++;
 	}
-	
-	return false;
+
+	return nr_entries;
 }
 
 void SimpleDirectory::close()
 {
-	_entries.clear();
+	Entry *entry = _head;
+	while (entry) {
+		Entry *next = entry->next;
+		delete entry;
+
+		entry = next;
+	}
+
+	_head = _tail = _cursor = NULL;
 }
 
 void SimpleDirectory::add_entry(const DirectoryEntry& e)
 {
-	_entries.append(e);
+	Entry *entry = new Entry();
+	entry->next = NULL;
+	entry->de = e;
+
+	if (_tail) _tail->next = entry;
+	else _head = entry;
+
+	_tail = entry;
+
+	// Entries added after the last one was read are still to be read.
+	if (!_cursor) _cursor = entry;
 }
@@ -7,6 +7,7 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/fs/exec/elf-loader.h>
+#include <infos/fs/exec/image-cache.h>
 #include <infos/fs/file.h>
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/process.h>
@@ -17,6 +18,7 @@ using namespace infos::kernel;
 using namespace infos::fs;
 using namespace infos::fs::exec;
 using namespace infos::util;
+using namespace infos::mm;
 
 ComponentLog infos::fs::exec::elf_log(syslog, "elf");
 
@@ -91,7 +93,89 @@ struct ELF64ProgramHeaderEntry
 	uint64_t filesz, memsz, align;
 };
 
-ElfLoader::ElfLoader(File &f) : _file(f)
+// The most pages read into by a single vectored read while a segment is loaded.
+#define LOAD_BATCH_PAGES 32
+
+/**
+ * Reads the file image of a segment straight into the pages that back it, a batch of pages at
+ * a time, and zeroes what is left of the segment in memory.
+ */
+static bool load_segment(File &f, VMA &vma, const ELF64ProgramHeaderEntry &ent)
+{
+	IOVector iov[LOAD_BATCH_PAGES];
+
+	virt_addr_t va = ent.vaddr;
+	off_t off = ent.offset;
+	size_t remaining = ent.filesz;
+
+	while (remaining > 0)
+	{
+		unsigned int nr_iov = 0;
+		size_t batch = 0;
+
+		while (nr_iov < LOAD_BATCH_PAGES && batch < remaining)
+		{
+			uint8_t *page = (uint8_t *)vma.backing_page(va + batch);
+			if (!page)
+				return false;
+
+			size_t page_offset = __page_offset(va + batch);
+			size_t chunk = __min((size_t)__page_size - page_offset, remaining - batch);
+
+			iov[nr_iov].base = page + page_offset;
+			iov[nr_iov].length = chunk;
+			nr_iov++;
+
+			batch += chunk;
+		}
+
+		if (f.preadv(iov, nr_iov, off) != (int)batch)
+			return false;
+
+		va += batch;
+		off += batch;
+		remaining -= batch;
+	}
+
+	// Pages of the .bss that have not been touched yet will be zeroed when they are.
+	if (ent.memsz > ent.filesz)
+		return vma.zero(ent.vaddr + ent.filesz, ent.memsz - ent.filesz);
+
+	return true;
+}
+
+/**
+ * Determines whether a segment shares a page with any other loadable segment, in which case its
+ * pages cannot be shared between processes.
+ */
+static bool shares_page(File &f, const ELF64Header &hdr, unsigned int index, const ELF64ProgramHeaderEntry &ent)
+{
+	virt_addr_t base = __page_base(ent.vaddr);
+	virt_addr_t end = ent.vaddr + ent.memsz;
+
+	for (unsigned int i = 0; i < hdr.phnum; i++)
+	{
+		if (i == index)
+			continue;
+
+		ELF64ProgramHeaderEntry other;
+		if (f.pread(&other, sizeof(other), hdr.phoff + (i * hdr.phentsize)) != sizeof(other))
+			return true;
+
+		if (other.type != ProgramHeaderEntryType::PT_LOAD)
+			continue;
+
+		virt_addr_t other_base = __page_base(other.vaddr);
+		virt_addr_t other_end = other.vaddr + other.memsz;
+
+		if (__page_base(end - 1) >= other_base && base <= __page_base(other_end - 1))
+			return true;
+	}
+
+	return false;
+}
+
+ElfLoader::ElfLoader(File &f, const PFSNode *node) : _file(f), _node(node)
 {
 }
 
@@ -164,15 +248,27 @@ Process *ElfLoader::load(const String &cmdline)
 		{
 		case ProgramHeaderEntryType::PT_LOAD:
 		{
-			if (!np->vma().is_mapped(ent.vaddr))
+			// A read-only segment is mapped from the pages of the image cache, unless it shares
+			// a page with a segment that this process has its own copy of.
+			bool writable = (uint32_t)ent.flags & (uint32_t)ProgramHeaderEntryFlags::PF_W;
+			if (_node && !writable && ent.memsz > 0 && !shares_page(_file, hdr, i, ent))
 			{
-				np->vma().allocate_virt(ent.vaddr, __align_up_page(ent.memsz) >> 12);
+				if (image_cache.map_segment(np->vma(), *_node, _file, ent.offset, ent.vaddr, ent.filesz, ent.memsz))
+					break;
 			}
 
-			char *buffer = new char[ent.filesz];
-			_file.pread(buffer, ent.filesz, ent.offset);
-			np->vma().copy_to(ent.vaddr, buffer, ent.filesz);
-			delete buffer;
+			// The segment is only reserved here -- its pages (including those of any .bss)
+			// are backed as they are touched, either by loading the segment, or by the program.
+			uint64_t span = __page_offset(ent.vaddr) + ent.memsz;
+			np->vma().allocate_virt(ent.vaddr, __align_up_page(span) >> 12);
+
+			if (!load_segment(_file, np->vma(), ent))
+			{
+				delete np;
+
+				elf_log.message(LogLevel::DEBUG, "Unable to load segment");
+				return NULL;
+			}
 		}
 		break;
 
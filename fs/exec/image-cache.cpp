@@ -0,0 +1,211 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * fs/exec/image-cache.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/fs/exec/image-cache.h>
+#include <infos/fs/exec/elf-loader.h>
+#include <infos/fs/file.h>
+#include <infos/fs/pfs-node.h>
+#include <infos/kernel/kernel.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/vma.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::kernel;
+using namespace infos::fs;
+using namespace infos::fs::exec;
+using namespace infos::mm;
+using namespace infos::util;
+
+ImageCache infos::fs::exec::image_cache;
+
+// The most segments kept in the cache.
+static unsigned long image_cache_size = 32;
+
+RegisterCmdLineArgument(ImageCacheSize, "execcache.size")
+{
+	image_cache_size = strtoul(value, NULL, 0);
+}
+
+// The most pages read into by a single vectored read while a segment is loaded.
+#define LOAD_BATCH_PAGES 32
+
+/**
+ * Maps a read-only segment of an executable into an address space, loading it into the cache
+ * first if it is not there already.
+ * @return Returns true if the segment was mapped, or false if the caller must load a private
+ * copy of it instead.
+ */
+bool ImageCache::map_segment(VMA& vma, const PFSNode& node, File& f, off_t offset, virt_addr_t vaddr, size_t filesz, size_t memsz)
+{
+	if (image_cache_size == 0) return false;
+
+	UniqueLock<Mutex> l(_mtx);
+
+	ImageSegment *segment = find(node, offset, vaddr, filesz, memsz);
+	if (!segment) {
+		segment = load(node, f, offset, vaddr, filesz, memsz);
+		if (!segment) return false;
+
+		segment->next = _segments;
+		_segments = segment;
+		_nr_segments++;
+
+		// Make room by dropping the least recently used segments.
+		ImageSegment **slot = &_segments;
+		for (unsigned int i = 0; *slot && i < image_cache_size; i++) {
+			slot = &(*slot)->next;
+		}
+
+		while (*slot) {
+			ImageSegment *victim = *slot;
+			*slot = victim->next;
+
+			release(victim);
+			_nr_segments--;
+		}
+	}
+
+	return vma.map_shared(segment->vaddr, segment->pages, segment->nr_pages);
+}
+
+/**
+ * Finds a segment of the current version of a file, moving it to the front of the cache.  Any
+ * segments of older versions of the file are dropped on the way.  The cache lock must be held.
+ */
+ImageSegment *ImageCache::find(const PFSNode& node, off_t offset, virt_addr_t vaddr, size_t filesz, size_t memsz)
+{
+	uint64_t version = node.version();
+
+	ImageSegment **slot = &_segments;
+	while (*slot) {
+		ImageSegment *segment = *slot;
+
+		if (segment->node != &node) {
+			slot = &segment->next;
+			continue;
+		}
+
+		if (segment->version != version) {
+			*slot = segment->next;
+
+			release(segment);
+			_nr_segments--;
+			continue;
+		}
+
+		if (segment->offset == offset && segment->vaddr == vaddr && segment->filesz == filesz && segment->memsz == memsz) {
+			*slot = segment->next;
+
+			segment->next = _segments;
+			_segments = segment;
+
+			return segment;
+		}
+
+		slot = &segment->next;
+	}
+
+	return NULL;
+}
+
+/**
+ * Reads a segment into pages of its own.  The file data is read straight into the pages, and
+ * the parts of pages it does not cover are zeroed.
+ */
+ImageSegment *ImageCache::load(const PFSNode& node, File& f, off_t offset, virt_addr_t vaddr, size_t filesz, size_t memsz)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	ImageSegment *segment = new ImageSegment();
+	if (!segment) return NULL;
+
+	segment->next = NULL;
+	segment->node = &node;
+	segment->version = node.version();
+	segment->offset = offset;
+	segment->vaddr = vaddr;
+	segment->filesz = filesz;
+	segment->memsz = memsz;
+
+	uint64_t span = __page_offset(vaddr) + memsz;
+	segment->nr_pages = 0;
+	segment->pages = new PageDescriptor *[__align_up_page(span) >> __page_bits];
+	if (!segment->pages) {
+		delete segment;
+		return NULL;
+	}
+
+	virt_addr_t base = __page_base(vaddr);
+	virt_addr_t data_end = vaddr + filesz;
+
+	for (virt_addr_t va = base; va < vaddr + memsz; va += __page_size) {
+		PageDescriptor *pgd = pgalloc.alloc_pages(0);
+		if (!pgd) {
+			release(segment);
+			return NULL;
+		}
+
+		pgd->refcount = 1;
+		segment->pages[segment->nr_pages++] = pgd;
+
+		if (va < vaddr || va + __page_size > data_end) {
+			pzero((void *)pgalloc.pgd_to_vpa(pgd));
+		}
+	}
+
+	IOVector iov[LOAD_BATCH_PAGES];
+
+	virt_addr_t va = vaddr;
+	while (va < data_end) {
+		unsigned int nr_iov = 0;
+		size_t batch = 0;
+
+		while (nr_iov < LOAD_BATCH_PAGES && va + batch < data_end) {
+			virt_addr_t page_va = va + batch;
+			PageDescriptor *pgd = segment->pages[(page_va - base) >> __page_bits];
+
+			size_t chunk = __min((size_t)__page_size - __page_offset(page_va), data_end - page_va);
+
+			iov[nr_iov].base = (void *)(pgalloc.pgd_to_vpa(pgd) + __page_offset(page_va));
+			iov[nr_iov].length = chunk;
+			nr_iov++;
+
+			batch += chunk;
+		}
+
+		if (f.preadv(iov, nr_iov, offset + (va - vaddr)) != (int)batch) {
+			elf_log.message(LogLevel::DEBUG, "Unable to read shared segment");
+
+			release(segment);
+			return NULL;
+		}
+
+		va += batch;
+	}
+
+	return segment;
+}
+
+/**
+ * Drops the cache's references to the pages of a segment, and forgets the segment.
+ */
+void ImageCache::release(ImageSegment *segment)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	for (unsigned int i = 0; i < segment->nr_pages; i++) {
+		pgalloc.put_page(segment->pages[i]);
+	}
+
+	delete[] segment->pages;
+	delete segment;
+}
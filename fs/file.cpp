@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * fs/file.cpp
+ * 
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ * 
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/fs/file.h>
+
+using namespace infos::fs;
+
+/*
+ * The vectored operations below transfer one buffer at a time, stopping at the first that comes
+ * up short.  Files that can do better override them.
+ */
+
+int File::readv(const IOVector *iov, unsigned int nr_iov)
+{
+	int total = 0;
+
+	for (unsigned int i = 0; i < nr_iov; i++) {
+		int n = read(iov[i].base, iov[i].length);
+		if (n < 0) return total > 0 ? total : n;
+
+		total += n;
+		if ((size_t)n < iov[i].length) break;
+	}
+
+	return total;
+}
+
+int File::preadv(const IOVector *iov, unsigned int nr_iov, off_t off)
+{
+	int total = 0;
+
+	for (unsigned int i = 0; i < nr_iov; i++) {
+		int n = pread(iov[i].base, iov[i].length, off + total);
+		if (n < 0) return total > 0 ? total : n;
+
+		total += n;
+		if ((size_t)n < iov[i].length) break;
+	}
+
+	return total;
+}
+
+int File::writev(const IOVector *iov, unsigned int nr_iov)
+{
+	int total = 0;
+
+	for (unsigned int i = 0; i < nr_iov; i++) {
+		int n = write(iov[i].base, iov[i].length);
+		if (n < 0) return total > 0 ? total : n;
+
+		total += n;
+		if ((size_t)n < iov[i].length) break;
+	}
+
+	return total;
+}
+
+int File::pwritev(const IOVector *iov, unsigned int nr_iov, off_t off)
+{
+	int total = 0;
+
+	for (unsigned int i = 0; i < nr_iov; i++) {
+		int n = pwrite(iov[i].base, iov[i].length, off + total);
+		if (n < 0) return total > 0 ? total : n;
+
+		total += n;
+		if ((size_t)n < iov[i].length) break;
+	}
+
+	return total;
+}
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * fs/readahead.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/fs/readahead.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+
+using namespace infos::fs;
+using namespace infos::util;
+
+// The initial, and the largest, readahead windows (in blocks).  A maximum of zero disables
+// readahead, but blocks that are actually requested are still read in a single transfer.
+#define INITIAL_WINDOW	8
+static unsigned long max_window = 128;
+
+RegisterCmdLineArgument(ReadaheadMax, "readahead.max")
+{
+	max_window = strtoul(value, NULL, 0);
+}
+
+/**
+ * Records a read of the file, and works out which blocks should be fetched for it.
+ * @param index The first block being read.
+ * @param count The number of blocks being read.
+ * @param nr_blocks The number of blocks in the file.
+ * @param ra_index Receives the first block to fetch.
+ * @param ra_count Receives the number of blocks to fetch.
+ * @return Returns true if there are blocks to fetch, or false if they have all been fetched
+ * already.
+ */
+bool Readahead::access(size_t index, size_t count, size_t nr_blocks, size_t& ra_index, size_t& ra_count)
+{
+	if (index >= nr_blocks || count == 0) return false;
+
+	size_t end = __min(index + count, nr_blocks);
+
+	// A read that starts where the last one finished (or within the last block of it, as reads
+	// need not be block aligned) continues a sequential stream.
+	bool sequential = index >= _prev_index && index <= _next_index;
+
+	_prev_index = index;
+	_next_index = end;
+
+	if (!sequential) {
+		_window = 0;
+		_ra_end = index;
+	} else if (_window == 0) {
+		_window = __min(__max(INITIAL_WINDOW, count * 2), max_window);
+	} else if (end + (_window / 2) >= _ra_end) {
+		// The reader has caught up with the second half of the window, so it is pushed
+		// further ahead, and grown.
+		_window = __min(_window * 2, max_window);
+	} else if (end <= _ra_end) {
+		return false;
+	}
+
+	size_t target = __min(end + _window, nr_blocks);
+
+	ra_index = __max(index, _ra_end);
+	if (ra_index >= target) return false;
+
+	ra_count = target - ra_index;
+	_ra_end = target;
+
+	return true;
+}
@@ -9,27 +9,183 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/fs/tmpfs.h>
-#include <infos/util/string.h>
+#include <infos/kernel/kernel.h>
 #include <infos/kernel/log.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/string.h>
 
 using namespace infos::fs;
+using namespace infos::mm;
 using namespace infos::util;
 using namespace infos::kernel;
 
+// The most bytes of file data a tmpfs instance may hold.
+static unsigned long tmpfs_size = 64 * 1024 * 1024;
+
+RegisterCmdLineArgument(TempFSSize, "tmpfs.size")
+{
+	const char *end;
+	unsigned long size = strtoul(value, &end, 0);
+
+	switch (*end) {
+	case 'g': case 'G': size <<= 10;
+	// fall through
+	case 'm': case 'M': size <<= 10;
+	// fall through
+	case 'k': case 'K': size <<= 10;
+	}
+
+	tmpfs_size = size;
+}
+
+TempFS::TempFS() : _nr_pages(0), _max_pages(tmpfs_size >> __page_bits)
+{
+
+}
+
 PFSNode *TempFS::mount()
 {
 	return new TempFSNode(*this, "");
 }
 
-TempFSNode::TempFSNode(TempFS& owner, const util::String& name) : PFSNode(NULL, owner), _name(name)
+/**
+ * Accounts for a page of file data, if the filesystem has room for it.
+ */
+bool TempFS::reserve_page()
 {
+	if (__sync_add_and_fetch(&_nr_pages, 1) > _max_pages) {
+		__sync_sub_and_fetch(&_nr_pages, 1);
+		return false;
+	}
 
+	return true;
+}
+
+void TempFS::release_pages(size_t nr_pages)
+{
+	__sync_sub_and_fetch(&_nr_pages, nr_pages);
+}
+
+void **TempFSPageTree::alloc_node()
+{
+	PageDescriptor *pgd = sys.mm().pgalloc().alloc_pages(0);
+	if (!pgd) return NULL;
+
+	void **node = (void **)sys.mm().pgalloc().pgd_to_vpa(pgd);
+	pzero(node);
+
+	return node;
+}
+
+void TempFSPageTree::free_node(void **node)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	pgalloc.free_pages(pgalloc.vpa_to_pgd((virt_addr_t)node), 0);
+}
+
+/**
+ * Finds the page holding the given page of a file.
+ * @return Returns the page, or NULL if that part of the file is a hole.
+ */
+PageDescriptor *TempFSPageTree::lookup(size_t index) const
+{
+	if (index >= capacity()) return NULL;
+
+	void **node = _root;
+	for (unsigned int level = _height - 1; level > 0; level--) {
+		node = (void **)node[(index >> (TMPFS_TREE_SHIFT * level)) & (TMPFS_TREE_SLOTS - 1)];
+		if (!node) return NULL;
+	}
+
+	return (PageDescriptor *)node[index & (TMPFS_TREE_SLOTS - 1)];
+}
+
+/**
+ * Puts a page into a hole, growing the tree upwards if the index is beyond what it can hold,
+ * and filling in the nodes on the way down to it.
+ */
+bool TempFSPageTree::insert(size_t index, PageDescriptor *pgd)
+{
+	while (index >= capacity()) {
+		if (_height == TMPFS_TREE_MAX_HEIGHT) return false;
+
+		void **root = alloc_node();
+		if (!root) return false;
+
+		root[0] = _root;
+		_root = root;
+		_height++;
+	}
+
+	void **node = _root;
+	for (unsigned int level = _height - 1; level > 0; level--) {
+		void *& slot = node[(index >> (TMPFS_TREE_SHIFT * level)) & (TMPFS_TREE_SLOTS - 1)];
+		if (!slot) {
+			slot = alloc_node();
+			if (!slot) return false;
+		}
+
+		node = (void **)slot;
+	}
+
+	node[index & (TMPFS_TREE_SLOTS - 1)] = pgd;
+	return true;
+}
+
+size_t TempFSPageTree::clear_node(void **node, unsigned int height)
+{
+	size_t nr_pages = 0;
+
+	for (unsigned int i = 0; i < TMPFS_TREE_SLOTS; i++) {
+		if (!node[i]) continue;
+
+		if (height > 1) {
+			nr_pages += clear_node((void **)node[i], height - 1);
+		} else {
+			sys.mm().pgalloc().free_pages((PageDescriptor *)node[i], 0);
+			nr_pages++;
+		}
+	}
+
+	free_node(node);
+	return nr_pages;
+}
+
+/**
+ * Frees every page in the tree, and the tree itself.
+ * @return Returns the number of data pages that were freed.
+ */
+size_t TempFSPageTree::clear()
+{
+	size_t nr_pages = 0;
+
+	if (_root) nr_pages = clear_node(_root, _height);
+
+	_root = NULL;
+	_height = 0;
+
+	return nr_pages;
+}
+
+TempFSNode::TempFSNode(TempFS& owner, const util::String& name, bool is_file)
+	: PFSNode(NULL, owner), _name(name), _first_child(NULL), _last_child(NULL), _next_sibling(NULL),
+	_is_file(is_file), _size(0)
+{
+
+}
+
+TempFSNode::~TempFSNode()
+{
+	fs().release_pages(_pages.clear());
 }
 
 PFSNode* TempFSNode::get_child(const util::String& name)
 {
 	TempFSNode *child;
-	
+
+	UniqueLock<Mutex> l(_mtx);
 	if (!_children.try_get_value(name.get_hash(), child)) {
 		return NULL;
 	}
@@ -39,31 +195,273 @@ PFSNode* TempFSNode::get_child(const util::String& name)
 
 PFSNode* TempFSNode::mkdir(const util::String& name)
 {
-	TempFSNode *dir = new TempFSNode((TempFS &)owner(), name);
-	_children.add(name.get_hash(), dir);
-	
+	if (_is_file) return NULL;
+
+	UniqueLock<Mutex> l(_mtx);
+
+	TempFSNode *dir;
+	if (_children.try_get_value(name.get_hash(), dir)) {
+		return dir->_is_file ? NULL : dir;
+	}
+
+	dir = new TempFSNode(fs(), name);
+	add_child(dir);
+
 	return dir;
 }
 
+PFSNode* TempFSNode::create(const util::String& name)
+{
+	if (_is_file) return NULL;
+
+	UniqueLock<Mutex> l(_mtx);
+
+	TempFSNode *file;
+	if (_children.try_get_value(name.get_hash(), file)) {
+		return file->_is_file ? file : NULL;
+	}
+
+	file = new TempFSNode(fs(), name, true);
+	add_child(file);
+
+	return file;
+}
+
+/**
+ * Adds a new child.  The node lock must be held.
+ */
+void TempFSNode::add_child(TempFSNode *child)
+{
+	_children.add(child->name().get_hash(), child);
+
+	if (_last_child) _last_child->_next_sibling = child;
+	else _first_child = child;
+
+	_last_child = child;
+}
+
+/**
+ * Steps through the children in the order they were created in.
+ * @param prev The child before the one wanted, or NULL for the first child.
+ */
+TempFSNode *TempFSNode::next_child(TempFSNode *prev)
+{
+	UniqueLock<Mutex> l(_mtx);
+	return prev ? prev->_next_sibling : _first_child;
+}
+
 File* TempFSNode::open()
 {
-	return NULL;
+	if (!_is_file) return NULL;
+	return new TempFSFile(*this);
 }
 
 Directory* TempFSNode::opendir()
 {
+	if (_is_file) return NULL;
 	return new TempFSDirectory(*this);
 }
 
-TempFSDirectory::TempFSDirectory(TempFSNode& node)
+/**
+ * Copies file data straight out of the pages that hold it into each of the buffers in turn.
+ * Holes read as zeroes.
+ */
+int TempFSNode::read_data(const IOVector *iov, unsigned int nr_iov, off_t off)
+{
+	if (!_is_file || off < 0) return -1;
+
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	UniqueLock<Mutex> l(_mtx);
+
+	size_t pos = off;
+	for (unsigned int i = 0; i < nr_iov && pos < _size; i++) {
+		uint8_t *buffer = (uint8_t *)iov[i].base;
+		size_t size = __min(iov[i].length, _size - pos);
+
+		while (size > 0) {
+			size_t page_offset = __page_offset(pos);
+			size_t chunk = __min((size_t)__page_size - page_offset, size);
+
+			const PageDescriptor *pgd = _pages.lookup(__page_index(pos));
+			if (pgd) {
+				memcpy(buffer, (const void *)(pgalloc.pgd_to_vpa(pgd) + page_offset), chunk);
+			} else {
+				bzero(buffer, chunk);
+			}
+
+			buffer += chunk;
+			pos += chunk;
+			size -= chunk;
+		}
+	}
+
+	return pos - off;
+}
+
+/**
+ * Finds the page to write a page of the file into, taking one for a hole if there is room.  A
+ * page that is only to be partly written is zeroed first, so that the rest of it reads as the
+ * hole it was.  The node lock must be held.
+ */
+PageDescriptor *TempFSNode::page_for_write(size_t index, bool partial)
 {
-	for (const auto& child : node.children()) {
-		DirectoryEntry de;
-		de.name = child.value->name();
-		de.size = 0;
-		
-		add_entry(de);
+	PageDescriptor *pgd = _pages.lookup(index);
+	if (pgd) return pgd;
+
+	if (!fs().reserve_page()) return NULL;
+
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	pgd = pgalloc.alloc_pages(0);
+	if (!pgd) {
+		fs().release_pages(1);
+		return NULL;
+	}
+
+	if (partial) {
+		pzero((void *)pgalloc.pgd_to_vpa(pgd));
 	}
+
+	if (!_pages.insert(index, pgd)) {
+		pgalloc.free_pages(pgd, 0);
+		fs().release_pages(1);
+		return NULL;
+	}
+
+	return pgd;
+}
+
+/**
+ * Copies each of the buffers in turn straight into the pages that hold the file data.
+ * @return Returns the number of bytes written, which is short if the filesystem is full.
+ */
+int TempFSNode::write_data(const IOVector *iov, unsigned int nr_iov, off_t off)
+{
+	if (!_is_file || off < 0) return -1;
+
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	UniqueLock<Mutex> l(_mtx);
+
+	size_t pos = off;
+	bool full = false;
+
+	for (unsigned int i = 0; i < nr_iov && !full; i++) {
+		const uint8_t *buffer = (const uint8_t *)iov[i].base;
+		size_t size = iov[i].length;
+
+		while (size > 0) {
+			size_t page_offset = __page_offset(pos);
+			size_t chunk = __min((size_t)__page_size - page_offset, size);
+
+			PageDescriptor *pgd = page_for_write(__page_index(pos), chunk < (size_t)__page_size);
+			if (!pgd) {
+				full = true;
+				break;
+			}
+
+			memcpy((void *)(pgalloc.pgd_to_vpa(pgd) + page_offset), buffer, chunk);
+
+			buffer += chunk;
+			pos += chunk;
+			size -= chunk;
+		}
+	}
+
+	if (pos > _size) {
+		_size = pos;
+	}
+
+	if (pos > (size_t)off) {
+		changed();
+	}
+
+	if (full && pos == (size_t)off) return -1;
+	return pos - off;
+}
+
+int TempFSFile::read(void* buffer, size_t size)
+{
+	IOVector iov = { buffer, size };
+	return readv(&iov, 1);
+}
+
+int TempFSFile::pread(void* buffer, size_t size, off_t off)
+{
+	IOVector iov = { buffer, size };
+	return _node.read_data(&iov, 1, off);
+}
+
+int TempFSFile::write(const void* buffer, size_t size)
+{
+	IOVector iov = { (void *)buffer, size };
+	return writev(&iov, 1);
+}
+
+int TempFSFile::pwrite(const void* buffer, size_t size, off_t off)
+{
+	IOVector iov = { (void *)buffer, size };
+	return _node.write_data(&iov, 1, off);
+}
+
+int TempFSFile::readv(const IOVector *iov, unsigned int nr_iov)
+{
+	int n = _node.read_data(iov, nr_iov, _pos);
+	if (n > 0) _pos += n;
+
+	return n;
+}
+
+int TempFSFile::preadv(const IOVector *iov, unsigned int nr_iov, off_t off)
+{
+	return _node.read_data(iov, nr_iov, off);
+}
+
+int TempFSFile::writev(const IOVector *iov, unsigned int nr_iov)
+{
+	int n = _node.write_data(iov, nr_iov, _pos);
+	if (n > 0) _pos += n;
+
+	return n;
+}
+
+int TempFSFile::pwritev(const IOVector *iov, unsigned int nr_iov, off_t off)
+{
+	return _node.write_data(iov, nr_iov, off);
+}
+
+void TempFSFile::seek(off_t offset, SeekType type)
+{
+	if (type == File::SeekAbsolute) {
+		_pos = offset;
+	} else if (type == File::SeekRelative) {
+		_pos += offset;
+	}
+}
+
+bool TempFSDirectory::read_entry(DirectoryEntry& entry)
+{
+	TempFSNode *child = _node.next_child(_last);
+	if (!child) return false;
+
+	entry.name = child->name();
+	entry.size = child->size();
+
+	_last = child;
+	return true;
+}
+
+unsigned int TempFSDirectory::read_entries(DirectoryEntrySink& sink)
+{
+	unsigned int nr_entries = 0;
+
+	for (TempFSNode *child = _node.next_child(_last); child; child = _node.next_child(child)) {
+		if (!sink.add(child->name().c_str(), child->name().length(), child->size())) break;
+
+		_last = child;
+		nr_entries++;
+	}
+
+	return nr_entries;
 }
 
 static Filesystem *tmpfs_create(VirtualFilesystem& vfs, infos::drivers::Device *dev)
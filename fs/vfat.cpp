@@ -2,10 +2,10 @@
 
 /*
  * fs/vfat.cpp
- * 
+ *
  * InfOS
  * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
- * 
+ *
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/fs/vfat.h>
@@ -18,55 +18,1228 @@ using namespace infos::kernel;
 using namespace infos::util;
 using namespace infos::drivers::block;
 
-VFAT::VFAT(drivers::block::BlockDevice& bdev) : BlockBasedFilesystem(bdev)
+// The number of clusters below which a filesystem is FAT12, and then FAT16.
+#define FAT12_MAX_CLUSTERS	4085
+#define FAT16_MAX_CLUSTERS	65525
+
+#define DIRENT_FREE		0xe5
+#define DIRENT_END		0x00
+
+#define NT_LOWER_BASE	0x08
+#define NT_LOWER_EXT	0x10
+
+#define LFN_LAST		0x40
+#define LFN_ORDER_MASK	0x1f
+#define LFN_CHARS		13
+
+VFAT::VFAT(drivers::block::BlockDevice& bdev)
+	: BlockBasedFilesystem(bdev),
+	_fat(NULL),
+	_fat_dirty(NULL),
+	_next_free(2),
+	_root(NULL)
 {
 
 }
 
+VFAT::~VFAT()
+{
+	delete[] _fat;
+	delete[] _fat_dirty;
+}
+
 PFSNode *VFAT::mount()
 {
-	fs_log.messagef(LogLevel::DEBUG, "vfat: block-size=%u, count=%u", block_device().block_size(), block_device().block_size());
+	fs_log.messagef(LogLevel::DEBUG, "vfat: block-size=%u, count=%u", block_device().block_size(), block_device().block_count());
 
-	if (block_device().block_size() != sizeof(vfat_boot_block)) {
+	if (_root) return _root;
+
+	_block_size = block_device().block_size();
+	if (_block_size != sizeof(vfat_boot_block)) {
 		return NULL;
 	}
 
 	if (!block_device().read_blocks(&_boot_block, 0, 1)) {
 		return NULL;
 	}
-	
+
 	if (_boot_block.signature != 0xaa55) {
 		fs_log.messagef(LogLevel::ERROR, "vfat: invalid signature");
 		return NULL;
 	}
-	
-	return new VFATNode(*this);
+
+	if (_boot_block.bytes_per_block != _block_size || _boot_block.blocks_per_alloc_unit == 0 || _boot_block.nr_fats == 0) {
+		fs_log.messagef(LogLevel::ERROR, "vfat: unsupported geometry");
+		return NULL;
+	}
+
+	_cluster_blocks = _boot_block.blocks_per_alloc_unit;
+	_cluster_size = _cluster_blocks * _block_size;
+
+	_nr_fats = _boot_block.nr_fats;
+	_fat_start = _boot_block.reserved_blocks;
+	_fat_blocks = _boot_block.nr_blocks_in_fat ? _boot_block.nr_blocks_in_fat : _boot_block.fat32.nr_blocks_in_fat;
+
+	_root_start = _fat_start + (_nr_fats * _fat_blocks);
+	_root_blocks = ((_boot_block.nr_root_entries * sizeof(vfat_dir_entry)) + _block_size - 1) / _block_size;
+	_data_start = _root_start + _root_blocks;
+
+	size_t total_blocks = _boot_block.total_blocks ? _boot_block.total_blocks : _boot_block.total_blocks_big;
+	if (_fat_blocks == 0 || total_blocks <= _data_start || total_blocks > block_device().block_count()) {
+		fs_log.messagef(LogLevel::ERROR, "vfat: invalid layout");
+		return NULL;
+	}
+
+	_nr_clusters = (total_blocks - _data_start) / _cluster_blocks;
+
+	// The type of a FAT filesystem is decided only by the number of clusters it has.
+	if (_nr_clusters < FAT12_MAX_CLUSTERS) {
+		_fat_type = FAT12;
+		_root_cluster = 0;
+	} else if (_nr_clusters < FAT16_MAX_CLUSTERS) {
+		_fat_type = FAT16;
+		_root_cluster = 0;
+	} else {
+		_fat_type = FAT32;
+		_root_cluster = _boot_block.fat32.root_cluster;
+	}
+
+	size_t fat_size = _fat_blocks * _block_size;
+	size_t fat_needed;
+	switch (_fat_type) {
+	case FAT12: fat_needed = ((_nr_clusters + 2) * 3 + 1) / 2; break;
+	case FAT16: fat_needed = (_nr_clusters + 2) * 2; break;
+	default: fat_needed = (_nr_clusters + 2) * 4; break;
+	}
+
+	if (fat_needed > fat_size) {
+		fs_log.messagef(LogLevel::ERROR, "vfat: FAT too small for volume");
+		return NULL;
+	}
+
+	// The whole of the first FAT is kept in memory, and read in one go.
+	_fat = new uint8_t[fat_size];
+	_fat_dirty = new uint8_t[(_fat_blocks + 7) / 8];
+	if (!_fat || !_fat_dirty) {
+		return NULL;
+	}
+
+	bzero(_fat_dirty, (_fat_blocks + 7) / 8);
+
+	if (!block_device().read_blocks(_fat, _fat_start, _fat_blocks)) {
+		fs_log.messagef(LogLevel::ERROR, "vfat: unable to read FAT");
+		return NULL;
+	}
+
+	fs_log.messagef(LogLevel::INFO, "vfat: FAT%u, %u clusters of %u bytes",
+		_fat_type == FAT12 ? 12 : (_fat_type == FAT16 ? 16 : 32), _nr_clusters, _cluster_size);
+
+	_root = new VFATNode(*this, NULL, "", VFATNode::ATTR_DIRECTORY, _root_cluster, 0);
+	return _root;
 }
 
-VFATNode::VFATNode(VFAT& owner) : PFSNode(NULL, owner)
+bool VFAT::is_eoc(uint32_t entry) const
 {
+	switch (_fat_type) {
+	case FAT12: return entry >= 0xff8;
+	case FAT16: return entry >= 0xfff8;
+	default: return entry >= 0x0ffffff8;
+	}
+}
 
+uint32_t VFAT::eoc() const
+{
+	switch (_fat_type) {
+	case FAT12: return 0xfff;
+	case FAT16: return 0xffff;
+	default: return 0x0fffffff;
+	}
 }
 
-PFSNode* VFATNode::get_child(const util::String& name)
+/**
+ * Returns the FAT entry of a cluster -- the next cluster in its chain, zero if the cluster is
+ * free, or an end-of-chain marker.
+ */
+uint32_t VFAT::fat_entry(uint32_t cluster) const
 {
-	return NULL;
+	if (cluster >= _nr_clusters + 2) return eoc();
+
+	switch (_fat_type) {
+	case FAT12: {
+		size_t offset = cluster + (cluster / 2);
+		uint16_t value = _fat[offset] | (_fat[offset + 1] << 8);
+
+		return (cluster & 1) ? (value >> 4) : (value & 0xfff);
+	}
+
+	case FAT16:
+		return ((const uint16_t *)_fat)[cluster];
+
+	default:
+		return ((const uint32_t *)_fat)[cluster] & 0x0fffffff;
+	}
 }
 
-PFSNode* VFATNode::mkdir(const util::String& name)
+/**
+ * Changes the FAT entry of a cluster in memory, and marks the blocks of the FAT it is in as
+ * needing to be written out.
+ */
+void VFAT::set_fat_entry(uint32_t cluster, uint32_t value)
+{
+	size_t offset, size;
+
+	switch (_fat_type) {
+	case FAT12: {
+		offset = cluster + (cluster / 2);
+		size = 2;
+
+		if (cluster & 1) {
+			_fat[offset] = (_fat[offset] & 0x0f) | ((value << 4) & 0xf0);
+			_fat[offset + 1] = value >> 4;
+		} else {
+			_fat[offset] = value;
+			_fat[offset + 1] = (_fat[offset + 1] & 0xf0) | ((value >> 8) & 0x0f);
+		}
+		break;
+	}
+
+	case FAT16:
+		offset = cluster * 2;
+		size = 2;
+
+		((uint16_t *)_fat)[cluster] = value;
+		break;
+
+	default:
+		offset = cluster * 4;
+		size = 4;
+
+		// The top four bits of a FAT32 entry are reserved, and must be preserved.
+		uint32_t *entry = &((uint32_t *)_fat)[cluster];
+		*entry = (*entry & 0xf0000000) | (value & 0x0fffffff);
+		break;
+	}
+
+	for (size_t block = offset / _block_size; block <= (offset + size - 1) / _block_size; block++) {
+		_fat_dirty[block / 8] |= 1 << (block % 8);
+	}
+}
+
+/**
+ * Writes the blocks of the FAT that have changed to every copy of the FAT on the device.
+ */
+bool VFAT::sync_fat()
+{
+	size_t block = 0;
+
+	while (block < _fat_blocks) {
+		if (!(_fat_dirty[block / 8] & (1 << (block % 8)))) {
+			block++;
+			continue;
+		}
+
+		size_t run = 0;
+		while (block + run < _fat_blocks && (_fat_dirty[(block + run) / 8] & (1 << ((block + run) % 8)))) {
+			_fat_dirty[(block + run) / 8] &= ~(1 << ((block + run) % 8));
+			run++;
+		}
+
+		for (unsigned int i = 0; i < _nr_fats; i++) {
+			if (!block_device().write_blocks(_fat + (block * _block_size), _fat_start + (i * _fat_blocks) + block, run)) {
+				return false;
+			}
+		}
+
+		block += run;
+	}
+
+	return true;
+}
+
+/**
+ * Allocates a free cluster, and links it onto the end of a chain.
+ * @param prev The last cluster of the chain, or zero to start a new chain.
+ * @return Returns the cluster, or zero if the filesystem is full.
+ */
+uint32_t VFAT::allocate_cluster(uint32_t prev)
+{
+	for (uint32_t i = 0; i < _nr_clusters; i++) {
+		uint32_t cluster = 2 + ((_next_free - 2 + i) % _nr_clusters);
+		if (fat_entry(cluster) != 0) continue;
+
+		set_fat_entry(cluster, eoc());
+		if (prev) set_fat_entry(prev, cluster);
+
+		_next_free = cluster + 1;
+		if (_next_free >= _nr_clusters + 2) _next_free = 2;
+
+		return cluster;
+	}
+
+	return 0;
+}
+
+bool VFAT::zero_blocks(size_t block, size_t count)
+{
+	uint8_t *zero = new uint8_t[count * _block_size];
+	if (!zero) return false;
+
+	bzero(zero, count * _block_size);
+	bool ok = block_device().write_blocks(zero, block, count);
+
+	delete[] zero;
+	return ok;
+}
+
+VFATNode::VFATNode(VFAT& fs, VFATNode *parent, const util::String& name, uint8_t attr, uint32_t first_cluster, uint32_t size)
+	: PFSNode(parent, fs),
+	_fs(fs),
+	_name(name),
+	_attr(attr),
+	_first_cluster(first_cluster),
+	_size(size),
+	_dirent_block(0),
+	_dirent_index(0),
+	_mapped(false),
+	_extents(NULL),
+	_nr_extents(0),
+	_max_extents(0),
+	_nr_blocks(0),
+	_indexed(false),
+	_buckets(NULL),
+	_nr_buckets(0),
+	_nr_entries(0),
+	_entries_head(NULL),
+	_entries_tail(NULL)
+{
+
+}
+
+VFATNode::~VFATNode()
+{
+	while (_entries_head) {
+		IndexEntry *entry = _entries_head;
+		_entries_head = entry->list_next;
+
+		delete entry;
+	}
+
+	delete[] _buckets;
+	delete[] _extents;
+}
+
+/**
+ * Adds a run of blocks to the end of the node's extents, extending the last extent if the run
+ * follows on from it.
+ */
+bool VFATNode::add_extent(size_t file_block, size_t block, size_t count)
+{
+	if (_nr_extents > 0) {
+		VFATExtent& last = _extents[_nr_extents - 1];
+		if (last.block + last.count == block) {
+			last.count += count;
+			_nr_blocks += count;
+
+			return true;
+		}
+	}
+
+	if (_nr_extents == _max_extents) {
+		unsigned int max_extents = _max_extents ? _max_extents * 2 : 4;
+
+		VFATExtent *extents = new VFATExtent[max_extents];
+		if (!extents) return false;
+
+		for (unsigned int i = 0; i < _nr_extents; i++) {
+			extents[i] = _extents[i];
+		}
+
+		delete[] _extents;
+
+		_extents = extents;
+		_max_extents = max_extents;
+	}
+
+	_extents[_nr_extents].file_block = file_block;
+	_extents[_nr_extents].block = block;
+	_extents[_nr_extents].count = count;
+	_nr_extents++;
+
+	_nr_blocks += count;
+	return true;
+}
+
+/**
+ * Walks the node's cluster chain (once), turning it into extents.  The filesystem lock must be
+ * held.
+ */
+bool VFATNode::map()
 {
+	if (_mapped) return true;
+
+	if (is_fixed_root()) {
+		if (!add_extent(0, _fs._root_start, _fs._root_blocks)) return false;
+	} else {
+		uint32_t cluster = _first_cluster;
+		uint32_t nr_clusters = 0;
+
+		while (cluster >= 2 && cluster < _fs._nr_clusters + 2) {
+			// A chain longer than the filesystem has a loop in it.
+			if (nr_clusters++ > _fs._nr_clusters) {
+				fs_log.messagef(LogLevel::ERROR, "vfat: cluster chain of '%s' is corrupt", _name.c_str());
+				return false;
+			}
+
+			if (!add_extent(_nr_blocks, _fs.cluster_to_block(cluster), _fs._cluster_blocks)) return false;
+
+			uint32_t next = _fs.fat_entry(cluster);
+			if (_fs.is_eoc(next)) break;
+
+			cluster = next;
+		}
+	}
+
+	_mapped = true;
+	return true;
+}
+
+/**
+ * Finds the block on the device that holds a block of the node.
+ * @param run Receives the number of blocks that follow on contiguously from it (including it),
+ * or zero if the node has no such block.
+ */
+size_t VFATNode::block_of(size_t file_block, size_t& run) const
+{
+	unsigned int lo = 0, hi = _nr_extents;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		const VFATExtent& extent = _extents[mid];
+
+		if (file_block < extent.file_block) {
+			hi = mid;
+		} else if (file_block >= extent.file_block + extent.count) {
+			lo = mid + 1;
+		} else {
+			run = extent.count - (file_block - extent.file_block);
+			return extent.block + (file_block - extent.file_block);
+		}
+	}
+
+	run = 0;
+	return 0;
+}
+
+/**
+ * Allocates clusters onto the end of the node, until it has at least the given number of
+ * blocks.  The filesystem lock must be held, and the node must have been mapped.
+ */
+bool VFATNode::extend(size_t nr_blocks)
+{
+	if (_nr_blocks >= nr_blocks) return true;
+	if (is_fixed_root()) return false;
+
+	uint32_t last = 0;
+	if (_nr_extents > 0) {
+		const VFATExtent& extent = _extents[_nr_extents - 1];
+		last = ((extent.block + extent.count - 1 - _fs._data_start) / _fs._cluster_blocks) + 2;
+	}
+
+	bool ok = true;
+	while (_nr_blocks < nr_blocks) {
+		uint32_t cluster = _fs.allocate_cluster(last);
+		if (!cluster) {
+			ok = false;
+			break;
+		}
+
+		if (!last) _first_cluster = cluster;
+
+		if (!add_extent(_nr_blocks, _fs.cluster_to_block(cluster), _fs._cluster_blocks)) {
+			ok = false;
+			break;
+		}
+
+		last = cluster;
+	}
+
+	return _fs.sync_fat() && ok;
+}
+
+/**
+ * Transfers data to or from the node.  Whole blocks are transferred straight to or from the
+ * buffer, a contiguous run at a time, and partial blocks through a bounce buffer.  The
+ * filesystem lock must be held, and the node must have been mapped.
+ * @param buffer The data, or NULL to write zeroes.
+ */
+bool VFATNode::transfer(bool write, void *buffer, size_t offset, size_t size)
+{
+	BlockDevice& bdev = _fs.block_device();
+	size_t block_size = _fs._block_size;
+
+	uint8_t *data = (uint8_t *)buffer;
+	uint8_t *bounce = NULL;
+	bool ok = true;
+
+	while (ok && size > 0) {
+		size_t block_offset = offset % block_size;
+
+		size_t run;
+		size_t block = block_of(offset / block_size, run);
+		if (run == 0) {
+			ok = false;
+			break;
+		}
+
+		size_t chunk;
+		if (data && block_offset == 0 && size >= block_size) {
+			size_t n = __min(run, size / block_size);
+			chunk = n * block_size;
+
+			ok = write ? bdev.write_blocks(data, block, n) : bdev.read_blocks(data, block, n);
+		} else {
+			chunk = __min(block_size - block_offset, size);
+
+			if (!bounce) {
+				bounce = new uint8_t[block_size];
+				if (!bounce) {
+					ok = false;
+					break;
+				}
+			}
+
+			// A whole block being written need not be read first.
+			if (!write || chunk < block_size) {
+				ok = bdev.read_blocks(bounce, block, 1);
+				if (!ok) break;
+			}
+
+			if (write) {
+				if (data) memcpy(bounce + block_offset, data, chunk);
+				else bzero(bounce + block_offset, chunk);
+
+				ok = bdev.write_blocks(bounce, block, 1);
+			} else {
+				memcpy(data, bounce + block_offset, chunk);
+			}
+		}
+
+		if (data) data += chunk;
+		offset += chunk;
+		size -= chunk;
+	}
+
+	delete[] bounce;
+	return ok;
+}
+
+/**
+ * Reads ahead of a sequential reader.  The readahead window is in blocks of the file, which are
+ * prefetched a contiguous run at a time.
+ */
+void VFATNode::readahead(Readahead& ra, size_t offset, size_t size)
+{
+	size_t block_size = _fs._block_size;
+
+	size_t index = offset / block_size;
+	size_t count = ((offset % block_size) + size + block_size - 1) / block_size;
+	size_t nr_blocks = (_size + block_size - 1) / block_size;
+
+	size_t ra_index, ra_count;
+	if (!ra.access(index, count, nr_blocks, ra_index, ra_count)) return;
+
+	while (ra_count > 0) {
+		size_t run;
+		size_t block = block_of(ra_index, run);
+		if (run == 0) break;
+
+		run = __min(run, ra_count);
+		_fs.block_device().prefetch_blocks(block, run);
+
+		ra_index += run;
+		ra_count -= run;
+	}
+}
+
+/**
+ * Writes the size and first cluster of the node back to its directory entry.
+ */
+bool VFATNode::update_dirent()
+{
+	if (!parent()) return true;
+
+	BlockDevice& bdev = _fs.block_device();
+
+	uint8_t *block = new uint8_t[_fs._block_size];
+	if (!block) return false;
+
+	bool ok = bdev.read_blocks(block, _dirent_block, 1);
+	if (ok) {
+		vfat_dir_entry *de = &((vfat_dir_entry *)block)[_dirent_index];
+
+		de->size = is_directory() ? 0 : _size;
+		de->first_cluster_lo = _first_cluster & 0xffff;
+		de->first_cluster_hi = _first_cluster >> 16;
+
+		ok = bdev.write_blocks(block, _dirent_block, 1);
+	}
+
+	delete[] block;
+	return ok;
+}
+
+static inline char to_lower(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline char to_upper(char c)
+{
+	return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+/**
+ * Hashes a name without regard to case, as names in a FAT directory are not case sensitive.
+ */
+String::hash_type VFATNode::hash_name(const char *name, size_t length)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < length; i++) {
+		hash ^= to_lower(name[i]);
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static bool names_equal(const String& a, const String& b)
+{
+	if (a.length() != b.length()) return false;
+
+	for (size_t i = 0; i < a.length(); i++) {
+		if (to_lower(a[i]) != to_lower(b[i])) return false;
+	}
+
+	return true;
+}
+
+static uint8_t short_name_checksum(const char *name)
+{
+	uint8_t sum = 0;
+
+	for (int i = 0; i < 11; i++) {
+		sum = ((sum & 1) << 7) + (sum >> 1) + (uint8_t)name[i];
+	}
+
+	return sum;
+}
+
+/**
+ * Returns one of the (UCS-2) characters in a long name entry, which are split across three
+ * fields.
+ */
+static uint16_t lfn_char(const vfat_lfn_entry& le, unsigned int index)
+{
+	const uint8_t *raw = (const uint8_t *)&le;
+	unsigned int offset;
+
+	if (index < 5) offset = offsetof(vfat_lfn_entry, name1) + (index * 2);
+	else if (index < 11) offset = offsetof(vfat_lfn_entry, name2) + ((index - 5) * 2);
+	else offset = offsetof(vfat_lfn_entry, name3) + ((index - 11) * 2);
+
+	return raw[offset] | (raw[offset + 1] << 8);
+}
+
+/**
+ * Turns the 8.3 name of a directory entry into a string, in lower case where the entry says so.
+ */
+static String short_name_to_string(const vfat_dir_entry& de)
+{
+	char name[12];
+	size_t length = 0;
+
+	int base_length = 8;
+	while (base_length > 0 && de.name[base_length - 1] == ' ') base_length--;
+
+	for (int i = 0; i < base_length; i++) {
+		char c = (i == 0 && (uint8_t)de.name[0] == 0x05) ? (char)DIRENT_FREE : de.name[i];
+		name[length++] = (de.nt_flags & NT_LOWER_BASE) ? to_lower(c) : c;
+	}
+
+	int ext_length = 3;
+	while (ext_length > 0 && de.name[8 + ext_length - 1] == ' ') ext_length--;
+
+	if (ext_length > 0) {
+		name[length++] = '.';
+
+		for (int i = 0; i < ext_length; i++) {
+			name[length++] = (de.nt_flags & NT_LOWER_EXT) ? to_lower(de.name[8 + i]) : de.name[8 + i];
+		}
+	}
+
+	return String(name, length);
+}
+
+static bool valid_short_char(char c)
+{
+	if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) return true;
+
+	switch (c) {
+	case '!': case '#': case '$': case '%': case '&': case '\'': case '(': case ')':
+	case '-': case '@': case '^': case '_': case '`': case '{': case '}': case '~':
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/**
+ * Turns a name into an 8.3 name, if it can be represented as one -- i.e. without a long name.
+ * A base or extension that is entirely in lower case is recorded as such in the NT flags.
+ */
+static bool string_to_short_name(const String& name, char *short_name, uint8_t& nt_flags)
+{
+	const char *str = name.c_str();
+	size_t length = name.length();
+
+	size_t dot = length;
+	for (size_t i = 0; i < length; i++) {
+		if (str[i] != '.') continue;
+		if (dot != length) return false;
+
+		dot = i;
+	}
+
+	size_t base_length = dot, ext_length = dot < length ? length - dot - 1 : 0;
+	if (base_length == 0 || base_length > 8 || ext_length > 3) return false;
+	if (dot < length && ext_length == 0) return false;
+
+	nt_flags = 0;
+
+	for (int part = 0; part < 2; part++) {
+		const char *chars = part ? str + dot + 1 : str;
+		size_t nr_chars = part ? ext_length : base_length;
+
+		bool lower = false, upper = false;
+		for (size_t i = 0; i < nr_chars; i++) {
+			if (!valid_short_char(chars[i])) return false;
+
+			lower |= chars[i] >= 'a' && chars[i] <= 'z';
+			upper |= chars[i] >= 'A' && chars[i] <= 'Z';
+		}
+
+		// Mixed case needs a long name to preserve it.
+		if (lower && upper) return false;
+		if (lower) nt_flags |= part ? NT_LOWER_EXT : NT_LOWER_BASE;
+	}
+
+	for (int i = 0; i < 11; i++) {
+		short_name[i] = ' ';
+	}
+
+	for (size_t i = 0; i < base_length; i++) {
+		short_name[i] = to_upper(str[i]);
+	}
+
+	for (size_t i = 0; i < ext_length; i++) {
+		short_name[8 + i] = to_upper(str[dot + 1 + i]);
+	}
+
+	return true;
+}
+
+VFATNode::IndexEntry *VFATNode::index_add(const String& name, const vfat_dir_entry& de, size_t block, unsigned int index)
+{
+	// The table is doubled in size whenever it gets too full.
+	if (_nr_entries >= _nr_buckets * 2) {
+		unsigned int nr_buckets = _nr_buckets ? _nr_buckets * 2 : 16;
+
+		IndexEntry **buckets = new IndexEntry *[nr_buckets];
+		if (!buckets) return NULL;
+
+		for (unsigned int i = 0; i < nr_buckets; i++) {
+			buckets[i] = NULL;
+		}
+
+		for (IndexEntry *entry = _entries_head; entry; entry = entry->list_next) {
+			IndexEntry *& bucket = buckets[entry->hash & (nr_buckets - 1)];
+
+			entry->hash_next = bucket;
+			bucket = entry;
+		}
+
+		delete[] _buckets;
+
+		_buckets = buckets;
+		_nr_buckets = nr_buckets;
+	}
+
+	IndexEntry *entry = new IndexEntry();
+	if (!entry) return NULL;
+
+	entry->name = name;
+	entry->hash = hash_name(name.c_str(), name.length());
+	entry->attr = de.attr;
+	entry->first_cluster = de.first_cluster_lo | ((uint32_t)de.first_cluster_hi << 16);
+	entry->size = de.size;
+	entry->dirent_block = block;
+	entry->dirent_index = index;
+	entry->node = NULL;
+
+	IndexEntry *& bucket = _buckets[entry->hash & (_nr_buckets - 1)];
+	entry->hash_next = bucket;
+	bucket = entry;
+
+	entry->list_next = NULL;
+	if (_entries_tail) _entries_tail->list_next = entry;
+	else _entries_head = entry;
+	_entries_tail = entry;
+
+	_nr_entries++;
+	return entry;
+}
+
+VFATNode::IndexEntry *VFATNode::index_find(const String& name) const
+{
+	if (!_nr_buckets) return NULL;
+
+	String::hash_type hash = hash_name(name.c_str(), name.length());
+
+	for (IndexEntry *entry = _buckets[hash & (_nr_buckets - 1)]; entry; entry = entry->hash_next) {
+		if (entry->hash == hash && names_equal(entry->name, name)) return entry;
+	}
+
 	return NULL;
 }
 
+/**
+ * Reads through a directory (once), adding each of its entries to the index under its long name
+ * if it has a valid one, or its short name otherwise.  The filesystem lock must be held.
+ */
+bool VFATNode::build_index()
+{
+	if (_indexed) return true;
+	if (!map()) return false;
+
+	size_t block_size = _fs._block_size;
+	size_t chunk_blocks = _fs._cluster_blocks;
+
+	uint8_t *buffer = new uint8_t[chunk_blocks * block_size];
+	if (!buffer) return false;
+
+	char lfn[LFN_CHARS * 20];
+	bool lfn_valid = false;
+	unsigned int lfn_next = 0;
+	uint8_t lfn_checksum = 0;
+
+	bool ok = true, end = false;
+
+	for (size_t file_block = 0; ok && !end && file_block < _nr_blocks; ) {
+		size_t run;
+		size_t block = block_of(file_block, run);
+
+		run = __min(run, chunk_blocks);
+		if (!_fs.block_device().read_blocks(buffer, block, run)) {
+			ok = false;
+			break;
+		}
+
+		unsigned int entries_per_block = block_size / sizeof(vfat_dir_entry);
+		for (unsigned int i = 0; !end && i < run * entries_per_block; i++) {
+			const vfat_dir_entry& de = ((const vfat_dir_entry *)buffer)[i];
+
+			if ((uint8_t)de.name[0] == DIRENT_END) {
+				end = true;
+				break;
+			}
+
+			if ((uint8_t)de.name[0] == DIRENT_FREE) {
+				lfn_valid = false;
+				continue;
+			}
+
+			if (de.attr == ATTR_LFN) {
+				const vfat_lfn_entry& le = (const vfat_lfn_entry&)de;
+				unsigned int order = le.order & LFN_ORDER_MASK;
+
+				// The parts of a long name are stored last first, each numbered.
+				if (le.order & LFN_LAST) {
+					lfn_valid = order > 0 && order <= 20;
+					lfn_checksum = le.checksum;
+					lfn_next = order;
+
+					for (unsigned int c = 0; c < sizeof(lfn); c++) lfn[c] = 0;
+				}
+
+				if (!lfn_valid || order != lfn_next || le.checksum != lfn_checksum) {
+					lfn_valid = false;
+					continue;
+				}
+
+				for (unsigned int j = 0; j < LFN_CHARS; j++) {
+					uint16_t ch = lfn_char(le, j);
+					char& c = lfn[((order - 1) * LFN_CHARS) + j];
+
+					if (ch == 0 || ch == 0xffff) c = 0;
+					else c = ch < 0x80 ? (char)ch : '?';
+				}
+
+				lfn_next--;
+				continue;
+			}
+
+			bool has_lfn = lfn_valid && lfn_next == 0 && short_name_checksum(de.name) == lfn_checksum;
+			lfn_valid = false;
+
+			// Volume labels, and the entries for the directory itself and its parent, are not
+			// children.
+			if (de.attr & ATTR_VOLUME_ID) continue;
+			if (de.name[0] == '.') continue;
+
+			size_t entry_block = block + (i / entries_per_block);
+			unsigned int entry_index = i % entries_per_block;
+
+			if (has_lfn) {
+				size_t length = 0;
+				while (length < sizeof(lfn) && lfn[length]) length++;
+
+				index_add(String(lfn, length), de, entry_block, entry_index);
+			} else {
+				index_add(short_name_to_string(de), de, entry_block, entry_index);
+			}
+		}
+
+		file_block += run;
+	}
+
+	delete[] buffer;
+
+	_indexed = ok;
+	return ok;
+}
+
+VFATNode *VFATNode::node_for(IndexEntry *entry)
+{
+	if (!entry->node) {
+		entry->node = new VFATNode(_fs, this, entry->name, entry->attr, entry->first_cluster, entry->size);
+		if (entry->node) {
+			entry->node->_dirent_block = entry->dirent_block;
+			entry->node->_dirent_index = entry->dirent_index;
+		}
+	}
+
+	return entry->node;
+}
+
+PFSNode* VFATNode::get_child(const util::String& name)
+{
+	UniqueLock<Mutex> l(_fs._mtx);
+
+	if (!is_directory()) return NULL;
+	if (!build_index()) return NULL;
+
+	IndexEntry *entry = index_find(name);
+	if (!entry) return NULL;
+
+	return node_for(entry);
+}
+
+/**
+ * Finds an unused directory entry, adding a cluster to the directory if it is full.  The
+ * filesystem lock must be held, and the directory must have been indexed.
+ */
+bool VFATNode::find_free_dirent(size_t& block, unsigned int& index)
+{
+	BlockDevice& bdev = _fs.block_device();
+	size_t block_size = _fs._block_size;
+	unsigned int entries_per_block = block_size / sizeof(vfat_dir_entry);
+
+	uint8_t *buffer = new uint8_t[block_size];
+	if (!buffer) return false;
+
+	bool found = false;
+	for (size_t file_block = 0; !found && file_block < _nr_blocks; file_block++) {
+		size_t run;
+		block = block_of(file_block, run);
+
+		if (!bdev.read_blocks(buffer, block, 1)) break;
+
+		for (index = 0; index < entries_per_block; index++) {
+			uint8_t first = ((const vfat_dir_entry *)buffer)[index].name[0];
+			if (first == DIRENT_END || first == DIRENT_FREE) {
+				found = true;
+				break;
+			}
+		}
+	}
+
+	delete[] buffer;
+	if (found) return true;
+
+	// The directory is full, so it is given another (empty) cluster.
+	size_t first_new = _nr_blocks;
+	if (!extend(_nr_blocks + _fs._cluster_blocks)) return false;
+
+	size_t run;
+	block = block_of(first_new, run);
+	index = 0;
+
+	return _fs.zero_blocks(block, _fs._cluster_blocks);
+}
+
+/**
+ * Creates a directory.  Only names that fit in an 8.3 directory entry can be created, as long
+ * names are not written.
+ */
+PFSNode* VFATNode::mkdir(const util::String& name)
+{
+	UniqueLock<Mutex> l(_fs._mtx);
+
+	if (!is_directory()) return NULL;
+	if (!build_index()) return NULL;
+	if (index_find(name)) return NULL;
+
+	vfat_dir_entry de;
+	bzero(&de, sizeof(de));
+
+	if (!string_to_short_name(name, de.name, de.nt_flags)) return NULL;
+
+	size_t dirent_block;
+	unsigned int dirent_index;
+	if (!find_free_dirent(dirent_block, dirent_index)) return NULL;
+
+	uint32_t cluster = _fs.allocate_cluster(0);
+	if (!cluster) return NULL;
+
+	if (!_fs.sync_fat()) return NULL;
+
+	BlockDevice& bdev = _fs.block_device();
+	size_t block_size = _fs._block_size;
+
+	uint8_t *buffer = new uint8_t[block_size];
+	if (!buffer) return NULL;
+
+	// The new directory starts with its '.' and '..' entries, and is otherwise empty.
+	bool ok = _fs.zero_blocks(_fs.cluster_to_block(cluster), _fs._cluster_blocks);
+	if (ok) {
+		bzero(buffer, block_size);
+
+		vfat_dir_entry *dot = (vfat_dir_entry *)buffer;
+		for (int i = 0; i < 11; i++) {
+			dot[0].name[i] = dot[1].name[i] = ' ';
+		}
+
+		dot[0].name[0] = '.';
+		dot[0].attr = ATTR_DIRECTORY;
+		dot[0].first_cluster_lo = cluster & 0xffff;
+		dot[0].first_cluster_hi = cluster >> 16;
+
+		// The root directory is always referred to as cluster zero.
+		uint32_t parent_cluster = parent() ? _first_cluster : 0;
+
+		dot[1].name[0] = dot[1].name[1] = '.';
+		dot[1].attr = ATTR_DIRECTORY;
+		dot[1].first_cluster_lo = parent_cluster & 0xffff;
+		dot[1].first_cluster_hi = parent_cluster >> 16;
+
+		ok = bdev.write_blocks(buffer, _fs.cluster_to_block(cluster), 1);
+	}
+
+	if (ok) {
+		de.attr = ATTR_DIRECTORY;
+		de.first_cluster_lo = cluster & 0xffff;
+		de.first_cluster_hi = cluster >> 16;
+
+		ok = bdev.read_blocks(buffer, dirent_block, 1);
+		if (ok) {
+			((vfat_dir_entry *)buffer)[dirent_index] = de;
+			ok = bdev.write_blocks(buffer, dirent_block, 1);
+		}
+	}
+
+	delete[] buffer;
+
+	if (!ok) {
+		_fs.set_fat_entry(cluster, 0);
+		_fs.sync_fat();
+
+		return NULL;
+	}
+
+	IndexEntry *entry = index_add(name, de, dirent_block, dirent_index);
+	if (!entry) return NULL;
+
+	return node_for(entry);
+}
 
 File* VFATNode::open()
 {
-	return NULL;
+	if (is_directory()) return NULL;
+	return new VFATFile(*this);
 }
 
 Directory* VFATNode::opendir()
 {
-	return NULL;
+	if (!is_directory()) return NULL;
+	return new VFATDirectory(*this);
+}
+
+int VFATFile::read(void* buffer, size_t size)
+{
+	IOVector iov = { buffer, size };
+	return readv(&iov, 1);
+}
+
+int VFATFile::pread(void* buffer, size_t size, off_t off)
+{
+	IOVector iov = { buffer, size };
+	return preadv(&iov, 1, off);
+}
+
+int VFATFile::write(const void* buffer, size_t size)
+{
+	IOVector iov = { (void *)buffer, size };
+	return writev(&iov, 1);
+}
+
+int VFATFile::pwrite(const void* buffer, size_t size, off_t off)
+{
+	IOVector iov = { (void *)buffer, size };
+	return pwritev(&iov, 1, off);
+}
+
+int VFATFile::readv(const IOVector *iov, unsigned int nr_iov)
+{
+	int n = preadv(iov, nr_iov, _pos);
+	if (n > 0) _pos += n;
+
+	return n;
+}
+
+/**
+ * Reads from the file into each of the buffers in turn.  Readahead is worked out for the whole
+ * range at once.
+ */
+int VFATFile::preadv(const IOVector *iov, unsigned int nr_iov, off_t off)
+{
+	UniqueLock<Mutex> l(_node._fs._mtx);
+
+	if (off < 0 || (size_t)off >= _node._size) return 0;
+	if (!_node.map()) return -1;
+
+	size_t size = 0;
+	for (unsigned int i = 0; i < nr_iov; i++) {
+		size += iov[i].length;
+	}
+
+	size = __min(size, (size_t)(_node._size - off));
+	_node.readahead(_ra, off, size);
+
+	size_t done = 0;
+	for (unsigned int i = 0; i < nr_iov && done < size; i++) {
+		size_t chunk = __min(iov[i].length, size - done);
+		if (chunk == 0) continue;
+
+		if (!_node.transfer(false, iov[i].base, off + done, chunk)) {
+			return done > 0 ? (int)done : -1;
+		}
+
+		done += chunk;
+	}
+
+	return done;
+}
+
+int VFATFile::writev(const IOVector *iov, unsigned int nr_iov)
+{
+	int n = pwritev(iov, nr_iov, _pos);
+	if (n > 0) _pos += n;
+
+	return n;
+}
+
+/**
+ * Writes each of the buffers to the file in turn, allocating clusters for the whole write up
+ * front.  Anything between the old end of the file and the start of the write is filled with
+ * zeroes, and the directory entry is updated once at the end.
+ */
+int VFATFile::pwritev(const IOVector *iov, unsigned int nr_iov, off_t off)
+{
+	UniqueLock<Mutex> l(_node._fs._mtx);
+
+	if (off < 0) return -1;
+	if (_node._attr & VFATNode::ATTR_READ_ONLY) return -1;
+
+	size_t size = 0;
+	for (unsigned int i = 0; i < nr_iov; i++) {
+		size += iov[i].length;
+	}
+
+	if (size == 0) return 0;
+
+	// The size of a file must fit in its directory entry.
+	size_t end = off + size;
+	if (end > 0xffffffffULL) return -1;
+
+	if (!_node.map()) return -1;
+
+	uint32_t old_first_cluster = _node._first_cluster;
+	size_t block_size = _node._fs._block_size;
+
+	if (!_node.extend((end + block_size - 1) / block_size)) {
+		// Any clusters that were allocated must still be recorded against the file.
+		if (_node._first_cluster != old_first_cluster) _node.update_dirent();
+		return -1;
+	}
+
+	if ((size_t)off > _node._size) {
+		if (!_node.transfer(true, NULL, _node._size, off - _node._size)) return -1;
+	}
+
+	size_t done = 0;
+	for (unsigned int i = 0; i < nr_iov; i++) {
+		if (iov[i].length == 0) continue;
+		if (!_node.transfer(true, iov[i].base, off + done, iov[i].length)) break;
+
+		done += iov[i].length;
+	}
+
+	if (done > 0) _node.changed();
+
+	end = off + done;
+	if (end > _node._size || _node._first_cluster != old_first_cluster) {
+		_node._size = __max((size_t)_node._size, end);
+		if (!_node.update_dirent()) return -1;
+	}
+
+	if (done == 0) return -1;
+	return done;
+}
+
+void VFATFile::seek(off_t offset, SeekType type)
+{
+	if (type == File::SeekAbsolute) {
+		_pos = offset;
+	} else if (type == File::SeekRelative) {
+		_pos += offset;
+	}
+}
+
+VFATDirectory::VFATDirectory(VFATNode& node)
+{
+	UniqueLock<Mutex> l(node._fs._mtx);
+
+	if (!node.build_index()) return;
+
+	for (VFATNode::IndexEntry *entry = node._entries_head; entry; entry = entry->list_next) {
+		DirectoryEntry de;
+		de.name = entry->name;
+		de.size = entry->node ? entry->node->_size : entry->size;
+
+		add_entry(de);
+	}
 }
 
 static Filesystem *vfat_create(VirtualFilesystem& vfs, infos::drivers::Device *dev)
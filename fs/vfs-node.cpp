@@ -13,6 +13,7 @@
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/log.h>
 #include <infos/fs/vfs.h>
+#include <infos/fs/dentry-cache.h>
 #include <infos/fs/filesystem.h>
 
 using namespace infos::fs;
@@ -39,29 +40,49 @@ Filesystem *VFSNode::mount(const util::String& fstype, drivers::Device* dev)
 	}
 	
 	_pn = pn;
-	_children.clear();
+
+	// Whatever was known about the names in this node belonged to the filesystem that has just
+	// been covered up.
+	sys.vfs().dcache().invalidate_children(this);
 	
 	//vfs_log.messagef(LogLevel::DEBUG, "vfsnode: mount vfs=%p pfs=%p", this, pn);
 	return fs;
 }
 
 VFSNode* VFSNode::get_child(const util::String& name)
+{
+	return lookup_child(name.c_str(), name.length(), name.get_hash());
+}
+
+/**
+ * Looks up a child by name, through the dentry cache.  The name need not be terminated, so that
+ * a component of a longer path can be looked up where it is.
+ */
+VFSNode* VFSNode::lookup_child(const char *name, size_t length, util::String::hash_type hash)
 {
 	if (!_pn) return NULL;
-	
+
+	DentryCache& dcache = sys.vfs().dcache();
+
 	VFSNode *child;
-	if (!_children.try_get_value(name.get_hash(), child)) {
-		PFSNode *assoc = _pn->get_child(name);
-		if (!assoc) {
-			return NULL;
-		}
-		
-		child = new VFSNode(this, assoc);
-		_children.add(name.get_hash(), child);
+	if (dcache.lookup(this, name, length, hash, child)) {
+		return child;
 	}
-	
-	//vfs_log.messagef(LogLevel::DEBUG, "vfsnode: get child %s vfs=%p pfs=%p child-vfs=%p", name.c_str(), this, _pn, child);
-	return child;
+
+	uint64_t generation = dcache.generation();
+
+	util::String sname(name, length);
+	PFSNode *assoc = _pn->get_child(sname);
+
+	child = assoc ? new VFSNode(this, assoc) : NULL;
+
+	VFSNode *cached = dcache.insert(this, sname, child, generation);
+	if (cached != child) {
+		delete child;
+	}
+
+	//vfs_log.messagef(LogLevel::DEBUG, "vfsnode: get child %s vfs=%p pfs=%p child-vfs=%p", sname.c_str(), this, _pn, cached);
+	return cached;
 }
 
 VFSNode* VFSNode::mkdir(const util::String& name)
@@ -70,6 +91,21 @@ VFSNode* VFSNode::mkdir(const util::String& name)
 	
 	PFSNode *dir = _pn->mkdir(name);
 	if (!dir) return NULL;
-	
+
+	// There may be a record of the name not existing.
+	sys.vfs().dcache().invalidate(this, name);
+
+	return get_child(name);
+}
+
+VFSNode* VFSNode::create(const util::String& name)
+{
+	if (!_pn) return NULL;
+
+	PFSNode *file = _pn->create(name);
+	if (!file) return NULL;
+
+	sys.vfs().dcache().invalidate(this, name);
+
 	return get_child(name);
 }
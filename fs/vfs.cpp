@@ -64,6 +64,9 @@ bool VirtualFilesystem::init()
 File* VirtualFilesystem::open(const String& path, int flags)
 {
 	VFSNode *node = lookup_node(path);
+	if (!node && (flags & OpenFlags::CREATE)) {
+		node = create_node(path);
+	}
 
 	if (!node) return NULL;
 	if (!node->pn()) return NULL;	
@@ -71,6 +74,26 @@ File* VirtualFilesystem::open(const String& path, int flags)
 	return node->pn()->open();
 }
 
+/**
+ * Creates a regular file at the given path, in a directory that must already exist.
+ */
+VFSNode *VirtualFilesystem::create_node(const String& path)
+{
+	const char *p = path.c_str();
+	int slash = -1;
+
+	for (int i = 0; p[i]; i++) {
+		if (p[i] == '/') slash = i;
+	}
+
+	if (slash < 0 || p[slash + 1] == 0) return NULL;
+
+	VFSNode *parent = slash == 0 ? lookup_node("/") : lookup_node(String(p, slash));
+	if (!parent) return NULL;
+
+	return parent->create(String(&p[slash + 1]));
+}
+
 Directory* VirtualFilesystem::opendir(const String& path, int flags)
 {
 	VFSNode *node = lookup_node(path);
@@ -103,6 +126,11 @@ Filesystem* VirtualFilesystem::instantiate_fs(const char* fstype, Device *dev)
 	return fsreg->creation_fn(*this, dev);
 }
 
+/**
+ * Finds the node at an absolute path.  A path that has been looked up before is found in the
+ * dentry cache in one go; otherwise, the path is walked one component at a time (through the
+ * cache), and the result recorded against the whole path.
+ */
 VFSNode* VirtualFilesystem::lookup_node(const String& spath)
 {
 	const char *path = spath.c_str();
@@ -117,29 +145,30 @@ VFSNode* VirtualFilesystem::lookup_node(const String& spath)
 	// Specialise for the root.
 	if (path[1] == 0) return _root_node;
 	
+	VFSNode *current_node;
+	if (_dcache.lookup_path(spath, current_node)) {
+		return current_node;
+	}
+
+	uint64_t generation = _dcache.generation();
+
 	// Start at the root.
-	VFSNode *current_node = _root_node;
-		
-	// Prepare to read path components
-	path++;
+	current_node = _root_node;
 	
-	char component[256];
-	do {
-		int i = 0;
-		while (*path && *path != '/') {
-			component[i++] = *path++;
-		}
-		component[i] = 0;
-		if (*path == '/') path++;
+	const char *component = path + 1;
+	while (current_node) {
+		const char *end = component;
+		while (*end && *end != '/') end++;
 		
-		if (strlen(component) == 0) {
-			return current_node;
-		}
+		// An empty component ends the path.
+		if (end == component) break;
 
-		//fs_log.messagef(LogLevel::DEBUG, "component=%s", component);
-		current_node = current_node->get_child(component);
-		//fs_log.messagef(LogLevel::DEBUG, "node=%p remain=%s", current_node, path);
-	} while (current_node);
+		current_node = current_node->lookup_child(component, end - component, String::hash(component, end - component));
+		
+		if (*end == 0) break;
+		component = end + 1;
+	}
 	
+	_dcache.insert_path(spath, current_node, generation);
 	return current_node;
 }
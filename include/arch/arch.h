@@ -25,6 +25,7 @@ namespace infos
 			virtual bool interrupts_enabled() = 0;
 			
 			virtual kernel::CPU& get_current_cpu() = 0;
+			virtual void send_reschedule(unsigned int cpu) = 0;
 			
 			virtual void dump_current_context() const = 0;
 			virtual void dump_thread_context(const kernel::ThreadContext& context) const = 0;
@@ -34,6 +35,7 @@ namespace infos
 			
 			virtual kernel::Thread& get_current_thread() const = 0;
 			virtual void set_current_thread(kernel::Thread& thread) = 0;
+			virtual void clear_after_switch(volatile bool& flag) = 0;
 			
 			virtual kernel::IRQ *request_irq() = 0;
 		};
@@ -2,26 +2,82 @@
 
 /*
  * include/arch/x86/cpu.h
- * 
+ *
  * InfOS
  * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
- * 
+ *
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #pragma once
 
 #include <infos/kernel/cpu.h>
+#include <arch/x86/dt.h>
 
 namespace infos
 {
+	namespace kernel
+	{
+		class Thread;
+	}
+
 	namespace arch
 	{
 		namespace x86
 		{
+			class X86CPU;
+
+			/**
+			 * The per-CPU data block.  The GS segment base of each CPU points at its own block,
+			 * so that fields can be read in a single (and therefore preemption-safe) instruction.
+			 * The assembly code in trap.S and syscall-trap.S depends on this layout.
+			 */
+			struct X86PerCPU
+			{
+				X86PerCPU *self;							// %gs:0
+				kernel::Thread *current_thread;				// %gs:8
+				volatile bool *switch_release;				// %gs:16
+				X86CPU *cpu;								// %gs:24
+				uintptr_t kernel_stack;						// %gs:32
+				uintptr_t user_stack;						// %gs:40
+			};
+
 			class X86CPU : public infos::kernel::CPU
 			{
 			public:
-				X86CPU();
+				X86CPU(unsigned int index, uint32_t lapic_id, GDT& gdt, TSS& tss);
+
+				static X86CPU& current() {
+					X86CPU *cpu;
+					asm volatile("mov %%gs:24, %0" : "=r"(cpu));
+					return *cpu;
+				}
+
+				static kernel::Thread *current_thread() {
+					kernel::Thread *thread;
+					asm volatile("mov %%gs:8, %0" : "=r"(thread));
+					return thread;
+				}
+
+				void activate();
+
+				X86PerCPU& per_cpu() { return _per_cpu; }
+
+				uint32_t lapic_id() const { return _lapic_id; }
+				void lapic_id(uint32_t id) { _lapic_id = id; }
+
+				bool online() const { return _online; }
+				void online(bool v) { _online = v; }
+
+				GDT& gdt() const { return _gdt; }
+				TSS& tss() const { return _tss; }
+
+			private:
+				X86PerCPU _per_cpu;
+				uint32_t _lapic_id;
+				volatile bool _online;
+
+				GDT& _gdt;
+				TSS& _tss;
 			};
 		}
 	}
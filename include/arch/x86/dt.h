@@ -224,6 +224,8 @@ namespace infos
 				const void *ptr;
 			} __packed;
 			
+			class TSS;
+
 			class DT {
 			public:
 				virtual bool init() = 0;
@@ -236,6 +238,7 @@ namespace infos
 			class GDT : public DT {
 			public:
 				bool init() override;
+				bool init(TSS& task_state);
 				bool reload() override;
 				uintptr_t get_ptr() override;
 
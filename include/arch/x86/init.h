@@ -23,6 +23,7 @@ namespace infos {
 			extern bool mm_init(void);
 			extern bool mm_pf_init(void);
 			extern bool cpu_init(void);
+			extern bool smp_init(void);
 			extern bool modules_init(void);
 			extern bool sched_init(void);
 			
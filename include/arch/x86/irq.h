@@ -18,6 +18,7 @@ namespace infos
 #define IRQ_GPF				0x0d
 #define IRQ_KERNEL_SYSCALL	0x80
 #define IRQ_USER_SYSCALL	0x81
+#define IRQ_RESCHEDULE		0xf0
 			
 			class ExceptionIRQ : public kernel::IRQ
 			{
@@ -24,6 +24,7 @@ namespace infos {
 			
 #define MSR_FS_BASE 0xc0000100
 #define MSR_GS_BASE 0xc0000101
+#define MSR_KERNEL_GS_BASE 0xc0000102
 
 			static inline void __wrmsr(uint32_t msr_id, uint64_t msr_value) {
 				uint32_t low = msr_value & 0xffffffff;
@@ -67,6 +67,13 @@ namespace infos
 				: "d"(port), "0"(buffer), "1"(count)
 				: "memory", "cc" );
 			}
+			
+			inline void __outsw(uint16_t port, uintptr_t buffer, size_t count)
+			{
+				asm volatile("cld\n\trep outsw" : "=S"(buffer), "=c"(count)
+				: "d"(port), "0"(buffer), "1"(count)
+				: "memory", "cc" );
+			}
 		}
 	}
 }
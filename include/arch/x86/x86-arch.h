@@ -15,6 +15,7 @@ namespace infos
 		namespace x86
 		{
 			class IRQManager;
+			class X86CPU;
 			
 			class X86Arch : public Arch
 			{
@@ -22,6 +23,7 @@ namespace infos
 				X86Arch();
 				
 				bool init();
+				bool init_cpu(X86CPU& cpu);
 				bool init_irq();
 				
 				void enable_interrupts() override { asm volatile("sti"); }
@@ -32,7 +34,12 @@ namespace infos
 					return !!(rflags & 0x200);
 				}
 
-				kernel::CPU& get_current_cpu() override { return *_cpus[0]; }
+				kernel::CPU& get_current_cpu() override;
+				void send_reschedule(unsigned int cpu) override;
+				
+				bool add_cpu(uint32_t lapic_id);
+				unsigned int nr_cpus() const { return _nr_cpus; }
+				X86CPU& get_cpu(unsigned int index) const { return *_cpus[index]; }
 				
 				void dump_native_context(const X86Context& native_context) const;
 				void dump_thread_context(const kernel::ThreadContext& context) const override;
@@ -43,13 +50,15 @@ namespace infos
 				
 				kernel::Thread& get_current_thread() const override;
 				void set_current_thread(kernel::Thread& thread) override;
+				void clear_after_switch(volatile bool& flag) override;
 				
 				kernel::IRQ* request_irq() override;
 				
 				IRQManager& irq_manager() { return _irq_manager; }
 				
 			private:
-				kernel::CPU *_cpus[1];
+				X86CPU *_cpus[MAX_CPUS];
+				unsigned int _nr_cpus;
 				IRQManager _irq_manager;
 			};
 			
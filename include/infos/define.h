@@ -72,6 +72,9 @@ typedef __gnuc_va_list va_list;
 #define PMEM_VA_END			((uintptr_t)0xFFFF800100000000)
 #define PMEM_VA_SIZE		(PMEM_VA_END - PMEM_VA_START)
 
+// The maximum number of CPUs that the kernel will bring online.
+#define MAX_CPUS			16
+
 #define STRINGIFY(__N) _STRINGIFY(__N)
 #define _STRINGIFY(__N) #__N
 
@@ -110,6 +113,23 @@ static inline phys_addr_t vpa_to_pa(virt_addr_t va)
 	return va - PMEM_VA_START;
 }
 
+/**
+ * Translates an address in either of the kernel's linear mappings of physical memory.
+ * @return Returns false if the address is not in a linear mapping.
+ */
+static inline bool linear_va_to_pa(virt_addr_t va, phys_addr_t& pa)
+{
+	if (va >= PMEM_VA_START && va < PMEM_VA_END) {
+		pa = va - PMEM_VA_START;
+	} else if (va >= KERNEL_VMEM_START) {
+		pa = va - KERNEL_VMEM_START;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
 static inline pfn_t pa_to_pfn(phys_addr_t pa)
 {
 	return (pfn_t)(pa >> __page_bits);
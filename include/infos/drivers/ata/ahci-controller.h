@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/drivers/device.h>
+#include <infos/kernel/log.h>
+
+// Generic host control registers.
+#define AHCI_REG_CAP	0x00
+#define AHCI_REG_GHC	0x04
+#define AHCI_REG_IS		0x08
+#define AHCI_REG_PI		0x0C
+#define AHCI_REG_VS		0x10
+
+#define AHCI_CAP_NCS(__v)	((((__v) >> 8) & 0x1f) + 1)
+#define AHCI_CAP_SNCQ		(1u << 30)
+#define AHCI_CAP_S64A		(1u << 31)
+
+#define AHCI_GHC_HR		(1u << 0)
+#define AHCI_GHC_IE		(1u << 1)
+#define AHCI_GHC_AE		(1u << 31)
+
+// Port registers, relative to the base of each port's register block.
+#define AHCI_PORT_BASE(__p)	(0x100 + ((__p) * 0x80))
+
+#define AHCI_PxCLB		0x00
+#define AHCI_PxCLBU		0x04
+#define AHCI_PxFB		0x08
+#define AHCI_PxFBU		0x0C
+#define AHCI_PxIS		0x10
+#define AHCI_PxIE		0x14
+#define AHCI_PxCMD		0x18
+#define AHCI_PxTFD		0x20
+#define AHCI_PxSIG		0x24
+#define AHCI_PxSSTS		0x28
+#define AHCI_PxSCTL		0x2C
+#define AHCI_PxSERR		0x30
+#define AHCI_PxSACT		0x34
+#define AHCI_PxCI		0x38
+
+#define AHCI_PxCMD_ST	(1u << 0)
+#define AHCI_PxCMD_SUD	(1u << 1)
+#define AHCI_PxCMD_POD	(1u << 2)
+#define AHCI_PxCMD_FRE	(1u << 4)
+#define AHCI_PxCMD_FR	(1u << 14)
+#define AHCI_PxCMD_CR	(1u << 15)
+
+#define AHCI_PxIS_DHRS	(1u << 0)	// Device to host register FIS
+#define AHCI_PxIS_PSS	(1u << 1)	// PIO setup FIS
+#define AHCI_PxIS_DSS	(1u << 2)	// DMA setup FIS
+#define AHCI_PxIS_SDBS	(1u << 3)	// Set device bits FIS
+#define AHCI_PxIS_IFS	(1u << 27)	// Interface fatal error
+#define AHCI_PxIS_HBDS	(1u << 28)	// Host bus data error
+#define AHCI_PxIS_HBFS	(1u << 29)	// Host bus fatal error
+#define AHCI_PxIS_TFES	(1u << 30)	// Task file error
+
+#define AHCI_PxIS_COMPLETION	(AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_DSS | AHCI_PxIS_SDBS)
+#define AHCI_PxIS_ERROR			(AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
+#define AHCI_PxSSTS_DET(__v)	((__v) & 0xf)
+#define AHCI_PxSSTS_DET_PRESENT	3
+
+#define AHCI_SIG_ATA	0x00000101
+
+#define AHCI_MAX_PORTS	32
+
+namespace infos
+{
+	namespace kernel
+	{
+		class IRQ;
+	}
+
+	namespace drivers
+	{
+		namespace ata
+		{
+			class AHCIDevice;
+
+			struct AHCIControllerConfiguration
+			{
+				// The virtual address of the memory-mapped registers (ABAR).
+				virt_addr_t abar;
+
+				// The interrupt of the controller, or NULL if commands must be polled for.
+				kernel::IRQ *irq;
+			};
+
+			/**
+			 * An AHCI host bus adapter.  Each port that has an ATA drive attached to it becomes an
+			 * AHCIDevice, which issues commands through the port's own command list.
+			 */
+			class AHCIController : public Device
+			{
+				friend class AHCIDevice;
+
+			public:
+				static const DeviceClass AHCIControllerDeviceClass;
+				const DeviceClass& device_class() const override { return AHCIControllerDeviceClass; }
+
+				AHCIController(const AHCIControllerConfiguration& cfg);
+
+				bool init(kernel::DeviceManager& dm) override;
+
+			private:
+				volatile uint32_t *_regs;
+				kernel::IRQ *_irq;
+				uint32_t _caps;
+
+				AHCIDevice *_ports[AHCI_MAX_PORTS];
+
+				inline uint32_t read(uint32_t reg) const { return _regs[reg >> 2]; }
+				inline void write(uint32_t reg, uint32_t value) { _regs[reg >> 2] = value; }
+
+				inline uint32_t port_read(int port, uint32_t reg) const { return read(AHCI_PORT_BASE(port) + reg); }
+				inline void port_write(int port, uint32_t reg, uint32_t value) { write(AHCI_PORT_BASE(port) + reg, value); }
+
+				bool irq_enabled() const { return _irq != NULL; }
+
+				bool probe_port(kernel::DeviceManager& dm, int port);
+
+				static void ahci_irq_handler(const kernel::IRQ *irq, void *priv);
+			};
+		}
+	}
+}
@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/drivers/block/block-device.h>
+#include <infos/drivers/block/block-device-partition.h>
+#include <infos/util/list.h>
+#include <infos/util/lock.h>
+#include <infos/util/wakequeue.h>
+
+// The number of physical region descriptors in each command table.
+#define AHCI_PRDS_PER_COMMAND	8
+
+// The largest transfer a single command is issued for.
+#define AHCI_MAX_COMMAND_BLOCKS	8192
+
+// The order of the bounce buffer used for memory the controller cannot address directly, which
+// limits the size of such transfers.
+#define AHCI_BOUNCE_ORDER		4
+
+namespace infos
+{
+	namespace mm
+	{
+		struct PageDescriptor;
+	}
+
+	namespace drivers
+	{
+		namespace ata
+		{
+			class AHCIController;
+
+			/**
+			 * An ATA drive attached to a port of an AHCI controller.  Each command occupies one
+			 * of the port's command slots, so (with native command queuing) as many transfers
+			 * as there are slots can be outstanding at once -- a thread submitting a command
+			 * sleeps on its own slot, not on the port.
+			 */
+			class AHCIDevice : public block::BlockDevice
+			{
+				friend class AHCIController;
+
+			public:
+				static const DeviceClass AHCIDeviceClass;
+				const DeviceClass& device_class() const override { return AHCIDeviceClass; }
+
+				AHCIDevice(AHCIController& controller, int port);
+
+				bool init(kernel::DeviceManager& dm) override;
+
+				size_t block_count() const override { return _size; }
+				size_t block_size() const override { return 512; }
+
+				unsigned int queue_depth() const override { return _nr_slots; }
+
+			protected:
+				bool read_blocks_direct(void *buffer, size_t offset, size_t count) override;
+				bool write_blocks_direct(const void *buffer, size_t offset, size_t count) override;
+				bool transfer_vector_direct(bool write, size_t offset, const block::BlockSegment *segments, unsigned int nr_segments) override;
+				bool flush_direct() override;
+
+			private:
+				struct CommandHeader {
+					uint16_t flags;
+					uint16_t prdtl;
+					volatile uint32_t prdbc;
+					uint32_t ctba;
+					uint32_t ctbau;
+					uint32_t reserved[4];
+				} __packed;
+
+				struct PRDEntry {
+					uint32_t dba;
+					uint32_t dbau;
+					uint32_t reserved;
+					uint32_t dbc;
+				} __packed;
+
+				struct CommandTable {
+					uint8_t cfis[64];
+					uint8_t acmd[16];
+					uint8_t reserved[48];
+					PRDEntry prdt[AHCI_PRDS_PER_COMMAND];
+				} __packed;
+
+				/**
+				 * The state of a command slot, while a command is outstanding in it.
+				 */
+				struct Slot {
+					volatile bool done;
+					bool error;
+					util::WakeQueue waiters;
+				};
+
+				AHCIController& _ctrl;
+				int _port;
+
+				uint64_t _size;
+				bool _lba48, _ncq;
+
+				CommandHeader *_cmd_list;
+				phys_addr_t _cmd_list_pa;
+				CommandTable *_cmd_tables;
+				phys_addr_t _cmd_tables_pa;
+
+				unsigned int _nr_slots;
+				Slot _slots[32];
+
+				// Slots that are free, and slots that have been issued to the port.
+				uint32_t _free_slots, _issued;
+				util::SpinLock _slot_lock;
+				volatile bool _slot_available;
+				util::WakeQueue _slot_waiters;
+
+				// Commands are held back while the port is restarted after an error, and fail
+				// if it could not be restarted.
+				volatile bool _port_ready;
+				bool _port_dead;
+				util::WakeQueue _port_waiters;
+
+				volatile bool _recovery_pending;
+				util::WakeQueue _recovery_work;
+
+				util::Mutex _flush_mtx;
+
+				inline uint32_t port_read(uint32_t reg) const;
+				inline void port_write(uint32_t reg, uint32_t value);
+
+				bool init_memory();
+				bool start_port();
+				void stop_port();
+
+				int alloc_slot();
+				void free_slot(int slot);
+
+				void build_command(int slot, uint8_t command, uint64_t lba, size_t nr_blocks, bool write);
+				bool map_buffer(int slot, phys_addr_t pa, size_t size, unsigned int& nr_prds);
+				bool execute(int slot);
+				void handle_interrupt();
+
+				static void recovery_thread_proc(void *arg);
+				void recover();
+
+				uint8_t transfer_command(bool write) const;
+
+				bool identify(uint16_t *ident);
+				bool transfer(bool write, uint64_t lba, void *buffer, size_t nr_blocks);
+				bool transfer_one(bool write, uint64_t lba, void *buffer, size_t nr_blocks);
+
+				util::List<block::BlockDevicePartition *> _partitions;
+			};
+		}
+	}
+}
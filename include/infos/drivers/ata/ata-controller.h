@@ -4,6 +4,10 @@
 #include <infos/drivers/device.h>
 #include <infos/kernel/log.h>
 #include <infos/util/lock.h>
+#include <infos/util/wakequeue.h>
+
+// The number of pages of DMA memory on each channel, which limits the size of a DMA transfer.
+#define ATA_DMA_PAGES	16
 
 namespace infos
 {
@@ -30,12 +34,11 @@ namespace infos
 				static DeviceClass ATAControllerDeviceClass;
 				const DeviceClass& device_class() const override { return ATAControllerDeviceClass; }
 
-				ATAController(kernel::IRQ& irq, const ATAControllerConfiguration& cfg);
+				ATAController(const ATAControllerConfiguration& cfg);
 				
 				bool init(kernel::DeviceManager& dm) override;
 				
 			private:
-				kernel::IRQ& _irq;
 				util::Mutex _mtx[2];
 				
 				uint8_t ata_read(int channel, int reg);
@@ -46,12 +49,56 @@ namespace infos
 				bool probe_channel(kernel::DeviceManager& dm, int channel);
 				bool probe_device(kernel::DeviceManager& dm, int channel, int device);
 				
+				bool init_dma(int channel);
+				bool init_irq(kernel::DeviceManager& dm);
+				
+				bool irq_enabled(int channel) const { return channels[channel].nIEN == 0; }
+				void arm_irq(int channel) { irqs[channel].raised = false; }
+				void wait_for_irq(int channel);
+				
+				static void ata_irq_handler(const kernel::IRQ *irq, void *priv);
+				
 				struct ChannelRegisters {
 					uint16_t base;
 					uint16_t ctrl;
 					uint16_t bmide;
 					uint8_t nIEN;
 				} channels[2];
+				
+				/**
+				 * A physical region descriptor, which describes one (physically contiguous) part of
+				 * the memory involved in a bus-master DMA transfer.
+				 */
+				struct PRDEntry {
+					uint32_t base;
+					uint16_t size;
+					uint16_t flags;
+				} __packed;
+				
+				/**
+				 * The memory used for bus-master DMA on a channel: the PRD table, and the pages that
+				 * data is transferred to and from.
+				 */
+				struct ChannelDMA {
+					bool enabled;
+					PRDEntry *prdt;
+					phys_addr_t prdt_pa;
+					uint8_t *pages[ATA_DMA_PAGES];
+					phys_addr_t pages_pa[ATA_DMA_PAGES];
+				} dma[2];
+				
+				/**
+				 * The interrupt of a channel, which the drive raises when it has finished a command
+				 * (or, for PIO, has a sector ready).  The thread waiting for it sleeps on the
+				 * channel's wake queue.
+				 */
+				struct ChannelIRQ {
+					ATAController *controller;
+					int channel;
+					kernel::IRQ *irq;
+					volatile bool raised;
+					util::WakeQueue waiters;
+				} irqs[2];
 			};
 			
 			extern kernel::ComponentLog ata_log;
@@ -129,6 +176,18 @@ namespace infos
 #define ATA_REG_CONTROL    0x0C
 #define ATA_REG_ALTSTATUS  0x0C
 #define ATA_REG_DEVADDRESS 0x0D
+#define ATA_REG_BMCOMMAND  0x0E
+#define ATA_REG_BMSTATUS   0x10
+#define ATA_REG_BMPRDT     0x12
+
+#define ATA_BM_CMD_START   0x01    // Start bus-master operation
+#define ATA_BM_CMD_READ    0x08    // Transfer from the device to memory
+
+#define ATA_BM_SR_ACTIVE   0x01    // Bus-master active
+#define ATA_BM_SR_ERR      0x02    // Bus-master error
+#define ATA_BM_SR_IRQ      0x04    // Interrupt raised
+
+#define ATA_PRD_EOT        0x8000  // Last entry in the PRD table
 
 #define ATA_PRIMARY      0x00
 #define ATA_SECONDARY    0x01
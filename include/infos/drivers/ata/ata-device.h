@@ -25,8 +25,11 @@ namespace infos {
 
                 size_t block_count() const override;
                 size_t block_size() const override;
-                bool read_blocks(void* buffer, size_t offset, size_t count) override;
-                bool write_blocks(const void* buffer, size_t offset, size_t count) override;
+
+            protected:
+                bool read_blocks_direct(void* buffer, size_t offset, size_t count) override;
+                bool write_blocks_direct(const void* buffer, size_t offset, size_t count) override;
+                bool flush_direct() override;
 
             private:
                 ATAController& _ctrl;
@@ -39,11 +42,15 @@ namespace infos {
                 void ata_write(int reg, uint8_t data);
                 int ata_poll(bool error_check = false);
 
+                bool _use_dma;
+
+                void select_lba48(uint64_t lba, size_t nr_blocks);
+                void wait_for_drive();
+
                 bool transfer(int direction, uint64_t lba, void *buffer, size_t nr_blocks);
+                bool pio_transfer(int direction, uint64_t lba, void *buffer, size_t nr_blocks);
+                bool dma_transfer(int direction, uint64_t lba, void *buffer, size_t nr_blocks);
 
-                bool check_for_partitions();
-                bool create_partitions(const uint8_t *partition_table);
-                
                 infos::util::List<block::BlockDevicePartition *> _partitions;
             };
         }
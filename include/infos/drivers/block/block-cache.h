@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/drivers/block/block-cache.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/mm/slab.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace block
+		{
+			class BlockDevice;
+
+			/**
+			 * A cache of the blocks of a block device.  Cached blocks are held in buffers, which are
+			 * found through a hash table keyed on the block number.  Buffers are reference counted,
+			 * and a buffer that is not referenced sits on an LRU list, from which the least recently
+			 * used buffer is recycled once the cache has reached its capacity.
+			 *
+			 * Writes are held in the cache as dirty buffers, which are written back (with runs of
+			 * adjacent blocks coalesced into single transfers) when the cache is flushed --
+			 * periodically by the writer thread, when too much of the cache is dirty, or on demand.
+			 */
+			class BlockCache
+			{
+			public:
+				struct Buffer : mm::SlabAllocated<Buffer>
+				{
+					static constexpr const char *slab_cache_name = "block-buffer";
+
+					Buffer *hash_next, *hash_prev;
+					Buffer *lru_next, *lru_prev;
+
+					size_t block;
+					bool hashed;
+					bool valid;
+					bool dirty;
+					unsigned int refcount;
+
+					// Held while the contents of the buffer are being filled in.
+					util::Mutex lock;
+					uint8_t *data;
+				};
+
+				static BlockCache *create(BlockDevice& bdev);
+
+				BlockCache(BlockDevice& bdev, unsigned int capacity);
+				~BlockCache();
+
+				Buffer *get(size_t block);
+				void put(Buffer *buffer);
+
+				bool read(void *buffer, size_t offset, size_t count);
+				bool write(const void *buffer, size_t offset, size_t count);
+				bool prefetch(size_t offset, size_t count);
+
+				bool writeback();
+				bool flush();
+
+				unsigned int capacity() const { return _capacity; }
+				uint64_t nr_hits() const { return _nr_hits; }
+				uint64_t nr_misses() const { return _nr_misses; }
+				uint64_t nr_prefetched() const { return _nr_prefetched; }
+				unsigned int nr_dirty() const { return _nr_dirty; }
+
+			private:
+				static const unsigned int NR_BUCKETS = 256;
+
+				BlockDevice& _bdev;
+				unsigned int _capacity;
+				unsigned int _nr_buffers;
+				unsigned int _nr_dirty;
+				bool _write_back;
+				volatile bool _needs_flush;
+
+				Buffer *_buckets[NR_BUCKETS];
+				Buffer *_lru_head, *_lru_tail;
+
+				uint64_t _nr_hits, _nr_misses, _nr_prefetched;
+
+				util::Mutex _mtx;
+
+				// Held across a whole write-back, and a flush of the device after it, so that a
+				// flush cannot finish while blocks are still on their way to the device.
+				util::Mutex _writeback_mtx;
+
+				// All caches are linked together, for the writer thread.
+				BlockCache *_next_cache;
+				static BlockCache *_all_caches;
+				static util::SpinLock _all_caches_lock;
+
+				static void writer_thread_proc(void *arg);
+
+				static inline unsigned int bucket_of(size_t block) { return block & (NR_BUCKETS - 1); }
+
+				Buffer *lookup(size_t block) const;
+				Buffer *acquire(size_t block);
+
+				void hash_insert(Buffer *buffer);
+				void hash_remove(Buffer *buffer);
+				void lru_insert(Buffer *buffer, bool most_recent);
+				void lru_remove(Buffer *buffer);
+
+				bool fill(Buffer *buffer);
+				bool store(size_t block, const void *data, bool overwrite, bool dirty);
+				void mark_dirty(Buffer *buffer);
+				bool write_dirty();
+			};
+		}
+	}
+}
@@ -2,6 +2,7 @@
 #pragma once
 
 #include <infos/drivers/block/block-device.h>
+#include <infos/util/list.h>
 
 namespace infos {
     namespace drivers {
@@ -18,12 +19,20 @@ namespace infos {
                 BlockDevicePartition(BlockDevice& underlying_block_device, size_t block_offset, size_t block_count);
                 virtual ~BlockDevicePartition();
 
-                virtual bool read_blocks(void *buffer, size_t offset, size_t count);
-                virtual bool write_blocks(const void *buffer, size_t offset, size_t count);
-
                 virtual size_t block_size() const { return _underlying_block_device.block_size(); }
                 virtual size_t block_count() const { return _block_count; }
+                unsigned int queue_depth() const override { return _underlying_block_device.queue_depth(); }
+
+                bool prefetch_blocks(size_t offset, size_t count) override;
+
+                static bool scan_partitions(BlockDevice& bdev, util::List<BlockDevicePartition *>& partitions);
                 
+            protected:
+                bool read_blocks_direct(void *buffer, size_t offset, size_t count) override;
+                bool write_blocks_direct(const void *buffer, size_t offset, size_t count) override;
+                bool flush_direct() override;
+                void submit_direct(BlockRequest *req) override;
+
             private:
                 BlockDevice& _underlying_block_device;
                 size_t _block_offset, _block_count;
@@ -2,6 +2,7 @@
 #pragma once
 
 #include <infos/drivers/device.h>
+#include <infos/drivers/block/block-request.h>
 
 namespace infos
 {
@@ -9,17 +10,66 @@ namespace infos
 	{
 		namespace block
 		{
+			class BlockCache;
+			class RequestQueue;
+			
 			class BlockDevice : public Device
 			{
+				friend class BlockCache;
+				friend class RequestQueue;
+				friend class BlockDevicePartition;
+				
 			public:
 				static const DeviceClass BlockDeviceClass;
 				const DeviceClass& device_class() const override { return BlockDeviceClass; }
 				
-				virtual bool read_blocks(void *buffer, size_t offset, size_t count) = 0;
-				virtual bool write_blocks(const void *buffer, size_t offset, size_t count) = 0;
+				explicit BlockDevice(bool cached = true);
+				virtual ~BlockDevice();
+				
+				bool read_blocks(void *buffer, size_t offset, size_t count);
+				bool write_blocks(const void *buffer, size_t offset, size_t count);
+				virtual bool prefetch_blocks(size_t offset, size_t count);
+				bool flush();
+				
+				bool submit(BlockRequest *req);
 				
 				virtual size_t block_size() const = 0;
 				virtual size_t block_count() const = 0;
+				
+				/**
+				 * The number of transfers the device can usefully have outstanding at once.
+				 */
+				virtual unsigned int queue_depth() const { return 1; }
+				
+				BlockCache *cache() const { return _cache; }
+				RequestQueue& queue();
+				
+			protected:
+				/**
+				 * Transfers blocks to or from the device itself, bypassing the block cache.
+				 */
+				virtual bool read_blocks_direct(void *buffer, size_t offset, size_t count) = 0;
+				virtual bool write_blocks_direct(const void *buffer, size_t offset, size_t count) = 0;
+				
+				/**
+				 * Transfers a run of blocks to or from several buffers.  Drivers that can scatter
+				 * and gather override this to do it in a single transfer.
+				 */
+				virtual bool transfer_vector_direct(bool write, size_t offset, const BlockSegment *segments, unsigned int nr_segments);
+				
+				/**
+				 * Queues a request, which has already been checked against the size of the device.
+				 */
+				virtual void submit_direct(BlockRequest *req);
+				
+				/**
+				 * Makes sure that blocks written to the device are on stable storage.
+				 */
+				virtual bool flush_direct() { return true; }
+				
+			private:
+				BlockCache *_cache;
+				RequestQueue *_queue;
 			};
 		}
 	}
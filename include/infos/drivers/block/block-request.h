@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/mm/slab.h>
+#include <infos/util/lock.h>
+#include <infos/util/wakequeue.h>
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace block
+		{
+			/**
+			 * One part of the memory involved in a vectored transfer.
+			 */
+			struct BlockSegment
+			{
+				void *buffer;
+				size_t count;
+			};
+
+			/**
+			 * An asynchronous request to a block device.  The request is owned by whoever
+			 * submitted it, and is handed back to them through the completion function -- which
+			 * is called from the request queue's dispatcher threads, and so must not wait for
+			 * other requests.
+			 */
+			struct BlockRequest : mm::SlabAllocated<BlockRequest>
+			{
+				static constexpr const char *slab_cache_name = "block-request";
+
+				enum Operation { READ, WRITE, FLUSH };
+				typedef void (*completion_fn_t)(BlockRequest *req, bool success);
+
+				BlockRequest(Operation op, size_t block, size_t count, void *buffer, completion_fn_t completion, void *priv)
+					: op(op), block(block), count(count), buffer(buffer), completion(completion), priv(priv),
+					deadline(0), sort_next(NULL), sort_prev(NULL), fifo_next(NULL), fifo_prev(NULL), merged(NULL) { }
+
+				Operation op;
+				size_t block;
+				size_t count;
+				void *buffer;
+
+				completion_fn_t completion;
+				void *priv;
+
+				// The remaining fields belong to the request queue and its scheduler.
+				uint64_t deadline;
+				BlockRequest *sort_next, *sort_prev;
+				BlockRequest *fifo_next, *fifo_prev;
+
+				// The requests that have been merged onto the end of this one.
+				BlockRequest *merged;
+			};
+
+			/**
+			 * Tracks a group of requests, so that their submitter can wait for all of them to
+			 * complete.  Each request is counted in with begin() before it is submitted, and
+			 * counted out with end() from its completion function.
+			 */
+			class BlockRequestGroup
+			{
+			public:
+				BlockRequestGroup() : _pending(0), _done(true), _ok(true) { }
+
+				void begin();
+				void end(bool success);
+				bool wait();
+
+			private:
+				unsigned int _pending;
+				volatile bool _done;
+				bool _ok;
+
+				util::SpinLock _lock;
+				util::WakeQueue _waiters;
+			};
+		}
+	}
+}
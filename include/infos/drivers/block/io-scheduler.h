@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/drivers/block/block-request.h>
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace block
+		{
+			/**
+			 * Decides the order in which the queued requests of a block device are dispatched.
+			 * Every scheduler keeps its requests in a list sorted by block number, which is
+			 * also where requests to merge with are found.  The request queue serialises all
+			 * calls into its scheduler.
+			 */
+			class IOScheduler
+			{
+			public:
+				typedef IOScheduler *(*CreationFn)();
+
+				IOScheduler() : _sorted(NULL), _nr_queued(0) { }
+				virtual ~IOScheduler() { }
+
+				virtual const char *name() const = 0;
+
+				virtual void add(BlockRequest *req) = 0;
+				virtual BlockRequest *next() = 0;
+
+				BlockRequest *take_adjacent(BlockRequest::Operation op, size_t block, size_t max_count);
+
+				bool empty() const { return _nr_queued == 0; }
+				unsigned int nr_queued() const { return _nr_queued; }
+
+			protected:
+				void sorted_insert(BlockRequest *req);
+				void sorted_remove(BlockRequest *req);
+				BlockRequest *sorted_first() const { return _sorted; }
+				BlockRequest *sorted_from(size_t block) const;
+
+				/**
+				 * Called when a request is removed by take_adjacent(), so that the scheduler can
+				 * forget about it too.
+				 */
+				virtual void removed(BlockRequest *req) { }
+
+			private:
+				BlockRequest *_sorted;
+				unsigned int _nr_queued;
+			};
+
+			struct IOSchedulerRegistration
+			{
+				const char *name;
+				IOScheduler::CreationFn creation_fn;
+			};
+
+			IOScheduler *create_io_scheduler();
+		}
+	}
+}
+
+#define RegisterIOScheduler(__name, __creation_fn) __section(".ioschedreg") infos::drivers::block::IOSchedulerRegistration __iosched_reg##__name = { \
+.name = STRINGIFY(__name), \
+.creation_fn = __creation_fn \
+}
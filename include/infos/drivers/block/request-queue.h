@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/drivers/block/block-request.h>
+#include <infos/util/lock.h>
+#include <infos/util/wakequeue.h>
+
+// The most dispatcher threads a single queue runs.
+#define REQUEST_QUEUE_MAX_DISPATCHERS	4
+
+// The limits on a request that has had others merged into it.
+#define REQUEST_QUEUE_MAX_MERGE_BLOCKS		256
+#define REQUEST_QUEUE_MAX_MERGE_SEGMENTS	8
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace block
+		{
+			class BlockDevice;
+			class IOScheduler;
+
+			/**
+			 * The queue of asynchronous requests for a block device.  Submitted requests are
+			 * ordered by an I/O scheduler, and are taken from it by dispatcher threads -- as many
+			 * as the device can usefully keep busy -- which merge requests for adjacent blocks
+			 * into a single vectored transfer before handing them to the driver.
+			 */
+			class RequestQueue
+			{
+			public:
+				RequestQueue(BlockDevice& bdev);
+
+				void submit(BlockRequest *req);
+
+				const char *scheduler_name() const;
+
+				uint64_t nr_submitted() const { return _nr_submitted; }
+				uint64_t nr_dispatched() const { return _nr_dispatched; }
+				uint64_t nr_merged() const { return _nr_merged; }
+
+			private:
+				BlockDevice& _bdev;
+				IOScheduler *_sched;
+
+				util::SpinLock _lock;
+				volatile bool _has_work;
+				util::WakeQueue _work;
+
+				volatile bool _started;
+
+				uint64_t _nr_submitted, _nr_dispatched, _nr_merged;
+
+				void start();
+				static void dispatcher_proc(void *arg);
+
+				BlockRequest *take_batch();
+				void dispatch(BlockRequest *req);
+			};
+		}
+	}
+}
@@ -71,6 +71,13 @@ namespace infos
 				LAPIC(virt_addr_t base_address);
 
 				bool init(kernel::DeviceManager& dm) override;
+				void init_local();
+
+				uint32_t id() const { return read(LAPICRegisters::ID) >> 24; }
+
+				void send_ipi(uint32_t apic_id, uint8_t vector);
+				void send_init(uint32_t apic_id);
+				void send_startup(uint32_t apic_id, uint8_t page);
 
 				void mask_interrupts(LVTs lvt);
 				void unmask_interrupts(LVTs lvt);
@@ -83,7 +90,8 @@ namespace infos
 				void set_timer_one_shot();
 				uint32_t get_timer_current_count();
 
-				kernel::IRQ& timer_irq() const { return *_timer_irq; }
+				kernel::IRQ *allocate_timer_irq();
+				kernel::IRQ *allocate_msi_irq(uint64_t& msg_address, uint32_t& msg_data);
 
 			private:
 				class LAPICIRQ : public kernel::IRQ
@@ -100,9 +108,25 @@ namespace infos
 					LVTs _lvt;
 				};
 
-				LAPICIRQ *_timer_irq;
+				/**
+				 * An interrupt that a device signals by writing a message straight to the local
+				 * APIC (i.e. an MSI), rather than through an interrupt pin.
+				 */
+				class MSIIRQ : public kernel::IRQ
+				{
+				public:
+					MSIIRQ(LAPIC& lapic) : _lapic(lapic) { }
+
+					void enable() override { }
+					void disable() override { }
+					void handle() const override;
+
+				private:
+					LAPIC& _lapic;
+				};
 
 				void set_timer_irq(uint8_t irq);
+				void send_command(uint32_t apic_id, uint32_t command);
 
 				volatile uint32_t *_apic_base;
 				inline void write(LAPICRegisters::LAPICRegisters reg, uint32_t value) {
@@ -13,6 +13,13 @@
 #define PCI_CONFIG_VENDOR(__v) PCI_CONFIG_VALUE(__v, 0, 16)
 #define PCI_CONFIG_DEVICE(__v) PCI_CONFIG_VALUE(__v, 16, 16)
 
+#define PCI_REG_COMMAND	0x04
+#define PCI_COMMAND_IO			(1 << 0)
+#define PCI_COMMAND_MEMORY		(1 << 1)
+#define PCI_COMMAND_BUS_MASTER	(1 << 2)
+#define PCI_COMMAND_INTX_DISABLE	(1 << 10)
+#define PCI_STATUS_CAPABILITIES	(1 << 20)
+
 #define PCI_REG_INFO	0x08
 #define PCI_CONFIG_CLASS(__v)		PCI_CONFIG_VALUE(__v, 24, 8)
 #define PCI_CONFIG_SUBCLASS(__v)	PCI_CONFIG_VALUE(__v, 16, 8)
@@ -31,12 +38,34 @@
 #define PCI_REG_BAR4 0x20
 #define PCI_REG_BAR5 0x24
 
+#define PCI_REG_CAPABILITIES 0x34
 #define PCI_REG_IRQ 0x3c
 
+#define PCI_CAP_ID_MSI	0x05
+#define PCI_CAP_ID_MSIX	0x11
+#define PCI_CAP_ID_VENDOR	0x09
+
+#define PCI_MSI_CTRL_ENABLE	(1 << 0)
+#define PCI_MSI_CTRL_64BIT	(1 << 7)
+
+#define PCI_MSIX_CTRL_TABLE_SIZE(__v)	(((__v) & 0x7ff) + 1)
+#define PCI_MSIX_CTRL_FUNCTION_MASK	(1 << 14)
+#define PCI_MSIX_CTRL_ENABLE	(1 << 15)
+
 namespace infos
 {
+	namespace kernel
+	{
+		class IRQ;
+	}
+
 	namespace drivers
 	{
+		namespace irq
+		{
+			class LAPIC;
+		}
+
 		namespace pci
 		{
 			class PCIBus;
@@ -87,6 +116,12 @@ namespace infos
 				uint32_t read_config(uint8_t reg) const;
 				void write_config(uint8_t reg, uint32_t value) const;
 				
+				uint8_t find_capability(uint8_t id, uint8_t start = 0) const;
+				kernel::IRQ *request_msi_irq(irq::LAPIC *lapic);
+				kernel::IRQ *request_msix_irq(irq::LAPIC *lapic, unsigned int entry);
+				
+				bool bar_address(int bar, phys_addr_t& pa) const;
+				
 			private:
 				PCIBus& _owner;
 				unsigned int _slot, _func;
@@ -47,6 +47,7 @@ namespace infos
 			private:
 				bool init_ide_controller(kernel::DeviceManager& dm);
 				bool init_sata_controller(kernel::DeviceManager& dm);
+				bool init_virtio_block(kernel::DeviceManager& dm);
 			};
 		}
 	}
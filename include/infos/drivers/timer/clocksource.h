@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/drivers/timer/clocksource.h
+ * 
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ * 
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/drivers/device.h>
+#include <infos/util/time.h>
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace timer
+		{
+			/**
+			 * A clocksource is a free-running counter that can be read at any time, and which
+			 * the kernel uses to tell the time -- as opposed to a timer, which raises events.
+			 */
+			class ClockSource : public Device
+			{
+			public:
+				static const DeviceClass ClockSourceDeviceClass;
+				
+				const DeviceClass& device_class() const override { return ClockSourceDeviceClass; }
+				
+				/**
+				 * Reads the current value of the clocksource.
+				 * @return Returns the time that has elapsed since some arbitrary (but fixed) point.
+				 */
+				virtual util::Nanoseconds read() const = 0;
+				
+				virtual uint64_t frequency() const = 0;
+			};
+		}
+	}
+}
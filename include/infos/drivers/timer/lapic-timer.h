@@ -47,14 +47,25 @@ namespace infos {
 
 				uint64_t frequency() const override { return _frequency; }
 
+				bool arm(util::Nanoseconds delay) override;
+
 			private:
 				uint64_t _frequency;
 
+				bool _oneshot;
+				uint32_t _period;
+				uint32_t _charged;			// Ticks of the current period already accounted for
+				bool _timekeeper;
+
 				kernel::IRQ *_irq;
 				drivers::irq::LAPIC *_lapic;
 
 				static void lapic_timer_irq_handler(const kernel::IRQ *irq, void *priv);
 				bool calibrate();
+				void charge_elapsed();
+
+				util::Nanoseconds ticks_to_ns(uint64_t ticks) const;
+				uint64_t ns_to_ticks(util::Nanoseconds ns) const;
 			};
 		}
 	}
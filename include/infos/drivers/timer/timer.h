@@ -11,6 +11,7 @@
 #pragma once
 
 #include <infos/drivers/device.h>
+#include <infos/util/time.h>
 
 namespace infos
 {
@@ -35,6 +36,13 @@ namespace infos
 				virtual bool expired() const = 0;
 				virtual uint64_t count() const = 0;
 				virtual uint64_t frequency() const = 0;
+
+				/**
+				 * Arms the timer to raise a single event after (approximately) the given delay.  A
+				 * delay of zero means that no event is required, and the timer should be quiesced for
+				 * as long as it can be.  Timers that cannot be used as an event source return FALSE.
+				 */
+				virtual bool arm(util::Nanoseconds delay) { return false; }
 			};
 		}
 	}
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/drivers/timer/tsc.h
+ * 
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ * 
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/drivers/timer/clocksource.h>
+
+namespace infos
+{
+	namespace drivers
+	{
+		namespace timer
+		{
+			class TSC : public ClockSource
+			{
+			public:
+				static const DeviceClass TSCDeviceClass;
+				const DeviceClass& device_class() const override { return TSCDeviceClass; }
+				
+				TSC();
+				
+				bool init(kernel::DeviceManager& dm) override;
+				
+				/**
+				 * Converts the current TSC value into nanoseconds, using the multiplier and shift
+				 * determined during calibration:  ns = (cycles * mult) >> shift
+				 */
+				util::Nanoseconds read() const override
+				{
+					return util::Nanoseconds((uint64_t)(((unsigned __int128)rdtsc() * _mult) >> Shift));
+				}
+				
+				uint64_t frequency() const override { return _frequency; }
+				
+				static inline uint64_t rdtsc()
+				{
+					uint32_t low, high;
+					asm volatile("rdtsc" : "=a"(low), "=d"(high));
+					return low | ((uint64_t)high << 32);
+				}
+				
+			private:
+				static const unsigned int Shift = 32;
+				
+				uint64_t _frequency;
+				uint64_t _mult;
+				
+				bool calibrate();
+			};
+		}
+	}
+}
@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/drivers/block/block-device.h>
+#include <infos/drivers/block/block-device-partition.h>
+#include <infos/drivers/virtio/virtqueue.h>
+#include <infos/kernel/log.h>
+#include <infos/util/list.h>
+#include <infos/util/lock.h>
+#include <infos/util/wakequeue.h>
+
+#define VIRTIO_BLK_F_SIZE_MAX	(1u << 1)
+#define VIRTIO_BLK_F_SEG_MAX	(1u << 2)
+#define VIRTIO_BLK_F_RO			(1u << 5)
+#define VIRTIO_BLK_F_FLUSH		(1u << 9)
+
+#define VIRTIO_BLK_T_IN			0
+#define VIRTIO_BLK_T_OUT		1
+#define VIRTIO_BLK_T_FLUSH		4
+
+#define VIRTIO_BLK_S_OK			0
+
+// The most data segments a single request is built from.
+#define VIRTIO_BLK_MAX_SEGMENTS	16
+
+// The most requests that can be outstanding on a device.
+#define VIRTIO_BLK_MAX_REQUESTS	64
+
+// The largest transfer a single request is made for.
+#define VIRTIO_BLK_MAX_REQUEST_BLOCKS	2048
+
+namespace infos
+{
+	namespace kernel
+	{
+		class IRQ;
+	}
+
+	namespace drivers
+	{
+		namespace virtio
+		{
+			struct VirtIOBlockDeviceConfiguration
+			{
+				// The base of the legacy I/O registers.
+				uint16_t io_base;
+
+				// The MSI-X interrupt of the request queue, or NULL if requests must be polled for.
+				kernel::IRQ *irq;
+			};
+
+			/**
+			 * A virtio block device, driven through the legacy virtio PCI interface.  Every request
+			 * is a header, its data segments and a status byte; with indirect descriptors the
+			 * whole request occupies a single descriptor in the ring, so as many requests as the
+			 * device has ring entries (up to a limit) can be outstanding at once.
+			 */
+			class VirtIOBlockDevice : public block::BlockDevice
+			{
+			public:
+				static const DeviceClass VirtIOBlockDeviceClass;
+				const DeviceClass& device_class() const override { return VirtIOBlockDeviceClass; }
+
+				VirtIOBlockDevice(const VirtIOBlockDeviceConfiguration& cfg);
+
+				bool init(kernel::DeviceManager& dm) override;
+
+				size_t block_count() const override { return _capacity; }
+				size_t block_size() const override { return 512; }
+				unsigned int queue_depth() const override { return _nr_slots; }
+
+			protected:
+				bool read_blocks_direct(void *buffer, size_t offset, size_t count) override;
+				bool write_blocks_direct(const void *buffer, size_t offset, size_t count) override;
+				bool transfer_vector_direct(bool write, size_t offset, const block::BlockSegment *segments, unsigned int nr_segments) override;
+				bool flush_direct() override;
+
+			private:
+				struct Segment {
+					phys_addr_t pa;
+					uint32_t size;
+				};
+
+				struct RequestHeader {
+					uint32_t type;
+					uint32_t reserved;
+					uint64_t sector;
+				} __packed;
+
+				// The memory of a request that the device reads from and writes to.  With indirect
+				// descriptors, the request's descriptor table is in here too.
+				struct Request {
+					VirtQueue::Descriptor table[VIRTIO_BLK_MAX_SEGMENTS + 2];
+					RequestHeader header;
+					volatile uint8_t status;
+				} __aligned(16);
+
+				struct Slot {
+					volatile bool done;
+					bool error;
+					util::WakeQueue waiters;
+				};
+
+				uint16_t _io_base;
+				kernel::IRQ *_irq;
+
+				uint32_t _features;
+				uint64_t _capacity;
+				size_t _max_segment_size;
+				unsigned int _max_segments;
+
+				VirtQueue _vq;
+
+				Request *_requests;
+				phys_addr_t _requests_pa;
+
+				unsigned int _nr_slots;
+				Slot _slots[VIRTIO_BLK_MAX_REQUESTS];
+
+				uint64_t _free_slots;
+				util::SpinLock _queue_lock;
+				volatile bool _slot_available;
+				util::WakeQueue _slot_waiters;
+
+				bool indirect() const { return _features & VIRTIO_RING_F_INDIRECT_DESC; }
+
+				// Without indirect descriptors, each slot owns a fixed run of ring descriptors.
+				static const unsigned int DESCRIPTORS_PER_SLOT = VIRTIO_BLK_MAX_SEGMENTS + 2;
+
+				bool init_queue();
+
+				int alloc_slot();
+				void free_slot(int slot);
+
+				bool execute(int slot, uint32_t type, uint64_t sector, const Segment *segments, unsigned int nr_segments, bool write);
+				void complete_requests();
+
+				bool transfer(bool write, uint64_t sector, void *buffer, size_t nr_blocks);
+				bool transfer_one(bool write, uint64_t sector, void *buffer, size_t nr_blocks);
+
+				static void virtio_irq_handler(const kernel::IRQ *irq, void *priv);
+
+				util::List<block::BlockDevicePartition *> _partitions;
+			};
+
+			extern kernel::ComponentLog virtio_log;
+		}
+	}
+}
@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/define.h>
+
+#define VIRTIO_PCI_VENDOR			0x1af4
+#define VIRTIO_PCI_DEVICE_BLOCK		0x1001
+
+// The registers of the legacy virtio PCI interface, relative to the I/O BAR.
+#define VIRTIO_PCI_HOST_FEATURES	0x00
+#define VIRTIO_PCI_GUEST_FEATURES	0x04
+#define VIRTIO_PCI_QUEUE_PFN		0x08
+#define VIRTIO_PCI_QUEUE_NUM		0x0C
+#define VIRTIO_PCI_QUEUE_SEL		0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY		0x10
+#define VIRTIO_PCI_STATUS			0x12
+#define VIRTIO_PCI_ISR				0x13
+#define VIRTIO_MSI_CONFIG_VECTOR	0x14
+#define VIRTIO_MSI_QUEUE_VECTOR		0x16
+
+// The device-specific configuration follows the common registers, which are two registers
+// longer when MSI-X is enabled.
+#define VIRTIO_PCI_CONFIG(__msix)	((__msix) ? 0x18 : 0x14)
+
+#define VIRTIO_MSI_NO_VECTOR		0xffff
+
+#define VIRTIO_STATUS_ACKNOWLEDGE	0x01
+#define VIRTIO_STATUS_DRIVER		0x02
+#define VIRTIO_STATUS_DRIVER_OK		0x04
+#define VIRTIO_STATUS_FAILED		0x80
+
+#define VIRTIO_RING_F_INDIRECT_DESC	(1u << 28)
+
+#define VRING_DESC_F_NEXT			1
+#define VRING_DESC_F_WRITE			2
+#define VRING_DESC_F_INDIRECT		4
+
+// The legacy interface places the used ring on the next page boundary after the available ring.
+#define VIRTIO_PCI_VRING_ALIGN		4096
+
+namespace infos
+{
+	namespace mm
+	{
+		struct PageDescriptor;
+	}
+
+	namespace drivers
+	{
+		namespace virtio
+		{
+			/**
+			 * A split virtqueue: a descriptor table, a ring of available descriptor chains that
+			 * the driver publishes to the device, and a ring of used chains that the device
+			 * hands back.  The queue does no locking of its own.
+			 */
+			class VirtQueue
+			{
+			public:
+				struct Descriptor {
+					uint64_t addr;
+					uint32_t len;
+					uint16_t flags;
+					uint16_t next;
+				} __packed;
+
+				VirtQueue();
+
+				bool init(unsigned int size);
+
+				unsigned int size() const { return _size; }
+				phys_addr_t ring_pa() const { return _ring_pa; }
+
+				Descriptor *descriptors() const { return _desc; }
+
+				void publish(uint16_t head);
+				bool next_used(uint32_t& id, uint32_t& len);
+
+			private:
+				struct UsedElement {
+					uint32_t id;
+					uint32_t len;
+				} __packed;
+
+				unsigned int _size;
+
+				mm::PageDescriptor *_ring_pgd;
+				phys_addr_t _ring_pa;
+
+				Descriptor *_desc;
+				volatile uint16_t *_avail_flags, *_avail_idx, *_avail_ring;
+				volatile uint16_t *_used_flags, *_used_idx;
+				volatile UsedElement *_used_ring;
+
+				uint16_t _next_avail, _last_used;
+			};
+		}
+	}
+}
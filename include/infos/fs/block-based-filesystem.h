@@ -15,6 +15,8 @@ namespace infos
 	
 	namespace fs
 	{
+		class Readahead;
+		
 		class BlockBasedFilesystem : public Filesystem
 		{
 		public:
@@ -25,6 +27,8 @@ namespace infos
 		protected:
 			drivers::block::BlockDevice& block_device() const { return _bdev; }
 			
+			void readahead(Readahead& ra, size_t base_block, size_t index, size_t count, size_t nr_blocks);
+			
 		private:
 			drivers::block::BlockDevice& _bdev;
 		};
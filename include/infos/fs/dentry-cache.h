@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/mm/slab.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
+
+namespace infos
+{
+	namespace fs
+	{
+		class VFSNode;
+
+		/**
+		 * A cache of the results of looking up names in the VFS.  Each entry maps a name in a
+		 * parent node to the child node it names, or records that there is no such child (a
+		 * negative entry), and entries are found through a hash table keyed on both.  Entries
+		 * with no parent map a whole absolute path to its node, so that a path that has been
+		 * looked up before is found with a single probe.
+		 *
+		 * Entries for nodes that exist are kept for as long as the nodes themselves -- i.e.
+		 * until the parent is mounted over.  Negative entries and path entries are only
+		 * shortcuts, and sit on an LRU list from which the oldest are dropped once there are too
+		 * many.  Every change to the namespace advances a generation number, which retires all
+		 * of the path entries at once.
+		 */
+		class DentryCache
+		{
+		public:
+			typedef util::String::hash_type hash_type;
+
+			DentryCache();
+
+			bool lookup(const VFSNode *parent, const char *name, size_t length, hash_type hash, VFSNode *& node);
+			VFSNode *insert(const VFSNode *parent, const util::String& name, VFSNode *node, uint64_t generation);
+
+			bool lookup_path(const util::String& path, VFSNode *& node);
+			void insert_path(const util::String& path, VFSNode *node, uint64_t generation);
+
+			void invalidate(const VFSNode *parent, const util::String& name);
+			void invalidate_children(const VFSNode *parent);
+
+			uint64_t generation() const { return _generation; }
+
+			uint64_t nr_hits() const { return _nr_hits; }
+			uint64_t nr_misses() const { return _nr_misses; }
+
+		private:
+			struct Dentry : mm::SlabAllocated<Dentry>
+			{
+				static constexpr const char *slab_cache_name = "dentry";
+
+				Dentry *hash_next, *hash_prev;
+				Dentry *lru_next, *lru_prev;
+
+				const VFSNode *parent;
+				util::String name;
+				hash_type hash;
+
+				// The node named, or NULL for a negative entry.
+				VFSNode *node;
+
+				// Whether the entry is on the LRU list, and the generation of a path entry.
+				bool on_lru;
+				uint64_t generation;
+
+				Dentry(const VFSNode *parent, const util::String& name, VFSNode *node)
+					: hash_next(NULL), hash_prev(NULL), lru_next(NULL), lru_prev(NULL),
+					parent(parent), name(name), hash(name.get_hash()), node(node), on_lru(false), generation(0) { }
+			};
+
+			static const unsigned int NR_BUCKETS = 1024;
+
+			Dentry *_buckets[NR_BUCKETS];
+			Dentry *_lru_head, *_lru_tail;
+			unsigned int _nr_lru;
+
+			volatile uint64_t _generation;
+			uint64_t _nr_hits, _nr_misses;
+
+			util::Mutex _mtx;
+
+			static unsigned int bucket_of(const VFSNode *parent, hash_type hash);
+
+			Dentry *find(const VFSNode *parent, const char *name, size_t length, hash_type hash) const;
+
+			void hash_insert(Dentry *dentry);
+			void hash_remove(Dentry *dentry);
+			void lru_insert(Dentry *dentry);
+			void lru_remove(Dentry *dentry);
+
+			void add(Dentry *dentry);
+			void remove(Dentry *dentry);
+		};
+	}
+}
@@ -60,10 +60,24 @@ namespace infos
 			drivers::Device& _dev;
 		};
 		
-		class DeviceFSDirectory : public SimpleDirectory
+		/**
+		 * Lists the devices there were when the directory was opened.  Only the devices
+		 * themselves are remembered, and their names are read as the entries are.
+		 */
+		class DeviceFSDirectory : public Directory
 		{
 		public:
 			DeviceFSDirectory(DeviceFSRootNode& node);
+			virtual ~DeviceFSDirectory();
+
+			bool read_entry(DirectoryEntry& entry) override;
+			unsigned int read_entries(DirectoryEntrySink& sink) override;
+			void close() override { }
+
+		private:
+			drivers::Device **_devices;
+			unsigned int _nr_devices;
+			unsigned int _cursor;
 		};
 	}
 }
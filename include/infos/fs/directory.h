@@ -15,30 +15,63 @@ namespace infos
 			unsigned int size;
 		};
 		
+		/**
+		 * Receives the entries of a directory as they are read in a batch.
+		 */
+		class DirectoryEntrySink
+		{
+		public:
+			virtual ~DirectoryEntrySink() { }
+
+			/**
+			 * Takes an entry, unless there is no room left for it -- in which case it is the
+			 * first entry read by the next batch.
+			 */
+			virtual bool add(const char *name, size_t length, unsigned int size) = 0;
+		};
+
 		class Directory
 		{
 		public:
+			Directory() : _has_pending(false) { }
 			virtual ~Directory() { }
 		
 			virtual bool read_entry(DirectoryEntry& entry) = 0;
+			virtual unsigned int read_entries(DirectoryEntrySink& sink);
 			
 			virtual void close() = 0;
+
+		private:
+			// An entry that was read, but that the last sink had no room for.
+			DirectoryEntry _pending;
+			bool _has_pending;
 		};
 		
+		/**
+		 * A directory whose entries are collected when it is opened.
+		 */
 		class SimpleDirectory : public Directory
 		{
 		public:
-			SimpleDirectory() : _current_entry(0) { }
+			SimpleDirectory() : _head(NULL), _tail(NULL), _cursor(NULL) { }
+			virtual ~SimpleDirectory();
 			
 			bool read_entry(DirectoryEntry& entry) override;
+			unsigned int read_entries(DirectoryEntrySink& sink) override;
 			void close() override;
 			
 		protected:
 			void add_entry(const DirectoryEntry& e);
 			
 		private:
-			util::List<DirectoryEntry> _entries;
-			unsigned int _current_entry;
+			struct Entry
+			{
+				Entry *next;
+				DirectoryEntry de;
+			};
+
+			Entry *_head, *_tail;
+			Entry *_cursor;
 		};
 	}
 }
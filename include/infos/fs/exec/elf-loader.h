@@ -9,19 +9,23 @@ namespace infos
 	namespace fs
 	{
 		class File;
+		class PFSNode;
 		
 		namespace exec
 		{
 			class ElfLoader : public Loader
 			{
 			public:
-				ElfLoader(File& f);
+				ElfLoader(File& f, const PFSNode *node = NULL);
 				virtual ~ElfLoader() { }
 				
 				kernel::Process* load(const util::String& cmdline) override;
 				
 			private:
 				File& _file;
+
+				// The node the file was opened from, if its read-only segments may be shared.
+				const PFSNode *_node;
 			};
 			
 			extern kernel::ComponentLog elf_log;
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: MIT */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		struct PageDescriptor;
+		class VMA;
+	}
+
+	namespace fs
+	{
+		class File;
+		class PFSNode;
+
+		namespace exec
+		{
+			/**
+			 * The pages of a read-only segment of an executable, as it was loaded from a
+			 * particular version of the file.
+			 */
+			struct ImageSegment
+			{
+				ImageSegment *next;
+
+				const PFSNode *node;
+				uint64_t version;
+
+				off_t offset;
+				virt_addr_t vaddr;
+				size_t filesz, memsz;
+
+				mm::PageDescriptor **pages;
+				unsigned int nr_pages;
+			};
+
+			/**
+			 * A cache of the read-only segments of the executables that have been loaded, so
+			 * that processes launched from the same image share the pages of those segments
+			 * rather than each reading in their own copy.  The cache holds a reference to each
+			 * page, and every address space it is mapped into holds another.  A segment is
+			 * dropped from the cache when its file changes, or when it is the least recently
+			 * used of too many -- its pages are freed once the last process using them has
+			 * gone.
+			 */
+			class ImageCache
+			{
+			public:
+				ImageCache() : _segments(NULL), _nr_segments(0) { }
+
+				bool map_segment(mm::VMA& vma, const PFSNode& node, File& f, off_t offset, virt_addr_t vaddr, size_t filesz, size_t memsz);
+
+			private:
+				// The segments, the most recently used first.
+				ImageSegment *_segments;
+				unsigned int _nr_segments;
+
+				util::Mutex _mtx;
+
+				ImageSegment *find(const PFSNode& node, off_t offset, virt_addr_t vaddr, size_t filesz, size_t memsz);
+				ImageSegment *load(const PFSNode& node, File& f, off_t offset, virt_addr_t vaddr, size_t filesz, size_t memsz);
+				void release(ImageSegment *segment);
+			};
+
+			extern ImageCache image_cache;
+		}
+	}
+}
@@ -7,6 +7,16 @@ namespace infos
 {
 	namespace fs
 	{
+		/**
+		 * One of the buffers of a vectored read or write.  This is laid out as userspace
+		 * passes it in.
+		 */
+		struct IOVector
+		{
+			void *base;
+			size_t length;
+		};
+
 		class File
 		{
 		public:
@@ -24,6 +34,11 @@ namespace infos
 			virtual int pwrite(const void *buffer, size_t size, off_t off) { return 0; }
 			virtual void seek(off_t offset, SeekType type) { }
 
+			virtual int readv(const IOVector *iov, unsigned int nr_iov);
+			virtual int preadv(const IOVector *iov, unsigned int nr_iov, off_t off);
+			virtual int writev(const IOVector *iov, unsigned int nr_iov);
+			virtual int pwritev(const IOVector *iov, unsigned int nr_iov, off_t off);
+
 			virtual void close() { }
 		};
 	}
@@ -13,6 +13,7 @@
 #include <infos/fs/pfs-node.h>
 #include <infos/fs/file.h>
 #include <infos/fs/directory.h>
+#include <infos/fs/readahead.h>
 #include <infos/drivers/block/block-device.h>
 #include <infos/util/string.h>
 #include <infos/util/map.h>
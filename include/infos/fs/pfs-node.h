@@ -14,15 +14,29 @@ namespace infos
 		class PFSNode : public FSNode<PFSNode>
 		{
 		public:
-			PFSNode(PFSNode *parent, Filesystem& owner) : FSNode(parent), _owner(owner) { }
+			PFSNode(PFSNode *parent, Filesystem& owner) : FSNode(parent), _owner(owner), _version(0) { }
 			
 			virtual File *open() = 0;
 			virtual Directory *opendir() = 0;
+
+			/**
+			 * Creates an empty regular file in this directory.  Filesystems that cannot create
+			 * files leave this alone.
+			 */
+			virtual PFSNode *create(const util::String& name) { return NULL; }
 			
 			Filesystem& owner() const { return _owner; }
+
+			/**
+			 * Counts the changes made to the node's data, so that anything kept from an
+			 * earlier read of it can tell when it has gone stale.
+			 */
+			uint64_t version() const { return _version; }
+			void changed() { __sync_add_and_fetch(&_version, 1); }
 			
 		private:
 			Filesystem& _owner;
+			volatile uint64_t _version;
 		};
 	}
 }
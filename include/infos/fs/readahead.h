@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/fs/readahead.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace fs
+	{
+		/**
+		 * Tracks the access pattern of an open file, to decide which blocks of the file should
+		 * be read ahead of the reader.  While the file is being read sequentially, the window
+		 * of blocks read ahead doubles each time the reader catches up with it, up to a limit.
+		 * A non-sequential access collapses the window.  Blocks are numbered relative to the
+		 * start of the file.
+		 */
+		class Readahead
+		{
+		public:
+			Readahead() : _prev_index(0), _next_index(0), _ra_end(0), _window(0) { }
+
+			bool access(size_t index, size_t count, size_t nr_blocks, size_t& ra_index, size_t& ra_count);
+
+			size_t window() const { return _window; }
+
+		private:
+			size_t _prev_index, _next_index;
+			size_t _ra_end;
+			size_t _window;
+		};
+	}
+}
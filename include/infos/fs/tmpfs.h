@@ -3,45 +3,153 @@
 
 #include <infos/fs/filesystem.h>
 #include <infos/fs/directory.h>
+#include <infos/fs/file.h>
 #include <infos/fs/pfs-node.h>
+#include <infos/util/lock.h>
 #include <infos/util/map.h>
 
+// The number of slots in a node of a file's page tree -- a page's worth of pointers.
+#define TMPFS_TREE_SHIFT	9
+#define TMPFS_TREE_SLOTS	(1 << TMPFS_TREE_SHIFT)
+#define TMPFS_TREE_MAX_HEIGHT	6
+
 namespace infos
 {
+	namespace mm
+	{
+		struct PageDescriptor;
+	}
+
 	namespace fs
 	{
+		/**
+		 * A filesystem that lives entirely in memory.  The data of its files is held in whole
+		 * pages taken from the page allocator, and the number of pages all of its files may
+		 * hold between them is limited.
+		 */
 		class TempFS : public Filesystem
 		{
 		public:
+			TempFS();
+
 			PFSNode *mount() override;
-			
+
 			const util::String name() const { return "tmpfs"; }
+
+			bool reserve_page();
+			void release_pages(size_t nr_pages);
+
+			size_t nr_pages() const { return _nr_pages; }
+			size_t max_pages() const { return _max_pages; }
+
+		private:
+			volatile size_t _nr_pages;
+			size_t _max_pages;
 		};
-		
+
+		/**
+		 * Maps the page indices of a file to the pages holding its data.  The tree is made of
+		 * page-sized nodes, and grows taller as the file does.  A page that has never been
+		 * written to is not in the tree at all.
+		 */
+		class TempFSPageTree
+		{
+		public:
+			TempFSPageTree() : _root(NULL), _height(0) { }
+
+			mm::PageDescriptor *lookup(size_t index) const;
+			bool insert(size_t index, mm::PageDescriptor *pgd);
+			size_t clear();
+
+		private:
+			void **_root;
+			unsigned int _height;
+
+			size_t capacity() const { return _height == 0 ? 0 : (size_t)1 << (TMPFS_TREE_SHIFT * _height); }
+
+			static void **alloc_node();
+			static void free_node(void **node);
+			static size_t clear_node(void **node, unsigned int height);
+		};
+
 		class TempFSNode : public PFSNode
 		{
 		public:
-			TempFSNode(TempFS& fs, const util::String& name);
+			TempFSNode(TempFS& fs, const util::String& name, bool is_file = false);
+			virtual ~TempFSNode();
 
 			PFSNode* get_child(const util::String& name) override;
 			PFSNode* mkdir(const util::String& name) override;
-			
+			PFSNode* create(const util::String& name) override;
+
 			File* open() override;
 			Directory* opendir() override;
-			
-			const util::Map<util::String::hash_type, TempFSNode *>& children() const { return _children; }
-			
+
+			TempFSNode *next_child(TempFSNode *prev);
+
 			const util::String& name() const { return _name; }
-			
+			bool is_file() const { return _is_file; }
+			size_t size() const { return _size; }
+
+			int read_data(const IOVector *iov, unsigned int nr_iov, off_t off);
+			int write_data(const IOVector *iov, unsigned int nr_iov, off_t off);
+
 		private:
 			const util::String _name;
 			util::Map<util::String::hash_type, TempFSNode *> _children;
+
+			// The children in the order they were created in.
+			TempFSNode *_first_child, *_last_child;
+			TempFSNode *_next_sibling;
+
+			bool _is_file;
+			size_t _size;
+			TempFSPageTree _pages;
+			util::Mutex _mtx;
+
+			TempFS& fs() const { return (TempFS&)owner(); }
+			mm::PageDescriptor *page_for_write(size_t index, bool partial);
+			void add_child(TempFSNode *child);
+		};
+
+		class TempFSFile : public File
+		{
+		public:
+			TempFSFile(TempFSNode& node) : _node(node), _pos(0) { }
+
+			int read(void *buffer, size_t size) override;
+			int pread(void *buffer, size_t size, off_t off) override;
+			int write(const void *buffer, size_t size) override;
+			int pwrite(const void *buffer, size_t size, off_t off) override;
+			void seek(off_t offset, SeekType type) override;
+
+			int readv(const IOVector *iov, unsigned int nr_iov) override;
+			int preadv(const IOVector *iov, unsigned int nr_iov, off_t off) override;
+			int writev(const IOVector *iov, unsigned int nr_iov) override;
+			int pwritev(const IOVector *iov, unsigned int nr_iov, off_t off) override;
+
+		private:
+			TempFSNode& _node;
+			off_t _pos;
 		};
-		
-		class TempFSDirectory : public SimpleDirectory
+
+		/**
+		 * Reads the children of a directory where they are, rather than collecting them when
+		 * the directory is opened.  The directory keeps its place by the last child read, so
+		 * children created in the meantime are read too.
+		 */
+		class TempFSDirectory : public Directory
 		{
 		public:
-			TempFSDirectory(TempFSNode& node);
+			TempFSDirectory(TempFSNode& node) : _node(node), _last(NULL) { }
+
+			bool read_entry(DirectoryEntry& entry) override;
+			unsigned int read_entries(DirectoryEntrySink& sink) override;
+			void close() override { }
+
+		private:
+			TempFSNode& _node;
+			TempFSNode *_last;
 		};
 	}
 }
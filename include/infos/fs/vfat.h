@@ -3,6 +3,11 @@
 
 #include <infos/fs/block-based-filesystem.h>
 #include <infos/fs/pfs-node.h>
+#include <infos/fs/file.h>
+#include <infos/fs/directory.h>
+#include <infos/fs/readahead.h>
+#include <infos/util/lock.h>
+#include <infos/util/string.h>
 
 namespace infos
 {
@@ -23,38 +28,267 @@ namespace infos
 			uint16_t nr_heads;
 			uint32_t nr_hidden_blocks;
 			uint32_t total_blocks_big;
-			uint16_t phys_drive_nr;
-			uint8_t ebr_signature;
-			uint32_t volume_serial_nr;
-			char label[11];
-			char fsid[8];
-			char bspr[0x1c0];
+
+			union {
+				// The extended boot record of FAT12 and FAT16.
+				struct {
+					uint8_t phys_drive_nr;
+					uint8_t reserved;
+					uint8_t ebr_signature;
+					uint32_t volume_serial_nr;
+					char label[11];
+					char fsid[8];
+				} __packed fat16;
+
+				// The extended boot record of FAT32.
+				struct {
+					uint32_t nr_blocks_in_fat;
+					uint16_t flags;
+					uint16_t version;
+					uint32_t root_cluster;
+					uint16_t fsinfo_block;
+					uint16_t backup_boot_block;
+					uint8_t reserved[12];
+					uint8_t phys_drive_nr;
+					uint8_t reserved1;
+					uint8_t ebr_signature;
+					uint32_t volume_serial_nr;
+					char label[11];
+					char fsid[8];
+				} __packed fat32;
+			} __packed;
+
+			char bspr[0x1a4];
 			uint16_t signature;
 		} __packed;
 
 		static_assert(sizeof(vfat_boot_block) == 512, "VFAT BOOT BLOCK not correct size");
 
+		struct vfat_dir_entry {
+			char name[11];
+			uint8_t attr;
+			uint8_t nt_flags;
+			uint8_t create_time_fine;
+			uint16_t create_time;
+			uint16_t create_date;
+			uint16_t access_date;
+			uint16_t first_cluster_hi;
+			uint16_t write_time;
+			uint16_t write_date;
+			uint16_t first_cluster_lo;
+			uint32_t size;
+		} __packed;
+
+		struct vfat_lfn_entry {
+			uint8_t order;
+			uint16_t name1[5];
+			uint8_t attr;
+			uint8_t type;
+			uint8_t checksum;
+			uint16_t name2[6];
+			uint16_t first_cluster;
+			uint16_t name3[2];
+		} __packed;
+
+		static_assert(sizeof(vfat_dir_entry) == 32, "VFAT DIRECTORY ENTRY not correct size");
+		static_assert(sizeof(vfat_lfn_entry) == 32, "VFAT LFN ENTRY not correct size");
+
+		class VFATNode;
+
+		/**
+		 * A FAT12, FAT16 or FAT32 filesystem.  The first copy of the FAT is read into memory when
+		 * the filesystem is mounted, and changes to it are written through to every copy on the
+		 * device.  The data of files and directories is located through their extents -- the
+		 * runs of contiguous clusters in their cluster chains -- so that each run is read or
+		 * written with a single transfer.
+		 */
 		class VFAT : public BlockBasedFilesystem
 		{
+			friend class VFATNode;
+			friend class VFATFile;
+			friend class VFATDirectory;
+
 		public:
+			enum FATType { FAT12, FAT16, FAT32 };
+
 			VFAT(drivers::block::BlockDevice& bdev);
+			virtual ~VFAT();
+
 			PFSNode *mount() override;
 			const util::String name() const { return "vfat"; }
-			
+
+			FATType fat_type() const { return _fat_type; }
+
 		private:
 			struct vfat_boot_block _boot_block;
+
+			FATType _fat_type;
+			size_t _block_size;
+			size_t _cluster_blocks;
+			size_t _cluster_size;
+
+			size_t _fat_start, _fat_blocks;
+			unsigned int _nr_fats;
+			size_t _root_start, _root_blocks;
+			uint32_t _root_cluster;
+			size_t _data_start;
+			uint32_t _nr_clusters;
+
+			uint8_t *_fat;
+			uint8_t *_fat_dirty;
+			uint32_t _next_free;
+
+			VFATNode *_root;
+
+			// Protects the FAT, and the metadata of every node.
+			util::Mutex _mtx;
+
+			size_t cluster_to_block(uint32_t cluster) const { return _data_start + ((size_t)(cluster - 2) * _cluster_blocks); }
+			bool is_eoc(uint32_t entry) const;
+			uint32_t eoc() const;
+
+			uint32_t fat_entry(uint32_t cluster) const;
+			void set_fat_entry(uint32_t cluster, uint32_t value);
+			bool sync_fat();
+
+			uint32_t allocate_cluster(uint32_t prev);
+			bool zero_blocks(size_t block, size_t count);
 		};
 
+		/**
+		 * A run of contiguous blocks in a file or directory.
+		 */
+		struct VFATExtent
+		{
+			size_t file_block;
+			size_t block;
+			size_t count;
+		};
+
+		/**
+		 * A file or directory in a VFAT filesystem.  A directory builds an index of its entries
+		 * the first time it is looked in, so that names are found with a hash table lookup
+		 * rather than by reading through its clusters again.
+		 */
 		class VFATNode : public PFSNode
 		{
+			friend class VFAT;
+			friend class VFATFile;
+			friend class VFATDirectory;
+
 		public:
-			VFATNode(VFAT& fs);
+			VFATNode(VFAT& fs, VFATNode *parent, const util::String& name, uint8_t attr, uint32_t first_cluster, uint32_t size);
+			virtual ~VFATNode();
 
 			PFSNode* get_child(const util::String& name) override;
 			PFSNode* mkdir(const util::String& name) override;
-			
+
 			File* open() override;
 			Directory* opendir() override;
+
+			const util::String& name() const { return _name; }
+			bool is_directory() const { return _attr & ATTR_DIRECTORY; }
+			uint32_t size() const { return _size; }
+
+			static const uint8_t ATTR_READ_ONLY = 0x01;
+			static const uint8_t ATTR_HIDDEN = 0x02;
+			static const uint8_t ATTR_SYSTEM = 0x04;
+			static const uint8_t ATTR_VOLUME_ID = 0x08;
+			static const uint8_t ATTR_DIRECTORY = 0x10;
+			static const uint8_t ATTR_ARCHIVE = 0x20;
+			static const uint8_t ATTR_LFN = 0x0f;
+
+		private:
+			struct IndexEntry
+			{
+				IndexEntry *hash_next;
+				IndexEntry *list_next;
+
+				util::String name;
+				util::String::hash_type hash;
+
+				uint8_t attr;
+				uint32_t first_cluster;
+				uint32_t size;
+
+				// Where the short entry is on the device.
+				size_t dirent_block;
+				unsigned int dirent_index;
+
+				VFATNode *node;
+			};
+
+			VFAT& _fs;
+			const util::String _name;
+
+			uint8_t _attr;
+			uint32_t _first_cluster;
+			uint32_t _size;
+
+			size_t _dirent_block;
+			unsigned int _dirent_index;
+
+			// The extents of the node's data, once they have been found.
+			bool _mapped;
+			VFATExtent *_extents;
+			unsigned int _nr_extents, _max_extents;
+			size_t _nr_blocks;
+
+			// The index of a directory's entries, once it has been built.
+			bool _indexed;
+			IndexEntry **_buckets;
+			unsigned int _nr_buckets;
+			unsigned int _nr_entries;
+
+			// The entries of a directory in the order they are stored in.
+			IndexEntry *_entries_head, *_entries_tail;
+
+			bool is_fixed_root() const { return _first_cluster == 0 && !parent() && _fs._fat_type != VFAT::FAT32; }
+
+			bool map();
+			bool add_extent(size_t file_block, size_t block, size_t count);
+			bool extend(size_t nr_blocks);
+			size_t block_of(size_t file_block, size_t& run) const;
+
+			bool transfer(bool write, void *buffer, size_t offset, size_t size);
+			void readahead(Readahead& ra, size_t offset, size_t size);
+			bool update_dirent();
+
+			static util::String::hash_type hash_name(const char *name, size_t length);
+			bool build_index();
+			IndexEntry *index_add(const util::String& name, const vfat_dir_entry& de, size_t block, unsigned int index);
+			IndexEntry *index_find(const util::String& name) const;
+			VFATNode *node_for(IndexEntry *entry);
+
+			bool find_free_dirent(size_t& block, unsigned int& index);
+		};
+
+		class VFATFile : public File
+		{
+		public:
+			VFATFile(VFATNode& node) : _node(node), _pos(0) { }
+
+			int read(void *buffer, size_t size) override;
+			int pread(void *buffer, size_t size, off_t off) override;
+			int write(const void *buffer, size_t size) override;
+			int pwrite(const void *buffer, size_t size, off_t off) override;
+			void seek(off_t offset, SeekType type) override;
+
+			int readv(const IOVector *iov, unsigned int nr_iov) override;
+			int preadv(const IOVector *iov, unsigned int nr_iov, off_t off) override;
+			int writev(const IOVector *iov, unsigned int nr_iov) override;
+			int pwritev(const IOVector *iov, unsigned int nr_iov, off_t off) override;
+
+		private:
+			VFATNode& _node;
+			off_t _pos;
+			Readahead _ra;
+		};
+
+		class VFATDirectory : public SimpleDirectory
+		{
+		public:
+			VFATDirectory(VFATNode& node);
 		};
 	}
 }
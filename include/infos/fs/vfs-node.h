@@ -2,7 +2,6 @@
 #pragma once
 
 #include <infos/fs/fs-node.h>
-#include <infos/util/map.h>
 
 namespace infos
 {
@@ -23,6 +22,9 @@ namespace infos
 
 			VFSNode* get_child(const util::String& name) override;
 			VFSNode* mkdir(const util::String& name) override;
+			VFSNode* create(const util::String& name);
+
+			VFSNode* lookup_child(const char *name, size_t length, util::String::hash_type hash);
 
 			PFSNode* pn() const { return _pn; }
 						
@@ -30,7 +32,6 @@ namespace infos
 			
 		private:
 			PFSNode *_pn;
-			util::Map<util::String::hash_type, VFSNode *> _children;
 		};
 	}
 }
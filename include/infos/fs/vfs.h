@@ -4,6 +4,7 @@
 #include <infos/kernel/subsystem.h>
 #include <infos/kernel/log.h>
 #include <infos/fs/vfs-node.h>
+#include <infos/fs/dentry-cache.h>
 #include <infos/util/list.h>
 #include <infos/util/string.h>
 
@@ -22,6 +23,15 @@ namespace infos
 		class Directory;
 		
 		class VFSNode;
+
+		namespace OpenFlags
+		{
+			enum OpenFlags
+			{
+				NONE = 0,
+				CREATE = 1,
+			};
+		}
 		
 		class VirtualFilesystem : public kernel::Subsystem
 		{
@@ -36,10 +46,15 @@ namespace infos
 			VFSNode *lookup_node(const util::String& path);
 			FilesystemRegistration *lookup_fs(const util::String& fstype) const;
 			
+			DentryCache& dcache() { return _dcache; }
+			
 		private:
 			VFSNode *_root_node;
+			DentryCache _dcache;
 			
 			util::List<FilesystemRegistration *> _filesystems;
+
+			VFSNode *create_node(const util::String& path);
 			Filesystem *instantiate_fs(const char *fstype, drivers::Device* dev = NULL);		
 		};
 				
@@ -20,9 +20,20 @@ namespace infos
 		class CPU
 		{
 		public:
+			CPU(unsigned int index) : _index(index) { }
+			
 			static CPU& current() {
 				return sys.arch().get_current_cpu();
 			}
+			
+			/**
+			 * Returns the logical index of this CPU.  The boot CPU is always zero, and the
+			 * remaining CPUs are numbered contiguously in the order they were discovered.
+			 */
+			unsigned int index() const { return _index; }
+			
+		private:
+			unsigned int _index;
 		};
 	}
 }
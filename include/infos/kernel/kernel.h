@@ -14,6 +14,7 @@
 #include <infos/kernel/device-manager.h>
 #include <infos/kernel/module.h>
 #include <infos/kernel/sched.h>
+#include <infos/kernel/timer-queue.h>
 #include <infos/kernel/syscall.h>
 #include <infos/mm/mm.h>
 #include <infos/fs/vfs.h>
@@ -27,6 +28,14 @@ namespace infos
 		class Arch;
 	}
 
+	namespace drivers
+	{
+		namespace timer
+		{
+			class ClockSource;
+		}
+	}
+
 	namespace kernel
 	{
 		class Process;
@@ -49,14 +58,19 @@ namespace infos
 			inline mm::MemoryManager& mm() { return _memory_manager; }
 			inline ModuleManager& module_manager() { return _module_manager; }
 			inline Scheduler& scheduler() { return _scheduler; }
+			inline TimerQueue& timer_queue() { return _timer_queue; }
 			inline fs::VirtualFilesystem& vfs() { return _vfs; }
 			inline util::CommandLine& cmdline() { return _cmdline; }
 			inline SyscallManager& syscalls() { return _scm; }
+			inline Process& kernel_process() const { return *_kernel_process; }
 
 			void update_runtime(util::Nanoseconds ns);
 			void print_tod();
 
-			const util::KernelRuntimeClock::Timepoint runtime() const { asm volatile("" ::: "memory"); return _runtime; }
+			void set_clocksource(drivers::timer::ClockSource& clocksource);
+			bool has_clocksource() const { return _clocksource != NULL; }
+
+			const util::KernelRuntimeClock::Timepoint runtime() const;
 
 			inline void spin_delay(util::Seconds s) { spin_delay(util::DurationCast<util::Nanoseconds>(s)); }
 			inline void spin_delay(util::Milliseconds s) { spin_delay(util::DurationCast<util::Nanoseconds>(s)); }
@@ -65,7 +79,7 @@ namespace infos
 
 			Process *launch_process(const util::String& path, const util::String& cmdline);
 
-			const util::TimeOfDay& time_of_day() const { return _tod; }
+			util::TimeOfDay time_of_day();
 
 		private:
 			arch::Arch& _arch;
@@ -74,6 +88,7 @@ namespace infos
 			mm::MemoryManager _memory_manager;
 			ModuleManager _module_manager;
 			Scheduler _scheduler;
+			TimerQueue _timer_queue;
 			fs::VirtualFilesystem _vfs;
 			util::CommandLine _cmdline;
 			SyscallManager _scm;
@@ -81,7 +96,14 @@ namespace infos
 			util::KernelRuntimeClock::Timepoint _runtime;
 			util::TimeOfDay _tod;
 
-			util::Nanoseconds _ticks_since_last_tod_update;
+			drivers::timer::ClockSource *_clocksource;
+			util::Nanoseconds _clocksource_offset;
+
+			util::KernelRuntimeClock::Timepoint _last_tod_update;
+
+			// Protects the time-of-day, which is advanced both from the timer interrupt and
+			// whenever it is read.
+			util::SpinLock _tod_lock;
 
 			Process *_kernel_process;
 
@@ -90,6 +112,7 @@ namespace infos
             void dump_partitions();
 			void initialise_tod();
 			void resync_tod();
+			void update_tod();
 			void increment_tod();
 		};
 
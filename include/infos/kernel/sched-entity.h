@@ -5,6 +5,7 @@
 #include <infos/util/time.h>
 #include <infos/util/event.h>
 #include <infos/util/string.h>
+#include <infos/util/rbtree.h>
 
 namespace infos
 {
@@ -34,6 +35,18 @@ namespace infos
             };
         }
 		
+		class SchedulingEntity;
+
+		/**
+		 * A red-black tree node that knows which scheduling entity it belongs to.
+		 */
+		struct SchedulingEntityNode : util::RBNode
+		{
+			SchedulingEntityNode(SchedulingEntity *owner) : Owner(owner) { }
+
+			SchedulingEntity *Owner;
+		};
+
 		class SchedulingEntity
 		{
 			friend class Scheduler;
@@ -42,7 +55,7 @@ namespace infos
 			typedef util::KernelRuntimeClock::Timepoint EntityStartTime;
 
 			SchedulingEntity(SchedulingEntityPriority::SchedulingEntityPriority priority, const util::String& name)
-			: _cpu_runtime(0), _exec_start_time(0), _name(name), _state(SchedulingEntityState::STOPPED), _priority(priority) { }
+			: _cpu_runtime(0), _exec_start_time(0), _vruntime(0), _charged_runtime(0), _runqueue_node(this), _on_cpu(false), _running(false), _name(name), _state(SchedulingEntityState::STOPPED), _priority(priority) { }
 			virtual ~SchedulingEntity() { }
 			
 			virtual bool activate(SchedulingEntity *prev) = 0;
@@ -59,10 +72,40 @@ namespace infos
 			bool stopped() const { return _state == SchedulingEntityState::STOPPED; }
 			
 			util::Event& state_changed() { return _state_changed; }
+
+			/**
+			 * The weighted virtual runtime of this entity, as maintained by a fair scheduling
+			 * algorithm.  Other algorithms are free to ignore it.
+			 */
+			EntityRuntime vruntime() const { return _vruntime; }
+			void vruntime(EntityRuntime vruntime) { _vruntime = vruntime; }
+
+			/**
+			 * The CPU runtime of this entity that has already been accounted for in its
+			 * virtual runtime.
+			 */
+			EntityRuntime charged_runtime() const { return _charged_runtime; }
+			void charged_runtime(EntityRuntime charged_runtime) { _charged_runtime = charged_runtime; }
+
+			/**
+			 * Scheduling algorithms that keep their runqueue in a red-black tree may embed
+			 * entities directly, using this node.
+			 */
+			util::RBNode& runqueue_node() { return _runqueue_node; }
+			static SchedulingEntity *from_runqueue_node(util::RBNode *node) { return static_cast<SchedulingEntityNode *>(node)->Owner; }
 			
 		private:
 			EntityRuntime _cpu_runtime;
 			EntityStartTime _exec_start_time;
+			EntityRuntime _vruntime;
+			EntityRuntime _charged_runtime;
+			SchedulingEntityNode _runqueue_node;
+
+			// Set while a CPU is running this entity -- or is still switching away from it.
+			volatile bool _on_cpu;
+
+			// Set while this entity is the current entity of a CPU, and so is not in the runqueue.
+			bool _running;
 
             const util::String _name;
             SchedulingEntityState::SchedulingEntityState _state;
@@ -14,11 +14,21 @@
 #include <infos/kernel/sched-entity.h>
 #include <infos/kernel/log.h>
 #include <infos/util/list.h>
+#include <infos/util/lock.h>
 
 namespace infos
 {
+	namespace drivers
+	{
+		namespace timer
+		{
+			class Timer;
+		}
+	}
+
 	namespace kernel
 	{
+		class CPU;
 		class Scheduler;
 		
 		class SchedulingAlgorithm
@@ -40,6 +50,8 @@ namespace infos
 			Scheduler(Kernel& owner);
 			
 			bool init();
+			bool add_cpu(CPU& cpu);
+			void init_cpu();
 			
 			SchedulingAlgorithm& algorithm() const { return *_algorithm; }
 			void algorithm(SchedulingAlgorithm& algorithm) { _algorithm = &algorithm; }
@@ -50,17 +62,50 @@ namespace infos
 			
 			void set_entity_state(SchedulingEntity& entity, SchedulingEntityState::SchedulingEntityState state);
 
-			SchedulingEntity& current_entity() const { return *_current; }
+			SchedulingEntity& current_entity() const { return *this_cpu().current; }
 			
 			void update_accounting();
+
+			void set_event_timer(drivers::timer::Timer& timer) { this_cpu().event_timer = &timer; }
+			bool tickless() const { return _tickless; }
+			util::Nanoseconds timeslice() const { return _timeslice; }
+			void update_event_timer();
 			
 		private:
+			/**
+			 * The scheduling state of a single CPU.
+			 */
+			struct CPUState
+			{
+				CPUState() : current(NULL), idle(NULL), running(false), event_timer(NULL) { }
+
+				SchedulingEntity *current;
+				SchedulingEntity *idle;
+				volatile bool running;				// Set once the CPU has joined the scheduler
+
+				drivers::timer::Timer *event_timer;
+				util::KernelRuntimeClock::Timepoint timeslice_end;
+			};
+
 			SchedulingAlgorithm *acquire_scheduler_algorithm();
+
+			CPUState& this_cpu();
+			const CPUState& this_cpu() const;
+
+			void activate_idle_entity(CPUState& cpu);
+			void notify_runnable(CPUState& cpu);
+
+			bool next_event(const CPUState& cpu, util::KernelRuntimeClock::Timepoint& deadline) const;
+			void program_event_timer(CPUState& cpu);
 			
-			bool _active;
+			volatile bool _active;
 			SchedulingAlgorithm *_algorithm;
-			SchedulingEntity *_current;
-			SchedulingEntity *_idle_entity;
+			util::SpinLock _lock;
+			CPUState _cpus[MAX_CPUS];
+
+			bool _tickless;
+			util::Nanoseconds _timeslice;
+			unsigned int _nr_runnable;
 		};
 		
 		extern ComponentLog sched_log;
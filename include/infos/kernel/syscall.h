@@ -34,9 +34,14 @@ namespace infos {
 			static unsigned int sys_write(ObjectHandle h, uintptr_t buffer, size_t size);
 			static unsigned int sys_pread(ObjectHandle h, uintptr_t buffer, size_t size, off_t off);
 			static unsigned int sys_pwrite(ObjectHandle h, uintptr_t buffer, size_t size, off_t off);
+			static unsigned int sys_readv(ObjectHandle h, uintptr_t iov, unsigned int nr_iov);
+			static unsigned int sys_writev(ObjectHandle h, uintptr_t iov, unsigned int nr_iov);
+			static unsigned int sys_preadv(ObjectHandle h, uintptr_t iov, unsigned int nr_iov, off_t off);
+			static unsigned int sys_pwritev(ObjectHandle h, uintptr_t iov, unsigned int nr_iov, off_t off);
 
 			static ObjectHandle sys_opendir(uintptr_t path, uint32_t flags);
 			static unsigned int sys_readdir(ObjectHandle h, uintptr_t buffer);
+			static unsigned int sys_getdents(ObjectHandle h, uintptr_t buffer, size_t size);
 			static unsigned int sys_closedir(ObjectHandle h);
 
 			static void sys_exit(unsigned int rc);
@@ -49,6 +54,7 @@ namespace infos {
 			static unsigned int sys_stop_thread(ObjectHandle h);
 			static unsigned int sys_join_thread(ObjectHandle h);
 			static unsigned long sys_usleep(unsigned long us);
+			static unsigned long sys_sleep_until(unsigned long deadline);
 			static unsigned int sys_get_tod(uintptr_t tpstruct);
 			static void sys_set_thread_name(ObjectHandle thr, uintptr_t name);
 			static unsigned long sys_get_ticks();
@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/kernel/timer-queue.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/kernel/subsystem.h>
+#include <infos/util/time.h>
+#include <infos/util/rbtree.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class Thread;
+		class TimerQueue;
+
+		/**
+		 * A one-shot kernel timer, that invokes a callback (in interrupt context) once its
+		 * deadline has passed.  The timer object is owned by the caller, and must remain valid
+		 * until it has either expired, or been cancelled.
+		 */
+		class KernelTimer
+		{
+			friend class TimerQueue;
+
+		public:
+			typedef void (*TimerCallback)(KernelTimer& timer, void *data);
+
+			KernelTimer(TimerCallback callback, void *data) : _callback(callback), _data(data), _pending(false) { }
+
+			const util::KernelRuntimeClock::Timepoint& deadline() const { return _deadline; }
+			bool pending() const { return _pending; }
+
+		private:
+			util::RBNode _node;
+			util::KernelRuntimeClock::Timepoint _deadline;
+			TimerCallback _callback;
+			void *_data;
+			bool _pending;
+		};
+
+		/**
+		 * Keeps the set of pending kernel timers ordered by deadline, so that the earliest deadline
+		 * can be found in constant time, and timers can be added and cancelled in O(log n).
+		 */
+		class TimerQueue : public Subsystem
+		{
+		public:
+			TimerQueue(Kernel& owner) : Subsystem(owner) { }
+
+			void add(KernelTimer& timer, util::KernelRuntimeClock::Timepoint deadline);
+			bool cancel(KernelTimer& timer);
+
+			void run_expired();
+
+			bool next_deadline(util::KernelRuntimeClock::Timepoint& deadline);
+
+			void sleep_until(util::KernelRuntimeClock::Timepoint deadline);
+			void sleep(util::Nanoseconds ns);
+
+		private:
+			struct Traits
+			{
+				static util::RBNode& node(KernelTimer& t) { return t._node; }
+				static KernelTimer *elem(util::RBNode *n) { return container_of(n, KernelTimer, _node); }
+				static bool less(const KernelTimer& l, const KernelTimer& r) { return l._deadline < r._deadline; }
+			};
+
+			util::RBTree<KernelTimer, Traits> _timers;
+			util::SpinLock _lock;
+		};
+	}
+}
@@ -34,6 +34,8 @@ namespace infos
 			PageDescriptor *next_free;
 			PageDescriptor *prev_free;
 			PageDescriptorType::PageDescriptorType type;
+			int free_order;		// Private to the allocation algorithm.
+			volatile unsigned int refcount;	// Only kept for pages that are shared.
 		} __aligned(16);
 
 		class MemoryManager;
@@ -75,6 +77,20 @@ namespace infos
 			const PageDescriptor *alloc_zero_page();
 			inline void free_page(PageDescriptor *pgd) { return free_pages(pgd, 0); }
 
+			/**
+			 * Takes a reference to a shared page.  A page that is to be shared must be given
+			 * its first reference by whoever allocated it.
+			 */
+			inline void get_page(PageDescriptor *pgd) { __sync_add_and_fetch(&pgd->refcount, 1); }
+
+			/**
+			 * Drops a reference to a shared page, and frees it once the last has gone.
+			 */
+			inline void put_page(PageDescriptor *pgd)
+			{
+				if (__sync_sub_and_fetch(&pgd->refcount, 1) == 0) free_pages(pgd, 0);
+			}
+
 			pfn_t pgd_to_pfn(const PageDescriptor *pgd) const
 			{
 				uintptr_t offset = (uintptr_t)pgd - (uintptr_t)_page_descriptors;
@@ -113,10 +129,31 @@ namespace infos
 			}
 
 		private:
+			/**
+			 * A per-CPU cache of free order-0 pages, which is refilled from and drained to the
+			 * allocation algorithm in batches.  Recently freed (hot) pages are reused first, and
+			 * the coldest pages are the ones that are drained.  As far as the algorithm is
+			 * concerned, pages in a cache are allocated.  A cache is only used by its own CPU,
+			 * except when every cache is drained, so its lock is (almost) never contended.
+			 */
+			struct PageCache
+			{
+				PageDescriptor *hot;
+				PageDescriptor *cold;
+				unsigned int count;
+				util::SpinLock lock;
+			};
+
 			uint64_t _nr_pages;
 			PageDescriptor *_page_descriptors;
 			PageAllocatorAlgorithm *_allocator_algorithm;
 			util::Mutex _mtx;
+			PageCache _page_caches[MAX_CPUS];
+
+			PageCache& this_cpu_cache();
+			PageDescriptor *alloc_cached_page();
+			void free_cached_page(PageDescriptor *pgd);
+			void drain_page_caches();
 
 			bool setup_page_descriptors();
 			bool self_test();
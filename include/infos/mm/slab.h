@@ -0,0 +1,147 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/slab.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/lock.h>
+
+inline void *operator new(size_t size, void *ptr) noexcept { return ptr; }
+
+namespace infos
+{
+	namespace mm
+	{
+		/**
+		 * A cache of fixed-size objects, allocated from slabs.  A slab is a single page,
+		 * holding a header followed by as many objects as will fit, and free objects are kept
+		 * on a free list within their slab.  A cache can be given constructor and destructor
+		 * hooks, which are run when a slab is created and released respectively -- not on every
+		 * allocation -- so objects keep their constructed state while they are cached.
+		 */
+		class ObjectCache
+		{
+		public:
+			typedef void (*object_hook_t)(void *obj);
+
+			// The largest object that can be allocated from a cache.
+			static const size_t MAX_OBJECT_SIZE = 512;
+
+			constexpr ObjectCache(const char *name, size_t object_size, size_t align = 8,
+					object_hook_t ctor = NULL, object_hook_t dtor = NULL)
+				: _name(name),
+				_object_size(object_size),
+				_align(align < 8 ? 8 : align),
+				_ctor(ctor),
+				_dtor(dtor),
+				_partial(NULL),
+				_full(NULL),
+				_nr_empty(0),
+				_nr_slabs(0),
+				_nr_allocated(0) { }
+
+			void *alloc();
+			void free(void *obj);
+
+			const char *name() const { return _name; }
+			size_t object_size() const { return _object_size; }
+
+			uint64_t nr_slabs() const { return _nr_slabs; }
+			uint64_t nr_allocated() const { return _nr_allocated; }
+
+		private:
+			struct Slab
+			{
+				Slab *next, *prev;
+				ObjectCache *cache;
+				void *free_list;
+				unsigned int in_use;
+			};
+
+			const char *_name;
+			size_t _object_size;
+			size_t _align;
+			object_hook_t _ctor, _dtor;
+
+			Slab *_partial;
+			Slab *_full;
+			unsigned int _nr_empty;
+
+			uint64_t _nr_slabs;
+			uint64_t _nr_allocated;
+
+			util::SpinLock _lock;
+
+			size_t stride() const;
+			size_t first_object_offset() const;
+			unsigned int objects_per_slab() const;
+
+			Slab *create_slab();
+			void release_slab(Slab *slab);
+
+			static void link(Slab *& list, Slab *slab);
+			static void unlink(Slab *& list, Slab *slab);
+		};
+
+		/**
+		 * An object cache for objects of a particular type, which constructs and destroys them
+		 * as they are allocated and freed.
+		 */
+		template<typename T>
+		class TypedObjectCache : public ObjectCache
+		{
+		public:
+			constexpr TypedObjectCache(const char *name) : ObjectCache(name, sizeof(T), alignof(T)) { }
+
+			template<typename... Args>
+			T *create(Args... args)
+			{
+				void *obj = alloc();
+				if (!obj) return NULL;
+
+				return new (obj) T(args...);
+			}
+
+			void destroy(T *obj)
+			{
+				obj->~T();
+				free(obj);
+			}
+		};
+
+		/**
+		 * Deriving a type from SlabAllocated (passing the type itself as the parameter) makes
+		 * 'new' and 'delete' allocate it from a dedicated object cache, named by the type's
+		 * 'slab_cache_name' member.  Types too large for a cache fall back to the object
+		 * allocator.
+		 */
+		template<typename T>
+		struct SlabAllocated
+		{
+			static void *operator new(size_t size)
+			{
+				if (sizeof(T) > ObjectCache::MAX_OBJECT_SIZE) return ::operator new(size);
+				return _slab_cache.alloc();
+			}
+
+			static void operator delete(void *obj)
+			{
+				if (sizeof(T) > ObjectCache::MAX_OBJECT_SIZE) return ::operator delete(obj);
+				_slab_cache.free(obj);
+			}
+
+		private:
+			static ObjectCache _slab_cache;
+		};
+
+		template<typename T>
+		ObjectCache SlabAllocated<T>::_slab_cache(T::slab_cache_name, sizeof(T), alignof(T));
+	}
+}
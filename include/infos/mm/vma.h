@@ -4,6 +4,7 @@
 
 #include <infos/define.h>
 #include <infos/util/list.h>
+#include <infos/util/lock.h>
 
 namespace infos
 {
@@ -39,13 +40,20 @@ namespace infos
 			bool allocate_virt(virt_addr_t va, int nr_pages);
 			bool allocate_virt_any(int nr_pages);
 			
+			bool is_reserved(virt_addr_t va);
+			bool handle_fault(virt_addr_t va);
+			
 			void insert_mapping(virt_addr_t va, phys_addr_t pa, MappingFlags::MappingFlags flags);
 			bool get_mapping(virt_addr_t va, phys_addr_t& pa);
 			bool is_mapped(virt_addr_t va);
 			
 			void install_default_kernel_mapping();
 			
+			bool map_shared(virt_addr_t va, PageDescriptor *const *pages, unsigned int nr_pages);
+			
 			bool copy_to(virt_addr_t dest_va, const void *src, size_t size);
+			bool zero(virt_addr_t dest_va, size_t size);
+			void *backing_page(virt_addr_t va);
 			
 			void dump();
 					
@@ -56,7 +64,21 @@ namespace infos
 				int allocation_order;
 			};
 			
+			/**
+			 * A range of virtual memory [base, end) that has been reserved, and is backed by
+			 * zeroed pages as they are first touched.
+			 */
+			struct VirtualRegion
+			{
+				virt_addr_t base, end;
+			};
+			
 			util::List<PageAllocation> _page_allocations;
+			util::List<VirtualRegion> _regions;
+			
+			// The ranges that are mapped (read-only) to pages shared with other address spaces.
+			util::List<VirtualRegion> _shared_regions;
+			util::Mutex _mtx;
 			
 			phys_addr_t _pgt_phys_base;
 			virt_addr_t _pgt_virt_base;
@@ -12,14 +12,17 @@
 
 #include <infos/define.h>
 #include <infos/util/support.h>
+#include <infos/mm/slab.h>
 
 namespace infos
 {
 	namespace util
 	{
 		template<typename T>
-		struct ListNode
+		struct ListNode : mm::SlabAllocated<ListNode<T>>
 		{
+			static constexpr const char *slab_cache_name = "list-node";
+
 			typedef T Elem;
 			typedef ListNode<T> Self;
 			
@@ -55,6 +55,26 @@ namespace infos
 			kernel::Thread *_owner;
 		};
 		
+		/**
+		 * A lock that busy-waits until it can be acquired.  It is safe to use between CPUs, but
+		 * does not disable interrupts -- so, if it is taken in interrupt context, it must be
+		 * held with interrupts disabled everywhere (e.g. underneath a UniqueIRQLock).
+		 */
+		class SpinLock : public Lock
+		{
+		public:
+			constexpr SpinLock() : _locked(0) { }
+			
+			void lock() override;
+			void unlock() override;
+			
+		private:
+			SpinLock(const SpinLock& c);
+			SpinLock(const SpinLock&& c);
+			
+			volatile unsigned long _locked;
+		};
+		
 		class ConditionVariable
 		{
 		public:
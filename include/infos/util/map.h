@@ -17,7 +17,8 @@ namespace infos {
 	namespace util {
 
 		template<typename TKey, typename TValue>
-		struct MapNode {
+		struct MapNode : mm::SlabAllocated<MapNode<TKey, TValue>> {
+			static constexpr const char *slab_cache_name = "map-node";
 
 			enum Colour {
 				RED,
@@ -0,0 +1,349 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/infos/util/rbtree.h
+ *
+ * An intrusive red-black tree.  The tree does not allocate any memory -- instead,
+ * each element embeds an RBNode, and a traits class tells the tree how to get from
+ * an element to its node (and back), and how to order two elements.
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace util
+	{
+		struct RBNode
+		{
+			RBNode() : Parent(NULL), Left(NULL), Right(NULL), Red(false) { }
+
+			RBNode *Parent;
+			RBNode *Left, *Right;
+			bool Red;
+		};
+
+		/**
+		 * An intrusive red-black tree, that caches its leftmost (i.e. smallest) element.
+		 *
+		 * TTraits must provide:
+		 *   static RBNode& node(TElem& e)               -- returns the node embedded in e
+		 *   static TElem *elem(RBNode *n)               -- returns the element containing n
+		 *   static bool less(const TElem& l, const TElem& r)  -- the ordering of the tree
+		 *
+		 * Elements that compare equal are inserted to the right of existing elements, so
+		 * that equal elements are retrieved in FIFO order.
+		 */
+		template<typename TElem, typename TTraits>
+		class RBTree
+		{
+		public:
+			typedef TElem Elem;
+			typedef RBTree<TElem, TTraits> Self;
+
+			RBTree() : _root(NULL), _leftmost(NULL), _count(0) { }
+
+			RBTree(const Self&) = delete;
+			RBTree(Self&&) = delete;
+
+			/**
+			 * Inserts an element into the tree.  O(log n)
+			 */
+			void insert(Elem& elem)
+			{
+				RBNode *nw = &TTraits::node(elem);
+				RBNode *parent = NULL;
+				RBNode **slot = &_root;
+				bool leftmost = true;
+
+				while (*slot) {
+					parent = *slot;
+
+					if (TTraits::less(elem, *TTraits::elem(parent))) {
+						slot = &parent->Left;
+					} else {
+						slot = &parent->Right;
+						leftmost = false;
+					}
+				}
+
+				nw->Parent = parent;
+				nw->Left = NULL;
+				nw->Right = NULL;
+				nw->Red = true;
+				*slot = nw;
+
+				if (leftmost) {
+					_leftmost = nw;
+				}
+
+				rebalance_insert(nw);
+				_count++;
+			}
+
+			/**
+			 * Removes an element from the tree.  The element MUST be in the tree.  O(log n)
+			 */
+			void remove(Elem& elem)
+			{
+				RBNode *z = &TTraits::node(elem);
+
+				if (z == _leftmost) {
+					_leftmost = next(z);
+				}
+
+				RBNode *x, *x_parent;
+				bool removed_black;
+
+				if (z->Left == NULL || z->Right == NULL) {
+					// The node has at most one child, so it can be spliced out directly.
+					x = z->Left ? z->Left : z->Right;
+					x_parent = z->Parent;
+					removed_black = !z->Red;
+
+					replace_child(z, x);
+				} else {
+					// The node has two children, so its successor (which has no left child) takes
+					// its place in the tree.
+					RBNode *y = z->Right;
+					while (y->Left) y = y->Left;
+
+					x = y->Right;
+					removed_black = !y->Red;
+
+					if (y->Parent == z) {
+						x_parent = y;
+					} else {
+						x_parent = y->Parent;
+
+						replace_child(y, x);
+						y->Right = z->Right;
+						y->Right->Parent = y;
+					}
+
+					replace_child(z, y);
+					y->Left = z->Left;
+					y->Left->Parent = y;
+					y->Red = z->Red;
+				}
+
+				if (removed_black) {
+					rebalance_remove(x, x_parent);
+				}
+
+				z->Parent = z->Left = z->Right = NULL;
+				_count--;
+			}
+
+			/**
+			 * Returns the smallest element in the tree, or NULL if the tree is empty.  O(1)
+			 */
+			Elem *first() const
+			{
+				return _leftmost ? TTraits::elem(_leftmost) : NULL;
+			}
+
+			/**
+			 * Returns the element that follows the given element, or NULL if it is the last.
+			 */
+			Elem *next(Elem& elem) const
+			{
+				RBNode *n = next(&TTraits::node(elem));
+				return n ? TTraits::elem(n) : NULL;
+			}
+
+			unsigned int count() const { return _count; }
+			bool empty() const { return _count == 0; }
+
+		private:
+			RBNode *_root;
+			RBNode *_leftmost;
+			unsigned int _count;
+
+			static RBNode *next(RBNode *n)
+			{
+				if (n->Right) {
+					n = n->Right;
+					while (n->Left) n = n->Left;
+					return n;
+				}
+
+				while (n->Parent && n == n->Parent->Right) {
+					n = n->Parent;
+				}
+
+				return n->Parent;
+			}
+
+			static inline bool is_red(const RBNode *n) { return n && n->Red; }
+			static inline bool is_black(const RBNode *n) { return !is_red(n); }
+
+			/**
+			 * Replaces 'old' with 'nw' in old's parent (or the root).
+			 */
+			void replace_child(RBNode *old, RBNode *nw)
+			{
+				if (old->Parent == NULL) {
+					_root = nw;
+				} else if (old == old->Parent->Left) {
+					old->Parent->Left = nw;
+				} else {
+					old->Parent->Right = nw;
+				}
+
+				if (nw) {
+					nw->Parent = old->Parent;
+				}
+			}
+
+			void rotate_left(RBNode *n)
+			{
+				RBNode *pivot = n->Right;
+				assert(pivot);
+
+				n->Right = pivot->Left;
+				if (pivot->Left) pivot->Left->Parent = n;
+
+				replace_child(n, pivot);
+
+				pivot->Left = n;
+				n->Parent = pivot;
+			}
+
+			void rotate_right(RBNode *n)
+			{
+				RBNode *pivot = n->Left;
+				assert(pivot);
+
+				n->Left = pivot->Right;
+				if (pivot->Right) pivot->Right->Parent = n;
+
+				replace_child(n, pivot);
+
+				pivot->Right = n;
+				n->Parent = pivot;
+			}
+
+			void rebalance_insert(RBNode *x)
+			{
+				while (is_red(x->Parent)) {
+					RBNode *parent = x->Parent;
+					RBNode *gp = parent->Parent;
+
+					if (parent == gp->Left) {
+						RBNode *uncle = gp->Right;
+
+						if (is_red(uncle)) {
+							parent->Red = false;
+							uncle->Red = false;
+							gp->Red = true;
+							x = gp;
+						} else {
+							if (x == parent->Right) {
+								x = parent;
+								rotate_left(x);
+								parent = x->Parent;
+							}
+
+							parent->Red = false;
+							gp->Red = true;
+							rotate_right(gp);
+						}
+					} else {
+						RBNode *uncle = gp->Left;
+
+						if (is_red(uncle)) {
+							parent->Red = false;
+							uncle->Red = false;
+							gp->Red = true;
+							x = gp;
+						} else {
+							if (x == parent->Left) {
+								x = parent;
+								rotate_right(x);
+								parent = x->Parent;
+							}
+
+							parent->Red = false;
+							gp->Red = true;
+							rotate_left(gp);
+						}
+					}
+				}
+
+				_root->Red = false;
+			}
+
+			void rebalance_remove(RBNode *x, RBNode *parent)
+			{
+				while (x != _root && is_black(x)) {
+					if (x == parent->Left) {
+						RBNode *sibling = parent->Right;
+
+						if (is_red(sibling)) {
+							sibling->Red = false;
+							parent->Red = true;
+							rotate_left(parent);
+							sibling = parent->Right;
+						}
+
+						if (is_black(sibling->Left) && is_black(sibling->Right)) {
+							sibling->Red = true;
+							x = parent;
+							parent = x->Parent;
+						} else {
+							if (is_black(sibling->Right)) {
+								sibling->Left->Red = false;
+								sibling->Red = true;
+								rotate_right(sibling);
+								sibling = parent->Right;
+							}
+
+							sibling->Red = parent->Red;
+							parent->Red = false;
+							sibling->Right->Red = false;
+							rotate_left(parent);
+							x = _root;
+						}
+					} else {
+						RBNode *sibling = parent->Left;
+
+						if (is_red(sibling)) {
+							sibling->Red = false;
+							parent->Red = true;
+							rotate_right(parent);
+							sibling = parent->Left;
+						}
+
+						if (is_black(sibling->Left) && is_black(sibling->Right)) {
+							sibling->Red = true;
+							x = parent;
+							parent = x->Parent;
+						} else {
+							if (is_black(sibling->Left)) {
+								sibling->Right->Red = false;
+								sibling->Red = true;
+								rotate_left(sibling);
+								sibling = parent->Left;
+							}
+
+							sibling->Red = parent->Red;
+							parent->Red = false;
+							sibling->Left->Red = false;
+							rotate_right(parent);
+							x = _root;
+						}
+					}
+				}
+
+				if (x) x->Red = false;
+			}
+		};
+	}
+}
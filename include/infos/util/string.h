@@ -18,6 +18,7 @@ namespace infos {
         extern size_t strlen(const char *str);
         extern int strncmp(const char *str1, const char *str2, size_t n);
         extern char *strncpy(char *dst, const char *src, size_t n);
+        extern unsigned long strtoul(const char *str, const char **end, int base);
 
         extern "C" void *memcpy(void *dest, const void *src, size_t n);
         extern "C" void *memset(void *dest, int c, size_t n);
@@ -46,6 +47,18 @@ namespace infos {
                 _data[_size] = 0;
             }
 
+            // From a run of characters, which need not be terminated
+
+            String(const char *str, size_t size) : _size(size), _data(NULL), _has_hash(false), _hash(0) {
+                _data = new char[_size + 1];
+
+                for (unsigned int i = 0; i < _size; i++) {
+                    _data[i] = str[i];
+                }
+
+                _data[_size] = 0;
+            }
+
             // Copy Constructor
 
             String(const String& str)
@@ -114,6 +127,24 @@ namespace infos {
                 return _hash;
             }
 
+            /**
+             * Hashes a run of characters in the same way as get_hash(), so that a
+             * string can be looked up without constructing one.
+             */
+            static hash_type hash(const char *data, size_t size) {
+                // Offset basis for 64-bit hash
+                uint64_t hash = 14695981039346656037ULL;
+
+                for (unsigned int i = 0; i < size; i++) {
+                    hash ^= data[i];
+
+                    // FNV Prime for 64-bit hash
+                    hash *= 1099511628211ULL;
+                }
+
+                return (hash_type) hash;
+            }
+
             List<String> split(char delim, bool remove_empty);
 
             friend String operator+(const String& l, const String& r) {
@@ -208,17 +239,7 @@ namespace infos {
              * Computes the FNV-1a hash
              */
             hash_type compute_hash() const {
-                // Offset basis for 64-bit hash
-                uint64_t hash = 14695981039346656037ULL;
-
-                for (unsigned int i = 0; i < _size; i++) {
-                    hash ^= _data[i];
-
-                    // FNV Prime for 64-bit hash
-                    hash *= 1099511628211ULL;
-                }
-
-                return (hash_type) hash;
+                return hash(_data, _size);
             }
 
             size_t _size;
@@ -4,6 +4,7 @@
 
 #include <infos/define.h>
 #include <infos/util/list.h>
+#include <infos/util/lock.h>
 
 namespace infos
 {
@@ -18,10 +19,12 @@ namespace infos
 		{
 		public:
             void sleep(kernel::Thread& thread);
+            void sleep_unless(kernel::Thread& thread, const volatile bool& done);
             void wake();
 
 		private:
 			util::List<kernel::Thread *> _waiters;
+			util::SpinLock _lock;
 		};
 	}
 }
@@ -16,9 +16,12 @@
 #include <infos/util/cmdline.h>
 #include <infos/util/string.h>
 #include <infos/fs/file.h>
+#include <infos/fs/pfs-node.h>
+#include <infos/fs/vfs-node.h>
 #include <infos/fs/exec/elf-loader.h>
 #include <infos/drivers/block/block-device.h>
 #include <infos/drivers/timer/rtc.h>
+#include <infos/drivers/timer/clocksource.h>
 
 #include <arch/arch.h>
 
@@ -56,7 +59,9 @@ _device_manager(*this),
 _memory_manager(*this),
 _module_manager(*this),
 _scheduler(*this),
-_vfs(*this)
+_timer_queue(*this),
+_vfs(*this),
+_clocksource(NULL)
 {
 
 }
@@ -169,14 +174,73 @@ bool Kernel::early_init(const char* cmdline)
 	return this->cmdline().parse(cmdline);
 }
 
+/**
+ * Tells the kernel that the given amount of time has passed.  This is how the kernel keeps
+ * time when there is no clocksource -- otherwise, the clocksource is authoritative, and this
+ * is just an opportunity to keep the time-of-day up-to-date.
+ * @param ticks The amount of time that has passed since the last update.
+ */
 void Kernel::update_runtime(Nanoseconds ticks)
 {
-	_runtime += ticks;
+	if (!_clocksource) {
+		_runtime += ticks;
+	}
+
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_tod_lock);
+	update_tod();
+}
 
-	_ticks_since_last_tod_update += ticks;
+/**
+ * Returns the amount of time that the kernel has been running for.
+ */
+const KernelRuntimeClock::Timepoint Kernel::runtime() const
+{
+	if (_clocksource) {
+		return KernelRuntimeClock::Timepoint(_clocksource->read() + _clocksource_offset);
+	}
 
-	while (_ticks_since_last_tod_update > Nanoseconds(1e9)) {
-		_ticks_since_last_tod_update -= Nanoseconds(1e9);
+	asm volatile("" ::: "memory");
+	return _runtime;
+}
+
+/**
+ * Installs a clocksource, from which the kernel runtime will be derived from now on.
+ * @param clocksource The clocksource to install.
+ */
+void Kernel::set_clocksource(drivers::timer::ClockSource& clocksource)
+{
+	// Offset the clocksource so that the kernel runtime carries on from where it is now,
+	// rather than jumping to wherever the clocksource happens to be.
+	_clocksource_offset = Nanoseconds(runtime().time_since_epoch().count() - clocksource.read().count());
+	_clocksource = &clocksource;
+
+	syslog.messagef(LogLevel::IMPORTANT, "*** USING CLOCKSOURCE: %s", clocksource.name().c_str());
+}
+
+/**
+ * Returns the current time-of-day.
+ */
+TimeOfDay Kernel::time_of_day()
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_tod_lock);
+
+	update_tod();
+	return _tod;
+}
+
+/**
+ * Advances the time-of-day by however many whole seconds have passed since it was last updated.
+ * The time-of-day lock must be held.
+ */
+void Kernel::update_tod()
+{
+	const Nanoseconds one_second = DurationCast<Nanoseconds>(Seconds(1));
+	auto now = runtime();
+
+	while (one_second < (now - _last_tod_update)) {
+		_last_tod_update += one_second;
 		increment_tod();
 	}
 }
@@ -195,18 +259,24 @@ void Kernel::initialise_tod()
 
 void Kernel::resync_tod()
 {
-	_ticks_since_last_tod_update = 0;
-
 	infos::drivers::timer::RTC *rtc;
 
 	if (!sys.device_manager().try_get_device_by_class<infos::drivers::timer::RTC>(infos::drivers::timer::RTC::RTCDeviceClass, rtc)) {
 		syslog.messagef(LogLevel::WARNING, "No RTC available to synchronise TOD");
+
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_tod_lock);
+		_last_tod_update = runtime();
 		return;
 	}
 
 	infos::drivers::timer::RTCTimePoint tp;
 	rtc->read_timepoint(tp);
 
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_tod_lock);
+
+	_last_tod_update = runtime();
 	_tod.day = tp.day_of_month;
 	_tod.hours = tp.hours;
 	_tod.minutes = tp.minutes;
@@ -241,7 +311,8 @@ void Kernel::print_tod()
 Process *Kernel::launch_process(const String& path, const String& cmdline)
 {
 	syslog.messagef(LogLevel::DEBUG, "Launching application: '%s' '%s'", path.c_str(), cmdline.c_str());
-	File *image = vfs().open(path, 0);
+	VFSNode *node = vfs().lookup_node(path);
+	File *image = (node && node->pn()) ? node->pn()->open() : NULL;
 	if (!image) {
 		syslog.message(LogLevel::ERROR, "Process not found");
 		return NULL;
@@ -251,7 +322,7 @@ Process *Kernel::launch_process(const String& path, const String& cmdline)
 	image->read(hdr, sizeof(hdr));
 
 	if (hdr[0] == 0x7f && hdr[1] == 'E' && hdr[2] == 'L' && hdr[3] == 'F') {
-		exec::ElfLoader *loader = new exec::ElfLoader(*image);
+		exec::ElfLoader *loader = new exec::ElfLoader(*image, node->pn());
 		Process *np = loader->load(cmdline);
 		if (!np) {
 			delete loader;
@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/sched-cfs-rb.cpp
+ *
+ * A weighted fair scheduling algorithm, modelled on the Completely Fair Scheduler from
+ * the Linux kernel.  Runnable entities are kept in a red-black tree ordered by their
+ * virtual runtime, so that picking the next entity is O(1), and enqueueing/dequeueing
+ * is O(log n).
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/kernel/sched.h>
+#include <infos/kernel/thread.h>
+#include <infos/kernel/log.h>
+#include <infos/util/rbtree.h>
+#include <infos/util/lock.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+
+/**
+ * The load weight corresponding to a NORMAL priority entity.  Virtual runtime advances
+ * at the same rate as real runtime for an entity with this weight.
+ */
+#define NORMAL_WEIGHT	1024
+
+/**
+ * Load weights, indexed by SchedulingEntityPriority.  These correspond to the Linux
+ * nice-to-weight table, for nice values of -20, -10, 0 and +19 respectively.  So, e.g.
+ * an INTERACTIVE entity receives roughly nine times the CPU share of a NORMAL entity.
+ */
+static const uint64_t priority_weights[] = {
+	88761,			// REALTIME
+	9548,			// INTERACTIVE
+	NORMAL_WEIGHT,	// NORMAL
+	15,				// DAEMON
+};
+
+struct RunqueueTraits
+{
+	static RBNode& node(SchedulingEntity& e) { return e.runqueue_node(); }
+	static SchedulingEntity *elem(RBNode *n) { return SchedulingEntity::from_runqueue_node(n); }
+	static bool less(const SchedulingEntity& l, const SchedulingEntity& r) { return l.vruntime() < r.vruntime(); }
+};
+
+/**
+ * A weighted, red-black tree based, fair scheduling algorithm.
+ */
+class WeightedFairScheduler : public SchedulingAlgorithm
+{
+public:
+	WeightedFairScheduler() : _min_vruntime(0) { }
+
+	/**
+	 * Returns the friendly name of the algorithm, for debugging and selection purposes.
+	 */
+	const char* name() const override { return "cfs-rb"; }
+
+	/**
+	 * Called during scheduler initialisation.
+	 */
+	void init() override
+	{
+		_min_vruntime = 0;
+	}
+
+	/**
+	 * Called when a scheduling entity becomes eligible for running.
+	 * @param entity
+	 */
+	void add_to_runqueue(SchedulingEntity& entity) override
+	{
+		UniqueIRQLock l;
+
+		// Entities leave the runqueue while they run, so charge this one for the time it
+		// has used since it was last here.
+		charge(entity);
+
+		// An entity that has been sleeping (or is brand new) must not be allowed to
+		// monopolise the CPU by virtue of a small virtual runtime, so it is placed no
+		// further left than the current minimum.
+		if (entity.vruntime() < _min_vruntime) {
+			entity.vruntime(_min_vruntime);
+		}
+
+		runqueue.insert(entity);
+	}
+
+	/**
+	 * Called when a scheduling entity is no longer eligible for running.
+	 * @param entity
+	 */
+	void remove_from_runqueue(SchedulingEntity& entity) override
+	{
+		UniqueIRQLock l;
+
+		runqueue.remove(entity);
+	}
+
+	/**
+	 * Called every time a scheduling event occurs, to cause the next eligible entity
+	 * to be chosen.  The entity that was running has been put back in the runqueue (and
+	 * charged for its time) by now, so the next eligible entity might actually be the same
+	 * entity, if it is still the furthest behind.
+	 */
+	SchedulingEntity *pick_next_entity() override
+	{
+		UniqueIRQLock l;
+
+		update_min_vruntime();
+		return runqueue.first();
+	}
+
+private:
+	typedef RBTree<SchedulingEntity, RunqueueTraits> Runqueue;
+
+	Runqueue runqueue;
+	SchedulingEntity::EntityRuntime _min_vruntime;
+
+	/**
+	 * Advances the virtual runtime of an entity by the CPU time it has consumed since it
+	 * was last charged, scaled inversely by its weight.  The entity must not be in the
+	 * runqueue when this is called, as its key will change.
+	 */
+	void charge(SchedulingEntity& entity)
+	{
+		SchedulingEntity::EntityRuntime now = entity.cpu_runtime();
+		uint64_t delta = now.count() - entity.charged_runtime().count();
+		entity.charged_runtime(now);
+
+		if (delta == 0) return;
+
+		uint64_t weight = priority_weights[entity.priority()];
+		if (weight != NORMAL_WEIGHT) {
+			delta = (delta * NORMAL_WEIGHT) / weight;
+		}
+
+		entity.vruntime(entity.vruntime() + delta);
+	}
+
+	/**
+	 * Keeps the minimum virtual runtime monotonically increasing, tracking the leftmost
+	 * entity in the runqueue.
+	 */
+	void update_min_vruntime()
+	{
+		SchedulingEntity *leftmost = runqueue.first();
+		if (leftmost && _min_vruntime < leftmost->vruntime()) {
+			_min_vruntime = leftmost->vruntime();
+		}
+	}
+};
+
+RegisterScheduler(WeightedFairScheduler);
@@ -12,8 +12,11 @@
 #include <infos/kernel/sched-entity.h>
 #include <infos/kernel/process.h>
 #include <infos/kernel/kernel.h>
+#include <infos/kernel/cpu.h>
 #include <infos/util/time.h>
 #include <infos/util/cmdline.h>
+#include <infos/util/string.h>
+#include <infos/drivers/timer/timer.h>
 #include <arch/arch.h>
 #include <arch/x86/context.h>
 
@@ -28,6 +31,19 @@ RegisterCmdLineArgument(SchedAlgorithm, "sched.algorithm") {
 	strncpy(sched_algorithm, value, sizeof(sched_algorithm)-1);
 }
 
+static bool sched_tickless;
+
+RegisterCmdLineArgument(SchedTickless, "sched.tickless") {
+	sched_tickless = strncmp(value, "1", 1) == 0;
+}
+
+static unsigned long sched_timeslice_us = 10000;
+
+RegisterCmdLineArgument(SchedTimeslice, "sched.timeslice") {
+	unsigned long us = strtoul(value, NULL, 10);
+	if (us) sched_timeslice_us = us;
+}
+
 RegisterCmdLineArgument(SchedDebug, "sched.debug") {
 	if (strncmp(value, "1", 1) == 0) {
 		sched_log.enable();
@@ -36,7 +52,7 @@ RegisterCmdLineArgument(SchedDebug, "sched.debug") {
 	}
 }
 
-Scheduler::Scheduler(Kernel& owner) : Subsystem(owner), _active(false), _current(NULL)
+Scheduler::Scheduler(Kernel& owner) : Subsystem(owner), _active(false), _algorithm(NULL), _tickless(false), _nr_runnable(0)
 {
 
 }
@@ -52,9 +68,9 @@ static void idle_task()
 bool Scheduler::init()
 {
 	sched_log.message(LogLevel::INFO, "Creating idle process");
-
-	Process *idle_process = new Process("idle", true, (Thread::thread_proc_t)idle_task);
-	_idle_entity = &idle_process->main_thread();
+	if (!add_cpu(CPU::current())) {
+		return false;
+	}
 
 	SchedulingAlgorithm *algo = acquire_scheduler_algorithm();
 	if (!algo) {
@@ -68,23 +84,96 @@ bool Scheduler::init()
 	_algorithm = algo;
     _algorithm->init();
 
+	_timeslice = DurationCast<Nanoseconds>(Microseconds(sched_timeslice_us));
+	_tickless = sched_tickless;
+
+	activate_idle_entity(this_cpu());
+	return true;
+}
+
+/**
+ * Prepares the scheduler for running on a CPU, by creating the CPU's idle entity.  This must
+ * be called before the CPU itself calls run().
+ * @param cpu The CPU that will be running the scheduler.
+ * @return Returns TRUE if the CPU was successfully added, or FALSE otherwise.
+ */
+bool Scheduler::add_cpu(CPU& cpu)
+{
+	if (cpu.index() >= MAX_CPUS) {
+		return false;
+	}
+
+	Process *idle_process = new Process("idle", true, (Thread::thread_proc_t)idle_task);
+	_cpus[cpu.index()].idle = &idle_process->main_thread();
+
+	return true;
+}
+
+/**
+ * Prepares the calling CPU -- which must already have been added -- for joining the scheduler, by
+ * making its idle entity current.  This must happen before the CPU does anything that might block,
+ * such as taking a mutex.
+ */
+void Scheduler::init_cpu()
+{
+	activate_idle_entity(this_cpu());
+}
+
+/**
+ * Makes the idle entity the current entity of the calling CPU.
+ */
+void Scheduler::activate_idle_entity(CPUState& cpu)
+{
 	// Set the idle entity to be runnable, and forcibly activate it.  This is so that
 	// when interrupts are enabled, the idle thread becomes the context that is saved and restored.
 	// We don't call set_entity_state() here, because that would add the idle task to the algorithm
 	// runqueue, meaning that the scheduler would schedule the idle task along with the regular tasks.
-    _idle_entity->_state = SchedulingEntityState::RUNNABLE;
-	idle_process->main_thread().activate(NULL);
+	cpu.idle->_state = SchedulingEntityState::RUNNABLE;
+	cpu.idle->_on_cpu = true;
+	cpu.idle->_running = true;
+	cpu.idle->activate(NULL);
 
-	return true;
+	cpu.current = cpu.idle;
+}
+
+Scheduler::CPUState& Scheduler::this_cpu()
+{
+	return _cpus[CPU::current().index()];
+}
+
+const Scheduler::CPUState& Scheduler::this_cpu() const
+{
+	return _cpus[CPU::current().index()];
 }
 
 void Scheduler::run()
 {
+	CPUState& cpu = this_cpu();
+
 	// This is now the point of no return.  Once the scheduler is activated, it will schedule the first
 	// eligible process.  Which may or may not be the idle task.  But, non-scheduled control-flow will cease
 	// to be, and the kernel will only run processes.
-	sched_log.message(LogLevel::INFO, "Activating scheduler...");
-	_active = true;
+	if (!_active) {
+		sched_log.message(LogLevel::INFO, "Activating scheduler...");
+		_active = true;
+	} else {
+		// A secondary CPU is joining the running scheduler.
+		sched_log.messagef(LogLevel::INFO, "Activating scheduler on cpu%u...", CPU::current().index());
+	}
+
+	cpu.running = true;
+
+	// In tickless mode, the periodic timer that has been driving the system up until now is
+	// replaced by one-shot events, programmed on demand -- starting with one straight away.
+	if (_tickless) {
+		if (cpu.event_timer) {
+			sched_log.messagef(LogLevel::INFO, "Tickless mode enabled, timeslice=%luus", DurationCast<Microseconds>(_timeslice).count());
+			cpu.event_timer->arm(Nanoseconds(1));
+		} else {
+			sched_log.message(LogLevel::WARNING, "No event timer available, tickless mode disabled");
+			_tickless = false;
+		}
+	}
 
 	// Enable interrupts
 	syslog.messagef(LogLevel::DEBUG, "Enabling interrupts");
@@ -110,36 +199,155 @@ void Scheduler::schedule()
 	if (!_active) return;
 	if (!_algorithm) return;
 
-	// Ask the scheduling algorithm for the next process.
-	SchedulingEntity *next = _algorithm->pick_next_entity();
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	CPUState& cpu = this_cpu();
+	if (!cpu.running) return;
+
+	SchedulingEntity *prev = cpu.current;
+
+	// The entity that was running is not in the runqueue while it runs -- so, if it is still
+	// runnable, put it back so that it competes with everything else.
+	prev->_running = false;
+	if (prev != cpu.idle && (prev->_state == SchedulingEntityState::RUNNABLE || prev->_state == SchedulingEntityState::RUNNING)) {
+		_algorithm->add_to_runqueue(*prev);
+	}
 
-	// If the algorithm refused to return a process, then schedule
-	// the idle entity.
-	if (!next) {
-		next = _idle_entity;
+	// Ask the scheduling algorithm for the next process.  Whatever it chooses leaves the runqueue
+	// while it runs, so no other CPU can choose it too.
+	SchedulingEntity *next = _algorithm->pick_next_entity();
+	if (next) {
+		_algorithm->remove_from_runqueue(*next);
+	} else {
+		// If the algorithm refused to return a process, then schedule
+		// the idle entity.
+		next = cpu.idle;
 	}
 
 	// If the next task to run, is NOT the currently running task...
-	if (next != _current) {
+	if (next != prev) {
+		// Another CPU may have only just switched away from the next task, and still be running
+		// on its stack -- so wait for it to finish doing so.
+		while (next->_on_cpu) {
+			asm volatile("pause");
+		}
+
 		// Activate the next task.
-		if (next->activate(_current)) {
+		if (next->activate(prev)) {
 			// Update the current task pointer.
-			_current = next;
+			cpu.current = next;
 
 		} else {
-			// If the task failed to activate, try and forcibly activate the idle entity.
-			if (!_idle_entity->activate(_current)) {
+			// The task failed to activate, so it goes back in the runqueue.
+			if (next != cpu.idle) {
+				_algorithm->add_to_runqueue(*next);
+			}
+
+			// Try and forcibly activate the idle entity.
+			if (!cpu.idle->activate(prev)) {
 				// We're in big trouble if even the idle thread won't activate.
 				arch_abort();
 			}
 
 			// Update the current task pointer.
-			_current = _idle_entity;
+			cpu.current = cpu.idle;
+		}
+
+		// This CPU is still running on the previous entity's stack, until the architecture has
+		// finished switching contexts, so the entity cannot be picked by another CPU until then.
+		if (cpu.current != prev) {
+			cpu.current->_on_cpu = true;
+			owner().arch().clear_after_switch(prev->_on_cpu);
 		}
 	}
 
+	cpu.current->_running = true;
+
+	auto now = owner().runtime();
+
 	// Update the execution start time for the task that's about to run.
-	_current->update_exec_start_time(owner().runtime());
+	cpu.current->update_exec_start_time(now);
+
+	// A new timeslice begins if a different task is now running, or if the task that was
+	// running has used up its timeslice.
+	if (cpu.current != prev || !(now < cpu.timeslice_end)) {
+		cpu.timeslice_end = now + _timeslice;
+	}
+
+	// Arrange for the next scheduling event.
+	if (_tickless) {
+		program_event_timer(cpu);
+	}
+}
+
+/**
+ * Determines when the scheduler next needs to run on a CPU, which is the earlier of the end of
+ * the current timeslice, and the expiry of the next kernel timer.
+ * @param cpu The CPU in question.
+ * @param deadline Receives the point in time of the next scheduling event.
+ * @return Returns TRUE if a scheduling event is required, or FALSE if nothing needs to happen.
+ */
+bool Scheduler::next_event(const CPUState& cpu, KernelRuntimeClock::Timepoint& deadline) const
+{
+	bool required = false;
+
+	// If the idle entity is running, then nothing is runnable, and so there is nothing to preempt.
+	// Similarly, if the current entity is the only one that is runnable.  But, without a
+	// clocksource, the kernel keeps time by counting timer events, so they must keep coming.
+	if (cpu.current != cpu.idle && (_nr_runnable > 1 || !owner().has_clocksource())) {
+		deadline = cpu.timeslice_end;
+		required = true;
+	}
+
+	// Sleeping threads need to be woken up on time.
+	KernelRuntimeClock::Timepoint timer_deadline;
+	if (owner().timer_queue().next_deadline(timer_deadline)) {
+		if (!required || timer_deadline < deadline) {
+			deadline = timer_deadline;
+		}
+
+		required = true;
+	}
+
+	return required;
+}
+
+/**
+ * Programs a CPU's event timer to fire when the scheduler next needs to run.  This must be
+ * called on the CPU itself, as the event timer is local to it.
+ */
+void Scheduler::program_event_timer(CPUState& cpu)
+{
+	KernelRuntimeClock::Timepoint deadline;
+
+	if (!cpu.event_timer) return;
+
+	if (!next_event(cpu, deadline)) {
+		cpu.event_timer->arm(Nanoseconds(0));
+		return;
+	}
+
+	auto now = owner().runtime();
+	if (now < deadline) {
+		cpu.event_timer->arm(deadline - now);
+	} else {
+		cpu.event_timer->arm(Nanoseconds(1));
+	}
+}
+
+/**
+ * Called when something that affects the next scheduling event has changed (e.g. a kernel
+ * timer has been added), so that the event timer can be reprogrammed.
+ */
+void Scheduler::update_event_timer()
+{
+	if (_tickless && _active) {
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_lock);
+
+		program_event_timer(this_cpu());
+	}
 }
 
 /**
@@ -147,17 +355,52 @@ void Scheduler::schedule()
  */
 void Scheduler::update_accounting()
 {
-	if (_current) {
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	CPUState& cpu = this_cpu();
+
+	if (cpu.current) {
 		auto now = owner().runtime();
 
 		// Calculate the delta.
-		SchedulingEntity::EntityRuntime delta = now - _current->_exec_start_time;
+		SchedulingEntity::EntityRuntime delta = now - cpu.current->_exec_start_time;
 
 		// Increment the CPU runtime.
-		_current->increment_cpu_runtime(delta);
+		cpu.current->increment_cpu_runtime(delta);
 
 		// Update the exec start time.
-		_current->update_exec_start_time(now);
+		cpu.current->update_exec_start_time(now);
+	}
+}
+
+/**
+ * Called when an entity has become runnable, so that it is picked up promptly.  If this CPU is
+ * idle, then it brings its own next scheduling event forward.  Otherwise, an idle CPU (if there
+ * is one) is asked to reschedule.
+ * @param cpu The calling CPU.
+ */
+void Scheduler::notify_runnable(CPUState& cpu)
+{
+	if (cpu.current == cpu.idle) {
+		// The event timer may be disarmed, so give it a kick.
+		if (_tickless) {
+			cpu.event_timer->arm(Nanoseconds(1));
+		}
+
+		return;
+	}
+
+	// If the current entity was running alone, it now needs a timeslice.
+	if (_tickless && _nr_runnable == 2) {
+		program_event_timer(cpu);
+	}
+
+	for (unsigned int i = 0; i < MAX_CPUS; i++) {
+		if (&_cpus[i] != &cpu && _cpus[i].running && _cpus[i].current == _cpus[i].idle) {
+			owner().arch().send_reschedule(i);
+			break;
+		}
 	}
 }
 
@@ -170,27 +413,49 @@ void Scheduler::set_entity_state(SchedulingEntity& entity, SchedulingEntityState
 {
 	assert(_algorithm);
 
-	// If the state is not being changed -- do nothing.
-	if (entity._state == state) return;
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_lock);
 
-	// If the new state is runnable...
-	if (state == SchedulingEntityState::RUNNABLE) {
-		// Add the entity to the runqueue only if it is transitioning from STOPPED or SLEEPING
-		if (entity._state == SchedulingEntityState::STOPPED || entity._state == SchedulingEntityState::SLEEPING) {
-			_algorithm->add_to_runqueue(entity);
-		}
-	} else if (state == SchedulingEntityState::STOPPED || state == SchedulingEntityState::SLEEPING) {
-		// Remove the entity from the runqueue only if it is transitioning from RUNNABLE or RUNNING
-		if (entity._state == SchedulingEntityState::RUNNABLE || entity._state == SchedulingEntityState::RUNNING) {
-			_algorithm->remove_from_runqueue(entity);
+		// If the state is not being changed -- do nothing.
+		if (entity._state == state) return;
+
+		// If the new state is runnable...
+		if (state == SchedulingEntityState::RUNNABLE) {
+			// Add the entity to the runqueue only if it is transitioning from STOPPED or SLEEPING -- and
+			// is not still running on a CPU, which will put it back in the runqueue when it switches away.
+			if (entity._state == SchedulingEntityState::STOPPED || entity._state == SchedulingEntityState::SLEEPING) {
+				_nr_runnable++;
+
+				if (!entity._running) {
+					_algorithm->add_to_runqueue(entity);
+
+					if (_active) {
+						notify_runnable(this_cpu());
+					}
+				}
+			}
+		} else if (state == SchedulingEntityState::STOPPED || state == SchedulingEntityState::SLEEPING) {
+			// Remove the entity from the runqueue only if it is transitioning from RUNNABLE or RUNNING -- and
+			// is not running on a CPU, as a running entity is not in the runqueue.
+			if (entity._state == SchedulingEntityState::RUNNABLE || entity._state == SchedulingEntityState::RUNNING) {
+				_nr_runnable--;
+
+				if (!entity._running) {
+					_algorithm->remove_from_runqueue(entity);
+				}
+			}
+		} else if (state == SchedulingEntityState::RUNNING) {
+			// The entity can only transition into RUNNING if it is currently RUNNABLE
+			assert(entity._state == SchedulingEntityState::RUNNABLE);
 		}
-	} else if (state == SchedulingEntityState::RUNNING) {
-		// The entity can only transition into RUNNING if it is currently RUNNABLE
-		assert(entity._state == SchedulingEntityState::RUNNABLE);
+
+		// Record the new state in the entity.
+		entity._state = state;
 	}
 
-	// Record the new state in the entity.
-	entity._state = state;
+	// Waking up anything waiting on the state change may well change the state of other
+	// entities, so this must happen outside the lock.
 	entity._state_changed.trigger();
 }
 
@@ -79,6 +79,15 @@ void DefaultSyscalls::RegisterDefaultSyscalls(SyscallManager& mgr)
 
 	mgr.RegisterSyscall(19, (SyscallManager::syscallfn) DefaultSyscalls::sys_pread);
 	mgr.RegisterSyscall(20, (SyscallManager::syscallfn) DefaultSyscalls::sys_pwrite);
+
+	mgr.RegisterSyscall(21, (SyscallManager::syscallfn) DefaultSyscalls::sys_sleep_until);
+
+	mgr.RegisterSyscall(22, (SyscallManager::syscallfn) DefaultSyscalls::sys_readv);
+	mgr.RegisterSyscall(23, (SyscallManager::syscallfn) DefaultSyscalls::sys_writev);
+	mgr.RegisterSyscall(24, (SyscallManager::syscallfn) DefaultSyscalls::sys_preadv);
+	mgr.RegisterSyscall(25, (SyscallManager::syscallfn) DefaultSyscalls::sys_pwritev);
+
+	mgr.RegisterSyscall(26, (SyscallManager::syscallfn) DefaultSyscalls::sys_getdents);
 }
 
 void DefaultSyscalls::sys_nop()
@@ -158,6 +167,61 @@ unsigned int DefaultSyscalls::sys_pwrite(ObjectHandle h, uintptr_t buffer, size_
 	return f->pwrite((const void *) buffer, size, off);
 }
 
+// The most buffers a single vectored read or write may be given.
+#define MAX_IOVECS	1024
+
+unsigned int DefaultSyscalls::sys_readv(ObjectHandle h, uintptr_t iov, unsigned int nr_iov)
+{
+	if (nr_iov > MAX_IOVECS) return -1;
+
+	File *f = (File *) sys.object_manager().get_object_secure(Thread::current(), h);
+	if (!f) {
+		return -1;
+	}
+
+	// TODO: Validate 'iov' and the buffers it points to...
+	return f->readv((const IOVector *) iov, nr_iov);
+}
+
+unsigned int DefaultSyscalls::sys_writev(ObjectHandle h, uintptr_t iov, unsigned int nr_iov)
+{
+	if (nr_iov > MAX_IOVECS) return -1;
+
+	File *f = (File *) sys.object_manager().get_object_secure(Thread::current(), h);
+	if (!f) {
+		return -1;
+	}
+
+	// TODO: Validate 'iov' and the buffers it points to...
+	return f->writev((const IOVector *) iov, nr_iov);
+}
+
+unsigned int DefaultSyscalls::sys_preadv(ObjectHandle h, uintptr_t iov, unsigned int nr_iov, off_t off)
+{
+	if (nr_iov > MAX_IOVECS) return -1;
+
+	File *f = (File *) sys.object_manager().get_object_secure(Thread::current(), h);
+	if (!f) {
+		return -1;
+	}
+
+	// TODO: Validate 'iov' and the buffers it points to...
+	return f->preadv((const IOVector *) iov, nr_iov, off);
+}
+
+unsigned int DefaultSyscalls::sys_pwritev(ObjectHandle h, uintptr_t iov, unsigned int nr_iov, off_t off)
+{
+	if (nr_iov > MAX_IOVECS) return -1;
+
+	File *f = (File *) sys.object_manager().get_object_secure(Thread::current(), h);
+	if (!f) {
+		return -1;
+	}
+
+	// TODO: Validate 'iov' and the buffers it points to...
+	return f->pwritev((const IOVector *) iov, nr_iov, off);
+}
+
 ObjectHandle DefaultSyscalls::sys_opendir(uintptr_t path, uint32_t flags)
 {
 	Directory *d = sys.vfs().opendir((const char *) path, flags);
@@ -177,6 +241,40 @@ unsigned int DefaultSyscalls::sys_closedir(ObjectHandle h)
 	return 0;
 }
 
+struct user_de {
+	char name[64];
+	unsigned int size;
+	int flags;
+};
+
+/**
+ * Fills in the single entry that sys_readdir returns.
+ */
+class UserDirectoryEntrySink : public DirectoryEntrySink
+{
+public:
+	UserDirectoryEntrySink(user_de *ude) : _ude(ude), _full(false) { }
+
+	bool add(const char *name, size_t length, unsigned int size) override
+	{
+		if (_full) return false;
+
+		length = __min(length, sizeof(_ude->name) - 1);
+		memcpy(_ude->name, name, length);
+		_ude->name[length] = 0;
+
+		_ude->flags = 0;
+		_ude->size = size;
+
+		_full = true;
+		return true;
+	}
+
+private:
+	user_de *_ude;
+	bool _full;
+};
+
 unsigned int DefaultSyscalls::sys_readdir(ObjectHandle h, uintptr_t buffer)
 {
 	Directory *d = (Directory *) sys.object_manager().get_object_secure(Thread::current(), h);
@@ -184,24 +282,78 @@ unsigned int DefaultSyscalls::sys_readdir(ObjectHandle h, uintptr_t buffer)
 		return 0;
 	}
 
-	DirectoryEntry de;
-	if (d->read_entry(de)) {
+	UserDirectoryEntrySink sink((user_de *) buffer);
+	return d->read_entries(sink);
+}
 
-		struct user_de {
-			char name[64];
-			unsigned int size;
-			int flags;
-		};
+/*
+ * The entries sys_getdents packs into its buffer.  Each is followed by its terminated name, and
+ * padded out so that the next entry is aligned.
+ */
+struct user_dirent {
+	unsigned int size;
+	uint16_t reclen;
+	uint16_t namelen;
+};
 
-		user_de *ude = (user_de *) buffer;
-		strncpy(ude->name, de.name.c_str(), 63);
-		ude->flags = 0;
-		ude->size = de.size;
+#define USER_DIRENT_ALIGN	8
 
-		return 1;
-	} else {
-		return 0;
+class UserDirentSink : public DirectoryEntrySink
+{
+public:
+	UserDirentSink(uint8_t *buffer, size_t size) : _buffer(buffer), _size(size), _used(0), _overflowed(false) { }
+
+	bool add(const char *name, size_t length, unsigned int size) override
+	{
+		size_t reclen = sizeof(user_dirent) + length + 1;
+		reclen = __align_up(reclen, USER_DIRENT_ALIGN);
+		if (length > 0xffff || reclen > _size - _used) {
+			_overflowed = true;
+			return false;
+		}
+
+		user_dirent *ude = (user_dirent *) &_buffer[_used];
+		ude->size = size;
+		ude->reclen = reclen;
+		ude->namelen = length;
+
+		char *ude_name = (char *) (ude + 1);
+		memcpy(ude_name, name, length);
+		ude_name[length] = 0;
+
+		_used += reclen;
+		return true;
 	}
+
+	size_t used() const { return _used; }
+	bool overflowed() const { return _overflowed; }
+
+private:
+	uint8_t *_buffer;
+	size_t _size, _used;
+	bool _overflowed;
+};
+
+/**
+ * Reads as many directory entries as will fit into the buffer.
+ * @return Returns the number of bytes filled in, which is zero at the end of the directory, or -1
+ * if the buffer is too small for the next entry.
+ */
+unsigned int DefaultSyscalls::sys_getdents(ObjectHandle h, uintptr_t buffer, size_t size)
+{
+	Directory *d = (Directory *) sys.object_manager().get_object_secure(Thread::current(), h);
+	if (!d) {
+		return -1;
+	}
+
+	// TODO: Validate 'buffer' etc...
+	UserDirentSink sink((uint8_t *) buffer, size);
+	if (d->read_entries(sink) == 0 && sink.overflowed()) {
+		// There was no room for even one entry.
+		return -1;
+	}
+
+	return sink.used();
 }
 
 void DefaultSyscalls::sys_exit(unsigned int rc)
@@ -287,17 +439,27 @@ unsigned int DefaultSyscalls::sys_join_thread(ObjectHandle h)
 
 unsigned long DefaultSyscalls::sys_usleep(unsigned long us)
 {
-	sys.spin_delay(util::Microseconds(us));
+	sys.timer_queue().sleep(util::DurationCast<util::Nanoseconds>(util::Microseconds(us)));
 	return us;
 }
 
+/**
+ * Sleeps until an absolute point in time, measured in the same units as sys_get_ticks().  Periodic
+ * tasks should use this, rather than sys_usleep(), so that their period does not drift.
+ */
+unsigned long DefaultSyscalls::sys_sleep_until(unsigned long deadline)
+{
+	sys.timer_queue().sleep_until(util::KernelRuntimeClock::Timepoint(deadline));
+	return sys.runtime().time_since_epoch().count();
+}
+
 struct userspace_tod_buffer {
 	unsigned short seconds, minutes, hours, day_of_month, month, year;
 };
 
 unsigned int DefaultSyscalls::sys_get_tod(uintptr_t tpstruct)
 {
-	auto& tod = sys.time_of_day();
+	auto tod = sys.time_of_day();
 
 	userspace_tod_buffer *userspace_tod = (userspace_tod_buffer *)tpstruct;
 	userspace_tod->day_of_month = tod.day;
@@ -164,10 +164,10 @@ void Thread::prepare_initial_stack()
 	uint64_t *stack = (uint64_t *)context().kernel_stack;
 
 	// System Context
-	*--stack = is_kernel_thread() ? 0x10 : 0x23;	// SS
+	*--stack = is_kernel_thread() ? 0x10 : 0x1b;	// SS
 	*--stack = 0;									// RSP
 	*--stack = 0x202;								// RFLAGS
-	*--stack = is_kernel_thread() ? 0x8 : 0x1b;		// CS
+	*--stack = is_kernel_thread() ? 0x8 : 0x23;		// CS
 	*--stack = (uint64_t)_entry_point;				// RIP
 	*--stack = 0;									// EXTRA
 
@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * kernel/timer-queue.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/kernel/timer-queue.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/thread.h>
+#include <infos/util/lock.h>
+#include <arch/arch.h>
+
+using namespace infos::kernel;
+using namespace infos::util;
+
+/**
+ * Adds a timer to the queue.
+ * @param timer The timer to add.  It must not already be pending.
+ * @param deadline The point in time at which the timer should expire.
+ */
+void TimerQueue::add(KernelTimer& timer, KernelRuntimeClock::Timepoint deadline)
+{
+	UniqueIRQLock irq;
+	bool earliest;
+
+	{
+		UniqueLock<SpinLock> l(_lock);
+
+		assert(!timer._pending);
+
+		timer._deadline = deadline;
+		timer._pending = true;
+		_timers.insert(timer);
+
+		earliest = _timers.first() == &timer;
+	}
+
+	// If this is now the earliest timer, the scheduler may need to bring its next event forward.
+	// The scheduler takes the queue lock itself when it does so, hence this happens outside it.
+	if (earliest) {
+		owner().scheduler().update_event_timer();
+	}
+}
+
+/**
+ * Removes a timer from the queue, before it expires.
+ * @param timer The timer to cancel.
+ * @return Returns TRUE if the timer was cancelled, or FALSE if it was not pending.
+ */
+bool TimerQueue::cancel(KernelTimer& timer)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	if (!timer._pending) return false;
+
+	_timers.remove(timer);
+	timer._pending = false;
+
+	return true;
+}
+
+/**
+ * Invokes the callbacks of all the timers whose deadlines have passed.  This is called from
+ * the system timer interrupt.
+ */
+void TimerQueue::run_expired()
+{
+	UniqueIRQLock irq;
+
+	auto now = owner().runtime();
+
+	for (;;) {
+		KernelTimer *timer;
+
+		{
+			UniqueLock<SpinLock> l(_lock);
+
+			timer = _timers.first();
+			if (!timer || now < timer->_deadline) break;
+
+			_timers.remove(*timer);
+			timer->_pending = false;
+		}
+
+		// The callback is invoked without the lock held, and so is free to re-add the timer.
+		timer->_callback(*timer, timer->_data);
+	}
+}
+
+/**
+ * Retrieves the deadline of the earliest pending timer.
+ * @param deadline Receives the earliest deadline.
+ * @return Returns TRUE if there is a pending timer, or FALSE otherwise.
+ */
+bool TimerQueue::next_deadline(KernelRuntimeClock::Timepoint& deadline)
+{
+	UniqueIRQLock irq;
+	UniqueLock<SpinLock> l(_lock);
+
+	KernelTimer *timer = _timers.first();
+	if (!timer) return false;
+
+	deadline = timer->_deadline;
+	return true;
+}
+
+static void wake_sleeping_thread(KernelTimer& timer, void *data)
+{
+	((Thread *)data)->wake_up();
+}
+
+/**
+ * Puts the current thread to sleep, until the given point in time.
+ * @param deadline The point in time at which the thread should wake up.
+ */
+void TimerQueue::sleep_until(KernelRuntimeClock::Timepoint deadline)
+{
+	Thread& current = Thread::current();
+	KernelTimer timer(wake_sleeping_thread, &current);
+
+	// Interrupts stay disabled until the thread is actually asleep.  The thread is marked as
+	// sleeping before the timer is added, as the timer may expire on another CPU straight away,
+	// and its wake-up must not be lost.
+	UniqueIRQLock l;
+
+	if (!(owner().runtime() < deadline)) return;
+
+	owner().scheduler().set_entity_state(current, SchedulingEntityState::SLEEPING);
+	add(timer, deadline);
+	owner().arch().invoke_kernel_syscall(1);
+
+	// The thread may have been woken for some other reason, in which case the timer is still
+	// pending, and must not outlive this stack frame.
+	cancel(timer);
+}
+
+/**
+ * Puts the current thread to sleep, for the given duration.
+ * @param ns The duration for which the thread should sleep.
+ */
+void TimerQueue::sleep(Nanoseconds ns)
+{
+	sleep_until(owner().runtime() + ns);
+}
@@ -0,0 +1,270 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/buddy-page-alloc.cpp
+ *
+ * A binary buddy page allocator.  Free memory is kept as naturally aligned blocks of 2^order
+ * pages, on one free list per order.  Allocation splits the smallest sufficiently large block,
+ * and freeing merges a block with its buddy for as long as the buddy is also free.
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/mm.h>
+#include <infos/kernel/kernel.h>
+#include <infos/util/printf.h>
+
+using namespace infos::kernel;
+using namespace infos::mm;
+using namespace infos::util;
+
+// The number of block orders, i.e. the largest block is 2^(MAX_ORDER - 1) pages.
+#define MAX_ORDER	17
+
+// The value of PageDescriptor::free_order for a page that does not head a free block.
+#define NOT_FREE	-1
+
+/**
+ * A buddy page allocation algorithm.
+ */
+class BuddyPageAllocator : public PageAllocatorAlgorithm
+{
+private:
+	PageDescriptor *_pgd_base;
+	uint64_t _nr_pgds;
+	PageDescriptor *_free_areas[MAX_ORDER];
+	uint64_t _nr_free[MAX_ORDER];
+
+	static inline uint64_t pages_per_block(int order) { return 1ull << order; }
+
+	inline pfn_t pgd_to_pfn(const PageDescriptor *pgd) const { return pgd - _pgd_base; }
+
+	/**
+	 * Pushes a block onto the free list of the given order.
+	 */
+	void push_block(PageDescriptor *block, int order)
+	{
+		block->free_order = order;
+		block->prev_free = NULL;
+		block->next_free = _free_areas[order];
+
+		if (block->next_free) {
+			block->next_free->prev_free = block;
+		}
+
+		_free_areas[order] = block;
+		_nr_free[order]++;
+	}
+
+	/**
+	 * Unlinks a block from the free list it is on.
+	 */
+	void remove_block(PageDescriptor *block)
+	{
+		int order = block->free_order;
+		assert(order >= 0 && order < MAX_ORDER);
+
+		if (block->prev_free) {
+			block->prev_free->next_free = block->next_free;
+		} else {
+			_free_areas[order] = block->next_free;
+		}
+
+		if (block->next_free) {
+			block->next_free->prev_free = block->prev_free;
+		}
+
+		block->next_free = NULL;
+		block->prev_free = NULL;
+		block->free_order = NOT_FREE;
+		_nr_free[order]--;
+	}
+
+	/**
+	 * Frees a block, merging it with its buddy (and then the buddy of the merged block, and so
+	 * on) for as long as the buddy is a free block of the same order.
+	 */
+	void free_block(pfn_t pfn, int order)
+	{
+		while (order < MAX_ORDER - 1) {
+			pfn_t buddy = pfn ^ pages_per_block(order);
+			if (buddy >= _nr_pgds || _pgd_base[buddy].free_order != order) break;
+
+			remove_block(&_pgd_base[buddy]);
+
+			if (buddy < pfn) pfn = buddy;
+			order++;
+		}
+
+		push_block(&_pgd_base[pfn], order);
+	}
+
+	/**
+	 * Locates the free block that contains the given page.
+	 * @param pfn The page to look for.
+	 * @param order Receives the order of the containing block.
+	 * @return Returns the first page of the containing block, or NULL if the page is not free.
+	 */
+	PageDescriptor *find_free_block(pfn_t pfn, int& order) const
+	{
+		for (order = 0; order < MAX_ORDER; order++) {
+			pfn_t head = pfn & ~(pages_per_block(order) - 1);
+			if (_pgd_base[head].free_order == order) {
+				return &_pgd_base[head];
+			}
+		}
+
+		return NULL;
+	}
+
+	/**
+	 * Returns the parts of a (removed) free block that lie outside the range [start, end) to
+	 * the free lists, by splitting the block in half until each half lies either entirely
+	 * inside the range, or entirely outside it.
+	 */
+	void carve_block(pfn_t head, int order, pfn_t start, pfn_t end)
+	{
+		pfn_t block_end = head + pages_per_block(order);
+
+		// Entirely inside -- the whole block is removed.
+		if (head >= start && block_end <= end) return;
+
+		// Entirely outside -- the whole block stays free.
+		if (block_end <= start || head >= end) {
+			push_block(&_pgd_base[head], order);
+			return;
+		}
+
+		carve_block(head, order - 1, start, end);
+		carve_block(head + pages_per_block(order - 1), order - 1, start, end);
+	}
+
+public:
+	bool init(PageDescriptor *page_descriptors, uint64_t nr_page_descriptors) override
+	{
+		mm_log.messagef(LogLevel::DEBUG, "Buddy Page Allocator online");
+		_pgd_base = page_descriptors;
+		_nr_pgds = nr_page_descriptors;
+
+		for (int order = 0; order < MAX_ORDER; order++) {
+			_free_areas[order] = NULL;
+			_nr_free[order] = 0;
+		}
+
+		for (uint64_t pfn = 0; pfn < _nr_pgds; pfn++) {
+			_pgd_base[pfn].free_order = NOT_FREE;
+		}
+
+		return true;
+	}
+
+	PageDescriptor *allocate_pages(int order) override
+	{
+		if (order < 0 || order >= MAX_ORDER) return NULL;
+
+		// Find the smallest order with a free block that is large enough.
+		int block_order = order;
+		while (block_order < MAX_ORDER && !_free_areas[block_order]) {
+			block_order++;
+		}
+
+		if (block_order == MAX_ORDER) return NULL;
+
+		PageDescriptor *block = _free_areas[block_order];
+		remove_block(block);
+
+		// Split the block down to size, returning the upper halves to the free lists.
+		while (block_order > order) {
+			block_order--;
+			push_block(block + pages_per_block(block_order), block_order);
+		}
+
+		return block;
+	}
+
+	void free_pages(PageDescriptor *pgd, int order) override
+	{
+		assert(order >= 0 && order < MAX_ORDER);
+		assert((pgd_to_pfn(pgd) & (pages_per_block(order) - 1)) == 0);
+
+		free_block(pgd_to_pfn(pgd), order);
+	}
+
+	virtual void insert_page_range(PageDescriptor *start, uint64_t count) override
+	{
+		mm_log.messagef(LogLevel::DEBUG, "Inserting available page range from %lx -- %lx", pgd_to_pfn(start), pgd_to_pfn(start + count));
+
+		pfn_t pfn = pgd_to_pfn(start);
+		pfn_t end = pfn + count;
+
+		// Free the range as the largest naturally aligned blocks that fit.
+		while (pfn < end) {
+			int order = 0;
+			while (order < MAX_ORDER - 1 && (pfn & (pages_per_block(order + 1) - 1)) == 0 && pfn + pages_per_block(order + 1) <= end) {
+				order++;
+			}
+
+			free_block(pfn, order);
+			pfn += pages_per_block(order);
+		}
+	}
+
+	virtual void remove_page_range(PageDescriptor *start, uint64_t count) override
+	{
+		mm_log.messagef(LogLevel::DEBUG, "Removing available page range from %lx -- %lx", pgd_to_pfn(start), pgd_to_pfn(start + count));
+
+		pfn_t pfn = pgd_to_pfn(start);
+		pfn_t end = pfn + count;
+
+		while (pfn < end) {
+			int order;
+			PageDescriptor *block = find_free_block(pfn, order);
+
+			if (!block) {
+				// This page was not free to begin with.
+				pfn++;
+				continue;
+			}
+
+			pfn_t head = pgd_to_pfn(block);
+
+			remove_block(block);
+			carve_block(head, order, pgd_to_pfn(start), end);
+
+			pfn = head + pages_per_block(order);
+		}
+	}
+
+	const char *name() const override { return "buddy"; }
+
+	void dump_state() const override
+	{
+		uint64_t total = 0;
+
+		mm_log.messagef(LogLevel::INFO, "BUDDY STATE:");
+		for (int order = 0; order < MAX_ORDER; order++) {
+			char buffer[128];
+			int n = snprintf(buffer, sizeof(buffer), "[%02d] %lu:", order, _nr_free[order]);
+
+			// Only show the first few blocks of each order, as the lists can be long.
+			int shown = 0;
+			for (PageDescriptor *block = _free_areas[order]; block && shown < 6; block = block->next_free, shown++) {
+				n += snprintf(buffer + n, sizeof(buffer) - n, " %lx", pgd_to_pfn(block));
+			}
+
+			if (shown == 6 && _nr_free[order] > 6) {
+				snprintf(buffer + n, sizeof(buffer) - n, " ...");
+			}
+
+			mm_log.messagef(LogLevel::INFO, "%s", buffer);
+			total += _nr_free[order] * pages_per_block(order);
+		}
+
+		mm_log.messagef(LogLevel::INFO, "free pages=%lu", total);
+	}
+};
+
+RegisterPageAllocator(BuddyPageAllocator);
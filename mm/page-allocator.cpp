@@ -13,6 +13,7 @@
 #include <infos/util/string.h>
 #include <infos/util/lock.h>
 #include <infos/util/cmdline.h>
+#include <infos/kernel/cpu.h>
 
 extern char _IMAGE_START, _IMAGE_END;
 extern char _STACK_START, _STACK_END;
@@ -50,8 +51,30 @@ RegisterCmdLineArgument(PageAllocSelfTest, "pgalloc.self-test")
 	}
 }
 
+// The size of the per-CPU page caches.  A cache that runs dry is refilled to the low watermark,
+// and a cache that grows beyond the high watermark is drained back down to the low watermark.
+// A high watermark of zero disables the caches.
+static unsigned long pcp_high = 128;
+static unsigned long pcp_low = 32;
+
+RegisterCmdLineArgument(PageAllocPCPHigh, "pgalloc.pcp-high")
+{
+	pcp_high = strtoul(value, NULL, 0);
+}
+
+RegisterCmdLineArgument(PageAllocPCPLow, "pgalloc.pcp-low")
+{
+	pcp_low = strtoul(value, NULL, 0);
+}
+
 PageAllocator::PageAllocator(MemoryManager &mm) : Allocator(mm), _page_descriptors(NULL)
 {
+	for (unsigned int i = 0; i < MAX_CPUS; i++)
+	{
+		_page_caches[i].hot = NULL;
+		_page_caches[i].cold = NULL;
+		_page_caches[i].count = 0;
+	}
 }
 
 bool PageAllocator::setup_page_descriptors()
@@ -136,6 +159,10 @@ bool PageAllocator::init()
     mm_log.messagef(LogLevel::INFO, "Reserving initial page table pages");
     nr_free_pages -= reserve_page_range(1, 6);
 
+    // Reserve the page that application processors start executing in
+    mm_log.messagef(LogLevel::INFO, "Reserving application processor start-up page");
+    nr_free_pages -= reserve_page_range(8, 1);
+
 	// Now, reserve the kernel's pages
 	// Reserve the range of pages corresponding to the kernel image
 	// pfn_t image_start_pfn = pa_to_pfn((phys_addr_t)&_IMAGE_START); // _IMAGE_START is a PA
@@ -159,6 +186,13 @@ bool PageAllocator::init()
 
 	mm_log.messagef(LogLevel::INFO, "Page Allocator: total=%lu, present=%lu, free=%lu (%u MB)", _nr_pages, nr_present_pages, nr_free_pages, MB(nr_free_pages << 12));
 
+	if (pcp_low > pcp_high)
+	{
+		pcp_low = pcp_high;
+	}
+
+	mm_log.messagef(LogLevel::INFO, "Per-CPU page caches: high=%lu, low=%lu", pcp_high, pcp_low);
+
 	// Now, initialise the page allocation algorithm.
 
 	if (do_self_test)
@@ -197,9 +231,24 @@ PageDescriptor *PageAllocator::alloc_pages(int order)
 	if (!_allocator_algorithm)
 		return NULL;
 
+	// Single pages come from the per-CPU cache.
+	if (order == 0 && pcp_high)
+		return alloc_cached_page();
+
 	UniqueLock<Mutex> l(_mtx);
 	PageDescriptor *pgd = _allocator_algorithm->allocate_pages(order);
 
+	// Free pages held in the per-CPU caches may be all that stops a block of this size from
+	// being formed, so give them back to the algorithm, and try once more.
+	if (!pgd && pcp_high)
+	{
+		drain_page_caches();
+		pgd = _allocator_algorithm->allocate_pages(order);
+	}
+
+	if (!pgd)
+		return NULL;
+
 	// Double check that all the pages are marked as available, and
 	// mark them as allocated.
 	for (unsigned int i = 0; i < (1u << order); i++)
@@ -219,6 +268,13 @@ PageDescriptor *PageAllocator::alloc_pages(int order)
  */
 void PageAllocator::free_pages(PageDescriptor *pgd, int order)
 {
+	// Single pages go back to the per-CPU cache.
+	if (order == 0 && pcp_high && _allocator_algorithm)
+	{
+		free_cached_page(pgd);
+		return;
+	}
+
 	// Call into the algorithm to actually free the pages.
 	if (_allocator_algorithm)
 	{
@@ -236,6 +292,191 @@ void PageAllocator::free_pages(PageDescriptor *pgd, int order)
 	}
 }
 
+PageAllocator::PageCache& PageAllocator::this_cpu_cache()
+{
+	return _page_caches[CPU::current().index()];
+}
+
+/**
+ * Allocates a single page from the calling CPU's page cache, refilling the cache from the
+ * allocation algorithm if it is empty.
+ * @return Returns the page descriptor of the allocated page, or NULL if allocation failed.
+ */
+PageDescriptor *PageAllocator::alloc_cached_page()
+{
+	PageDescriptor *pgd = NULL;
+
+	{
+		UniqueIRQLock l;
+
+		PageCache &cache = this_cpu_cache();
+		UniqueLock<SpinLock> cl(cache.lock);
+
+		if (cache.hot)
+		{
+			pgd = cache.hot;
+			cache.hot = pgd->next_free;
+			if (cache.hot)
+				cache.hot->prev_free = NULL;
+			else
+				cache.cold = NULL;
+
+			cache.count--;
+		}
+	}
+
+	if (!pgd)
+	{
+		// The cache is empty, so take a batch of pages from the algorithm.  The batch is built
+		// up privately (with interrupts enabled), as the allocator lock may sleep.
+		PageDescriptor *batch = NULL, *batch_tail = NULL;
+		unsigned int batch_count = 0;
+
+		{
+			UniqueLock<Mutex> l(_mtx);
+
+			pgd = _allocator_algorithm->allocate_pages(0);
+			if (!pgd)
+				return NULL;
+
+			assert(pgd->type == PageDescriptorType::AVAILABLE);
+			pgd->type = PageDescriptorType::ALLOCATED;
+
+			while (batch_count < pcp_low)
+			{
+				PageDescriptor *page = _allocator_algorithm->allocate_pages(0);
+				if (!page)
+					break;
+
+				assert(page->type == PageDescriptorType::AVAILABLE);
+				page->type = PageDescriptorType::ALLOCATED;
+
+				page->prev_free = batch_tail;
+				page->next_free = NULL;
+				if (batch_tail)
+					batch_tail->next_free = page;
+				else
+					batch = page;
+
+				batch_tail = page;
+				batch_count++;
+			}
+		}
+
+		// The batch goes in at the cold end, behind any pages that were freed in the meantime.
+		if (batch)
+		{
+			UniqueIRQLock l;
+
+			PageCache &cache = this_cpu_cache();
+			UniqueLock<SpinLock> cl(cache.lock);
+
+			batch->prev_free = cache.cold;
+			if (cache.cold)
+				cache.cold->next_free = batch;
+			else
+				cache.hot = batch;
+
+			cache.cold = batch_tail;
+			cache.count += batch_count;
+		}
+	}
+
+	pgalloc_log.messagef(LogLevel::DEBUG, "alloc: order=0, pgd=%p (%lx)", pgd, pgd_to_pa(pgd));
+	return pgd;
+}
+
+/**
+ * Frees a single page into the calling CPU's page cache, draining the coldest pages back to
+ * the allocation algorithm if the cache is over its high watermark.
+ * @param pgd The page descriptor of the page to free.
+ */
+void PageAllocator::free_cached_page(PageDescriptor *pgd)
+{
+	assert(pgd->type == PageDescriptorType::ALLOCATED);
+
+	pgalloc_log.messagef(LogLevel::DEBUG, "free: order=0, pgd=%p (%lx)", pgd, pgd_to_pa(pgd));
+
+	PageDescriptor *drain = NULL;
+
+	{
+		UniqueIRQLock l;
+
+		PageCache &cache = this_cpu_cache();
+		UniqueLock<SpinLock> cl(cache.lock);
+
+		pgd->prev_free = NULL;
+		pgd->next_free = cache.hot;
+		if (cache.hot)
+			cache.hot->prev_free = pgd;
+		else
+			cache.cold = pgd;
+
+		cache.hot = pgd;
+		cache.count++;
+
+		if (cache.count <= pcp_high)
+			return;
+
+		// Detach the coldest pages, leaving the low watermark's worth behind.
+		while (cache.count > pcp_low)
+		{
+			PageDescriptor *page = cache.cold;
+			cache.cold = page->prev_free;
+			if (cache.cold)
+				cache.cold->next_free = NULL;
+			else
+				cache.hot = NULL;
+
+			cache.count--;
+
+			page->next_free = drain;
+			drain = page;
+		}
+	}
+
+	UniqueLock<Mutex> l(_mtx);
+	while (drain)
+	{
+		PageDescriptor *next = drain->next_free;
+		_allocator_algorithm->free_pages(drain, 0);
+		drain->type = PageDescriptorType::AVAILABLE;
+		drain = next;
+	}
+}
+
+/**
+ * Returns every page held in the per-CPU page caches to the allocation algorithm, so that
+ * they can be coalesced into larger blocks.  The allocator lock must be held.
+ */
+void PageAllocator::drain_page_caches()
+{
+	for (unsigned int i = 0; i < MAX_CPUS; i++)
+	{
+		PageDescriptor *drain;
+
+		{
+			UniqueIRQLock l;
+
+			PageCache &cache = _page_caches[i];
+			UniqueLock<SpinLock> cl(cache.lock);
+
+			drain = cache.hot;
+			cache.hot = NULL;
+			cache.cold = NULL;
+			cache.count = 0;
+		}
+
+		while (drain)
+		{
+			PageDescriptor *next = drain->next_free;
+			_allocator_algorithm->free_pages(drain, 0);
+			drain->type = PageDescriptorType::AVAILABLE;
+			drain = next;
+		}
+	}
+}
+
 const PageDescriptor *PageAllocator::alloc_zero_page()
 {
 	const PageDescriptor *pgd = alloc_page();
@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/slab.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/mm/slab.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/kernel/kernel.h>
+#include <infos/util/lock.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+
+// The number of completely free slabs a cache holds on to, before returning them to the
+// page allocator.
+#define MAX_EMPTY_SLABS	1
+
+/**
+ * Returns the distance between consecutive objects in a slab.
+ */
+size_t ObjectCache::stride() const
+{
+	// A free object must be able to hold the free-list link.
+	size_t size = _object_size < sizeof(void *) ? sizeof(void *) : _object_size;
+	return __align_up(size, _align);
+}
+
+/**
+ * Returns the offset of the first object in a slab, after the slab header.
+ */
+size_t ObjectCache::first_object_offset() const
+{
+	return __align_up(sizeof(Slab), _align);
+}
+
+unsigned int ObjectCache::objects_per_slab() const
+{
+	return (__page_size - first_object_offset()) / stride();
+}
+
+void ObjectCache::link(Slab *& list, Slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = list;
+
+	if (list) list->prev = slab;
+	list = slab;
+}
+
+void ObjectCache::unlink(Slab *& list, Slab *slab)
+{
+	if (slab->prev) {
+		slab->prev->next = slab->next;
+	} else {
+		list = slab->next;
+	}
+
+	if (slab->next) slab->next->prev = slab->prev;
+}
+
+/**
+ * Creates a new slab from a fresh page, and threads its objects onto the slab's free list.
+ * @return Returns the new slab, or NULL if a page could not be allocated.
+ */
+ObjectCache::Slab *ObjectCache::create_slab()
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	PageDescriptor *pgd = pgalloc.alloc_pages(0);
+	if (!pgd) return NULL;
+
+	Slab *slab = (Slab *)pgalloc.pgd_to_vpa(pgd);
+	slab->next = NULL;
+	slab->prev = NULL;
+	slab->cache = this;
+	slab->in_use = 0;
+	slab->free_list = NULL;
+
+	uintptr_t base = (uintptr_t)slab + first_object_offset();
+	size_t step = stride();
+
+	// Thread the objects in reverse, so that they are handed out in address order.
+	for (unsigned int i = objects_per_slab(); i > 0; i--) {
+		void *obj = (void *)(base + ((i - 1) * step));
+
+		if (_ctor) _ctor(obj);
+
+		*(void **)obj = slab->free_list;
+		slab->free_list = obj;
+	}
+
+	return slab;
+}
+
+/**
+ * Returns a completely free slab to the page allocator.
+ */
+void ObjectCache::release_slab(Slab *slab)
+{
+	if (_dtor) {
+		uintptr_t base = (uintptr_t)slab + first_object_offset();
+		for (unsigned int i = 0; i < objects_per_slab(); i++) {
+			_dtor((void *)(base + (i * stride())));
+		}
+	}
+
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	pgalloc.free_pages(pgalloc.vpa_to_pgd((virt_addr_t)slab), 0);
+}
+
+/**
+ * Allocates an object from the cache.
+ * @return Returns a pointer to the object, or NULL if the allocation failed.
+ */
+void *ObjectCache::alloc()
+{
+	assert(_object_size <= MAX_OBJECT_SIZE);
+
+	for (;;) {
+		{
+			UniqueIRQLock irq;
+			UniqueLock<SpinLock> l(_lock);
+
+			Slab *slab = _partial;
+			if (slab) {
+				void *obj = slab->free_list;
+				slab->free_list = *(void **)obj;
+
+				if (slab->in_use++ == 0) {
+					_nr_empty--;
+				}
+
+				// A slab with no free objects moves to the full list, so that the partial list
+				// only ever contains slabs that can satisfy an allocation.
+				if (!slab->free_list) {
+					unlink(_partial, slab);
+					link(_full, slab);
+				}
+
+				_nr_allocated++;
+				return obj;
+			}
+		}
+
+		// There are no free objects, so a new slab is needed.  This is created without the
+		// lock held, as the page allocator may sleep.
+		Slab *slab = create_slab();
+		if (!slab) return NULL;
+
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_lock);
+
+		link(_partial, slab);
+		_nr_empty++;
+		_nr_slabs++;
+	}
+}
+
+/**
+ * Returns an object to the cache.
+ * @param obj The object to free, which must have been allocated from this cache.
+ */
+void ObjectCache::free(void *obj)
+{
+	if (!obj) return;
+
+	Slab *slab = (Slab *)((uintptr_t)obj & ~((uintptr_t)__page_size - 1));
+	assert(slab->cache == this);
+
+	Slab *release = NULL;
+
+	{
+		UniqueIRQLock irq;
+		UniqueLock<SpinLock> l(_lock);
+
+		if (!slab->free_list) {
+			unlink(_full, slab);
+			link(_partial, slab);
+		}
+
+		*(void **)obj = slab->free_list;
+		slab->free_list = obj;
+		_nr_allocated--;
+
+		if (--slab->in_use == 0) {
+			if (_nr_empty >= MAX_EMPTY_SLABS) {
+				unlink(_partial, slab);
+				_nr_slabs--;
+				release = slab;
+			} else {
+				_nr_empty++;
+			}
+		}
+	}
+
+	if (release) {
+		release_slab(release);
+	}
+}
@@ -30,6 +30,16 @@ VMA::~VMA()
 {
 	// TODO: Release allocations
 	
+	// Drop this address space's references to the pages it shared.
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	for (const auto& region : _shared_regions) {
+		for (virt_addr_t va = region.base; va < region.end; va += __page_size) {
+			phys_addr_t pa;
+			if (get_mapping(va, pa)) {
+				pgalloc.put_page(pgalloc.pfn_to_pgd(pa_to_pfn(pa)));
+			}
+		}
+	}
 }
 
 // This is a hack.  In fact, this whole file is a hack because it's
@@ -200,26 +210,91 @@ bool VMA::allocate_virt_any(int nr_pages)
 	return false;
 }
 
+/**
+ * Reserves a region of virtual memory.  No physical memory is allocated here -- each page of
+ * the region is backed by a freshly zeroed page when it is first touched (see handle_fault).
+ * @param va The virtual address of the start of the region.
+ * @param nr_pages The number of pages in the region.
+ * @return Returns true if the region was reserved, or false otherwise.
+ */
 bool VMA::allocate_virt(virt_addr_t va, int nr_pages)
 {
-	if (nr_pages == 0) return false;
+	if (nr_pages <= 0) return false;
 	
-	int order = __log2ceil(nr_pages);
+	VirtualRegion region;
+	region.base = __page_base(va);
+	region.end = region.base + ((uint64_t)nr_pages << __page_bits);
 	
-	const PageDescriptor *pgd = allocate_phys(order);
-	if (!pgd) {
-		return false;
+	UniqueLock<Mutex> l(_mtx);
+	_regions.append(region);
+	
+	return true;
+}
+
+/**
+ * Determines whether or not a virtual address lies within a reserved region.
+ */
+bool VMA::is_reserved(virt_addr_t va)
+{
+	UniqueLock<Mutex> l(_mtx);
+	
+	for (const auto& region : _regions) {
+		if (va >= region.base && va < region.end) return true;
 	}
 	
-	virt_addr_t vbase = va;
-	phys_addr_t pbase = sys.mm().pgalloc().pgd_to_pa(pgd);
-	for (unsigned int i = 0; i < (1u << order); i++) {
-		insert_mapping(vbase, pbase, MappingFlags::Present | MappingFlags::User | MappingFlags::Writable);
-		
-		vbase += 0x1000;
-		pbase += 0x1000;
+	return false;
+}
+
+/**
+ * Handles a fault on a virtual address, by mapping a zeroed page at that address if it lies
+ * within a reserved region, and is not yet backed.
+ * @param va The faulting virtual address.
+ * @return Returns true if the fault was resolved, or false if the address is not valid.
+ */
+bool VMA::handle_fault(virt_addr_t va)
+{
+	if (!is_reserved(va)) return false;
+	
+	UniqueLock<Mutex> l(_mtx);
+	
+	// Another thread in this address space may have got here first.
+	if (is_mapped(va)) return true;
+	
+	PageDescriptor *pgd = allocate_phys(0);
+	if (!pgd) return false;
+	
+	insert_mapping(__page_base(va), sys.mm().pgalloc().pgd_to_pa(pgd), MappingFlags::Present | MappingFlags::User | MappingFlags::Writable);
+	return true;
+}
+
+/**
+ * Maps pages that are shared with other address spaces, read-only, at a virtual address.  The
+ * range is not reserved, so a write to it is a fault that cannot be resolved.
+ * @param va The virtual address of the start of the range.
+ * @param pages The pages to map, each of which gains a reference.
+ * @param nr_pages The number of pages to map.
+ * @return Returns true if the pages were mapped, or false if part of the range is in use.
+ */
+bool VMA::map_shared(virt_addr_t va, PageDescriptor *const *pages, unsigned int nr_pages)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	
+	VirtualRegion region;
+	region.base = __page_base(va);
+	region.end = region.base + ((uint64_t)nr_pages << __page_bits);
+	
+	UniqueLock<Mutex> l(_mtx);
+	
+	for (virt_addr_t page_va = region.base; page_va < region.end; page_va += __page_size) {
+		if (is_mapped(page_va)) return false;
+	}
+	
+	for (unsigned int i = 0; i < nr_pages; i++) {
+		pgalloc.get_page(pages[i]);
+		insert_mapping(region.base + ((uint64_t)i << __page_bits), pgalloc.pgd_to_pa(pages[i]), MappingFlags::Present | MappingFlags::User);
 	}
 	
+	_shared_regions.append(region);
 	return true;
 }
 
@@ -265,16 +340,69 @@ bool VMA::get_mapping(virt_addr_t va, phys_addr_t& pa)
 }
 
 
-bool VMA::copy_to(virt_addr_t dest_va, const void* src, size_t size)
+/**
+ * Finds the page that backs a virtual address, backing it first if it has not been touched yet.
+ * @return Returns the kernel's address for the start of the page, or NULL if the address is not
+ * valid.
+ */
+void *VMA::backing_page(virt_addr_t va)
 {
 	phys_addr_t pa;
-	if (!get_mapping(dest_va, pa))
-		return false;
+	if (!get_mapping(va, pa)) {
+		if (!handle_fault(va) || !get_mapping(va, pa))
+			return NULL;
+	}
+
+	return (void *)pa_to_vpa(__page_base(pa));
+}
+
+bool VMA::copy_to(virt_addr_t dest_va, const void* src, size_t size)
+{
+	const uint8_t *src_bytes = (const uint8_t *)src;
 	
-	void *dest = (void *)pa_to_vpa(pa);
+	// The destination may span several (physically discontiguous) pages, which are backed on
+	// demand if they have not been touched yet.
+	while (size > 0) {
+		uint8_t *page = (uint8_t *)backing_page(dest_va);
+		if (!page) return false;
+		
+		size_t chunk = __page_size - __page_offset(dest_va);
+		if (chunk > size) chunk = size;
+		
+		memcpy(page + __page_offset(dest_va), src_bytes, chunk);
+		
+		dest_va += chunk;
+		src_bytes += chunk;
+		size -= chunk;
+	}
 	
-	//mm_log.messagef(LogLevel::DEBUG, "vma: copy-to dst=va=%p:pa=%p:vpa=%p src=%p size=%p", dest_va, pa, dest, src, size);
-	memcpy(dest, src, size);
+	return true;
+}
+
+/**
+ * Zeroes a range of virtual memory.  Only the pages that are already backed need touching, as
+ * the rest will be backed by zeroed pages when they are.
+ */
+bool VMA::zero(virt_addr_t dest_va, size_t size)
+{
+	while (size > 0) {
+		size_t chunk = __page_size - __page_offset(dest_va);
+		if (chunk > size) chunk = size;
+		
+		phys_addr_t pa;
+		if (get_mapping(dest_va, pa)) {
+			if (chunk == (size_t)__page_size) {
+				pzero((void *)pa_to_vpa(pa));
+			} else {
+				bzero((void *)pa_to_vpa(pa), chunk);
+			}
+		} else if (!is_reserved(dest_va)) {
+			return false;
+		}
+		
+		dest_va += chunk;
+		size -= chunk;
+	}
 	
 	return true;
 }
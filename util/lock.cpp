@@ -37,6 +37,18 @@ bool Mutex::locked_by_me()
 	return locked() && _owner == &Thread::current();
 }
 
+void SpinLock::lock()
+{
+	while (__sync_lock_test_and_set(&_locked, 1)) {
+		while (_locked) asm volatile("pause");
+	}
+}
+
+void SpinLock::unlock()
+{
+	__sync_lock_release(&_locked);
+}
+
 void ConditionVariable::wait(Mutex& mtx)
 {
 	assert(mtx.locked_by_me());
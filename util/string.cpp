@@ -50,6 +50,51 @@ char *infos::util::strncpy(char *dest, const char *src, size_t n)
 	return dest;
 }
 
+/**
+ * Parses an unsigned integer from a string.  A base of zero will auto-detect a
+ * hexadecimal (0x) prefix, and otherwise assume decimal.
+ * @param str The string to parse.
+ * @param end If non-NULL, receives a pointer to the first unparsed character.
+ * @param base The numeric base of the string.
+ * @return Returns the parsed value, or zero if no digits were present.
+ */
+unsigned long infos::util::strtoul(const char *str, const char **end, int base)
+{
+	unsigned long value = 0;
+	
+	if (base == 0) {
+		if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+			base = 16;
+			str += 2;
+		} else {
+			base = 10;
+		}
+	} else if (base == 16 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+		str += 2;
+	}
+	
+	for (;; str++) {
+		int digit;
+		
+		if (*str >= '0' && *str <= '9') {
+			digit = *str - '0';
+		} else if (*str >= 'a' && *str <= 'z') {
+			digit = *str - 'a' + 10;
+		} else if (*str >= 'A' && *str <= 'Z') {
+			digit = *str - 'A' + 10;
+		} else {
+			break;
+		}
+		
+		if (digit >= base) break;
+		
+		value = (value * base) + digit;
+	}
+	
+	if (end) *end = str;
+	return value;
+}
+
 String infos::util::ToString(unsigned int v)
 {
 #define BUFFER_SIZE	16
@@ -18,17 +18,56 @@ using namespace infos::util;
 
 void WakeQueue::sleep(Thread& thread)
 {
-    // TODO: some sort of lock
-    _waiters.append(&thread);
-    thread.sleep();
+    UniqueIRQLock irq;
+
+    {
+        // The thread must be marked as sleeping while it is on the list, otherwise a wake-up
+        // from another CPU could come and go before it has actually gone to sleep.
+        UniqueLock<SpinLock> l(_lock);
+
+        _waiters.append(&thread);
+        sys.scheduler().set_entity_state(thread, SchedulingEntityState::SLEEPING);
+    }
+
+    if (&Thread::current() == &thread) {
+        sys.arch().invoke_kernel_syscall(1);
+    }
+}
+
+/**
+ * Puts a thread to sleep on the queue, unless a condition has already been met.  The condition
+ * is checked under the queue lock, so a waker that sets it before calling wake() will either be
+ * seen here, or find the thread on the queue.
+ */
+void WakeQueue::sleep_unless(Thread& thread, const volatile bool& done)
+{
+    UniqueIRQLock irq;
+
+    {
+        UniqueLock<SpinLock> l(_lock);
+        if (done) return;
+
+        _waiters.append(&thread);
+        sys.scheduler().set_entity_state(thread, SchedulingEntityState::SLEEPING);
+    }
+
+    if (&Thread::current() == &thread) {
+        sys.arch().invoke_kernel_syscall(1);
+    }
 }
 
 void WakeQueue::wake()
 {
-    // TODO: some sort of lock
-    for (auto waiter : _waiters) {
+    UniqueIRQLock irq;
+
+    // Take the whole list of waiters, leaving the queue empty.
+    _lock.lock();
+    List<Thread *> waiters(static_cast<List<Thread *>&&>(_waiters));
+    _lock.unlock();
+
+    // Waking a thread may well cause it to be woken on another queue, so this is done
+    // with the lock dropped.
+    for (auto waiter : waiters) {
         waiter->wake_up();
     }
-
-    _waiters.clear();
 }